@@ -21,10 +21,13 @@
 @ECHO OFF
 
 glslangValidator -V -S vert -o "bin/assets/shaders/shadow_v.spv" "vktut/assets/shaders/shadow_v.glsl"
+glslangValidator -V -S vert -o "bin/assets/shaders/shadow_layered_v.spv" "vktut/assets/shaders/shadow_layered_v.glsl"
+glslangValidator -V -S geom -o "bin/assets/shaders/shadow_layered_g.spv" "vktut/assets/shaders/shadow_layered_g.glsl"
 glslangValidator -V -S vert -o "bin/assets/shaders/forward_v.spv" "vktut/assets/shaders/forward_v.glsl"
 glslangValidator -V -S frag -o "bin/assets/shaders/forward_f.spv" "vktut/assets/shaders/forward_f.glsl"
 glslangValidator -V -S vert -o "bin/assets/shaders/post_v.spv" "vktut/assets/shaders/post_v.glsl"
 glslangValidator -V -S frag -o "bin/assets/shaders/post_f.spv" "vktut/assets/shaders/post_f.glsl"
+glslangValidator -V -S comp -o "bin/assets/shaders/cull_c.spv" "vktut/assets/shaders/cull_c.glsl"
 
 "tools\mconv.exe" "vktut/assets/models/cube.obj" "bin/assets/models/cube.bobj"
 "tools\mconv.exe" "vktut/assets/models/texcube.obj" "bin/assets/models/texcube.bobj"
@@ -43,6 +43,12 @@ assets = {
 		"vktut/assets/shaders/shadow_v.glsl" : [
 			{ 'stage': 'vert', 'out': 'bin/assets/shaders/shadow_v.spv' },
 		],
+		"vktut/assets/shaders/shadow_layered_v.glsl" : [
+			{ 'stage': 'vert', 'out': 'bin/assets/shaders/shadow_layered_v.spv' },
+		],
+		"vktut/assets/shaders/shadow_layered_g.glsl" : [
+			{ 'stage': 'geom', 'out': 'bin/assets/shaders/shadow_layered_g.spv' },
+		],
 		"vktut/assets/shaders/forward_v.glsl" : [
 			{ 'stage': 'vert', 'out': 'bin/assets/shaders/forward_v.spv' },
 		],
@@ -55,6 +61,9 @@ assets = {
 		"vktut/assets/shaders/post_f.glsl" : [
 			{ 'stage': 'frag', 'out': 'bin/assets/shaders/post_f.spv' },
 		],
+		"vktut/assets/shaders/cull_c.glsl" : [
+			{ 'stage': 'comp', 'out': 'bin/assets/shaders/cull_c.spv' },
+		],
 	},
 	"models" : {
 		"vktut/assets/models/cube.obj" : [
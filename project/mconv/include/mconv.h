@@ -25,15 +25,17 @@ extern "C" {	// Expose functions with C linkage for cross-compat with C and C++
 
 #include <stdint.h>
 
-#define BOBJ_VERSION 0x100
+#define BOBJ_VERSION 0x700
 
 #define MAKE_FOURCC(a,b,c,d) ((a) | (b<<8) | (c<<16) | (d<<24))
-#define BOBJ_FILE_MAGIC         MAKE_FOURCC('B','O','B','J')
-#define BOBJ_OBJECT_MAGIC       MAKE_FOURCC('O','B','J',' ')
-#define BOBJ_TEXTURE_MAGIC      MAKE_FOURCC('T','X','T','R')
-#define BOBJ_TEXTURE_DATA_MAGIC MAKE_FOURCC('T','X','D','T')
-#define BOBJ_VERTEX_DATA_MAGIC  MAKE_FOURCC('V','X','D','T')
-#define BOBJ_INDEX_DATA_MAGIC   MAKE_FOURCC('I','X','D','T')
+#define BOBJ_FILE_MAGIC          MAKE_FOURCC('B','O','B','J')
+#define BOBJ_OBJECT_MAGIC        MAKE_FOURCC('O','B','J',' ')
+#define BOBJ_TEXTURE_MAGIC       MAKE_FOURCC('T','X','T','R')
+#define BOBJ_TEXTURE_DATA_MAGIC  MAKE_FOURCC('T','X','D','T')
+#define BOBJ_VERTEX_DATA_MAGIC   MAKE_FOURCC('V','X','D','T')
+#define BOBJ_POSITION_DATA_MAGIC MAKE_FOURCC('P','S','D','T')
+#define BOBJ_CLUSTER_DATA_MAGIC  MAKE_FOURCC('C','L','D','T')
+#define BOBJ_INDEX_DATA_MAGIC    MAKE_FOURCC('I','X','D','T')
 
 typedef struct
 {
@@ -43,25 +45,87 @@ typedef struct
 	uint32_t objectsStart;
 	uint32_t texturesStart;
 	uint32_t vertexStart;
+	uint32_t positionStart;	// vertexCount positions, in the same order as the vertices
+	uint32_t clusterStart;
 	uint32_t indexStart;
 	uint32_t texdataStart;
 
 	uint32_t vertexCount;
-	uint32_t indexCount;
+	uint32_t indexDataSize;	// In bytes, as objects may use indices of different sizes
+	uint32_t clusterCount;
 	uint32_t objCount;
 	uint32_t texCount;
+
+	// Quantized vertices store their position relative to the bounds of the model: the actual
+	// position is positionOffset + positionScale * position. For float vertices, the offset is 0
+	// and the scale is 1.
+	uint32_t vertexFormat;	// bobj_vertex_format
+	float positionScale[3];
+	float positionOffset[3];
 } bobj_file_header;
 
+// Every object comes in up to BOBJ_MAX_LODS levels of detail, each coarser than the one before.
+// They all use the vertices of the object, with an index range of their own within the indices of
+// the object. The first is the object at full detail, with an error of 0. The error of the others
+// is an estimate of how far, at most, their surface strays from the full detail one.
+#define BOBJ_MAX_LODS 4
+
+typedef struct
+{
+	uint32_t indexOffset;	// Relative to the indexOffset of the object
+	uint32_t indexCount;
+	float error;
+} bobj_lod;
+
+// Objects that use less than 65536 distinct vertices store 16 bit indices, relative to the first
+// vertex they use, vertexOffset. The indices of every object start at a multiple of their size in
+// the index data, so indexOffset counts indices of the object's own size. The indices of all
+// levels of detail together make up the indices of the object.
 typedef struct
 {
 	uint32_t magic;
 	uint32_t indexOffset;
 	uint32_t indexCount;
+	uint32_t indexSize;	// sizeof ( bobj_index ) or sizeof ( bobj_index16 )
+	uint32_t vertexOffset;
+	uint32_t clusterOffset;
+	uint32_t clusterCount;	// Of the full detail level only
 	uint32_t textureIndex;
 	float aabbMin[3];
 	float aabbMax[3];
+	uint32_t lodCount;
+	bobj_lod lods[BOBJ_MAX_LODS];
 } bobj_object_header;
 
+// The triangles of every object are split up in clusters of consecutive triangles, of at most
+// BOBJ_CLUSTER_MAX_VERTICES distinct vertices and BOBJ_CLUSTER_MAX_TRIANGLES triangles. Objects
+// can cover a large part of the scene, clusters are small enough to be culled on their own.
+// Every cluster comes with a bounding sphere and box, and a cone containing the normals of all of
+// its triangles: the cluster faces away from a camera at position p, and can be culled when
+// back faces are, if
+//   dot ( center - p, coneAxis ) >= coneCutoff * length ( center - p ) + radius
+// Clusters whose normals are all over the place get a coneCutoff of 1, which never culls them.
+#define BOBJ_CLUSTER_MAX_VERTICES  64
+#define BOBJ_CLUSTER_MAX_TRIANGLES 124
+
+typedef struct
+{
+	uint32_t indexOffset;	// Relative to the indexOffset of the object
+	uint32_t indexCount;
+	float center[3];
+	float radius;
+	float aabbMin[3];
+	float aabbMax[3];
+	float coneAxis[3];
+	float coneCutoff;
+} bobj_cluster;
+
+typedef enum
+{
+	BOBJ_VERTEX_FORMAT_FLOAT     = 0,	// bobj_vert
+	BOBJ_VERTEX_FORMAT_QUANTIZED = 1,	// bobj_vert_quantized
+} bobj_vertex_format;
+
 typedef struct
 {
 	float position[3];
@@ -69,7 +133,44 @@ typedef struct
 	float normal[3];
 } bobj_vert;
 
+// Half the size of bobj_vert. The position is snorm16 within the bounds of the model (the fourth
+// component is padding, as three 16 bit components aren't a commonly supported vertex format),
+// the texcoord is half float and the normal is an octahedral encoding in snorm16: the unit
+// sphere folded onto a square, which spends the bits a lot more evenly than storing x and y.
+typedef struct
+{
+	int16_t  position[4];
+	uint16_t texcoord[2];
+	int16_t  normal[2];
+} bobj_vert_quantized;
+
+// Passes that only need the depth of the geometry, like shadow maps, read the positions from a
+// separate stream of their own rather than pulling entire vertices through the vertex fetch only to
+// throw most of it away. The positions are a copy of those in the vertices, in the same format.
+typedef struct
+{
+	float position[3];
+} bobj_position;
+
+typedef struct
+{
+	int16_t position[4];
+} bobj_position_quantized;
+
 typedef uint32_t bobj_index;
+typedef uint16_t bobj_index16;
+
+// Block compressed formats store 4x4 texel blocks: 8 bytes per block for BC1 and ETC2 RGB8, and
+// 16 bytes per block for BC3 and ETC2 RGBA8, where the first 8 bytes hold the alpha channel.
+// All formats hold sRGB color and linear alpha.
+typedef enum
+{
+	BOBJ_TEXTURE_FORMAT_RGBA8      = 0,
+	BOBJ_TEXTURE_FORMAT_BC1        = 1,	// Opaque
+	BOBJ_TEXTURE_FORMAT_BC3        = 2,
+	BOBJ_TEXTURE_FORMAT_ETC2_RGB8  = 3,	// Opaque
+	BOBJ_TEXTURE_FORMAT_ETC2_RGBA8 = 4,	// ETC2 color with EAC alpha
+} bobj_texture_format;
 
 typedef struct
 {
@@ -77,6 +178,9 @@ typedef struct
 	uint32_t width;
 	uint32_t height;
 	uint32_t offset;
+	uint32_t format;	// bobj_texture_format
+	uint32_t mipCount;	// Every level is stored, largest first, each one right after the other
+	uint32_t size;		// Of all mip levels together
 } bobj_texture_header;
 
 #ifdef __cplusplus
@@ -1,44 +1,1548 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
+#define STBI_NO_FAILURE_STRINGS	// The failure strings live in a global, which isn't thread safe
 #include "tiny_obj_loader.h"
 #include "stb_image.h"
 
 #include "../include/mconv.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#if defined ( _WIN32 )
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// SSE is there on every x86 CPU that's still around, and is always on for 64 bit x86 builds
+#if defined ( __SSE__ ) || defined ( _M_X64 ) || (defined ( _M_IX86_FP ) && _M_IX86_FP >= 1)
+#define MCONV_SSE 1
+#include <xmmintrin.h>
+#else
+#define MCONV_SSE 0
+#endif
+
 #define V_BIT_CNT 21ULL
 #define VT_BIT_CNT 21ULL
 #define VN_BIT_CNT 20ULL
 
-using namespace tinyobj;
+using namespace tinyobj;
+
+int32_t index_to_uid ( index_t idx, uint64_t* uid )
+{
+	uint32_t vertexBits = ((1<<(V_BIT_CNT+1))-1);
+	uint32_t texcoordBits = ((1<<(VT_BIT_CNT+1))-1);
+	uint32_t normalBits = ((1<<(VN_BIT_CNT+1))-1);
+
+	if ( (idx.vertex_index & vertexBits) != idx.vertex_index
+		|| ((idx.texcoord_index & texcoordBits) != idx.texcoord_index && idx.texcoord_index != -1 )
+		|| ((idx.normal_index & normalBits) != idx.normal_index && idx.normal_index != -1) )
+		return -2;
+
+	*uid = ((uint64_t)idx.vertex_index)
+		| ((uint64_t)idx.texcoord_index << V_BIT_CNT)
+		| ((uint64_t)idx.normal_index << (V_BIT_CNT + VT_BIT_CNT));
+	return 0;
+}
+
+////////////////////////////////////////
+// Vertex welding
+
+// Maps the packed uids of index_to_uid to vertex indices. Sponza has close to a million triangle
+// corners, and std::map does a node allocation for every unique one of them on top of its
+// O(log n) lookups. This is an open addressing table instead: one flat array and linear probing.
+// It doubles in size whenever it gets over half full, which keeps the probe sequences short.
+//
+// Sizing it for the amount of corners up front would avoid growing altogether, but most corners
+// share their vertex with others: the table would be mostly empty, and a lot larger than the
+// caches.
+
+class uid_table
+{
+public:
+	uid_table ( )
+	{
+		resize ( 1024 );
+	}
+
+	// Returns the index stored for uid. If there is none yet, newIndex is stored and returned,
+	// and inserted is set.
+	uint32_t find_or_insert ( uint64_t uid, uint32_t newIndex, bool* inserted )
+	{
+		if ( (count + 1) * 2 > values.size ( ) )
+			resize ( values.size ( ) * 2 );
+
+		size_t slot = find_slot ( uid );
+		if ( values[slot] != EMPTY )
+		{
+			*inserted = false;
+			return values[slot];
+		}
+
+		keys[slot]   = uid;
+		values[slot] = newIndex;
+		count++;
+		*inserted    = true;
+		return newIndex;
+	}
+
+private:
+	// Every uid is a valid key, so empty slots are marked in the values instead
+	enum : uint32_t { EMPTY = 0xFFFFFFFF };
+
+	// The uids are mostly small numbers in the low bits, mix them up before using them as an index
+	static uint64_t hash ( uint64_t x )
+	{
+		x ^= x >> 33;
+		x *= 0xff51afd7ed558ccdULL;
+		x ^= x >> 33;
+		x *= 0xc4ceb9fe1a85ec53ULL;
+		x ^= x >> 33;
+		return x;
+	}
+
+	// The slot holding uid, or the empty slot where it should go
+	size_t find_slot ( uint64_t uid ) const
+	{
+		size_t slot = hash ( uid ) & mask;
+		while ( values[slot] != EMPTY && keys[slot] != uid )
+			slot = (slot + 1) & mask;
+		return slot;
+	}
+
+	void resize ( size_t capacity )
+	{
+		std::vector<uint64_t> oldKeys;
+		std::vector<uint32_t> oldValues;
+		oldKeys.swap ( keys );
+		oldValues.swap ( values );
+
+		keys.resize ( capacity );
+		values.resize ( capacity, EMPTY );
+		mask = capacity - 1;
+
+		for ( size_t i = 0; i < oldValues.size ( ); i++ )
+		{
+			if ( oldValues[i] == EMPTY )
+				continue;
+			size_t slot = find_slot ( oldKeys[i] );
+			keys[slot]   = oldKeys[i];
+			values[slot] = oldValues[i];
+		}
+	}
+
+	std::vector<uint64_t> keys;
+	std::vector<uint32_t> values;
+	size_t                mask;
+	size_t                count = 0;
+};
+
+FILE* open_file ( const char* path, const char* mode )
+{
+#if defined ( _MSC_VER )
+	FILE* f = NULL;
+	fopen_s ( &f, path, mode );
+	return f;
+#else
+	return fopen ( path, mode );
+#endif
+}
+
+// The output is written front to back in one go, never seeking back, so it can just as well be
+// a pipe. Rather than asking the file where we are (ftell doesn't work on pipes), we keep count.
+bool write_bytes ( FILE* f, const void* data, size_t size, uint64_t* offset )
+{
+	*offset += size;
+	return size == 0 || fwrite ( data, size, 1, f ) == 1;
+}
+
+////////////////////////////////////////
+// Thread pool
+
+// A fixed amount of workers taking jobs off a shared queue. The conversion steps that can be done
+// in parallel (decoding textures, gathering the indices of every object) all produce their results
+// into slots of their own, which are then processed in the same order as the single threaded
+// version would. That way, the output doesn't depend on the amount of threads or on which job
+// happens to finish first.
+//
+// With a thread count of 1 there are no workers at all: jobs are run on the calling thread as
+// soon as they are queued.
+
+class thread_pool
+{
+public:
+	explicit thread_pool ( uint32_t threadCount )
+	{
+		for ( uint32_t i = 0; threadCount > 1 && i < threadCount; i++ )
+			workers.emplace_back ( [this] ( ) { work ( ); } );
+	}
+
+	~thread_pool ( )
+	{
+		{
+			std::lock_guard<std::mutex> lock ( mutex );
+			stopping = true;
+		}
+		jobAvailable.notify_all ( );
+		for ( auto& worker : workers )
+			worker.join ( );
+	}
+
+	void run ( std::function<void()> job )
+	{
+		if ( workers.empty ( ) )
+		{
+			job ( );
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock ( mutex );
+			jobs.push_back ( std::move ( job ) );
+			pending++;
+		}
+		jobAvailable.notify_one ( );
+	}
+
+	void wait ( )
+	{
+		std::unique_lock<std::mutex> lock ( mutex );
+		allDone.wait ( lock, [this] ( ) { return pending == 0; } );
+	}
+
+	// Calls fn(i) for every i in [0,count) and waits for all of them to complete
+	template<typename F>
+	void parallel_for ( uint32_t count, F fn )
+	{
+		for ( uint32_t i = 0; i < count; i++ )
+			run ( [&fn, i] ( ) { fn ( i ); } );
+		wait ( );
+	}
+
+private:
+	void work ( )
+	{
+		for ( ;; )
+		{
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock ( mutex );
+				jobAvailable.wait ( lock, [this] ( ) { return stopping || !jobs.empty ( ); } );
+				if ( jobs.empty ( ) )
+					return;
+				job = std::move ( jobs.front ( ) );
+				jobs.pop_front ( );
+			}
+
+			job ( );
+
+			std::lock_guard<std::mutex> lock ( mutex );
+			if ( --pending == 0 )
+				allDone.notify_all ( );
+		}
+	}
+
+	std::vector<std::thread>          workers;
+	std::deque<std::function<void()>> jobs;
+	std::mutex                        mutex;
+	std::condition_variable           jobAvailable, allDone;
+	uint32_t                          pending  = 0;
+	bool                              stopping = false;
+};
+
+////////////////////////////////////////
+// Texture compression
+
+// Textures are stored with their full mip chain, compressed in one of the block compressed
+// formats GPUs can sample directly. BC1 and BC3 are what desktop GPUs support, ETC2 is what
+// mobile GPUs support. Both compress blocks of 4x4 texels: BC1 and ETC2 RGB8 into 8 bytes, BC3
+// and ETC2 RGBA8 into 16. That's 8 and 4 times smaller than RGBA8 respectively.
+//
+// The encoders go for a decent result in a single quick fit per block, rather than an exhaustive
+// search for the best possible one.
+
+enum texture_compression
+{
+	TEXTURE_COMPRESSION_NONE,
+	TEXTURE_COMPRESSION_BC,
+	TEXTURE_COMPRESSION_ETC2,
+};
+
+// Colors are stored in sRGB, which spends more of its precision on dark colors, the way our eyes
+// do. Averaging sRGB values as if they were linear makes the mips of high contrast textures too
+// dark (a black and white checkerboard averages to 50% sRGB gray, which is 21% linear), so mips
+// are made from linear colors instead. Alpha is linear to begin with.
+
+float srgb_to_linear ( float c )
+{
+	return c <= 0.04045f ? c / 12.92f : std::pow ( (c + 0.055f) / 1.055f, 2.4f );
+}
+
+uint8_t linear_to_srgb8 ( float c )
+{
+	c = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow ( c, 1.0f / 2.4f ) - 0.055f;
+	return (uint8_t)std::min ( 255.0f, std::max ( 0.0f, c * 255.0f + 0.5f ) );
+}
+
+// Makes every mip level of an RGBA8 image, down to 1x1, one level after the other. Every texel
+// of the next level is the average of the 2x2 texels it covers, a box filter. The levels are made
+// from the linear values of the previous one rather than from the rounded result, so rounding
+// errors don't pile up in the smaller levels.
+std::vector<uint8_t> make_mip_chain (
+	const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t* outMipCount
+)
+{
+	float toLinear[256];
+	for ( uint32_t i = 0; i < 256; i++ )
+		toLinear[i] = srgb_to_linear ( i / 255.0f );
+
+	std::vector<uint8_t> chain ( pixels, pixels + width * height * 4 );
+	std::vector<float> level ( width * height * 4 ), next;
+	for ( uint32_t i = 0; i < width * height; i++ )
+	{
+		for ( uint32_t j = 0; j < 3; j++ )
+			level[i * 4 + j] = toLinear[pixels[i * 4 + j]];
+		level[i * 4 + 3] = pixels[i * 4 + 3] / 255.0f;
+	}
+
+	uint32_t mipCount = 1;
+	while ( width > 1 || height > 1 )
+	{
+		uint32_t newWidth = std::max ( 1u, width / 2 ), newHeight = std::max ( 1u, height / 2 );
+		next.resize ( newWidth * newHeight * 4 );
+
+		// All four channels of a texel are filtered at once with SSE. The last row and column
+		// are repeated for levels with an odd size.
+
+		for ( uint32_t y = 0; y < newHeight; y++ )
+		{
+			uint32_t y0 = std::min ( 2 * y, height - 1 ), y1 = std::min ( 2 * y + 1, height - 1 );
+			for ( uint32_t x = 0; x < newWidth; x++ )
+			{
+				uint32_t x0 = std::min ( 2 * x, width - 1 ), x1 = std::min ( 2 * x + 1, width - 1 );
+				const float* t00 = &level[(y0 * width + x0) * 4];
+				const float* t01 = &level[(y0 * width + x1) * 4];
+				const float* t10 = &level[(y1 * width + x0) * 4];
+				const float* t11 = &level[(y1 * width + x1) * 4];
+				float* dst = &next[(y * newWidth + x) * 4];
+#if MCONV_SSE
+				__m128 sum = _mm_add_ps (
+					_mm_add_ps ( _mm_loadu_ps ( t00 ), _mm_loadu_ps ( t01 ) ),
+					_mm_add_ps ( _mm_loadu_ps ( t10 ), _mm_loadu_ps ( t11 ) )
+				);
+				_mm_storeu_ps ( dst, _mm_mul_ps ( sum, _mm_set1_ps ( 0.25f ) ) );
+#else
+				for ( uint32_t j = 0; j < 4; j++ )
+					dst[j] = (t00[j] + t01[j] + t10[j] + t11[j]) * 0.25f;
+#endif
+			}
+		}
+
+		size_t newStart = chain.size ( );
+		chain.resize ( newStart + newWidth * newHeight * 4 );
+		for ( uint32_t i = 0; i < newWidth * newHeight; i++ )
+		{
+			for ( uint32_t j = 0; j < 3; j++ )
+				chain[newStart + i * 4 + j] = linear_to_srgb8 ( next[i * 4 + j] );
+			chain[newStart + i * 4 + 3] = (uint8_t)(next[i * 4 + 3] * 255.0f + 0.5f);
+		}
+
+		level.swap ( next );
+		width = newWidth, height = newHeight;
+		mipCount++;
+	}
+
+	*outMipCount = mipCount;
+	return chain;
+}
+
+int32_t clamp_255 ( int32_t v )
+{
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+// BC1: two RGB565 end points, and a 2 bit index per texel choosing between them and the two
+// colors at 1/3 and 2/3 between them. The end points are put on the line that best fits the
+// colors of the block, its principal axis, as far apart as the colors are along it.
+void encode_bc1 ( const uint8_t block[16][4], uint8_t out[8] )
+{
+	float mean[3] = { }, lo[3] = { 255, 255, 255 }, hi[3] = { };
+	for ( uint32_t i = 0; i < 16; i++ )
+	{
+		for ( uint32_t j = 0; j < 3; j++ )
+		{
+			mean[j] += block[i][j] / 16.0f;
+			lo[j] = std::min<float> ( lo[j], block[i][j] );
+			hi[j] = std::max<float> ( hi[j], block[i][j] );
+		}
+	}
+
+	float cov[3][3] = { };
+	for ( uint32_t i = 0; i < 16; i++ )
+	{
+		for ( uint32_t j = 0; j < 3; j++ )
+		{
+			for ( uint32_t k = 0; k < 3; k++ )
+				cov[j][k] += (block[i][j] - mean[j]) * (block[i][k] - mean[k]);
+		}
+	}
+
+	// A few rounds of power iteration, starting from the diagonal of the bounding box, get the
+	// principal axis close enough
+
+	float axis[3] = { hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2] };
+	for ( uint32_t round = 0; round < 4; round++ )
+	{
+		float next[3] = { };
+		for ( uint32_t j = 0; j < 3; j++ )
+			next[j] = cov[j][0] * axis[0] + cov[j][1] * axis[1] + cov[j][2] * axis[2];
+		float length = std::sqrt ( next[0] * next[0] + next[1] * next[1] + next[2] * next[2] );
+		if ( length < 1e-6f )
+			break;
+		for ( uint32_t j = 0; j < 3; j++ )
+			axis[j] = next[j] / length;
+	}
+	float length = std::sqrt ( axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2] );
+	if ( length > 1e-6f )
+	{
+		for ( uint32_t j = 0; j < 3; j++ )
+			axis[j] /= length;
+	}
+
+	float tMin = FLT_MAX, tMax = -FLT_MAX;
+	for ( uint32_t i = 0; i < 16; i++ )
+	{
+		float t = (block[i][0] - mean[0]) * axis[0] + (block[i][1] - mean[1]) * axis[1]
+			+ (block[i][2] - mean[2]) * axis[2];
+		tMin = std::min ( tMin, t ), tMax = std::max ( tMax, t );
+	}
+
+	uint16_t c[2];
+	for ( uint32_t i = 0; i < 2; i++ )
+	{
+		float t = i == 0 ? tMax : tMin;
+		int32_t r = clamp_255 ( (int32_t)(mean[0] + axis[0] * t + 0.5f) );
+		int32_t g = clamp_255 ( (int32_t)(mean[1] + axis[1] * t + 0.5f) );
+		int32_t b = clamp_255 ( (int32_t)(mean[2] + axis[2] * t + 0.5f) );
+		c[i] = (uint16_t)(((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 | ((b * 31 + 127) / 255));
+	}
+
+	// The first end point has to be the larger one to get the four color mode. If they're the
+	// same, the block is a single color and all indices can stay 0.
+
+	if ( c[0] < c[1] )
+		std::swap ( c[0], c[1] );
+
+	uint32_t indices = 0;
+	if ( c[0] != c[1] )
+	{
+		int32_t palette[4][3];
+		for ( uint32_t i = 0; i < 2; i++ )
+		{
+			int32_t r = (c[i] >> 11) & 31, g = (c[i] >> 5) & 63, b = c[i] & 31;
+			palette[i][0] = (r << 3) | (r >> 2);
+			palette[i][1] = (g << 2) | (g >> 4);
+			palette[i][2] = (b << 3) | (b >> 2);
+		}
+		for ( uint32_t j = 0; j < 3; j++ )
+		{
+			palette[2][j] = (2 * palette[0][j] + palette[1][j]) / 3;
+			palette[3][j] = (palette[0][j] + 2 * palette[1][j]) / 3;
+		}
+
+		for ( uint32_t i = 0; i < 16; i++ )
+		{
+			uint32_t best = 0, bestError = UINT32_MAX;
+			for ( uint32_t k = 0; k < 4; k++ )
+			{
+				uint32_t error = 0;
+				for ( uint32_t j = 0; j < 3; j++ )
+					error += (block[i][j] - palette[k][j]) * (block[i][j] - palette[k][j]);
+				if ( error < bestError )
+					best = k, bestError = error;
+			}
+			indices |= best << (2 * i);
+		}
+	}
+
+	out[0] = (uint8_t)c[0], out[1] = (uint8_t)(c[0] >> 8);
+	out[2] = (uint8_t)c[1], out[3] = (uint8_t)(c[1] >> 8);
+	for ( uint32_t i = 0; i < 4; i++ )
+		out[4+i] = (uint8_t)(indices >> (8 * i));
+}
+
+// BC3 alpha: two 8 bit end points, and a 3 bit index per texel choosing between them and six
+// values between them. The end points are simply the lowest and highest alpha in the block.
+void encode_bc3_alpha ( const uint8_t block[16][4], uint8_t out[8] )
+{
+	int32_t a0 = 0, a1 = 255;
+	for ( uint32_t i = 0; i < 16; i++ )
+		a0 = std::max<int32_t> ( a0, block[i][3] ), a1 = std::min<int32_t> ( a1, block[i][3] );
+
+	uint64_t indices = 0;
+	if ( a0 != a1 )
+	{
+		int32_t palette[8] = { a0, a1 };
+		for ( int32_t i = 1; i < 7; i++ )
+			palette[1+i] = ((7 - i) * a0 + i * a1) / 7;
+
+		for ( uint32_t i = 0; i < 16; i++ )
+		{
+			uint32_t best = 0;
+			for ( uint32_t k = 1; k < 8; k++ )
+			{
+				if ( std::abs ( block[i][3] - palette[k] ) < std::abs ( block[i][3] - palette[best] ) )
+					best = k;
+			}
+			indices |= (uint64_t)best << (3 * i);
+		}
+	}
+
+	out[0] = (uint8_t)a0, out[1] = (uint8_t)a1;
+	for ( uint32_t i = 0; i < 6; i++ )
+		out[2+i] = (uint8_t)(indices >> (8 * i));
+}
+
+// ETC2 RGB8, using only the modes it shares with ETC1: the block is split in two halves of 2x4 or
+// 4x2 texels, each with a base color. Every texel adds one of four modifiers from a table to the
+// base color of its half, which makes ETC good at variations in brightness rather than in hue.
+// The base colors are either 4 bits per channel each ("individual"), or 5 bits per channel for
+// the first and a 3 bit offset from it for the second ("differential"). Both are tried for both
+// ways of splitting the block, with the average colors of the halves as base colors.
+
+static const int32_t ETC_MODIFIERS[8][4] = {
+	{  2,   8,  -2,   -8 }, {  5,  17,  -5,  -17 }, {  9,  29,  -9,  -29 }, { 13,  42, -13,  -42 },
+	{ 18,  60, -18,  -60 }, { 24,  80, -24,  -80 }, { 33, 106, -33, -106 }, { 47, 183, -47, -183 },
+};
+
+// Finds the modifier table and indices for one half of a block. Texels are numbered down the
+// columns, like in the block itself.
+uint32_t etc_fit_half (
+	const uint8_t block[16][4], const uint32_t texels[8], const int32_t base[3],
+	uint32_t* outTable, uint32_t outIndices[8]
+)
+{
+	uint32_t bestError = UINT32_MAX;
+	for ( uint32_t t = 0; t < 8; t++ )
+	{
+		uint32_t error = 0, indices[8];
+		for ( uint32_t p = 0; p < 8 && error < bestError; p++ )
+		{
+			const uint8_t* c = block[(texels[p] % 4) * 4 + texels[p] / 4];
+			uint32_t texelError = UINT32_MAX;
+			for ( uint32_t m = 0; m < 4; m++ )
+			{
+				uint32_t e = 0;
+				for ( uint32_t j = 0; j < 3; j++ )
+				{
+					int32_t d = clamp_255 ( base[j] + ETC_MODIFIERS[t][m] ) - c[j];
+					e += d * d;
+				}
+				if ( e < texelError )
+					texelError = e, indices[p] = m;
+			}
+			error += texelError;
+		}
+
+		if ( error < bestError )
+		{
+			bestError = error;
+			*outTable = t;
+			memcpy ( outIndices, indices, sizeof ( indices ) );
+		}
+	}
+	return bestError;
+}
+
+void encode_etc2_rgb ( const uint8_t block[16][4], uint8_t out[8] )
+{
+	uint64_t best = 0;
+	uint32_t bestError = UINT32_MAX;
+	for ( uint32_t flip = 0; flip < 2; flip++ )
+	{
+		uint32_t texels[2][8];
+		float average[2][3] = { };
+		for ( uint32_t i = 0; i < 16; i++ )
+		{
+			uint32_t x = i / 4, y = i % 4;
+			uint32_t half = flip ? y >= 2 : x >= 2;
+			uint32_t slot = flip ? x * 2 + y % 2 : (x % 2) * 4 + y;
+			texels[half][slot] = i;
+			for ( uint32_t j = 0; j < 3; j++ )
+				average[half][j] += block[y * 4 + x][j] / 8.0f;
+		}
+
+		for ( uint32_t differential = 0; differential < 2; differential++ )
+		{
+			int32_t quantized[2][3], base[2][3];
+			for ( uint32_t j = 0; j < 3; j++ )
+			{
+				if ( differential )
+				{
+					quantized[0][j] = (int32_t)(average[0][j] * 31 / 255 + 0.5f);
+					quantized[1][j] = (int32_t)(average[1][j] * 31 / 255 + 0.5f);
+					quantized[1][j] = quantized[0][j] + std::max ( -4, std::min ( 3, quantized[1][j] - quantized[0][j] ) );
+					for ( uint32_t h = 0; h < 2; h++ )
+						base[h][j] = (quantized[h][j] << 3) | (quantized[h][j] >> 2);
+				}
+				else
+				{
+					for ( uint32_t h = 0; h < 2; h++ )
+					{
+						quantized[h][j] = (int32_t)(average[h][j] * 15 / 255 + 0.5f);
+						base[h][j] = (quantized[h][j] << 4) | quantized[h][j];
+					}
+				}
+			}
+
+			uint32_t table[2], indices[2][8];
+			uint32_t error = etc_fit_half ( block, texels[0], base[0], &table[0], indices[0] );
+			if ( error >= bestError )
+				continue;
+			error += etc_fit_half ( block, texels[1], base[1], &table[1], indices[1] );
+			if ( error >= bestError )
+				continue;
+
+			uint64_t w = 0;
+			for ( uint32_t j = 0; j < 3; j++ )
+			{
+				if ( differential )
+				{
+					w |= (uint64_t)quantized[0][j] << (59 - 8 * j);
+					w |= (uint64_t)((quantized[1][j] - quantized[0][j]) & 7) << (56 - 8 * j);
+				}
+				else
+				{
+					w |= (uint64_t)quantized[0][j] << (60 - 8 * j);
+					w |= (uint64_t)quantized[1][j] << (56 - 8 * j);
+				}
+			}
+			w |= (uint64_t)table[0] << 37 | (uint64_t)table[1] << 34;
+			w |= (uint64_t)differential << 33 | (uint64_t)flip << 32;
+			for ( uint32_t h = 0; h < 2; h++ )
+			{
+				for ( uint32_t p = 0; p < 8; p++ )
+				{
+					uint32_t i = texels[h][p];
+					w |= (uint64_t)(indices[h][p] >> 1) << (16 + i) | (uint64_t)(indices[h][p] & 1) << i;
+				}
+			}
+
+			best = w, bestError = error;
+		}
+	}
+
+	for ( uint32_t i = 0; i < 8; i++ )
+		out[i] = (uint8_t)(best >> (56 - 8 * i));
+}
+
+// EAC alpha: an 8 bit base value, and a 3 bit index per texel choosing one of eight modifiers
+// from a table, multiplied by a 4 bit multiplier, to add to it. For every table, the multiplier
+// that spreads it over the range of alpha values in the block is tried, along with its
+// neighbours.
+
+static const int32_t EAC_MODIFIERS[16][8] = {
+	{ -3, -6,  -9, -15, 2, 5, 8, 14 }, { -3, -7, -10, -13, 2, 6, 9, 12 },
+	{ -2, -5,  -8, -13, 1, 4, 7, 12 }, { -2, -4,  -6, -13, 1, 3, 5, 12 },
+	{ -3, -6,  -8, -12, 2, 5, 7, 11 }, { -3, -7,  -9, -11, 2, 6, 8, 10 },
+	{ -4, -7,  -8, -11, 3, 6, 7, 10 }, { -3, -5,  -8, -11, 2, 4, 7, 10 },
+	{ -2, -6,  -8, -10, 1, 5, 7,  9 }, { -2, -5,  -8, -10, 1, 4, 7,  9 },
+	{ -2, -4,  -8, -10, 1, 3, 7,  9 }, { -2, -5,  -7, -10, 1, 4, 6,  9 },
+	{ -3, -4,  -7, -10, 2, 3, 6,  9 }, { -1, -2,  -3, -10, 0, 1, 2,  9 },
+	{ -4, -6,  -8,  -9, 3, 5, 7,  8 }, { -3, -5,  -7,  -9, 2, 4, 6,  8 },
+};
+
+void encode_eac_alpha ( const uint8_t block[16][4], uint8_t out[8] )
+{
+	int32_t aMin = 255, aMax = 0;
+	for ( uint32_t i = 0; i < 16; i++ )
+		aMin = std::min<int32_t> ( aMin, block[i][3] ), aMax = std::max<int32_t> ( aMax, block[i][3] );
+
+	// A single value takes the table with a modifier of 0, which is the common case of opaque
+	// blocks in a texture that isn't
+
+	int32_t bestBase = aMin, bestMultiplier = 1, bestTable = 13;
+	uint64_t bestIndices = 0;
+	for ( uint32_t i = 0; i < 16; i++ )
+		bestIndices |= 4ull << (45 - 3 * i);
+
+	uint32_t bestError = UINT32_MAX;
+	for ( int32_t t = 0; t < 16 && aMin != aMax; t++ )
+	{
+		int32_t range = EAC_MODIFIERS[t][7] - EAC_MODIFIERS[t][3];
+		int32_t guess = (aMax - aMin + range / 2) / range;
+		for ( int32_t m = std::max ( 1, guess - 1 ); m <= std::min ( 15, guess + 1 ); m++ )
+		{
+			// Centered such that the outer modifiers land on the lowest and highest value
+			int32_t base = clamp_255 (
+				(aMin + aMax - m * (EAC_MODIFIERS[t][3] + EAC_MODIFIERS[t][7]) + 1) / 2
+			);
+			uint32_t error = 0;
+			uint64_t indices = 0;
+			for ( uint32_t i = 0; i < 16 && error < bestError; i++ )
+			{
+				int32_t a = block[(i % 4) * 4 + i / 4][3];
+				uint32_t best = 0, texelError = UINT32_MAX;
+				for ( uint32_t k = 0; k < 8; k++ )
+				{
+					int32_t d = clamp_255 ( base + EAC_MODIFIERS[t][k] * m ) - a;
+					if ( (uint32_t)(d * d) < texelError )
+						best = k, texelError = d * d;
+				}
+				error += texelError;
+				indices |= (uint64_t)best << (45 - 3 * i);
+			}
+
+			if ( error < bestError )
+			{
+				bestError = error;
+				bestBase = base, bestMultiplier = m, bestTable = t, bestIndices = indices;
+			}
+		}
+	}
+
+	out[0] = (uint8_t)bestBase;
+	out[1] = (uint8_t)(bestMultiplier << 4 | bestTable);
+	for ( uint32_t i = 0; i < 6; i++ )
+		out[2+i] = (uint8_t)(bestIndices >> (40 - 8 * i));
+}
+
+// Compresses every level of a mip chain made by make_mip_chain. Textures without any translucent
+// texels use the opaque formats, which are half the size.
+std::vector<uint8_t> compress_texture (
+	texture_compression compression, const std::vector<uint8_t>& chain,
+	uint32_t width, uint32_t height, uint32_t mipCount, uint32_t* outFormat
+)
+{
+	bool opaque = true;
+	for ( uint32_t i = 0; i < width * height && opaque; i++ )
+		opaque = chain[i * 4 + 3] == 255;
+
+	switch ( compression )
+	{
+	case TEXTURE_COMPRESSION_NONE:
+		*outFormat = BOBJ_TEXTURE_FORMAT_RGBA8;
+		return chain;
+	case TEXTURE_COMPRESSION_BC:
+		*outFormat = opaque ? BOBJ_TEXTURE_FORMAT_BC1 : BOBJ_TEXTURE_FORMAT_BC3;
+		break;
+	case TEXTURE_COMPRESSION_ETC2:
+		*outFormat = opaque ? BOBJ_TEXTURE_FORMAT_ETC2_RGB8 : BOBJ_TEXTURE_FORMAT_ETC2_RGBA8;
+		break;
+	}
+
+	std::vector<uint8_t> out;
+	const uint8_t* level = chain.data ( );
+	for ( uint32_t mip = 0; mip < mipCount; mip++ )
+	{
+		uint32_t w = std::max ( 1u, width >> mip ), h = std::max ( 1u, height >> mip );
+		for ( uint32_t by = 0; by < h; by += 4 )
+		{
+			for ( uint32_t bx = 0; bx < w; bx += 4 )
+			{
+				// Blocks sticking out of the image repeat the texels at its edges
+
+				uint8_t block[16][4];
+				for ( uint32_t y = 0; y < 4; y++ )
+				{
+					for ( uint32_t x = 0; x < 4; x++ )
+					{
+						uint32_t sx = std::min ( bx + x, w - 1 ), sy = std::min ( by + y, h - 1 );
+						memcpy ( block[y * 4 + x], level + (sy * w + sx) * 4, 4 );
+					}
+				}
+
+				uint8_t encoded[16];
+				switch ( *outFormat )
+				{
+				case BOBJ_TEXTURE_FORMAT_BC1:
+					encode_bc1 ( block, encoded );
+					out.insert ( out.end ( ), encoded, encoded + 8 );
+					break;
+				case BOBJ_TEXTURE_FORMAT_BC3:
+					encode_bc3_alpha ( block, encoded );
+					encode_bc1 ( block, encoded + 8 );
+					out.insert ( out.end ( ), encoded, encoded + 16 );
+					break;
+				case BOBJ_TEXTURE_FORMAT_ETC2_RGB8:
+					encode_etc2_rgb ( block, encoded );
+					out.insert ( out.end ( ), encoded, encoded + 8 );
+					break;
+				case BOBJ_TEXTURE_FORMAT_ETC2_RGBA8:
+					encode_eac_alpha ( block, encoded );
+					encode_etc2_rgb ( block, encoded + 8 );
+					out.insert ( out.end ( ), encoded, encoded + 16 );
+					break;
+				}
+			}
+		}
+		level += w * h * 4;
+	}
+	return out;
+}
+
+////////////////////////////////////////
+// Vertex quantization
+
+// Rounds to the nearest half float, ties to even. Texcoords are the only thing stored this way, so
+// there's no need for anything fancy regarding infinities and NaNs: they're kept as they are.
+uint16_t float_to_half ( float f )
+{
+	uint32_t x;
+	memcpy ( &x, &f, sizeof ( x ) );
+
+	uint32_t sign     = (x >> 16) & 0x8000;
+	int32_t  exponent = (int32_t)((x >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = x & 0x7FFFFF;
+
+	if ( ((x >> 23) & 0xFF) == 0xFF )
+		return (uint16_t)(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+	if ( exponent >= 31 )
+		return (uint16_t)(sign | 0x7C00);	// Too large, becomes infinity
+	if ( exponent <= 0 )
+	{
+		// Too small for a normal half float, becomes a denormal or zero
+		if ( exponent < -10 )
+			return (uint16_t)sign;
+		mantissa |= 0x800000;
+		uint32_t shift = 14 - exponent;
+		uint32_t half = mantissa >> shift, rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+		if ( rest > halfway || (rest == halfway && (half & 1)) )
+			half++;
+		return (uint16_t)(sign | half);
+	}
+
+	// Rounding up may carry into the exponent, which is exactly what should happen
+	uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13), rest = mantissa & 0x1FFF;
+	if ( rest > 0x1000 || (rest == 0x1000 && (half & 1)) )
+		half++;
+	return (uint16_t)(sign | half);
+}
+
+int16_t float_to_snorm16 ( float f )
+{
+	f = std::max ( -1.0f, std::min ( 1.0f, f ) );
+	return (int16_t)std::floor ( f * 32767.0f + 0.5f );
+}
+
+// Folds the lower half of the octahedron onto the upper half, after which x and y are all that
+// is needed. The result is decoded in forward_v.glsl.
+void encode_octahedral ( const float n[3], int16_t out[2] )
+{
+	float length = std::abs ( n[0] ) + std::abs ( n[1] ) + std::abs ( n[2] );
+	if ( length <= 0.0f )
+	{
+		out[0] = out[1] = 0;
+		return;
+	}
+
+	float x = n[0] / length, y = n[1] / length;
+	if ( n[2] < 0.0f )
+	{
+		float foldedX = (1.0f - std::abs ( y )) * (x >= 0.0f ? 1.0f : -1.0f);
+		float foldedY = (1.0f - std::abs ( x )) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = foldedX, y = foldedY;
+	}
+	out[0] = float_to_snorm16 ( x );
+	out[1] = float_to_snorm16 ( y );
+}
+
+void quantize_vertex (
+	const bobj_vert& in, const float positionOffset[3], const float positionScale[3],
+	bobj_vert_quantized* out
+)
+{
+	for ( uint32_t j = 0; j < 3; j++ )
+		out->position[j] = float_to_snorm16 ( (in.position[j] - positionOffset[j]) / positionScale[j] );
+	out->position[3] = 0;
+	out->texcoord[0] = float_to_half ( in.texcoord[0] );
+	out->texcoord[1] = float_to_half ( in.texcoord[1] );
+	encode_octahedral ( in.normal, out->normal );
+}
+
+////////////////////////////////////////
+// Vertex cache optimization
+
+// After a vertex has been transformed, the GPU keeps the result around in a small cache for a
+// while, so triangles sharing that vertex shortly after don't have to transform it again. How
+// often that works out depends entirely on the order of the triangles. The triangles of every
+// object are reordered with Tom Forsyth's "Linear-Speed Vertex Cache Optimisation": every vertex
+// gets a score based on where it is in a simulated LRU cache and on how many triangles still
+// need it, and the next triangle is always the one with the highest combined score among the
+// triangles of the vertices in the cache.
+
+const uint32_t VERTEX_CACHE_SIZE = 32;
+
+float forsyth_vertex_score ( int32_t cachePosition, uint32_t remainingTriangles )
+{
+	if ( remainingTriangles == 0 )
+		return -1.0f;	// Nothing left to draw with this vertex
+
+	float score = 0.0f;
+	if ( cachePosition >= 0 )
+	{
+		// The vertices of the triangle that was just added get a fixed score, so there's no
+		// preference for any of the three. The rest of the cache is worth less the older it gets.
+		if ( cachePosition < 3 )
+			score = 0.75f;
+		else
+			score = powf ( 1.0f - (cachePosition - 3) / (float)(VERTEX_CACHE_SIZE - 3), 1.5f );
+	}
+
+	// Vertices with only a few triangles left are boosted, to get rid of them rather than leaving
+	// lone triangles behind that will need the vertex to be transformed all over again later
+	return score + 2.0f * powf ( (float)remainingTriangles, -0.5f );
+}
+
+void optimize_vertex_cache ( std::vector<bobj_index>& indices )
+{
+	uint32_t triangleCount = indices.size ( ) / 3;
+	if ( triangleCount == 0 )
+		return;
+
+	// The indices refer to the vertices of the entire model. The object only uses a few of them,
+	// which get local numbers for the duration of the optimization.
+
+	std::vector<bobj_index> unique ( indices );
+	std::sort ( unique.begin ( ), unique.end ( ) );
+	unique.erase ( std::unique ( unique.begin ( ), unique.end ( ) ), unique.end ( ) );
+	uint32_t vertexCount = unique.size ( );
+
+	std::vector<uint32_t> local ( indices.size ( ) );
+	for ( uint32_t i = 0; i < indices.size ( ); i++ )
+		local[i] = std::lower_bound ( unique.begin ( ), unique.end ( ), indices[i] ) - unique.begin ( );
+
+	// The triangles of every vertex, in one array. The triangles that are still to be drawn are at
+	// the start of the range of every vertex, the count of which is in remaining.
+
+	std::vector<uint32_t> remaining ( vertexCount, 0 ), triangleStart ( vertexCount + 1, 0 );
+	for ( uint32_t i = 0; i < local.size ( ); i++ )
+		remaining[local[i]]++;
+	for ( uint32_t v = 0; v < vertexCount; v++ )
+		triangleStart[v+1] = triangleStart[v] + remaining[v];
+
+	std::vector<uint32_t> vertexTriangles ( local.size ( ) ), fill ( triangleStart.begin ( ), triangleStart.end ( ) - 1 );
+	for ( uint32_t i = 0; i < local.size ( ); i++ )
+		vertexTriangles[fill[local[i]]++] = i / 3;
+
+	// The scores are looked up rather than calculated over and over, as the powers aren't cheap.
+	// Hardly any vertex has more triangles than the table covers.
+
+	const uint32_t SCORE_TABLE_VALENCE = 32;
+	float scoreTable[VERTEX_CACHE_SIZE+1][SCORE_TABLE_VALENCE];
+	for ( uint32_t i = 0; i <= VERTEX_CACHE_SIZE; i++ )
+	{
+		for ( uint32_t j = 0; j < SCORE_TABLE_VALENCE; j++ )
+			scoreTable[i][j] = forsyth_vertex_score ( (int32_t)i - 1, j );
+	}
+	auto score = [&] ( int32_t cachePosition, uint32_t remainingTriangles )
+	{
+		return remainingTriangles < SCORE_TABLE_VALENCE
+			? scoreTable[cachePosition+1][remainingTriangles]
+			: forsyth_vertex_score ( cachePosition, remainingTriangles );
+	};
+
+	std::vector<int32_t> cachePosition ( vertexCount, -1 );
+	std::vector<float> vertexScore ( vertexCount );
+	for ( uint32_t v = 0; v < vertexCount; v++ )
+		vertexScore[v] = score ( -1, remaining[v] );
+
+	std::vector<float> triangleScore ( triangleCount );
+	for ( uint32_t t = 0; t < triangleCount; t++ )
+		triangleScore[t] = vertexScore[local[t*3+0]] + vertexScore[local[t*3+1]] + vertexScore[local[t*3+2]];
+
+	std::vector<bool> drawn ( triangleCount, false );
+	std::vector<uint32_t> cache, newCache;
+	std::vector<bobj_index> result;
+	result.reserve ( indices.size ( ) );
+
+	int32_t best = -1;
+	uint32_t nextUndrawn = 0;
+	for ( uint32_t drawnCount = 0; drawnCount < triangleCount; drawnCount++ )
+	{
+		// When none of the vertices in the cache have any triangles left, just continue with the
+		// first triangle that hasn't been drawn yet. Searching for the best one instead would make
+		// the whole thing quadratic, for very little gain.
+		if ( best < 0 )
+		{
+			while ( drawn[nextUndrawn] )
+				nextUndrawn++;
+			best = nextUndrawn;
+		}
+
+		drawn[best] = true;
+		newCache.clear ( );
+		for ( uint32_t k = 0; k < 3; k++ )
+		{
+			uint32_t v = local[best*3+k];
+			result.push_back ( indices[best*3+k] );
+			newCache.push_back ( v );
+
+			uint32_t* tris = &vertexTriangles[triangleStart[v]];
+			uint32_t* end  = tris + remaining[v];
+			std::swap ( *std::find ( tris, end, (uint32_t)best ), end[-1] );
+			remaining[v]--;
+		}
+
+		// The vertices of the triangle move to the front of the cache, pushing the others back.
+		// Vertices pushed out of it are kept in the list for now, so their score gets updated.
+		for ( uint32_t i = 0; i < cache.size ( ); i++ )
+		{
+			if ( cache[i] != newCache[0] && cache[i] != newCache[1] && cache[i] != newCache[2] )
+				newCache.push_back ( cache[i] );
+		}
+
+		for ( uint32_t i = 0; i < newCache.size ( ); i++ )
+		{
+			uint32_t v = newCache[i];
+			cachePosition[v] = i < VERTEX_CACHE_SIZE ? (int32_t)i : -1;
+			vertexScore[v]   = score ( cachePosition[v], remaining[v] );
+		}
+
+		best = -1;
+		float bestScore = -1.0f;
+		for ( uint32_t i = 0; i < newCache.size ( ); i++ )
+		{
+			uint32_t v = newCache[i];
+			for ( uint32_t j = 0; j < remaining[v]; j++ )
+			{
+				uint32_t t = vertexTriangles[triangleStart[v]+j];
+				triangleScore[t] = vertexScore[local[t*3+0]] + vertexScore[local[t*3+1]] + vertexScore[local[t*3+2]];
+				if ( triangleScore[t] > bestScore )
+					bestScore = triangleScore[t], best = t;
+			}
+		}
+
+		if ( newCache.size ( ) > VERTEX_CACHE_SIZE )
+			newCache.resize ( VERTEX_CACHE_SIZE );
+		cache.swap ( newCache );
+	}
+
+	indices.swap ( result );
+}
+
+// The average cache miss ratio (ACMR) is the amount of vertices transformed per triangle, and the
+// average transform to vertex ratio (ATVR) the amount of times every vertex is transformed. An
+// ATVR of 1 is the best there is. These run the indices through a FIFO cache, which is what most
+// hardware actually has, rather than the LRU cache the optimization simulates.
+void vertex_cache_statistics ( const std::vector<bobj_index>& indices, float* outAcmr, float* outAtvr )
+{
+	std::vector<bobj_index> fifo;
+	std::vector<bobj_index> unique ( indices );
+	std::sort ( unique.begin ( ), unique.end ( ) );
+	unique.erase ( std::unique ( unique.begin ( ), unique.end ( ) ), unique.end ( ) );
+
+	uint32_t misses = 0, head = 0;
+	for ( uint32_t i = 0; i < indices.size ( ); i++ )
+	{
+		if ( std::find ( fifo.begin ( ), fifo.end ( ), indices[i] ) != fifo.end ( ) )
+			continue;
+
+		misses++;
+		if ( fifo.size ( ) < VERTEX_CACHE_SIZE )
+			fifo.push_back ( indices[i] );
+		else
+			fifo[head] = indices[i], head = (head + 1) % VERTEX_CACHE_SIZE;
+	}
+
+	*outAcmr = indices.empty ( ) ? 0.0f : misses / (indices.size ( ) / 3.0f);
+	*outAtvr = unique.empty ( )  ? 0.0f : misses / (float)unique.size ( );
+}
+
+////////////////////////////////////////
+// Simplification
+
+// The levels of detail are made by collapsing edges: one vertex of the edge is merged into the
+// other, which takes the triangles sharing the edge with it. Which edges go first is decided
+// by quadric error metrics (Garland & Heckbert): every vertex keeps the sum of the squared
+// distance to the planes of its triangles in a 4x4 matrix, the quadric, and the cost of moving a
+// vertex somewhere is that quadric evaluated at the new position. Merging vertices sums their
+// quadrics, so the cost keeps track of all of the planes the merged vertices were on. The planes
+// are weighted by the area of their triangles, and the sum divided by the total weight, which
+// makes the cost the mean squared distance to the planes.
+
+// Symmetric, so only the upper triangle is stored: xx xy xz xw yy yz yw zz zw ww
+struct quadric
+{
+	double m[10];
+	double weight;
+};
+
+void quadric_add_plane ( quadric* q, const double n[3], double d, double weight )
+{
+	double p[4] = { n[0], n[1], n[2], d };
+	for ( uint32_t i = 0, k = 0; i < 4; i++ )
+	{
+		for ( uint32_t j = i; j < 4; j++ )
+			q->m[k++] += weight * p[i] * p[j];
+	}
+	q->weight += weight;
+}
+
+void quadric_add ( quadric* q, const quadric& other )
+{
+	for ( uint32_t k = 0; k < 10; k++ )
+		q->m[k] += other.m[k];
+	q->weight += other.weight;
+}
+
+double quadric_error ( const quadric& q, const float p[3] )
+{
+	double v[4] = { p[0], p[1], p[2], 1.0 };
+	double error = 0.0;
+	for ( uint32_t i = 0, k = 0; i < 4; i++ )
+	{
+		for ( uint32_t j = i; j < 4; j++, k++ )
+			error += (i == j ? 1.0 : 2.0) * q.m[k] * v[i] * v[j];
+	}
+	return q.weight > 0.0 ? std::max ( error / q.weight, 0.0 ) : 0.0;
+}
+
+// Vertices only move onto other vertices, so the simplified triangles use the vertices of the
+// object and need nothing but indices of their own. Vertices on the border of the object, and
+// those sharing their position with other vertices (seams between different texcoords or
+// normals), stay where they are: moving them would open up holes in the surface. Returns the
+// error of the simplified triangles: the square root of the largest collapse cost, the root mean
+// square distance of the worst vertex to the planes it replaced.
+float simplify (
+	std::vector<bobj_index>* indices, uint32_t targetTriangleCount,
+	const std::vector<index_t>& vertices, const std::vector<float>& positions
+)
+{
+	std::vector<bobj_index> unique ( *indices );
+	std::sort ( unique.begin ( ), unique.end ( ) );
+	unique.erase ( std::unique ( unique.begin ( ), unique.end ( ) ), unique.end ( ) );
+	uint32_t vertexCount = unique.size ( );
+
+	std::vector<uint32_t> local ( indices->size ( ) );
+	for ( uint32_t i = 0; i < indices->size ( ); i++ )
+		local[i] = std::lower_bound ( unique.begin ( ), unique.end ( ), (*indices)[i] ) - unique.begin ( );
+
+	std::vector<float> position ( vertexCount * 3 );
+	for ( uint32_t v = 0; v < vertexCount; v++ )
+	{
+		int32_t p = vertices[unique[v]].vertex_index;
+		for ( uint32_t j = 0; j < 3; j++ )
+			position[v*3+j] = p == -1 ? 0.0f : positions[p*3+j];
+	}
+
+	// Seams: vertices with the same position. Borders: edges between positions used by only one
+	// triangle, counting both directions together.
+
+	std::vector<bool> locked ( vertexCount, false );
+	uid_table positionVertex;
+	for ( uint32_t v = 0; v < vertexCount; v++ )
+	{
+		bool inserted;
+		uint32_t first = positionVertex.find_or_insert ( (uint32_t)vertices[unique[v]].vertex_index, v, &inserted );
+		if ( !inserted )
+			locked[v] = locked[first] = true;
+	}
+
+	uid_table edges;
+	std::vector<uint32_t> edgeOf ( local.size ( ) ), edgeUse;
+	for ( uint32_t i = 0; i < local.size ( ); i++ )
+	{
+		uint32_t a = vertices[unique[local[i]]].vertex_index;
+		uint32_t b = vertices[unique[local[i - i % 3 + (i + 1) % 3]]].vertex_index;
+		bool inserted;
+		edgeOf[i] = edges.find_or_insert (
+			((uint64_t)std::min ( a, b ) << 32) | std::max ( a, b ), edgeUse.size ( ), &inserted
+		);
+		if ( inserted )
+			edgeUse.push_back ( 0 );
+		edgeUse[edgeOf[i]]++;
+	}
+	for ( uint32_t i = 0; i < local.size ( ); i++ )
+	{
+		if ( edgeUse[edgeOf[i]] == 1 )
+			locked[local[i]] = locked[local[i - i % 3 + (i + 1) % 3]] = true;
+	}
+
+	// Gives the unit normal of a triangle, and twice its area
+	auto triangle_normal = [&] ( uint32_t a, uint32_t b, uint32_t c, double n[3] ) -> double
+	{
+		const float* p0 = &position[a*3];
+		const float* p1 = &position[b*3];
+		const float* p2 = &position[c*3];
+		double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+		double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+		n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+		double length = sqrt ( n[0]*n[0] + n[1]*n[1] + n[2]*n[2] );
+		if ( length > 0.0 )
+			n[0] /= length, n[1] /= length, n[2] /= length;
+		return length;
+	};
 
-int32_t index_to_uid ( index_t idx, uint64_t* uid )
+	std::vector<quadric> quadrics ( vertexCount, quadric ( ) );
+	for ( uint32_t t = 0; t < local.size ( ) / 3; t++ )
+	{
+		double n[3];
+		double area = triangle_normal ( local[t*3+0], local[t*3+1], local[t*3+2], n );
+		if ( area <= 0.0 )
+			continue;
+		const float* p = &position[local[t*3]*3];
+		double d = -(n[0] * p[0] + n[1] * p[1] + n[2] * p[2]);
+		for ( uint32_t k = 0; k < 3; k++ )
+			quadric_add_plane ( &quadrics[local[t*3+k]], n, d, area );
+	}
+
+	// Collapses are done in passes. Every pass sorts all possible collapses by their cost and
+	// does the cheapest ones, as long as they don't touch triangles changed earlier in the same
+	// pass, until enough triangles are gone.
+
+	struct collapse
+	{
+		double cost;
+		uint32_t from, to;
+		bool operator < ( const collapse& other ) const
+		{
+			return cost < other.cost || (cost == other.cost && (from < other.from || (from == other.from && to < other.to)));
+		}
+	};
+
+	double maxCost = 0.0;
+	std::vector<uint32_t> remap ( vertexCount ), triangleStart ( vertexCount + 1 ), vertexTriangles;
+	std::vector<collapse> collapses;
+	std::vector<bool> touched;
+	while ( local.size ( ) / 3 > targetTriangleCount )
+	{
+		uint32_t triangleCount = local.size ( ) / 3;
+
+		std::fill ( triangleStart.begin ( ), triangleStart.end ( ), 0 );
+		for ( uint32_t i = 0; i < local.size ( ); i++ )
+			triangleStart[local[i]+1]++;
+		for ( uint32_t v = 0; v < vertexCount; v++ )
+			triangleStart[v+1] += triangleStart[v];
+		vertexTriangles.resize ( local.size ( ) );
+		std::vector<uint32_t> fill ( triangleStart.begin ( ), triangleStart.end ( ) - 1 );
+		for ( uint32_t i = 0; i < local.size ( ); i++ )
+			vertexTriangles[fill[local[i]]++] = i / 3;
+
+		// Only the cheapest collapse of every vertex is considered, the others wouldn't get a
+		// chance in this pass anyway once that one is done
+
+		collapses.assign ( vertexCount, collapse { DBL_MAX, 0, 0 } );
+		for ( uint32_t i = 0; i < local.size ( ); i++ )
+		{
+			uint32_t a = local[i], b = local[i - i % 3 + (i + 1) % 3];
+			if ( locked[a] && locked[b] )
+				continue;
+
+			quadric q = quadrics[a];
+			quadric_add ( &q, quadrics[b] );
+			collapse ab = { quadric_error ( q, &position[b*3] ), a, b };
+			collapse ba = { quadric_error ( q, &position[a*3] ), b, a };
+			if ( !locked[a] && ab < collapses[a] )
+				collapses[a] = ab;
+			if ( !locked[b] && ba < collapses[b] )
+				collapses[b] = ba;
+		}
+		collapses.erase (
+			std::remove_if ( collapses.begin ( ), collapses.end ( ), [] ( const collapse& c ) { return c.cost == DBL_MAX; } ),
+			collapses.end ( )
+		);
+		std::sort ( collapses.begin ( ), collapses.end ( ) );
+
+		for ( uint32_t v = 0; v < vertexCount; v++ )
+			remap[v] = v;
+		touched.assign ( vertexCount, false );
+
+		uint32_t removed = 0;
+		for ( uint32_t c = 0; c < collapses.size ( ) && triangleCount - removed > targetTriangleCount; c++ )
+		{
+			uint32_t from = collapses[c].from, to = collapses[c].to;
+			if ( touched[from] || touched[to] || from == to )
+				continue;
+
+			// Triangles flipping over are a sure sign of a collapse gone wrong
+			bool flips = false;
+			uint32_t gone = 0;
+			for ( uint32_t k = triangleStart[from]; k < triangleStart[from+1] && !flips; k++ )
+			{
+				uint32_t t = vertexTriangles[k];
+				uint32_t tri[3] = { local[t*3+0], local[t*3+1], local[t*3+2] };
+				if ( tri[0] == to || tri[1] == to || tri[2] == to )
+				{
+					gone++;
+					continue;
+				}
+
+				double before[3], after[3];
+				if ( triangle_normal ( tri[0], tri[1], tri[2], before ) <= 0.0 )
+					continue;
+				for ( uint32_t j = 0; j < 3; j++ )
+					tri[j] = tri[j] == from ? to : tri[j];
+				flips = triangle_normal ( tri[0], tri[1], tri[2], after ) <= 0.0
+					|| before[0]*after[0] + before[1]*after[1] + before[2]*after[2] < 0.25;
+			}
+			if ( flips )
+				continue;
+
+			remap[from] = to;
+			quadric_add ( &quadrics[to], quadrics[from] );
+			maxCost  = std::max ( maxCost, collapses[c].cost );
+			removed += gone;
+
+			// Everything around the collapse is off limits for the rest of the pass, as the
+			// triangles used for the flip check would no longer be up to date
+			for ( uint32_t k = triangleStart[from]; k < triangleStart[from+1]; k++ )
+			{
+				uint32_t t = vertexTriangles[k];
+				touched[local[t*3+0]] = touched[local[t*3+1]] = touched[local[t*3+2]] = true;
+			}
+		}
+
+		// Apply the collapses, leaving out the triangles that collapsed along with their edge
+		std::vector<uint32_t> next;
+		next.reserve ( local.size ( ) );
+		for ( uint32_t t = 0; t < triangleCount; t++ )
+		{
+			uint32_t a = remap[local[t*3+0]], b = remap[local[t*3+1]], c = remap[local[t*3+2]];
+			if ( a != b && b != c && a != c )
+				next.push_back ( a ), next.push_back ( b ), next.push_back ( c );
+		}
+
+		if ( next.size ( ) == local.size ( ) )
+			break;	// Nothing left that can be collapsed
+		local.swap ( next );
+	}
+
+	indices->resize ( local.size ( ) );
+	for ( uint32_t i = 0; i < local.size ( ); i++ )
+		(*indices)[i] = unique[local[i]];
+	return (float)sqrt ( maxCost );
+}
+
+////////////////////////////////////////
+// Clusters
+
+// Splits the triangles of an object into clusters, in the order they are in. After optimizing
+// for the vertex cache, consecutive triangles are close to one another, which makes for clusters
+// that are compact enough to be worth culling on their own.
+void build_clusters (
+	const bobj_index* indices, uint32_t indexCount, const std::vector<index_t>& vertices,
+	const std::vector<float>& positions, std::vector<bobj_cluster>* outClusters
+)
 {
-	uint32_t vertexBits = ((1<<(V_BIT_CNT+1))-1);
-	uint32_t texcoordBits = ((1<<(VT_BIT_CNT+1))-1);
-	uint32_t normalBits = ((1<<(VN_BIT_CNT+1))-1);
+	auto position = [&] ( bobj_index index, float out[3] )
+	{
+		int32_t v = vertices[index].vertex_index;
+		for ( uint32_t j = 0; j < 3; j++ )
+			out[j] = v == -1 ? 0.0f : positions[v*3+j];
+	};
 
-	if ( (idx.vertex_index & vertexBits) != idx.vertex_index
-		|| ((idx.texcoord_index & texcoordBits) != idx.texcoord_index && idx.texcoord_index != -1 )
-		|| ((idx.normal_index & normalBits) != idx.normal_index && idx.normal_index != -1) )
-		return -2;
+	uint32_t triangleCount = indexCount / 3;
+	for ( uint32_t first = 0; first < triangleCount; )
+	{
+		// Take triangles until either limit would be exceeded
+		bobj_index clusterVertices[BOBJ_CLUSTER_MAX_VERTICES];
+		uint32_t vertexCount = 0, last = first;
+		for ( ; last < triangleCount && last - first < BOBJ_CLUSTER_MAX_TRIANGLES; last++ )
+		{
+			bobj_index added[3];
+			uint32_t addedCount = 0;
+			for ( uint32_t k = 0; k < 3; k++ )
+			{
+				bobj_index index = indices[last*3+k];
+				if ( std::find ( clusterVertices, clusterVertices + vertexCount, index ) == clusterVertices + vertexCount
+				  && std::find ( added, added + addedCount, index ) == added + addedCount )
+					added[addedCount++] = index;
+			}
+			if ( vertexCount + addedCount > BOBJ_CLUSTER_MAX_VERTICES )
+				break;
+			for ( uint32_t k = 0; k < addedCount; k++ )
+				clusterVertices[vertexCount++] = added[k];
+		}
 
-	*uid = ((uint64_t)idx.vertex_index)
-		| ((uint64_t)idx.texcoord_index << V_BIT_CNT)
-		| ((uint64_t)idx.normal_index << (V_BIT_CNT + VT_BIT_CNT));
-	return 0;
+		bobj_cluster cluster = {};
+		cluster.indexOffset = first * 3;
+		cluster.indexCount  = (last - first) * 3;
+
+		for ( uint32_t j = 0; j < 3; j++ )
+			cluster.aabbMin[j] = FLT_MAX, cluster.aabbMax[j] = -FLT_MAX;
+		for ( uint32_t i = 0; i < vertexCount; i++ )
+		{
+			float p[3];
+			position ( clusterVertices[i], p );
+			for ( uint32_t j = 0; j < 3; j++ )
+			{
+				cluster.aabbMin[j] = std::min ( cluster.aabbMin[j], p[j] );
+				cluster.aabbMax[j] = std::max ( cluster.aabbMax[j], p[j] );
+			}
+		}
+
+		// The sphere is centered on the box, which is hardly ever the smallest sphere there is,
+		// but close enough for clusters this small
+		for ( uint32_t j = 0; j < 3; j++ )
+			cluster.center[j] = (cluster.aabbMin[j] + cluster.aabbMax[j]) * 0.5f;
+		for ( uint32_t i = 0; i < vertexCount; i++ )
+		{
+			float p[3];
+			position ( clusterVertices[i], p );
+			float dx = p[0] - cluster.center[0], dy = p[1] - cluster.center[1], dz = p[2] - cluster.center[2];
+			cluster.radius = std::max ( cluster.radius, sqrtf ( dx*dx + dy*dy + dz*dz ) );
+		}
+
+		// The axis of the cone is the average of the normals of the triangles, and its opening
+		// angle the largest angle between the axis and any of the normals. The normals come from
+		// the winding of the triangles rather than the vertex normals, as the winding is what
+		// decides whether a triangle gets culled.
+		std::vector<float> normals ( (last - first) * 3 );
+		float axis[3] = { 0.0f, 0.0f, 0.0f };
+		for ( uint32_t t = first; t < last; t++ )
+		{
+			float p0[3], p1[3], p2[3];
+			position ( indices[t*3+0], p0 );
+			position ( indices[t*3+1], p1 );
+			position ( indices[t*3+2], p2 );
+			float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+			float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+			float* n = &normals[(t - first) * 3];
+			n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+			n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+			n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+			float length = sqrtf ( n[0]*n[0] + n[1]*n[1] + n[2]*n[2] );
+			for ( uint32_t j = 0; j < 3; j++ )
+			{
+				n[j] = length > 0.0f ? n[j] / length : 0.0f;	// Degenerate triangles don't count
+				axis[j] += n[j];
+			}
+		}
+
+		float axisLength = sqrtf ( axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2] );
+		float minDot = 1.0f;
+		for ( uint32_t j = 0; j < 3; j++ )
+			cluster.coneAxis[j] = axisLength > 0.0f ? axis[j] / axisLength : 0.0f;
+		for ( uint32_t t = 0; t < last - first; t++ )
+		{
+			const float* n = &normals[t * 3];
+			if ( n[0] != 0.0f || n[1] != 0.0f || n[2] != 0.0f )
+				minDot = std::min ( minDot, n[0]*cluster.coneAxis[0] + n[1]*cluster.coneAxis[1] + n[2]*cluster.coneAxis[2] );
+		}
+
+		// Cones that open up too far would hardly ever cull anything
+		cluster.coneCutoff = axisLength > 0.0f && minDot > 0.1f ? sqrtf ( 1.0f - minDot * minDot ) : 1.0f;
+
+		outClusters->push_back ( cluster );
+		first = last;
+	}
+}
+
+////////////////////////////////////////
+// Conversion
+
+void print_usage ( )
+{
+	printf ( "Correct usage: mconv.exe [-j threads] [-t] [-s] [-q] [-c compression] [in] [out]\n" );
+	printf ( "  -j threads  Amount of threads to convert with, defaults to the amount of cores\n" );
+	printf ( "  -t          Print how long every step of the conversion took\n" );
+	printf ( "  -s          Print the vertex cache efficiency of every object\n" );
+	printf ( "  -q          Quantize vertices to 16 bytes, rather than 32 bytes of floats\n" );
+	printf ( "  -c bc       Compress textures to BC1/BC3, for desktop GPUs (default)\n" );
+	printf ( "  -c etc2     Compress textures to ETC2, for mobile GPUs\n" );
+	printf ( "  -c none     Store textures as plain RGBA8\n" );
+	printf ( "  out         May be - to write to stdout\n" );
 }
 
-// mconv.exe in out
+typedef std::chrono::steady_clock timer_clock;
+
+double elapsed_ms ( timer_clock::time_point* since )
+{
+	timer_clock::time_point now = timer_clock::now ( );
+	double ms = std::chrono::duration<double, std::milli> ( now - *since ).count ( );
+	*since = now;
+	return ms;
+}
+
+// mconv.exe [-j N] [-t] [-s] [-q] [-c bc|etc2|none] in out|-
 int main ( int argc, char* argv[] )
 {
-	if ( argc != 3 )
+	char* in  = NULL;
+	char* out = NULL;
+	uint32_t threadCount = std::thread::hardware_concurrency ( );
+	bool printTimings = false;
+	bool quantizeVertices = false;
+	bool printStatistics = false;
+	texture_compression compression = TEXTURE_COMPRESSION_BC;
+	for ( int i = 1; i < argc; i++ )
+	{
+		if ( strcmp ( argv[i], "-j" ) == 0 && i + 1 < argc )
+		{
+			threadCount = (uint32_t)atoi ( argv[++i] );
+		}
+		else if ( strcmp ( argv[i], "-t" ) == 0 )
+		{
+			printTimings = true;
+		}
+		else if ( strcmp ( argv[i], "-s" ) == 0 )
+		{
+			printStatistics = true;
+		}
+		else if ( strcmp ( argv[i], "-q" ) == 0 )
+		{
+			quantizeVertices = true;
+		}
+		else if ( strcmp ( argv[i], "-c" ) == 0 && i + 1 < argc )
+		{
+			i++;
+			if ( strcmp ( argv[i], "bc" ) == 0 )
+				compression = TEXTURE_COMPRESSION_BC;
+			else if ( strcmp ( argv[i], "etc2" ) == 0 )
+				compression = TEXTURE_COMPRESSION_ETC2;
+			else if ( strcmp ( argv[i], "none" ) == 0 )
+				compression = TEXTURE_COMPRESSION_NONE;
+			else
+			{
+				in = NULL;
+				break;
+			}
+		}
+		else if ( in == NULL )
+		{
+			in = argv[i];
+		}
+		else if ( out == NULL )
+		{
+			out = argv[i];
+		}
+		else
+		{
+			in = NULL;
+			break;
+		}
+	}
+
+	if ( in == NULL || out == NULL )
 	{
-		printf ( "ERROR: Invalid parameters. Correct usage: mconv.exe [in] [out]\n" );
+		printf ( "ERROR: Invalid parameters. " );
+		print_usage ( );
 		return -1;
 	}
+	if ( threadCount == 0 )
+		threadCount = 1;
+
+	// When writing the output to stdout, everything else goes to stderr
+	bool toStdout = strcmp ( out, "-" ) == 0;
+	FILE* msg = toStdout ? stderr : stdout;
+
+	thread_pool pool ( threadCount );
 
-	char* in = argv[1];
-	char* out = argv[2];
+	// Timings of the individual steps, printed at the end with -t
+	timer_clock::time_point stepStart = timer_clock::now ( );
+	double loadMs, weldMs, textureMs, objectMs, writeMs;
 
 	uint32_t fileStart = 0;
 	for ( int32_t i = strlen ( in ); i >= 0; i-- )
@@ -59,65 +1563,117 @@ int main ( int argc, char* argv[] )
 	bool success = LoadObj(&attrib, &shapes, &materials, &error, in, base.c_str ( ));
 	if ( !success )
 	{
-		printf ( "ERROR: Failed to load OBJ file %s\n%s\n", in, error.c_str ( ) );
+		fprintf ( msg, "ERROR: Failed to load OBJ file %s\n%s\n", in, error.c_str ( ) );
 		return -1;
 	}
+	loadMs = elapsed_ms ( &stepStart );
 
-	FILE* fOut;
-	fopen_s ( &fOut, out, "wb" );
+	FILE* fOut = toStdout ? stdout : open_file ( out, "wb" );
 	if ( !fOut )
 	{
-		printf ( "ERROR: Failed to load output file %s\n", out );
+		fprintf ( msg, "ERROR: Failed to load output file %s\n", out );
 		return -1;
 	}
+#if defined ( _WIN32 )
+	if ( toStdout )
+		_setmode ( _fileno ( stdout ), _O_BINARY );	// No \n to \r\n conversion, please
+#endif
+
+	// Everything is written in a single pass through a large buffer, so the amount of writes that
+	// actually end up at the OS is small no matter how the sections are split up
+	setvbuf ( fOut, NULL, _IOFBF, 1 << 20 );
+
+	// Vertices get their index in the order they are first used, so this has to stay sequential.
+	// The vertex index of every corner is stored right away, so the objects below don't have to
+	// look them up again.
+
+	size_t cornerCount = 0;
+	for ( uint32_t i = 0; i < shapes.size ( ); i++ )
+		cornerCount += shapes[i].mesh.indices.size ( );
 
-	std::map<uint64_t,uint32_t> hashToIdx;
+	uid_table uidToIdx;
 	std::vector<index_t> vertices;
+	std::vector<std::vector<uint32_t>> cornerToIdx ( shapes.size ( ) );
 	for ( uint32_t i = 0; i < shapes.size ( ); i++ )
 	{
 		auto& indices = shapes[i].mesh.indices;
+		cornerToIdx[i].resize ( indices.size ( ) );
 		for ( uint32_t j = 0; j < indices.size ( ); j++ )
 		{
 			uint64_t uid;
 			if ( index_to_uid ( indices[j], &uid ) != 0 )
 			{
-				printf ( "ERROR: Vertex, texcoord or normal indices out of range\n" );
+				fprintf ( msg, "ERROR: Vertex, texcoord or normal indices out of range\n" );
 				return -2;
 			}
-			auto it = hashToIdx.find ( uid );
-			if ( it == hashToIdx.end ( ) )
-			{
-				hashToIdx[uid] = vertices.size();
+
+			bool inserted;
+			cornerToIdx[i][j] = uidToIdx.find_or_insert ( uid, (uint32_t)vertices.size ( ), &inserted );
+			if ( inserted )
 				vertices.push_back ( indices[j] );
-			}
 		}
 	}
+	weldMs = elapsed_ms ( &stepStart );
+
+	// Textures are decoded, mipmapped and compressed in parallel, one job per distinct texture.
+	// Textures that fail to load are left out, the same way they have always been.
 
 	struct tex_desc
 	{
-		uint8_t* pixels;
+		bool loaded;
 		int width, height;
+		uint32_t format, mipCount;
+		std::vector<uint8_t> data;
 	};
+	std::vector<std::string> texNames;
+	std::map<std::string,uint32_t> texNameIdx;
+	for ( uint32_t i = 0; i < materials.size ( ); i++ )
+	{
+		if ( texNameIdx.find ( materials[i].diffuse_texname ) == texNameIdx.end ( ) )
+		{
+			texNameIdx[materials[i].diffuse_texname] = texNames.size ( );
+			texNames.push_back ( materials[i].diffuse_texname );
+		}
+	}
+
+	std::vector<tex_desc> decoded ( texNames.size ( ) );
+	pool.parallel_for ( texNames.size ( ), [&] ( uint32_t i )
+	{
+		tex_desc& desc = decoded[i];
+		int dummy;
+		uint8_t* pixels = stbi_load (
+			(base + texNames[i]).c_str ( ), &desc.width, &desc.height, &dummy, 4
+		);
+		desc.loaded = pixels != NULL;
+		if ( !desc.loaded )
+			return;
+
+		std::vector<uint8_t> chain = make_mip_chain ( pixels, desc.width, desc.height, &desc.mipCount );
+		stbi_image_free ( pixels );
+		desc.data = compress_texture (
+			compression, chain, desc.width, desc.height, desc.mipCount, &desc.format
+		);
+	} );
+
 	uint32_t texdataSize = 0;
 	std::vector<tex_desc> tex;
 	std::map<std::string,uint32_t> txIdx;
-	for ( uint32_t i = 0; i < materials.size ( ); i++ )
+	for ( uint32_t i = 0; i < texNames.size ( ); i++ )
 	{
-		if ( txIdx.find ( materials[i].diffuse_texname ) == txIdx.end ( ) )
+		if ( decoded[i].loaded )
 		{
-			tex_desc desc = { };
-			int dummy;
-			desc.pixels = stbi_load (
-				(base + materials[i].diffuse_texname).c_str ( ), &desc.width, &desc.height, &dummy, 4
-			);
-			if ( desc.pixels != NULL )
-			{
-				txIdx[materials[i].diffuse_texname] = tex.size ( );
-				tex.push_back ( desc );
-				texdataSize += desc.width * desc.height * 4;
-			}
+			txIdx[texNames[i]] = tex.size ( );
+			texdataSize += decoded[i].data.size ( );
+			tex.push_back ( std::move ( decoded[i] ) );
 		}
 	}
+	textureMs = elapsed_ms ( &stepStart );
+
+	// Materials without a texture are treated as not having a material at all
+
+	std::vector<int> materialRemap ( materials.size ( ) );
+	for ( uint32_t i = 0; i < materials.size ( ); i++ )
+		materialRemap[i] = txIdx.find ( materials[i].diffuse_texname ) == txIdx.end ( ) ? -1 : (int)i;
 
 	std::map<uint64_t,uint32_t> hashToObject;
 	std::vector<std::pair<uint32_t,int>> objectMaterials;
@@ -127,8 +1683,8 @@ int main ( int argc, char* argv[] )
 		for ( uint32_t j = 0; j < indices.size ( ); j++ )
 		{
 			int mat = indices[j];
-			if ( mat >= 0 && txIdx.find ( materials[mat].diffuse_texname) == txIdx.end ( ) )
-				mat = -1;
+			if ( mat >= 0 )
+				mat = materialRemap[mat];
 			uint64_t hash = ((uint64_t)i << 32) | (uint32_t)mat;
 			auto it = hashToObject.find ( hash );
 			if ( it == hashToObject.end ( ) )
@@ -139,144 +1695,406 @@ int main ( int argc, char* argv[] )
 		}
 	}
 
+	// Every object gathers its own indices and bounding box in a job of its own. The index lists
+	// are concatenated in object order afterwards, giving the same index buffer as gathering them
+	// one object after the other.
+
+	struct object_desc
+	{
+		std::vector<bobj_index> indices;
+		std::vector<bobj_index16> shortIndices;	// Used instead of indices, when they fit
+		uint32_t vertexOffset, indexSize, indexOffset;
+		float aabbMin[3], aabbMax[3];
+		float acmr[2], atvr[2];	// Before and after optimizing for the vertex cache
+		std::vector<bobj_cluster> clusters;
+		uint32_t clusterOffset;
+		std::vector<bobj_lod> lods;	// Their indices follow one another in indices
+	};
+	std::vector<object_desc> objects ( objectMaterials.size ( ) );
+	pool.parallel_for ( objectMaterials.size ( ), [&] ( uint32_t i )
+	{
+		auto pair = objectMaterials[i];
+		object_desc& obj = objects[i];
+
+		auto& mesh   = shapes[pair.first].mesh;
+		auto& corner = cornerToIdx[pair.first];
+		for ( uint32_t j = 0; j < mesh.material_ids.size ( ); j++ )
+		{
+			int mat = mesh.material_ids[j];
+			if ( mat >= 0 )
+				mat = materialRemap[mat];
+
+			if ( mat == pair.second )
+			{
+				obj.indices.push_back ( corner[j*3+0] );
+				obj.indices.push_back ( corner[j*3+1] );
+				obj.indices.push_back ( corner[j*3+2] );
+			}
+		}
+
+		obj.aabbMin[0] =  FLT_MAX, obj.aabbMin[1] =  FLT_MAX, obj.aabbMin[2] =  FLT_MAX;
+		obj.aabbMax[0] = -FLT_MAX, obj.aabbMax[1] = -FLT_MAX, obj.aabbMax[2] = -FLT_MAX;
+
+		for ( uint32_t k = 0; k < obj.indices.size ( ); k++ )
+		{
+			auto index = obj.indices[k];
+			auto vIdx  = vertices[index].vertex_index;
+
+			for ( uint32_t j = 0; j < 3; j++ )
+			{
+				float x = attrib.vertices[vIdx*3+j];
+				if ( x < obj.aabbMin[j] )
+					obj.aabbMin[j] = x;
+				if ( x > obj.aabbMax[j] )
+					obj.aabbMax[j] = x;
+			}
+		}
+
+		// The triangles are reordered for the vertex cache right away, keeping track of how well
+		// the cache did before and after for the report
+
+		if ( printStatistics )
+			vertex_cache_statistics ( obj.indices, &obj.acmr[0], &obj.atvr[0] );
+		optimize_vertex_cache ( obj.indices );
+		if ( printStatistics )
+			vertex_cache_statistics ( obj.indices, &obj.acmr[1], &obj.atvr[1] );
+
+		// Every level of detail gets a quarter of the triangles of the one before it, for as long
+		// as simplifying still gets anywhere. Their errors add up, as every level is simplified
+		// from the one before it rather than from the full detail one.
+
+		obj.lods.push_back ( bobj_lod { 0, (uint32_t)obj.indices.size ( ), 0.0f } );
+		std::vector<bobj_index> lod ( obj.indices );
+		float error = 0.0f;
+		while ( obj.lods.size ( ) < BOBJ_MAX_LODS && !lod.empty ( ) )
+		{
+			uint32_t previousCount = lod.size ( );
+			error += simplify ( &lod, previousCount / 3 / 4, vertices, attrib.vertices );
+			if ( lod.size ( ) * 10 > previousCount * 9 )
+				break;
+
+			optimize_vertex_cache ( lod );
+			obj.lods.push_back ( bobj_lod { (uint32_t)obj.indices.size ( ), (uint32_t)lod.size ( ), error } );
+			obj.indices.insert ( obj.indices.end ( ), lod.begin ( ), lod.end ( ) );
+		}
+	} );
+
+	// With the triangles in their final order, the vertices are renumbered in the order the
+	// triangles first use them. Vertices used one after the other then sit next to one another in
+	// the vertex buffer as well, so fetching them reads memory mostly front to back rather than
+	// jumping all over the place.
+
+	std::vector<uint32_t> vertexRemap ( vertices.size ( ), UINT32_MAX );
+	std::vector<index_t> remappedVertices;
+	remappedVertices.reserve ( vertices.size ( ) );
+	for ( uint32_t i = 0; i < objects.size ( ); i++ )
+	{
+		for ( uint32_t k = 0; k < objects[i].indices.size ( ); k++ )
+		{
+			uint32_t index = objects[i].indices[k];
+			if ( vertexRemap[index] == UINT32_MAX )
+			{
+				vertexRemap[index] = remappedVertices.size ( );
+				remappedVertices.push_back ( vertices[index] );
+			}
+		}
+	}
+	vertices.swap ( remappedVertices );
+
+	pool.parallel_for ( objects.size ( ), [&] ( uint32_t i )
+	{
+		object_desc& obj = objects[i];
+		for ( uint32_t k = 0; k < obj.indices.size ( ); k++ )
+			obj.indices[k] = vertexRemap[obj.indices[k]];
+
+		build_clusters ( obj.indices.data ( ), obj.lods[0].indexCount, vertices, attrib.vertices, &obj.clusters );
+
+		// The renumbering keeps the vertices of an object right next to one another. When they
+		// span less than 65536 vertices, the indices are stored relative to the first one in 16
+		// bits, halving their size.
+
+		uint32_t minIndex = UINT32_MAX, maxIndex = 0;
+		for ( uint32_t k = 0; k < obj.indices.size ( ); k++ )
+		{
+			minIndex = std::min ( minIndex, obj.indices[k] );
+			maxIndex = std::max ( maxIndex, obj.indices[k] );
+		}
+
+		obj.vertexOffset = 0;
+		obj.indexSize    = sizeof ( bobj_index );
+		if ( !obj.indices.empty ( ) && maxIndex - minIndex <= UINT16_MAX )
+		{
+			obj.vertexOffset = minIndex;
+			obj.indexSize    = sizeof ( bobj_index16 );
+			obj.shortIndices.resize ( obj.indices.size ( ) );
+			for ( uint32_t k = 0; k < obj.indices.size ( ); k++ )
+				obj.shortIndices[k] = (bobj_index16)(obj.indices[k] - minIndex);
+			std::vector<bobj_index> ( ).swap ( obj.indices );
+		}
+	} );
+
+	objectMs = elapsed_ms ( &stepStart );
+
+	// With everything converted, the layout of the file is known up front, including the amount
+	// of indices, so the file header can be written first and doesn't need patching afterwards
+
+	// The indices of every object start at a multiple of their size, so 32 bit indices following
+	// an odd amount of 16 bit ones get two bytes of padding in front of them
+
+	uint32_t indexDataSize = 0, shortObjects = 0, clusterCount = 0;
+	for ( uint32_t i = 0; i < objects.size ( ); i++ )
+	{
+		object_desc& obj = objects[i];
+		obj.clusterOffset = clusterCount;
+		clusterCount     += obj.clusters.size ( );
+		indexDataSize   = (indexDataSize + obj.indexSize - 1) / obj.indexSize * obj.indexSize;
+		obj.indexOffset = indexDataSize / obj.indexSize;
+		indexDataSize  += (obj.indices.size ( ) + obj.shortIndices.size ( )) * obj.indexSize;
+		shortObjects   += obj.indexSize == sizeof ( bobj_index16 );
+	}
+
 	bobj_file_header fhead;
 	fhead.magic       = BOBJ_FILE_MAGIC;
 	fhead.version     = BOBJ_VERSION;
 	fhead.objCount    = objectMaterials.size ( );
 	fhead.texCount    = txIdx.size ( );
 	fhead.vertexCount = vertices.size ( );
+	fhead.indexDataSize = indexDataSize;
+	fhead.clusterCount  = clusterCount;
+
+	fhead.vertexFormat = quantizeVertices ? BOBJ_VERTEX_FORMAT_QUANTIZED : BOBJ_VERTEX_FORMAT_FLOAT;
+	uint32_t vertexSize = quantizeVertices ? sizeof ( bobj_vert_quantized ) : sizeof ( bobj_vert );
+	uint32_t positionSize = quantizeVertices ? sizeof ( bobj_position_quantized ) : sizeof ( bobj_position );
+	for ( uint32_t j = 0; j < 3; j++ )
+		fhead.positionScale[j] = 1.0f, fhead.positionOffset[j] = 0.0f;
 
 	fhead.objectsStart  = sizeof ( fhead );
 	fhead.texturesStart = fhead.objectsStart + fhead.objCount * sizeof ( bobj_object_header );
 	fhead.texdataStart  = fhead.texturesStart + fhead.texCount * sizeof ( bobj_texture_header ) + sizeof ( uint32_t );
 	fhead.vertexStart   = fhead.texdataStart + texdataSize + sizeof ( uint32_t );
-	fhead.indexStart    = fhead.vertexStart + fhead.vertexCount * sizeof ( bobj_vert ) + sizeof ( uint32_t );
-	
-	fwrite ( &fhead, sizeof ( fhead ), 1, fOut );
+	fhead.positionStart = fhead.vertexStart + fhead.vertexCount * vertexSize + sizeof ( uint32_t );
+	fhead.clusterStart  = fhead.positionStart + fhead.vertexCount * positionSize + sizeof ( uint32_t );
+	fhead.indexStart    = fhead.clusterStart + fhead.clusterCount * sizeof ( bobj_cluster ) + sizeof ( uint32_t );
 
-	std::vector<bobj_index> indices;
+	// The vertices are built in memory first, so they can go out in a single write. Chunks of
+	// them are built in parallel.
 
-	for ( uint32_t i = 0; i < objectMaterials.size ( ); i++ )
+	const uint32_t VERTEX_CHUNK = 16384;
+	std::vector<bobj_vert> vertexData ( vertices.size ( ) );
+	pool.parallel_for ( (vertices.size ( ) + VERTEX_CHUNK - 1) / VERTEX_CHUNK, [&] ( uint32_t chunk )
 	{
-		auto pair = objectMaterials[i];
-
-		bobj_object_header ohead;
-		ohead.magic        = BOBJ_OBJECT_MAGIC;
-		ohead.indexOffset  = indices.size ( );
-
-		auto& mesh = shapes[pair.first].mesh;
-		for ( uint32_t j = 0; j < mesh.material_ids.size ( ); j++ )
+		uint32_t end = std::min<uint32_t> ( (chunk + 1) * VERTEX_CHUNK, vertices.size ( ) );
+		for ( uint32_t i = chunk * VERTEX_CHUNK; i < end; i++ )
 		{
-			int mat = mesh.material_ids[j];
-			if ( mat >= 0 && txIdx.find ( materials[mat].diffuse_texname) == txIdx.end ( ) )
-				mat = -1;
+			auto v = vertices[i];
+			bobj_vert vert = {};
 
-			if ( mat == pair.second )
+			if ( v.vertex_index != -1 )
 			{
-				uint64_t uid[3];
-				if ( index_to_uid ( mesh.indices[j*3+0], &uid[0] ) != 0
-					|| index_to_uid ( mesh.indices[j*3+1], &uid[1] ) != 0
-					|| index_to_uid ( mesh.indices[j*3+2], &uid[2] ) != 0)
-				{
-					printf ( "ERROR: Vertex, texcoord or normal indices out of range\n" );
-					return -3;
-				}
+				vert.position[0] = attrib.vertices[v.vertex_index*3+0];
+				vert.position[1] = attrib.vertices[v.vertex_index*3+1];
+				vert.position[2] = attrib.vertices[v.vertex_index*3+2];
+			}
+
+			if ( v.texcoord_index != -1 )
+			{
+				vert.texcoord[0] = attrib.texcoords[v.texcoord_index*2+0];
+				vert.texcoord[1] = attrib.texcoords[v.texcoord_index*2+1];
+			}
 
-				indices.push_back ( hashToIdx[uid[0]] );
-				indices.push_back ( hashToIdx[uid[1]] );
-				indices.push_back ( hashToIdx[uid[2]] );
+			if ( v.normal_index != -1 )
+			{
+				vert.normal[0] = attrib.normals[v.normal_index*3+0];
+				vert.normal[1] = attrib.normals[v.normal_index*3+1];
+				vert.normal[2] = attrib.normals[v.normal_index*3+2];
 			}
+
+			vertexData[i] = vert;
 		}
+	} );
 
-		ohead.aabbMin[0] =  FLT_MAX, ohead.aabbMin[1] =  FLT_MAX, ohead.aabbMin[2] =  FLT_MAX;
-		ohead.aabbMax[0] = -FLT_MAX, ohead.aabbMax[1] = -FLT_MAX, ohead.aabbMax[2] = -FLT_MAX;
+	// Quantized positions are relative to the bounds of all vertices together, rather than those
+	// of the objects: objects share vertices with one another.
 
-		for ( uint32_t i = ohead.indexOffset; i < indices.size ( ); i++ )
+	std::vector<bobj_vert_quantized> quantizedData;
+	if ( quantizeVertices )
+	{
+		float boundsMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, boundsMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for ( uint32_t i = 0; i < vertexData.size ( ); i++ )
 		{
-			auto index = indices[i];
-			auto vIdx  = vertices[index].vertex_index;
-			
 			for ( uint32_t j = 0; j < 3; j++ )
 			{
-				float x = attrib.vertices[vIdx*3+j];
-				if ( x < ohead.aabbMin[j] )
-					ohead.aabbMin[j] = x;
-				if ( x > ohead.aabbMax[j] )
-					ohead.aabbMax[j] = x;
+				boundsMin[j] = std::min ( boundsMin[j], vertexData[i].position[j] );
+				boundsMax[j] = std::max ( boundsMax[j], vertexData[i].position[j] );
 			}
 		}
+		for ( uint32_t j = 0; j < 3 && !vertexData.empty ( ); j++ )
+		{
+			fhead.positionOffset[j] = (boundsMin[j] + boundsMax[j]) * 0.5f;
+			fhead.positionScale[j]  = (boundsMax[j] - boundsMin[j]) * 0.5f;
+			if ( fhead.positionScale[j] <= 0.0f )
+				fhead.positionScale[j] = 1.0f;	// Flat along this axis, anything goes
+		}
+
+		quantizedData.resize ( vertexData.size ( ) );
+		pool.parallel_for ( (vertices.size ( ) + VERTEX_CHUNK - 1) / VERTEX_CHUNK, [&] ( uint32_t chunk )
+		{
+			uint32_t end = std::min<uint32_t> ( (chunk + 1) * VERTEX_CHUNK, vertices.size ( ) );
+			for ( uint32_t i = chunk * VERTEX_CHUNK; i < end; i++ )
+				quantize_vertex ( vertexData[i], fhead.positionOffset, fhead.positionScale, &quantizedData[i] );
+		} );
+	}
+
+	// The position stream is a copy of the positions of the vertices, as they are stored in them
+
+	std::vector<bobj_position> positionData;
+	std::vector<bobj_position_quantized> quantizedPositionData;
+	if ( quantizeVertices )
+	{
+		quantizedPositionData.resize ( quantizedData.size ( ) );
+		for ( uint32_t i = 0; i < quantizedData.size ( ); i++ )
+			memcpy ( quantizedPositionData[i].position, quantizedData[i].position, sizeof ( quantizedData[i].position ) );
+	}
+	else
+	{
+		positionData.resize ( vertexData.size ( ) );
+		for ( uint32_t i = 0; i < vertexData.size ( ); i++ )
+			memcpy ( positionData[i].position, vertexData[i].position, sizeof ( vertexData[i].position ) );
+	}
+
+	uint64_t offset = 0;
+	bool ok = write_bytes ( fOut, &fhead, sizeof ( fhead ), &offset );
+
+	std::vector<bobj_object_header> objectHeaders ( objectMaterials.size ( ) );
+	for ( uint32_t i = 0; i < objectMaterials.size ( ); i++ )
+	{
+		auto pair = objectMaterials[i];
 
-		ohead.indexCount   = indices.size ( ) - ohead.indexOffset;
-		ohead.textureIndex = pair.second == -1 ? 0xFFFFFFFF : txIdx[materials[pair.second].diffuse_texname];
+		bobj_object_header& ohead = objectHeaders[i];
+		ohead.magic         = BOBJ_OBJECT_MAGIC;
+		ohead.indexOffset   = objects[i].indexOffset;
+		ohead.indexCount    = objects[i].indices.size ( ) + objects[i].shortIndices.size ( );
+		ohead.indexSize     = objects[i].indexSize;
+		ohead.vertexOffset  = objects[i].vertexOffset;
+		ohead.clusterOffset = objects[i].clusterOffset;
+		ohead.clusterCount  = objects[i].clusters.size ( );
+		ohead.textureIndex  = pair.second == -1 ? 0xFFFFFFFF : txIdx[materials[pair.second].diffuse_texname];
+		ohead.lodCount      = objects[i].lods.size ( );
+		memset ( ohead.lods, 0, sizeof ( ohead.lods ) );
+		for ( uint32_t j = 0; j < objects[i].lods.size ( ); j++ )
+			ohead.lods[j] = objects[i].lods[j];
 
-		fwrite ( &ohead, sizeof ( ohead ), 1, fOut );
+		for ( uint32_t j = 0; j < 3; j++ )
+		{
+			ohead.aabbMin[j] = objects[i].aabbMin[j];
+			ohead.aabbMax[j] = objects[i].aabbMax[j];
+		}
 	}
+	ok = ok && write_bytes ( fOut, objectHeaders.data ( ), objectHeaders.size ( ) * sizeof ( bobj_object_header ), &offset );
 
-	assert ( ftell ( fOut ) == fhead.texturesStart );
+	assert ( offset == fhead.texturesStart );
 	uint32_t texOff = 0;
+	std::vector<bobj_texture_header> textureHeaders ( tex.size ( ) );
 	for ( uint32_t i = 0; i < tex.size ( ); i++ )
 	{
-		bobj_texture_header t = { };
+		bobj_texture_header& t = textureHeaders[i];
 		t.magic  = BOBJ_TEXTURE_MAGIC;
-		t.width  = tex[i].width;
-		t.height = tex[i].height;
-		t.offset = texOff;
-		texOff  += tex[i].width * tex[i].height * 4;
-		fwrite ( &t, sizeof ( t ), 1, fOut );
+		t.width    = tex[i].width;
+		t.height   = tex[i].height;
+		t.offset   = texOff;
+		t.format   = tex[i].format;
+		t.mipCount = tex[i].mipCount;
+		t.size     = tex[i].data.size ( );
+		texOff    += t.size;
 	}
+	ok = ok && write_bytes ( fOut, textureHeaders.data ( ), textureHeaders.size ( ) * sizeof ( bobj_texture_header ), &offset );
 
 	uint32_t magic = BOBJ_TEXTURE_DATA_MAGIC;
-	fwrite ( &magic, sizeof ( magic ), 1, fOut );
-	assert ( ftell ( fOut ) == fhead.texdataStart );
+	ok = ok && write_bytes ( fOut, &magic, sizeof ( magic ), &offset );
+	assert ( offset == fhead.texdataStart );
 	for ( uint32_t i = 0; i < tex.size ( ); i++ )
 	{
-		fwrite ( tex[i].pixels, tex[i].width * tex[i].height * 4, 1, fOut );
+		ok = ok && write_bytes ( fOut, tex[i].data.data ( ), tex[i].data.size ( ), &offset );
 	}
 
 	magic = BOBJ_VERTEX_DATA_MAGIC;
-	fwrite ( &magic, sizeof ( magic ), 1, fOut );
-	assert ( ftell ( fOut ) == fhead.vertexStart );
-	for ( uint32_t i = 0; i < vertices.size ( ); i++ )
-	{
-		auto v = vertices[i];
-		bobj_vert vert = {};
-		
-		if ( v.vertex_index != -1 )
-		{
-			vert.position[0] = attrib.vertices[v.vertex_index*3+0];
-			vert.position[1] = attrib.vertices[v.vertex_index*3+1];
-			vert.position[2] = attrib.vertices[v.vertex_index*3+2];
-		}
+	ok = ok && write_bytes ( fOut, &magic, sizeof ( magic ), &offset );
+	assert ( offset == fhead.vertexStart );
+	if ( quantizeVertices )
+		ok = ok && write_bytes ( fOut, quantizedData.data ( ), quantizedData.size ( ) * vertexSize, &offset );
+	else
+		ok = ok && write_bytes ( fOut, vertexData.data ( ), vertexData.size ( ) * vertexSize, &offset );
 
-		if ( v.texcoord_index != -1 )
-		{
-			vert.texcoord[0] = attrib.texcoords[v.texcoord_index*2+0];
-			vert.texcoord[1] = attrib.texcoords[v.texcoord_index*2+1];
-		}
-
-		if ( v.normal_index != -1 )
-		{
-			vert.normal[0] = attrib.normals[v.normal_index*3+0];
-			vert.normal[1] = attrib.normals[v.normal_index*3+1];
-			vert.normal[2] = attrib.normals[v.normal_index*3+2];
-		}
+	magic = BOBJ_POSITION_DATA_MAGIC;
+	ok = ok && write_bytes ( fOut, &magic, sizeof ( magic ), &offset );
+	assert ( offset == fhead.positionStart );
+	if ( quantizeVertices )
+		ok = ok && write_bytes ( fOut, quantizedPositionData.data ( ), quantizedPositionData.size ( ) * positionSize, &offset );
+	else
+		ok = ok && write_bytes ( fOut, positionData.data ( ), positionData.size ( ) * positionSize, &offset );
 
-		fwrite ( &vert, sizeof ( vert ), 1, fOut );
+	magic = BOBJ_CLUSTER_DATA_MAGIC;
+	ok = ok && write_bytes ( fOut, &magic, sizeof ( magic ), &offset );
+	assert ( offset == fhead.clusterStart );
+	for ( uint32_t i = 0; i < objects.size ( ); i++ )
+	{
+		ok = ok && write_bytes (
+			fOut, objects[i].clusters.data ( ), objects[i].clusters.size ( ) * sizeof ( bobj_cluster ), &offset
+		);
 	}
 
-	magic = BOBJ_INDEX_DATA_MAGIC;
-	fwrite ( &magic, sizeof ( magic ), 1, fOut );
-	assert ( ftell ( fOut ) == fhead.indexStart );
-	fwrite ( indices.data(), indices.size ( ) * sizeof ( bobj_index ), 1, fOut );
-
-	// Patch the fileheader to fill in the field we left blank before lalalalalala
-	fhead.indexCount = indices.size ( );
-	fseek ( fOut, 0, SEEK_SET );
-	fwrite ( &fhead, sizeof ( fhead ), 1, fOut );
+	// The indices of the objects follow one another, no need to glue them together first
 
+	magic = BOBJ_INDEX_DATA_MAGIC;
+	ok = ok && write_bytes ( fOut, &magic, sizeof ( magic ), &offset );
+	assert ( offset == fhead.indexStart );
+	for ( uint32_t i = 0; i < objects.size ( ); i++ )
+	{
+		static const uint8_t padding[sizeof ( bobj_index )] = {};
+		uint64_t start = fhead.indexStart + (uint64_t)objects[i].indexOffset * objects[i].indexSize;
+		ok = ok && write_bytes ( fOut, padding, start - offset, &offset );
+		ok = ok && write_bytes (
+			fOut, objects[i].indices.data ( ), objects[i].indices.size ( ) * sizeof ( bobj_index ), &offset
+		);
+		ok = ok && write_bytes (
+			fOut, objects[i].shortIndices.data ( ), objects[i].shortIndices.size ( ) * sizeof ( bobj_index16 ), &offset
+		);
+	}
+	assert ( offset == fhead.indexStart + fhead.indexDataSize );
 
-	fclose ( fOut );
+	ok = fflush ( fOut ) == 0 && ok;
+	if ( !toStdout )
+		ok = fclose ( fOut ) == 0 && ok;
+	if ( !ok )
+	{
+		fprintf ( msg, "ERROR: Failed to write output file %s\n", out );
+		return -4;
+	}
+	writeMs = elapsed_ms ( &stepStart );
 
-	printf ( "%s ==> %s\n", in, out );
+	fprintf ( msg, "%s ==> %s\n", in, out );
+	if ( printTimings )
+	{
+		fprintf ( msg, "  load     %9.2f ms\n", loadMs    );
+		fprintf ( msg, "  weld     %9.2f ms (%u vertices from %u corners)\n",
+			weldMs, (uint32_t)vertices.size ( ), (uint32_t)cornerCount );
+		fprintf ( msg, "  textures %9.2f ms\n", textureMs );
+		fprintf ( msg, "  objects  %9.2f ms (%u of %u with 16 bit indices, %u clusters)\n",
+			objectMs, shortObjects, (uint32_t)objects.size ( ), clusterCount );
+		fprintf ( msg, "  write    %9.2f ms\n", writeMs   );
+	}
+	if ( printStatistics )
+	{
+		fprintf ( msg, "  object  triangles   ACMR before/after   ATVR before/after   LOD triangles (error)\n" );
+		for ( uint32_t i = 0; i < objects.size ( ); i++ )
+		{
+			fprintf ( msg, "  %6u %10u   %6.3f   %6.3f     %6.3f   %6.3f    ",
+				i, objects[i].lods[0].indexCount / 3,
+				objects[i].acmr[0], objects[i].acmr[1], objects[i].atvr[0], objects[i].atvr[1] );
+			for ( uint32_t j = 1; j < objects[i].lods.size ( ); j++ )
+				fprintf ( msg, " %u (%g)", objects[i].lods[j].indexCount / 3, objects[i].lods[j].error );
+			fprintf ( msg, "\n" );
+		}
+	}
 	return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,365 @@
+/*
+  Copyright (c) 2016 Rick van Miltenburg, NHTV Breda University of Applied Sciences
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+  associated documentation files (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all copies or
+  substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#version 450
+
+#extension GL_ARB_separate_shader_objects  : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+////////////////////////////////////////
+// Specialization constants
+
+// Set when the draws in view are counted, for vkCmdDrawIndexedIndirectCountAMD: the draws of
+// every group are packed together at its start, and their amount is written to the count buffer.
+// Otherwise every object keeps a range of draws of its own, without any instances for the draws
+// it doesn't need.
+layout(constant_id = 0)
+const bool COMPACT = false;
+
+////////////////////////////////////////
+// Input uniforms
+
+// The culling is done in two passes over all models. The first gathers the shadow receivers of
+// every light, the second writes the draws, see main.
+layout(push_constant)
+uniform CB
+{
+	uint objectCount;
+	uint groupCount;
+	uint drawCount;		// Draws of the model in every view
+	uint receivers;		// Set for the pass gathering the receivers
+} cb;
+
+#define MAX_VIEWS 17
+#define CAMERA    0		// VIEW_CAMERA
+struct View
+{
+	mat4 vp;
+	vec4 planes[6];		// The frustum planes, not normalized
+	vec3 position;		// Of the camera or light
+	float lodScale;		// Levels of detail with an error of up to distance / lodScale are fine
+	uint firstInstance;	// The shadow map layer, when rendering all of them in a single pass
+	uint enabled;		// Views not rendered this frame aren't culled either
+	uint backfaceCulling;	// Set to skip clusters facing away from the view
+	uint casterCulling;		// Set to skip objects not casting shadows on anything the camera sees
+};
+
+layout(std140, binding = 0) uniform ViewCB
+{
+	View views[MAX_VIEWS];
+} cull;
+
+////////////////////////////////////////
+// Input and output buffers
+
+struct Lod
+{
+	uint indexStart;
+	uint indexCount;
+	float error;
+	uint _dummy;
+};
+
+struct Object
+{
+	vec3 aabbMin; uint lodCount;
+	vec3 aabbMax; int  vertexOffset;
+	uint group;			// The group of objects its draws are part of
+	uint groupStart;	// The first draw of that group
+	uint drawStart;		// The first of the draws of the object itself, when not COMPACT
+	uint drawCount;		// The most draws it can take: one for every cluster
+	uint clusterStart;
+	uint clusterCount;
+	uint _dummy0, _dummy1;
+	Lod lods[4];
+};
+
+layout(std430, binding = 1) readonly buffer ObjectBuffer
+{
+	Object objects[];
+};
+
+struct Cluster
+{
+	vec3 aabbMin; uint indexStart;
+	vec3 aabbMax; uint indexCount;
+	vec3 center;  float radius;
+	vec3 coneAxis; float coneCutoff;
+};
+
+layout(std430, binding = 4) readonly buffer ClusterBuffer
+{
+	Cluster clusters[];
+};
+
+// Laid out like VkDrawIndexedIndirectCommand, drawCount of them for every view
+struct Draw
+{
+	uint indexCount;
+	uint instanceCount;
+	uint firstIndex;
+	int  vertexOffset;
+	uint firstInstance;
+};
+
+layout(std430, binding = 2) writeonly buffer DrawBuffer
+{
+	Draw draws[];
+};
+
+// The amount of draws in view, groupCount of them for every view
+layout(std430, binding = 3) buffer CountBuffer
+{
+	uint counts[];
+};
+
+// The bounds of the shadow receivers of every view, in its clip space: x and y for the minimum,
+// x, y and z for the maximum. They're kept as uints that order like the floats they hold, see
+// orderedFloat, so they can be gathered with atomics. The minimums start out at ~0u, the maximums
+// at 0, which is further out than any float on either side.
+layout(std430, binding = 5) buffer ReceiverBuffer
+{
+	uint receiverMin[MAX_VIEWS * 2];
+	uint receiverMax[MAX_VIEWS * 3];
+};
+
+////////////////////////////////////////
+// Utility functions
+
+// Flips the bits of floats such that the resulting uints compare like the floats did: negative
+// floats get all of their bits flipped, positive ones only their sign bit.
+uint orderedFloat ( float f )
+{
+	uint u = floatBitsToUint ( f );
+	return ( u & 0x80000000u ) != 0u ? ~u : u | 0x80000000u;
+}
+
+// A box is out of view when it is entirely outside of any of the planes, which is the case when
+// the corner furthest along the normal of the plane is outside of it. It is entirely in view when
+// even the corner furthest against the normal is inside all of them.
+bool boxInView ( uint view, vec3 aabbMin, vec3 aabbMax, out bool inside )
+{
+	inside = true;
+	for ( int i = 0; i < 6; i++ )
+	{
+		vec4  plane    = cull.views[view].planes[i];
+		bvec3 positive = greaterThanEqual ( plane.xyz, vec3 ( 0.0 ) );
+		if ( dot ( plane.xyz, mix ( aabbMin, aabbMax, positive ) ) + plane.w < 0.0 )
+			return false;
+		if ( dot ( plane.xyz, mix ( aabbMax, aabbMin, positive ) ) + plane.w < 0.0 )
+			inside = false;
+	}
+	return true;
+}
+
+// Projects a box into the clip space of a view, like app_util_aabb_project. Boxes reaching behind
+// the viewpoint don't have bounds there, for those false is returned.
+bool projectBox ( uint view, vec3 aabbMin, vec3 aabbMax, out vec3 outMin, out vec3 outMax )
+{
+	outMin = vec3 (  1.0e38 );
+	outMax = vec3 ( -1.0e38 );
+	for ( int i = 0; i < 8; i++ )
+	{
+		vec3 corner = mix ( aabbMin, aabbMax, bvec3 ( ( i & 1 ) != 0, ( i & 2 ) != 0, ( i & 4 ) != 0 ) );
+		vec4 clip   = cull.views[view].vp * vec4 ( corner, 1.0 );
+		if ( clip.w <= 0.0 )
+			return false;
+		outMin = min ( outMin, clip.xyz / clip.w );
+		outMax = max ( outMax, clip.xyz / clip.w );
+	}
+	return true;
+}
+
+// The same test as app_util_cluster_backfacing_check
+bool clusterBackfacing ( Cluster cluster, vec3 position )
+{
+	vec3 d = cluster.center - position;
+	return dot ( d, cluster.coneAxis ) >= cluster.coneCutoff * length ( d ) + cluster.radius;
+}
+
+void writeDraw ( uint view, uint slot, uint indexCount, uint firstIndex, int vertexOffset, uint instanceCount )
+{
+	draws[view * cb.drawCount + slot] = Draw (
+		indexCount, instanceCount, firstIndex, vertexOffset, cull.views[view].firstInstance
+	);
+}
+
+// Culls the clusters of an object at full detail, like app_render_model: runs of consecutive
+// clusters in view make a single draw. Returns the amount of draws, which are only written when
+// write is set, from slot onward. The clusters of objects entirely in view don't need the
+// frustum check.
+uint cullClusters ( Object obj, uint view, bool objectInside, bool write, uint slot )
+{
+	uint drawStart = 0u, drawCount = 0u, runs = 0u;
+	for ( uint i = 0u; i < obj.clusterCount; i++ )
+	{
+		Cluster cluster = clusters[obj.clusterStart + i];
+
+		bool clusterInside;
+		if ( !objectInside && !boxInView ( view, cluster.aabbMin, cluster.aabbMax, clusterInside ) )
+			continue;
+		if ( cull.views[view].backfaceCulling != 0u && clusterBackfacing ( cluster, cull.views[view].position ) )
+			continue;
+
+		if ( drawCount > 0u && drawStart + drawCount == cluster.indexStart )
+		{
+			drawCount += cluster.indexCount;
+			continue;
+		}
+
+		if ( drawCount > 0u )
+		{
+			if ( write )
+				writeDraw ( view, slot + runs, drawCount, drawStart, obj.vertexOffset, 1u );
+			runs++;
+		}
+		drawStart = cluster.indexStart;
+		drawCount = cluster.indexCount;
+	}
+
+	if ( drawCount > 0u )
+	{
+		if ( write )
+			writeDraw ( view, slot + runs, drawCount, drawStart, obj.vertexOffset, 1u );
+		runs++;
+	}
+	return runs;
+}
+
+////////////////////////////////////////
+// Passes
+
+// Objects in view of both the camera and a light can receive shadows from the light. Their bounds
+// in the clip space of the light are gathered for castsShadow, like app_cull_shadow_casters does.
+void gatherReceivers ( Object obj, uint view )
+{
+	bool inside;
+	if ( cull.views[view].casterCulling == 0u
+	  || !boxInView ( CAMERA, obj.aabbMin, obj.aabbMax, inside )
+	  || !boxInView ( view, obj.aabbMin, obj.aabbMax, inside ) )
+		return;
+
+	// Receivers reaching behind the light can't be projected, so they are considered to be
+	// anywhere in view of the light
+	vec3 bmin, bmax;
+	if ( !projectBox ( view, obj.aabbMin, obj.aabbMax, bmin, bmax ) )
+	{
+		bmin = vec3 ( -1.0, -1.0, 0.0 );
+		bmax = vec3 ( 1.0, 1.0, uintBitsToFloat ( 0x7F800000u ) );
+	}
+
+	atomicMin ( receiverMin[view * 2 + 0], orderedFloat ( bmin.x ) );
+	atomicMin ( receiverMin[view * 2 + 1], orderedFloat ( bmin.y ) );
+	atomicMax ( receiverMax[view * 3 + 0], orderedFloat ( bmax.x ) );
+	atomicMax ( receiverMax[view * 3 + 1], orderedFloat ( bmax.y ) );
+	atomicMax ( receiverMax[view * 3 + 2], orderedFloat ( bmax.z ) );
+}
+
+// Shadows are cast straight away from the light, along z in its clip space, so only objects
+// overlapping the receivers in x and y, and closer to the light than the furthest of them, can
+// shadow any of them. Objects reaching behind the light are considered to be anywhere.
+bool castsShadow ( Object obj, uint view )
+{
+	vec3 bmin, bmax;
+	if ( !projectBox ( view, obj.aabbMin, obj.aabbMax, bmin, bmax ) )
+		return true;
+
+	return orderedFloat ( bmax.x ) >= receiverMin[view * 2 + 0]
+	    && orderedFloat ( bmin.x ) <= receiverMax[view * 3 + 0]
+	    && orderedFloat ( bmax.y ) >= receiverMin[view * 2 + 1]
+	    && orderedFloat ( bmin.y ) <= receiverMax[view * 3 + 1]
+	    && orderedFloat ( bmin.z ) <= receiverMax[view * 3 + 2];
+}
+
+////////////////////////////////////////
+// Entry point
+
+// Every invocation culls a single object for a single view: the objects along x, the views along
+// y. The draws of an object in view are picked like app_render_model does: a single draw of the
+// level of detail it is at, or the clusters in view when that is full detail.
+
+layout(local_size_x = 64) in;
+
+void main()
+{
+	uint index = gl_GlobalInvocationID.x;
+	uint view  = gl_WorkGroupID.y;
+	if ( index >= cb.objectCount || cull.views[view].enabled == 0 )
+		return;
+
+	Object obj = objects[index];
+
+	if ( cb.receivers != 0u )
+	{
+		if ( view != CAMERA )
+			gatherReceivers ( obj, view );
+		return;
+	}
+
+	bool inside;
+	bool visible = boxInView ( view, obj.aabbMin, obj.aabbMax, inside );
+	if ( visible && cull.views[view].casterCulling != 0u )
+		visible = castsShadow ( obj, view );
+
+	if ( COMPACT && !visible )
+		return;
+
+	// The coarsest level of detail with an error that is small enough at the distance of the
+	// closest point of the box. Objects without clusters are drawn whole at full detail as well.
+
+	vec3  position = cull.views[view].position;
+	float distance = length ( max ( max ( obj.aabbMin - position, position - obj.aabbMax ), vec3 ( 0.0 ) ) );
+
+	uint lod = 0;
+	for ( uint i = obj.lodCount - 1; i > 0 && lod == 0; i-- )
+	{
+		if ( obj.lods[i].error * cull.views[view].lodScale <= distance )
+			lod = i;
+	}
+	bool whole = lod > 0 || obj.clusterCount == 0u;
+
+	// Packed together, the draws can only be written once it is known how many there are
+
+	uint slot = obj.drawStart;
+	if ( COMPACT )
+	{
+		uint count = whole ? 1u : cullClusters ( obj, view, inside, false, 0u );
+		if ( count == 0u )
+			return;
+		slot = obj.groupStart + atomicAdd ( counts[view * cb.groupCount + obj.group], count );
+	}
+
+	uint written = 0u;
+	if ( visible && whole )
+	{
+		writeDraw ( view, slot, obj.lods[lod].indexCount, obj.lods[lod].indexStart, obj.vertexOffset, 1u );
+		written = 1u;
+	}
+	else if ( visible )
+	{
+		written = cullClusters ( obj, view, inside, true, slot );
+	}
+
+	// Otherwise every draw of the object is drawn, the ones it doesn't need without instances
+
+	if ( !COMPACT )
+	{
+		for ( uint i = written; i < obj.drawCount; i++ )
+			writeDraw ( view, slot + i, 0u, 0u, 0, 0u );
+	}
+}
\ No newline at end of file
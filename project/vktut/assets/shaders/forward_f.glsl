@@ -88,7 +88,8 @@ vec3 EvaluateSpotLight ( uint lightIndex )
 		shadowFactor = texture ( shadowTex, texcoord );
 	}
 
-	return NdotL * coneFactor * shadowFactor * texture ( sampler2D ( tex, samp ), texcoord ).xyz;
+	return lighting.lights[lightIndex].color * NdotL * coneFactor * shadowFactor
+		* texture ( sampler2D ( tex, samp ), texcoord ).xyz;
 }
 
 void main()
@@ -29,9 +29,17 @@ layout(push_constant)
 uniform CB
 {
 	layout(offset = 0)  mat4 MVP;
-	layout(offset = 64) mat4 MV;
+	layout(offset = 64) mat4 M;	// Model to world, undoes the quantization of vertex positions
 } cb;
 
+////////////////////////////////////////
+// Specialization constants
+
+// Set for quantized vertices, which store their normal octahedral encoded in the first two
+// components of inNormal
+layout(constant_id = 0)
+const bool OCTAHEDRAL_NORMALS = false;
+
 ////////////////////////////////////////
 // Input attributes
 
@@ -61,10 +69,22 @@ out gl_PerVertex
 // Entry point
 
 #if 1
+// Unfolds the lower half of the octahedron that mconv folded onto the upper half
+vec3 decode_octahedral ( vec2 e )
+{
+	vec3 n = vec3 ( e, 1.0 - abs ( e.x ) - abs ( e.y ) );
+	float t = max ( -n.z, 0.0 );
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize ( n );
+}
+
 void main()
 {
-	vec4 worldPosition       =          vec4 ( inPosition, 1.0 );
-	vec4 worldNormal         =          vec4 ( inNormal,   0.0 );
+	vec3 normal = OCTAHEDRAL_NORMALS ? decode_octahedral ( inNormal.xy ) : inNormal;
+
+	vec4 worldPosition       = cb.M   * vec4 ( inPosition, 1.0 );
+	vec4 worldNormal         =          vec4 ( normal,     0.0 );
 	vec4 transformedPosition = cb.MVP * vec4 ( inPosition, 1.0 );
 	
 
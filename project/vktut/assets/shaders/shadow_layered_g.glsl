@@ -0,0 +1,86 @@
+/*
+  Copyright (c) 2016 Rick van Miltenburg, NHTV Breda University of Applied Sciences
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+  associated documentation files (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all copies or
+  substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#version 450
+
+#extension GL_ARB_separate_shader_objects  : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+////////////////////////////////////////
+// Input uniforms
+
+#define MAX_LIGHTS 16
+struct Spotlight
+{
+	mat4 shadowVp;
+	vec3 position;  float innerDot;
+	vec3 direction; float outerDot;
+	vec3 color;
+	vec3 attenuation;
+};
+
+layout(std140, binding = 0) uniform LightingCB
+{
+	vec3 cameraPosition; uint lightCount;
+	Spotlight lights[MAX_LIGHTS];
+} lighting;
+
+////////////////////////////////////////
+// Input and output primitives
+
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+////////////////////////////////////////
+// Input attributes
+
+layout(location = 0) flat in int inLayer[];
+
+in gl_PerVertex
+{
+	vec4 gl_Position;
+} gl_in[];
+
+////////////////////////////////////////
+// Output attributes
+
+out gl_PerVertex
+{
+	vec4 gl_Position;
+};
+
+////////////////////////////////////////
+// Entry point
+
+// The world space triangle is transformed for the light of its instance, and sent to the layer of
+// that light's shadow map.
+
+void main()
+{
+	int  layer    = inLayer[0];
+	mat4 shadowVp = lighting.lights[layer].shadowVp;
+
+	for ( int i = 0; i < 3; i++ )
+	{
+		gl_Position = shadowVp * gl_in[i].gl_Position;
+		gl_Layer    = layer;
+		EmitVertex ( );
+	}
+	EndPrimitive ( );
+}
\ No newline at end of file
@@ -0,0 +1,59 @@
+/*
+  Copyright (c) 2016 Rick van Miltenburg, NHTV Breda University of Applied Sciences
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+  associated documentation files (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all copies or
+  substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#version 450
+
+#extension GL_ARB_separate_shader_objects  : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+////////////////////////////////////////
+// Input uniforms
+
+layout(push_constant)
+uniform CB
+{
+	layout(offset = 0)  mat4 MVP;	// Unused, every layer has its own view projection
+	layout(offset = 64) mat4 M;	// Model to world, undoes the quantization of vertex positions
+} cb;
+
+////////////////////////////////////////
+// Input attributes
+
+layout(location = 0)
+in vec3 inPosition;
+
+////////////////////////////////////////
+// Output attributes
+
+// The instance is the light, and the shadow map layer, the geometry shader renders into
+layout(location = 0) flat out int outLayer;
+
+out gl_PerVertex
+{
+	vec4 gl_Position;
+};
+
+////////////////////////////////////////
+// Entry point
+
+void main()
+{
+	gl_Position = cb.M * vec4 ( inPosition, 1.0 );
+	outLayer    = gl_InstanceIndex;
+}
\ No newline at end of file
@@ -29,7 +29,7 @@ layout(push_constant)
 uniform CB
 {
 	layout(offset = 0)  mat4 MVP;
-	layout(offset = 64) mat4 MV;
+	layout(offset = 64) mat4 M;	// Model to world, undoes the quantization of vertex positions
 } cb;
 
 ////////////////////////////////////////
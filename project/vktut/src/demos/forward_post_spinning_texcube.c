@@ -43,6 +43,12 @@ int32_t app_destroy_renderpass ( app_t* app );
 int32_t app_init_static_resources ( app_t* app );
 int32_t app_destroy_static_resources ( app_t* app );
 
+int32_t app_init_model_bounds ( app_t* app );
+int32_t app_destroy_model_bounds ( app_t* app );
+
+int32_t app_init_model_draws ( app_t* app );
+int32_t app_destroy_model_draws ( app_t* app );
+
 int32_t app_init_graphics_pipeline_prerequisites ( app_t* app );
 int32_t app_destroy_graphics_pipeline_prerequisites ( app_t* app );
 
@@ -62,6 +68,38 @@ int32_t app_destroy_render_attachments ( app_t* app );
 #define MAX_LIGHTS                  16
 #define SHADOW_MAP_WIDTH            1024
 #define SHADOW_MAP_HEIGHT           1024
+#define PIPELINE_CACHE_FILE         "pipeline_cache.bin"
+
+// The levels of detail of objects are picked so their error stays below this many pixels on
+// screen. Shadow casters are only ever seen through the shadows they cast, so they get away with
+// quite a bit more.
+#define LOD_PIXEL_ERROR             1.0f
+#define LOD_PIXEL_ERROR_SHADOW      4.0f
+
+// The shadow maps of all lights are layers of the same image. With SHADOW_LAYERED, they are all
+// rendered in a single pass: every object is drawn once, with an instance per light, and a
+// geometry shader sends every instance to the layer of its light. Devices without geometry
+// shaders render the shadow maps one pass at a time regardless.
+#define SHADOW_LAYERED              1
+
+// Shadow maps are only rendered again when their light, or the objects casting shadows in them,
+// changed. Of the ones that did, at most this many are rendered each frame, the others keep their
+// old shadow map (and light) for a while. See app_schedule_shadow_maps.
+// All lights of the demo move every frame, so anything less than all of them has every light and
+// its shadow visibly lag behind, and leaves receivers coming into view without their shadows for
+// a frame or so. Lower it for scenes with many lights that mostly stay put.
+#define SHADOW_UPDATE_BUDGET        LIGHT_COUNT
+
+// Lights are considered to reach as far as their attenuation keeps them above this intensity
+#define LIGHT_CUTOFF                (1.0f/256.0f)
+
+// Rather than culling the objects on the CPU and drawing the ones in view one by one, the GPU can
+// cull them itself: a compute shader writes the draws of the objects in view into a buffer, which
+// is drawn from with indirect draws. The CPU then records the same handful of draws for every
+// view, however many objects there are. The GPU culls clusters and shadow casters just like the
+// CPU does, see app_render_cull_draws. On devices that can't do more than a single indirect draw
+// at once, the objects are culled on the CPU regardless.
+#define GPU_DRIVEN                  1
 
 typedef struct light_s
 {
@@ -104,12 +142,19 @@ light_t LIGHTS[] = {
 };
 #define LIGHT_COUNT STATIC_ARRAY_LENGTH(LIGHTS)
 
+// Every frame, the objects are culled against all views at once: the camera, followed by the
+// shadow map of every light.
+#define VIEW_CAMERA   0
+#define VIEW_LIGHT(i) (1+(i))
+#define VIEW_COUNT    (1+LIGHT_COUNT)
+
 ////////////////////////////////////////
 // Enumerations
 
 enum
 {
 	QUEUE_MAIN,
+	QUEUE_TRANSFER,
 
 	QUEUE_COUNT,
 };
@@ -155,6 +200,78 @@ enum
 	VERTEX_ATTRIBUTE_COUNT,
 };
 
+// The vertex layouts of the BOBJ vertex formats. Quantized vertices are half the size, which
+// matters for the vertex fetch of both the shadow and the forward pass. The vertex shader undoes
+// the quantization of positions with the model matrix, and decodes the octahedral normals when
+// told so through a specialization constant.
+typedef struct vertex_layout_s
+{
+	uint32_t stride;
+	VkVertexInputAttributeDescription attributes[VERTEX_ATTRIBUTE_COUNT];
+	VkBool32 octahedralNormals;
+
+	// The separate position stream, which is all the shadow pass binds
+	uint32_t positionStride;
+	VkVertexInputAttributeDescription positionAttribute;
+} vertex_layout_t;
+
+static const vertex_layout_t VERTEX_LAYOUTS[] = {
+	[BOBJ_VERTEX_FORMAT_FLOAT] = {
+		.stride     = sizeof ( bobj_vert ),
+		.attributes = {
+			[VERTEX_ATTRIBUTE_POSITION] = {
+				.location = VERTEX_ATTRIBUTE_POSITION,
+				.format   = VK_FORMAT_R32G32B32_SFLOAT,
+				.offset   = offsetof(bobj_vert, position),
+			},
+			[VERTEX_ATTRIBUTE_TEXCOORD] = {
+				.location = VERTEX_ATTRIBUTE_TEXCOORD,
+				.format   = VK_FORMAT_R32G32_SFLOAT,
+				.offset   = offsetof(bobj_vert, texcoord),
+			},
+			[VERTEX_ATTRIBUTE_NORMAL] = {
+				.location = VERTEX_ATTRIBUTE_NORMAL,
+				.format   = VK_FORMAT_R32G32B32_SFLOAT,
+				.offset   = offsetof(bobj_vert, normal),
+			},
+		},
+		.octahedralNormals = VK_FALSE,
+		.positionStride    = sizeof ( bobj_position ),
+		.positionAttribute = {
+			.location = VERTEX_ATTRIBUTE_POSITION,
+			.format   = VK_FORMAT_R32G32B32_SFLOAT,
+			.offset   = offsetof(bobj_position, position),
+		},
+	},
+	[BOBJ_VERTEX_FORMAT_QUANTIZED] = {
+		.stride     = sizeof ( bobj_vert_quantized ),
+		.attributes = {
+			[VERTEX_ATTRIBUTE_POSITION] = {
+				.location = VERTEX_ATTRIBUTE_POSITION,
+				.format   = VK_FORMAT_R16G16B16A16_SNORM,
+				.offset   = offsetof(bobj_vert_quantized, position),
+			},
+			[VERTEX_ATTRIBUTE_TEXCOORD] = {
+				.location = VERTEX_ATTRIBUTE_TEXCOORD,
+				.format   = VK_FORMAT_R16G16_SFLOAT,
+				.offset   = offsetof(bobj_vert_quantized, texcoord),
+			},
+			[VERTEX_ATTRIBUTE_NORMAL] = {
+				.location = VERTEX_ATTRIBUTE_NORMAL,
+				.format   = VK_FORMAT_R16G16_SNORM,
+				.offset   = offsetof(bobj_vert_quantized, normal),
+			},
+		},
+		.octahedralNormals = VK_TRUE,
+		.positionStride    = sizeof ( bobj_position_quantized ),
+		.positionAttribute = {
+			.location = VERTEX_ATTRIBUTE_POSITION,
+			.format   = VK_FORMAT_R16G16B16A16_SNORM,
+			.offset   = offsetof(bobj_position_quantized, position),
+		},
+	},
+};
+
 enum
 {
 	STATIC_TEXTURE_DIFFUSE_DEFAULT,
@@ -176,6 +293,8 @@ enum
 	MARKER_CPU_RENDER_FENCE_WAIT,
 	MARKER_CPU_RENDER_IMAGE_ACQUIRE,
 	MARKER_CPU_RENDER_CB_INIT,
+	MARKER_CPU_RENDER_RECORD,
+	MARKER_CPU_RENDER_RP_SHADOW,
 	MARKER_CPU_RENDER_RP_START,
 	MARKER_CPU_RENDER_RP_FWD,
 	MARKER_CPU_RENDER_RP_POST,
@@ -189,6 +308,8 @@ static const char* MarkerCPUNames[MARKER_CPU_COUNT] = {
 	[MARKER_CPU_RENDER_FENCE_WAIT   ] = "Waiting for fence",
 	[MARKER_CPU_RENDER_IMAGE_ACQUIRE] = "Image acquire",
 	[MARKER_CPU_RENDER_CB_INIT      ] = "Command buffer init",
+	[MARKER_CPU_RENDER_RECORD       ] = "Secondary command buffers",
+	[MARKER_CPU_RENDER_RP_SHADOW    ] = "Renderpass shadow",
 	[MARKER_CPU_RENDER_RP_START     ] = "Renderpass start",
 	[MARKER_CPU_RENDER_RP_FWD       ] = "Renderpass forward",
 	[MARKER_CPU_RENDER_RP_POST      ] = "Renderpass post",
@@ -198,6 +319,8 @@ static const char* MarkerCPUNames[MARKER_CPU_COUNT] = {
 
 enum
 {
+	MARKER_GPU_CULL,
+	MARKER_GPU_SHADOW,
 	MARKER_GPU_FORWARD,
 	MARKER_GPU_POST,
 
@@ -205,6 +328,8 @@ enum
 };
 
 static const char* MarkerGPUNames[MARKER_GPU_COUNT] = {
+	[MARKER_GPU_CULL   ] = "Culling",
+	[MARKER_GPU_SHADOW ] = "Shadow renderpasses",
 	[MARKER_GPU_FORWARD] = "Forward subpass",
 	[MARKER_GPU_POST   ] = "Post subpass",
 };
@@ -218,6 +343,13 @@ typedef struct render_cmd_buffer_s
 	VkFence         fenceComplete;
 	VkSemaphore     semaphoreBackbufferWritable;
 	VkSemaphore     semaphoreComplete;
+
+	// The views are recorded into secondary command buffers by the worker threads. Command pools
+	// can only be used by one thread at a time, so every thread has a pool of its own, with a
+	// secondary command buffer for every view: any thread can end up recording any view. Those of
+	// thread t are threadCommandBuffers[t*VIEW_COUNT] onwards.
+	VkCommandPool*   threadCommandPools;
+	VkCommandBuffer* threadCommandBuffers;
 } render_cmd_buffer_t;
 
 typedef struct forward_fs_cb_s
@@ -239,6 +371,64 @@ typedef struct forward_fs_cb_s
 	} lights[MAX_LIGHTS];
 } forward_vs_cb_t;
 
+// Culling on the GPU, see GPU_DRIVEN. The objects of a model are culled in groups of objects
+// sharing their index type and texture: a group is drawn with the same index buffer and descriptor
+// set bound, from a consecutive range of the draws the compute shader writes for every view. Every
+// object has room for a draw per cluster in there, for when its clusters are culled.
+
+typedef struct draw_group_s
+{
+	VkIndexType indexType;
+	uint32_t    textureIndex;
+	uint32_t    drawStart, drawCount;	// The range of draws of the group
+} draw_group_t;
+
+typedef struct cull_object_s
+{
+	// !!! WARNING !!!
+	// Laid out with the "std430" alignment rules in mind, see cull_c.glsl
+	float    aabbMin[3]; uint32_t lodCount;
+	float    aabbMax[3]; int32_t  vertexOffset;
+	uint32_t group, groupStart, drawStart, drawCount;
+	uint32_t clusterStart, clusterCount, _dummy[2];
+	struct
+	{
+		uint32_t indexStart, indexCount;
+		float    error;
+		uint32_t _dummy;
+	} lods[VKUTIL_MAX_LODS];
+} cull_object_t;
+
+typedef struct cull_cluster_s
+{
+	// !!! WARNING !!!
+	// Laid out with the "std430" alignment rules in mind, see cull_c.glsl
+	float aabbMin[3];  uint32_t indexStart;
+	float aabbMax[3];  uint32_t indexCount;
+	float center[3];   float    radius;
+	float coneAxis[3]; float    coneCutoff;
+} cull_cluster_t;
+
+typedef struct cull_cb_s
+{
+	// !!! WARNING !!!
+	// Laid out with the "std140" alignment rules in mind, like forward_vs_cb_t
+	struct
+	{
+		rvm_aos_mat4 vp;
+		rvm_aos_vec4 planes[6];
+		rvm_aos_vec3 position;		float lodScale;
+		uint32_t firstInstance, enabled, backfaceCulling, casterCulling;
+	} views[MAX_LIGHTS+1];
+} cull_cb_t;
+
+// The bounds of the shadow receivers of every view, gathered by the GPU, see cull_c.glsl
+typedef struct cull_receivers_s
+{
+	uint32_t min[MAX_LIGHTS+1][2];
+	uint32_t max[MAX_LIGHTS+1][3];
+} cull_receivers_t;
+
 struct app_s
 {
 	// Standard vkbase objects
@@ -248,6 +438,15 @@ struct app_s
 	queue_t     queues[QUEUE_COUNT];
 	swapchain_t swapchain;
 
+	// All device memory of the demo comes from here
+	vkutil_allocator_t allocator;
+
+	// Resources are uploaded through here, see vkutil_uploader_init
+	vkutil_uploader_t uploader;
+
+	// Threads to record command buffers with
+	worker_pool_t workers;
+
 	// Command buffer resources for rendering
 	VkCommandPool       commandPool;
 	VkCommandBuffer     commandBufferStaging;
@@ -268,13 +467,35 @@ struct app_s
 		VkRenderPass renderPass;
 		VkFramebuffer framebuffers[LIGHT_COUNT];
 		VkPipeline pipeline;
+
+		// Only when rendering all shadow maps in a single pass, see SHADOW_LAYERED. As that pass
+		// only renders some of the shadow maps, it keeps the contents of the others.
+		VkBool32 layered;
+		VkRenderPass renderPassKeep;
+		VkFramebuffer framebufferLayered;
+		VkPipeline pipelineLayered;
 	} shadowRenderpass;
 
+	// What every shadow map was last rendered with, see app_schedule_shadow_maps
+	struct
+	{
+		VkBool32     valid;
+		rvm_aos_mat4 v, p;
+		uint32_t     framesStale;	// Frames the shadow map has been out of date for
+		uint32_t     modelMask;		// The models it was rendered with, when culling on the GPU
+		rvm_aos_mat4 cameraVp;		// And the view of the camera its receivers were culled for
+	} shadowMaps[LIGHT_COUNT];
+
+	// Whether the objects are culled on the GPU, see GPU_DRIVEN
+	VkBool32 gpuDriven;
+
 	// Static resources
 	struct
 	{
 		//
 		VkBuffer lightBuffer;
+		VkBuffer cullBuffer;		// Only when culling on the GPU
+		VkBuffer receiverBuffer;	// Likewise
 
 		// Samplers
 		VkSampler samplerAnisotropic;
@@ -291,7 +512,10 @@ struct app_s
 		VkImageView imageViewShadowDepthAttachment[LIGHT_COUNT];
 
 		// Memory
-		VkDeviceMemory imageMemory, lightBufferMemory;
+		vkutil_allocation_t imageAllocations[STATIC_TEXTURE_COUNT];
+		vkutil_allocation_t lightBufferAllocation;
+		vkutil_allocation_t cullBufferAllocation;
+		vkutil_allocation_t receiverBufferAllocation;
 	} staticResources;
 
 	struct
@@ -302,24 +526,84 @@ struct app_s
 		VkImageView imageViewIntermediateColor;
 		VkImageView imageViewIntermediateDepth;
 
-		VkDeviceMemory memory;
+		vkutil_allocation_t allocations[TRANSIENT_ATTACHMENT_COUNT];
 	} attachments;
 
 	// Descriptor management
 	VkDescriptorPool      descriptorPool;
 	VkDescriptorSetLayout descriptorSetLayout[PIPELINE_COUNT];
 	VkDescriptorSet       descriptorSet      [PIPELINE_COUNT];
+	VkDescriptorSetLayout descriptorSetLayoutShadowLayered;
+	VkDescriptorSet       descriptorSetShadowLayered;
+	VkDescriptorSetLayout descriptorSetLayoutCull;
 
 	// Pipeline management
 	VkPipelineCache pipelineCache;
 	VkPipelineLayout pipelineLayout[PIPELINE_COUNT];
 	VkPipelineLayout pipelineLayoutShadow;
+	VkPipelineLayout pipelineLayoutShadowLayered;
+	VkPipelineLayout pipelineLayoutCull;
+	VkPipeline       pipelineCull;
 	
 	// Model(s)
 	vkutil_model_t model[MODEL_COUNT];
+	uint64_t       modelUploadTicket[MODEL_COUNT];
 	VkDescriptorSet* modelDescriptorSets;
+
+	// The bounding boxes of the objects of every model, as separate arrays of centers and extents so
+	// they can be culled a couple at a time. The results are a bit per object for every view, in
+	// wordCount words per view. casterBits holds the objects every shadow map was last rendered
+	// with, in wordCount words per light.
+	struct
+	{
+		void* memory;
+		rvm_soa_vec3 centers, extents;
+		uint32_t wordCount;
+		uint32_t* visibleBits;
+		uint32_t* insideBits;
+		uint32_t* casterBits;
+	} modelBounds[MODEL_COUNT];
+
+	// What the GPU culls the objects of every model with, see app_init_model_draws: the objects
+	// themselves and their clusters, and the draws, and their amounts, it writes for every view.
+	struct
+	{
+		VkBuffer objectBuffer, clusterBuffer, drawBuffer, countBuffer;
+		vkutil_allocation_t objectAllocation, clusterAllocation, drawAllocation, countAllocation;
+		VkDescriptorSet descriptorSet;
+		draw_group_t* groups;
+		uint32_t groupCount;
+		uint32_t drawCount;	// In every view
+	} modelDraws[MODEL_COUNT];
+
+	// Shadow caster culling statistics per light, summed over the shadow maps rendered since they
+	// were last written to the profile log: the objects in the frustum of the light, and the ones
+	// of those casting shadows on anything in view. See app_cull_shadow_casters.
+	struct
+	{
+		uint64_t inFrustum[LIGHT_COUNT];
+		uint64_t casters[LIGHT_COUNT];
+		uint32_t renders[LIGHT_COUNT];
+		uint32_t frameCount;
+	} shadowCasterStats;
+
+	// Time in seconds the scene has been animated for, advanced by the dt of every frame
+	// rendered. See app_render.
+	double time;
+
+	// Profiling
+	profiler_t profilerCpu;
+	profiler_t profilerGpu;
+	log_file_t profilerLog;
 };
 
+// Culling on the GPU, every object gets a draw for every one of its clusters: at full detail,
+// that's how many it takes at most when only some of them are in view.
+static uint32_t app_util_object_draw_count ( const vkutil_object_t* obj )
+{
+	return obj->clusterCount > 0 ? obj->clusterCount : 1;
+}
+
 ////////////////////////////////////////
 // Callback functions from the platform layer
 
@@ -342,23 +626,59 @@ int32_t app_init ( app_t** outApp, void* userdata )
 	if ( ret != 0 )
 		return ret;
 
-	// We create a single device with a single queue, where we are only interested in graphics
-	// and transfer functionality
+	// We create a single device with two queues: one for graphics (and presenting), and one for
+	// uploading resources. For the latter, we would really like a queue from a family that can do
+	// nothing but transfers, as these usually map to the DMA engines of the GPU, which can copy
+	// data while the rest of the GPU keeps rendering. Devices without such a family simply get
+	// the main queue for both.
 
 	ret = vkbase_init_device (
 		&app->device, &app->instance,
 		1, (window_t*[1]) { &app->window },
-		QUEUE_COUNT, (queue_create_info_t[1]){
+		QUEUE_COUNT, (queue_create_info_t[QUEUE_COUNT]){
 			[QUEUE_MAIN] = {
 				.queueFlags            = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_TRANSFER_BIT,
 				.presentWindowCount    = 1,
 				.presentWindowIndices  = (uint32_t[1]) { 0 },
 			},
+			[QUEUE_TRANSFER] = {
+				.queueFlags            = VK_QUEUE_TRANSFER_BIT,
+				.avoidFlags            = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT,
+			},
 		}, app->queues
 	);
 	if ( ret != 0 )
 		return ret;
 
+	// Rendering all shadow maps in a single pass takes a geometry shader, which not every device
+	// supports; mobile devices in particular tend to lack them. vkbase_init_device enabled them if
+	// they are there, otherwise the shadow maps are rendered one by one.
+
+	app->shadowRenderpass.layered = SHADOW_LAYERED && app->device.features.geometryShader;
+
+	// Rather than allocating device memory for every resource separately, we use an allocator that
+	// hands out parts of larger blocks of memory. See vkutil_allocator_alloc for the details.
+
+	ret = vkutil_allocator_init (
+		&app->allocator, app->device.device, &app->device.memoryProperties, VKUTIL_ALLOCATOR_BLOCK_SIZE
+	);
+	if ( ret != 0 )
+		return ret;
+
+	// Uploads are recorded on the transfer queue and finished on the main queue, without ever
+	// waiting for them to complete. All of them go through the same fixed size staging buffer,
+	// which is reused over and over. See vkutil_uploader_init for the details.
+
+	ret = vkutil_uploader_init (
+		&app->uploader, &app->allocator,
+		app->queues[QUEUE_TRANSFER].queue, app->queues[QUEUE_TRANSFER].familyIndex,
+		app->queues[QUEUE_TRANSFER].minImageTransferGranularity,
+		app->queues[QUEUE_MAIN].queue, app->queues[QUEUE_MAIN].familyIndex,
+		VKUTIL_UPLOADER_STAGING_SIZE
+	);
+	if ( ret != 0 )
+		return platform_throw_error ( ret, "vkutil_uploader_init failed (%d)", ret );
+
 	// The swapchain - responsible for the communication between the device and the window - is then
 	// created.
 
@@ -368,12 +688,49 @@ int32_t app_init ( app_t** outApp, void* userdata )
 	if ( ret != 0 )
 		return ret;
 
+	// Recording command buffers can take a good while with a lot of objects and lights, and can be
+	// spread over multiple threads just fine, as long as every thread records into its own command
+	// buffers allocated from its own command pools. We start a thread per CPU core for it.
+
+	ret = platform_worker_pool_create ( &app->workers, 0 );
+	if ( ret != 0 )
+		return ret;
+
 	// We now create the objects required for passing commands onto the driver/GPU.
 
 	ret = app_init_command_infrastructure ( app );
 	if ( ret != 0 )
 		return ret;
 
+	// To see where the time goes, every frame is divided up into markers, both on the CPU and on the
+	// GPU. The GPU profiler needs a query pool for each command buffer we may have in flight, as we
+	// can only read a pool back once the GPU is done with the frame it was used in.
+
+	ret = vkbase_profiler_init_cpu ( &app->profilerCpu, MARKER_CPU_COUNT, MarkerCPUNames );
+	if ( ret != 0 )
+		return ret;
+
+	ret = vkbase_profiler_init_gpu (
+		&app->profilerGpu, &app->device, &app->queues[QUEUE_MAIN], RENDER_COMMAND_BUFFER_COUNT,
+		MARKER_GPU_COUNT, MarkerGPUNames
+	);
+	if ( ret != 0 )
+		return ret;
+
+	// Both profilers keep rolling averages, which we stream to a log file every second or so. Not
+	// being able to write the log is no reason not to run the demo, so we merely warn about it.
+
+	if ( platform_log_file_create ( &app->profilerLog, "profile.log" ) == 0 )
+	{
+		vkbase_profiler_set_log_file ( &app->profilerCpu, &app->profilerLog, "CPU", 60 );
+		vkbase_profiler_set_log_file ( &app->profilerGpu, &app->profilerLog, "GPU", 60 );
+	}
+	else
+	{
+		app->profilerLog.platform = NULL;
+		platform_log_warning ( "Could not create profile.log, profiler results will not be logged\n" );
+	}
+
 	// Images created by the swapchain need to be transitioned to the proper layout before use.
 	// I have got to be honest and say I do not understand why the images are not implicitly
 	// transferred to _PRESENT layout at creation, as they are supposed to be in this layout
@@ -385,24 +742,58 @@ int32_t app_init ( app_t** outApp, void* userdata )
 
 	// This is just a simple process to load a binary object file into objects.
 	// vkutil_load_bobj contains the functionality required to create the model object we will use
-	// in the application. The platform_file_load is fundamentally pretty uninteresting.
+	// in the application. Rather than reading the whole file into a heap allocation first, we map
+	// it: vkutil_load_bobj reads the vertex, index and texel data straight from the mapping into
+	// staging memory, so the file contents are only ever copied once on their way to the GPU.
+	// It does not wait for the upload to complete: app_render skips the model until it has.
 
-	file_t bobjFile;
-	ret = platform_file_load ( &bobjFile, "models/sponza.bobj" );
+	file_mapping_t bobjFile;
+	ret = platform_file_map ( &bobjFile, "models/sponza.bobj" );
 	if ( ret != 0 )
 		return ret;
 
 	ret = vkutil_load_bobj (
-		&app->model[MODEL_TEXCUBE], app->device.device, bobjFile.data, bobjFile.sizeInBytes,
-		&app->device.memoryProperties, app->queues[QUEUE_MAIN].queue, app->commandBufferStaging
+		&app->model[MODEL_TEXCUBE], app->device.physical, &app->uploader,
+		bobjFile.data, bobjFile.sizeInBytes,
+		&app->modelUploadTicket[MODEL_TEXCUBE]
 	);
+	if ( ret != 0 )
+	{
+		platform_file_unmap ( &bobjFile );
+		return ret;
+	}
+
+	ret = platform_file_unmap ( &bobjFile );
 	if ( ret != 0 )
 		return ret;
 
-	ret = platform_file_close ( &bobjFile );
+	ret = app_init_model_bounds ( app );
 	if ( ret != 0 )
 		return ret;
 
+	// Culling on the GPU draws the objects of a group with a single indirect draw, which takes
+	// multiDrawIndirect. Rendering all shadow maps in a single pass passes the layer through the
+	// first instance of the draw as well, for which drawIndirectFirstInstance is needed. The
+	// draws of a model, one for every cluster, can't be more than a single draw can draw either.
+
+	app->gpuDriven = GPU_DRIVEN && app->device.features.multiDrawIndirect
+		&& ( app->device.features.drawIndirectFirstInstance || !app->shadowRenderpass.layered );
+	for ( uint32_t i = 0; i < MODEL_COUNT; i++ )
+	{
+		uint64_t drawCount = 0;
+		for ( uint32_t j = 0; j < app->model[i].objectCount; j++ )
+			drawCount += app_util_object_draw_count ( &app->model[i].objects[j] );
+		if ( drawCount > app->device.properties.limits.maxDrawIndirectCount )
+			app->gpuDriven = VK_FALSE;
+	}
+
+	if ( app->gpuDriven )
+	{
+		ret = app_init_model_draws ( app );
+		if ( ret != 0 )
+			return ret;
+	}
+
 	// We now ask the platform what size window we have. While it would be nice to specify the size
 	// manually in the application code, that is clearly not really how platforms like Android
 	// function
@@ -471,12 +862,14 @@ int32_t app_free ( app_t* app )
 
 	for ( uint32_t i = 0; i < QUEUE_COUNT; i++ )
 		vkQueueWaitIdle ( app->queues[i].queue );
+	vkutil_uploader_destroy ( &app->uploader );
 
 	// Destroy functions. I'm not going to comment these one-by-one, two-by-two, or any-by-any.
 	// Just know if you have the debug layers enabled, and you destroy any Vulkan resources
 	// out-of-order or not at all, you usually get an error for it. It's pretty useful.
 
 	app_destroy_command_infrastructure ( app );
+	platform_worker_pool_destroy ( &app->workers );
 	app_destroy_descriptor_sets ( app );
 	app_destroy_renderpass ( app );
 	
@@ -486,7 +879,15 @@ int32_t app_free ( app_t* app )
 	app_destroy_graphics_pipeline_prerequisites ( app );
 	app_destroy_renderpass_framebuffers ( app );
 
-	vkutil_destroy_bobj ( &app->model[MODEL_TEXCUBE], app->device.device );
+	app_destroy_model_bounds ( app );
+	app_destroy_model_draws ( app );
+	vkutil_destroy_bobj ( &app->model[MODEL_TEXCUBE], &app->allocator );
+	vkbase_profiler_destroy ( &app->profilerCpu, &app->device );
+	vkbase_profiler_destroy ( &app->profilerGpu, &app->device );
+	if ( app->profilerLog.platform != NULL )
+		platform_log_file_close ( &app->profilerLog );
+	
+	vkutil_allocator_destroy ( &app->allocator );
 	
 	vkbase_destroy_swapchain ( &app->device, &app->swapchain );
 	vkbase_destroy_device ( &app->device );
@@ -576,22 +977,26 @@ int32_t app_resize ( app_t* app, uint32_t windowWidth, uint32_t windowHeight )
 	return 0;
 }
 
-// This is just a very simple frustum culling method, determining whether or not objects
+// This is just a very simple frustum culling method, determining whether or not clusters
 // can potentially be in view, or are _DEFINITELY OUT OF VIEW_. It is definitely not optimal, but
-// at least it reduces some of the GPU load on mobile.
+// at least it reduces some of the GPU load on mobile. Whole objects are culled for all views at once
+// with rvm_soa_aabb_frustum_cull instead.
+// Returns 0 for boxes out of view, 2 for boxes entirely in view and 1 for anything in between.
 
-static int32_t app_util_object_visibility_check ( vkutil_object_t* obj, rvm_aos_mat4* mvp )
+static int32_t app_util_aabb_visibility_check (
+	const float aabbMin[3], const float aabbMax[3], rvm_aos_mat4* mvp
+)
 {
 	rvm_aos_vec4 corners[8] = {
-		{ obj->aabbMin[0], obj->aabbMin[1], obj->aabbMin[2], 1.0f },
-		{ obj->aabbMax[0], obj->aabbMin[1], obj->aabbMin[2], 1.0f },
-		{ obj->aabbMin[0], obj->aabbMax[1], obj->aabbMin[2], 1.0f },
-		{ obj->aabbMax[0], obj->aabbMax[1], obj->aabbMin[2], 1.0f },
-
-		{ obj->aabbMax[0], obj->aabbMin[1], obj->aabbMax[2], 1.0f },
-		{ obj->aabbMin[0], obj->aabbMin[1], obj->aabbMax[2], 1.0f },
-		{ obj->aabbMax[0], obj->aabbMax[1], obj->aabbMax[2], 1.0f },
-		{ obj->aabbMin[0], obj->aabbMax[1], obj->aabbMax[2], 1.0f },
+		{ aabbMin[0], aabbMin[1], aabbMin[2], 1.0f },
+		{ aabbMax[0], aabbMin[1], aabbMin[2], 1.0f },
+		{ aabbMin[0], aabbMax[1], aabbMin[2], 1.0f },
+		{ aabbMax[0], aabbMax[1], aabbMin[2], 1.0f },
+
+		{ aabbMax[0], aabbMin[1], aabbMax[2], 1.0f },
+		{ aabbMin[0], aabbMin[1], aabbMax[2], 1.0f },
+		{ aabbMax[0], aabbMax[1], aabbMax[2], 1.0f },
+		{ aabbMin[0], aabbMax[1], aabbMax[2], 1.0f },
 	};
 
 	for ( uint32_t i = 0; i < 8; i++ )
@@ -636,10 +1041,28 @@ static int32_t app_util_object_visibility_check ( vkutil_object_t* obj, rvm_aos_
 	if ( outcodeAND )
 		return 0;	// All corners out on at least one of the sides
 
+	if ( outcodeOR == 0 && cornerValidBits == 0xFF )
+		return 2;	// All corners in
+
 	// Potentially visible
 	return 1;
 }
 
+// Clusters with all their triangles facing away from the camera can be skipped altogether, when
+// back faces are culled anyway. See bobj_cluster for where the test comes from.
+
+static int32_t app_util_cluster_backfacing_check ( vkutil_cluster_t* cluster, const float cameraPosition[3] )
+{
+	float d[3] = {
+		cluster->center[0] - cameraPosition[0],
+		cluster->center[1] - cameraPosition[1],
+		cluster->center[2] - cameraPosition[2],
+	};
+	float length = sqrtf ( d[0]*d[0] + d[1]*d[1] + d[2]*d[2] );
+	float dot    = d[0]*cluster->coneAxis[0] + d[1]*cluster->coneAxis[1] + d[2]*cluster->coneAxis[2];
+	return dot >= cluster->coneCutoff * length + cluster->radius;
+}
+
 static void app_util_create_rotating_vp (
 	float T, float rotX, float rotY, float rotZ, float rotXSpeed, float rotYSpeed, float rotZSpeed,
 	float posX, float posY, float posZ,
@@ -699,15 +1122,131 @@ static void app_util_create_orbiting_vp (
 	*outP = p;
 }
 
+// Estimates the share of the screen a light reaches, from 0 to 1, to decide which shadow maps
+// matter most. The light reaches as far as its attenuation keeps it above LIGHT_CUTOFF, which is
+// projected onto the screen as a sphere: the further away the light, the smaller it gets. Lights
+// reaching nothing in view of the camera at all cover nothing. cameraPlanes are the frustum
+// planes of the camera, pixelsPerUnit the pixels something of size 1 at distance 1 covers.
+
+static float app_util_light_screen_coverage (
+	const light_t* light, const rvm_aos_vec4 cameraPlanes[6], const float cameraPosition[3],
+	float pixelsPerUnit, float viewportArea
+)
+{
+	// Solve c + l*d + q*d^2 = 1/LIGHT_CUTOFF for the distance d the light reaches
+	float c = light->attenuation.x - 1.0f / LIGHT_CUTOFF;
+	float l = light->attenuation.y, q = light->attenuation.z;
+	float range = INFINITY;
+	if ( q > 0.0f )
+		range = ( -l + sqrtf ( l*l - 4.0f*q*c ) ) / ( 2.0f*q );
+	else if ( l > 0.0f )
+		range = -c / l;
+
+	// The planes aren't normalized, so the distances to them are scaled by the length of their
+	// normals
+	for ( uint32_t i = 0; i < 6; i++ )
+	{
+		const rvm_aos_vec4* plane = &cameraPlanes[i];
+		float d = plane->x*light->pos.x + plane->y*light->pos.y + plane->z*light->pos.z + plane->w;
+		if ( d < -range * sqrtf ( plane->x*plane->x + plane->y*plane->y + plane->z*plane->z ) )
+			return 0.0f;
+	}
+
+	float d[3] = {
+		light->pos.x - cameraPosition[0],
+		light->pos.y - cameraPosition[1],
+		light->pos.z - cameraPosition[2],
+	};
+	float distance = sqrtf ( d[0]*d[0] + d[1]*d[1] + d[2]*d[2] );
+	if ( distance <= range )
+		return 1.0f;
+
+	float radius = range * pixelsPerUnit / distance;
+	return fminf ( RVM_PI * radius * radius / viewportArea, 1.0f );
+}
+
+// Draws a range of indices once for every view in viewMask, as instances: the shaders take the
+// instance index as the view, and the layer, to render into. Views the range isn't drawn for can't
+// simply be skipped over, so every run of consecutive views takes a draw of its own.
+
+static void app_render_draw_views (
+	VkCommandBuffer commandBuffer, uint32_t indexCount, uint32_t firstIndex, int32_t vertexOffset,
+	uint32_t viewMask
+)
+{
+	while ( viewMask != 0 )
+	{
+		uint32_t firstView = 0;
+		while ( ( viewMask & ( 1u << firstView ) ) == 0 )
+			firstView++;
+
+		uint32_t view = firstView;
+		while ( view < 32 && ( viewMask & ( 1u << view ) ) != 0 )
+			viewMask &= ~( 1u << view++ );
+
+		vkCmdDrawIndexed (
+			commandBuffer,
+			indexCount, view - firstView, firstIndex,
+			vertexOffset, firstView
+		);
+	}
+}
+
 // This is the main render function for rendering a model. As the function name alludes. Maybe.
+// Passes that only need the positions of the vertices, like the shadow pass, set positionsOnly to
+// bind the position stream of the model instead of the full vertices. Passes that cull back faces
+// set backfaceCulling, to skip clusters that face away from the camera entirely. Levels of detail
+// are picked for a viewport of viewportHeight pixels, allowing an error of lodPixelError pixels.
+// The objects were culled for the views already: visibleBits and insideBits are the results of
+// rvm_soa_aabb_frustum_cull for them, wordCount words per view.
+//
+// A model can be rendered for up to 32 views at once, when rendering into the layers of a layered
+// framebuffer: p and v hold viewCount views then, and every object is drawn with an instance per
+// view it is visible in, see app_render_draw_views. With a single view, this is just a single
+// instance.
 
 static void app_render_model (
-	vkutil_model_t* model, rvm_aos_mat4* p, rvm_aos_mat4* v, VkCommandBuffer commandBuffer,
-	VkPipelineLayout pipelineLayout, VkDescriptorSet* modelDescriptorSet,
-	VkDescriptorSet dummyDescriptorSet, uint32_t dynamicOffsetCount, uint32_t* dynamicOffsets
+	vkutil_model_t* model, uint32_t viewCount, const uint32_t* visibleBits,
+	const uint32_t* insideBits, uint32_t wordCount,
+	rvm_aos_mat4* p, rvm_aos_mat4* v, VkCommandBuffer commandBuffer,
+	VkPipelineLayout pipelineLayout, VkBool32 positionsOnly, VkBool32 backfaceCulling,
+	float viewportHeight, float lodPixelError,
+	VkDescriptorSet* modelDescriptorSet, VkDescriptorSet dummyDescriptorSet,
+	uint32_t dynamicOffsetCount, uint32_t* dynamicOffsets
 )
 {
-	rvm_aos_mat4 vp = rvm_aos_mat4_mul_aos_mat4 ( p, v );
+	rvm_aos_mat4* vp             = alloca ( viewCount * sizeof ( rvm_aos_mat4 ) );
+	float*        pixelsPerUnit  = alloca ( viewCount * sizeof ( float ) );
+	float       (*cameraPosition)[3] = alloca ( viewCount * sizeof ( float[3] ) );
+
+	for ( uint32_t i = 0; i < viewCount; i++ )
+	{
+		vp[i] = rvm_aos_mat4_mul_aos_mat4 ( &p[i], &v[i] );
+
+		// With a perspective projection, something of size s at distance d covers
+		// s * p[1][1] / d * viewportHeight / 2 pixels vertically
+		pixelsPerUnit[i] = fabsf ( p[i].rows[1][1] ) * viewportHeight * 0.5f;
+
+		// The camera sits at the origin of view space, so its world space position is the
+		// translation of the inverse of the view matrix
+		rvm_aos_mat4 invV = rvm_aos_mat4_inverse ( &v[i] );
+		cameraPosition[i][0] = invV.rows[3][0];
+		cameraPosition[i][1] = invV.rows[3][1];
+		cameraPosition[i][2] = invV.rows[3][2];
+	}
+
+	// The model matrix takes the vertex positions to world space. The models themselves are in
+	// world space already, but quantized vertices store their positions relative to the bounds of
+	// the model, which the model matrix undoes.
+
+	rvm_aos_mat4 t = rvm_aos_mat4_translate (
+		model->positionOffset[0], model->positionOffset[1], model->positionOffset[2]
+	);
+	rvm_aos_mat4 s = rvm_aos_mat4_scale (
+		model->positionScale[0], model->positionScale[1], model->positionScale[2]
+	);
+	rvm_aos_mat4 m   = rvm_aos_mat4_mul_aos_mat4 ( &t, &s );
+	rvm_aos_mat4 mvp = rvm_aos_mat4_mul_aos_mat4 ( &vp[0], &m );
 
 	vkCmdPushConstants (
 		commandBuffer,
@@ -715,7 +1254,7 @@ static void app_render_model (
 		VK_SHADER_STAGE_VERTEX_BIT,
 		0,
 		16 * sizeof ( float ),
-		vp.cells
+		mvp.cells
 	);
 
 	vkCmdPushConstants (
@@ -724,30 +1263,52 @@ static void app_render_model (
 		VK_SHADER_STAGE_VERTEX_BIT,
 		64,
 		16 * sizeof ( float ),
-		v->cells
+		m.cells
 	);
 
 	vkCmdBindVertexBuffers (
 		commandBuffer,
 		0, 1,
-		(VkBuffer[1]){ model->vertexBuffer },
+		(VkBuffer[1]){ positionsOnly ? model->positionBuffer : model->vertexBuffer },
 		(VkDeviceSize[1]){ 0 }
 	);
 
-	vkCmdBindIndexBuffer (
-		commandBuffer,
-		model->indexBuffer,
-		0,
-		VK_INDEX_TYPE_UINT32
-	);
+	// Objects can have either 16 or 32 bit indices, all in the same index buffer. The index buffer
+	// is bound again whenever the index type changes; the indices of every object start at a
+	// multiple of their size, so binding at offset 0 works for both.
+
+	VkIndexType boundIndexType = VK_INDEX_TYPE_MAX_ENUM;
 
 	for ( uint32_t j = 0; j < model->objectCount; j++ )
 	{
 		vkutil_object_t* obj = &model->objects[j];
 
-		if ( !app_util_object_visibility_check ( obj, &vp ) )
+		// Gather the views the object is in, and whether it is entirely inside all of them
+
+		uint32_t viewMask = 0;
+		VkBool32 objectInside = VK_TRUE;
+		for ( uint32_t i = 0; i < viewCount; i++ )
+		{
+			if ( ( visibleBits[i*wordCount + j/32] & ( 1u << (j&31) ) ) == 0 )
+				continue;
+			viewMask |= 1u << i;
+			if ( ( insideBits[i*wordCount + j/32] & ( 1u << (j&31) ) ) == 0 )
+				objectInside = VK_FALSE;
+		}
+		if ( viewMask == 0 )
 			continue;
 
+		if ( obj->indexType != boundIndexType )
+		{
+			vkCmdBindIndexBuffer (
+				commandBuffer,
+				model->indexBuffer,
+				0,
+				obj->indexType
+			);
+			boundIndexType = obj->indexType;
+		}
+
 		VkDescriptorSet descriptorSet;
 
 		if ( obj->textureIndex == 0xFFFFFFFF || modelDescriptorSet == NULL )
@@ -766,141 +1327,1130 @@ static void app_render_model (
 			);
 		}
 
-		vkCmdDrawIndexed (
-			commandBuffer,
-			obj->indexCount, 1, obj->indexStart,
-			0, 0
-		);
-	}
-}
-
-int32_t app_render ( app_t* app, double dt )
-{
-	platform_log_warning ( "dt: %8.02f, FPS: %8.02f\n", dt, 1.0 / dt );
-
-	VkResult result = VK_SUCCESS;
-
-	app->commandBufferRenderIndex = (app->commandBufferRenderIndex + 1) % RENDER_COMMAND_BUFFER_COUNT;
-	render_cmd_buffer_t* renderCommandBuffer =
-		&app->commandBufferRender[app->commandBufferRenderIndex];
+		// Pick the coarsest level of detail with an error that is small enough at the distance of
+		// the closest point of the object. At full detail the clusters are culled below, coarser
+		// levels are drawn in one go: they are typically far away, and small on screen. All views
+		// share the same draw, so the view needing the most detail decides.
 
-	// Before we do any actual rendering, we will need to wait for a fence in order to ensure we
-	// can do the operations we would like to do. Specifically, we would like to wait for the
-	// command list we submitted the previous frame before we attempt to put more data into
-	// the same command list. Doing so while the command list is still being executed is illegal,
-	// as allowing it to happen would effectively mean you could change GPU instructions while it
-	// is still executing its instructions.
+		uint32_t lod = obj->lodCount - 1;
+		for ( uint32_t i = 0; i < viewCount && lod > 0; i++ )
+		{
+			if ( ( viewMask & ( 1u << i ) ) == 0 )
+				continue;
 
-	result = vkWaitForFences (
-		app->device.device,
-		1,
-		(VkFence[1]){ renderCommandBuffer->fenceComplete },
-		VK_TRUE,
-		UINT64_MAX
-	);
-	if ( result != VK_SUCCESS )
-		return platform_throw_error ( -1, "vkWaitForFences failed (%u)", result );
+			float distanceSq = 0.0f;
+			for ( uint32_t k = 0; k < 3; k++ )
+			{
+				float d = fmaxf ( fmaxf ( obj->aabbMin[k] - cameraPosition[i][k], cameraPosition[i][k] - obj->aabbMax[k] ), 0.0f );
+				distanceSq += d * d;
+			}
+			float distance = sqrtf ( distanceSq );
 
-	// At a later stage we would need to wait for this fence again. In order to do so, we do need
-	// to reset the fence despite already having waited for that fence.
+			uint32_t viewLod = 0;
+			for ( uint32_t k = lod; k > 0 && viewLod == 0; k-- )
+			{
+				if ( obj->lods[k].error * pixelsPerUnit[i] <= lodPixelError * distance )
+					viewLod = k;
+			}
+			lod = viewLod;
+		}
 
-	result = vkResetFences (
-		app->device.device,
-		1,
-		(VkFence[1]){ renderCommandBuffer->fenceComplete }
-	);
-	if ( result != VK_SUCCESS )
-		return platform_throw_error ( -1, "vkResetFences failed (%u)", result );
+		if ( lod > 0 )
+		{
+			app_render_draw_views (
+				commandBuffer,
+				obj->lods[lod].indexCount, obj->lods[lod].indexStart,
+				(int32_t)obj->vertexOffset, viewMask
+			);
+			continue;
+		}
 
-	// Now we request an unused image from the swapchain, we will need this in order to know
-	// which target we are to be rendering to.
+		// An object can cover a large part of the scene, while only a small part of it is in view.
+		// Every cluster of the object is culled on its own, and the clusters that are left are
+		// drawn in as few draws as possible: clusters are consecutive ranges of indices, so runs of
+		// visible clusters make a single draw. The clusters of objects entirely in view don't need
+		// the frustum check. With multiple views, a cluster is drawn if any of them sees it.
 
-	result = vkAcquireNextImageKHR (
-		app->device.device,
-		app->swapchain.swapchain,
-		UINT64_MAX,
-		renderCommandBuffer->semaphoreBackbufferWritable,
-		VK_NULL_HANDLE,
-		&app->backbufferIndex
-	);
-	if ( result != VK_SUCCESS )
-		return platform_throw_error ( -1, "vkAcquireNextImageKHR failed (%u)", result );
+		uint32_t drawStart = 0, drawCount = 0;
+		for ( uint32_t k = 0; k < obj->clusterCount; k++ )
+		{
+			vkutil_cluster_t* cluster = &model->clusters[obj->clusterStart + k];
 
-	// It is always helpful to know the window width and height in the render function. So just
-	// query it at the top of the function for convenience. The aspect is also frequently used,
-	// so why not.
+			VkBool32 clusterVisible = VK_FALSE;
+			for ( uint32_t i = 0; i < viewCount && !clusterVisible; i++ )
+			{
+				if ( ( viewMask & ( 1u << i ) ) == 0 )
+					continue;
+				if ( !objectInside
+				  && !app_util_aabb_visibility_check ( cluster->aabbMin, cluster->aabbMax, &vp[i] ) )
+					continue;
+				if ( backfaceCulling && app_util_cluster_backfacing_check ( cluster, cameraPosition[i] ) )
+					continue;
+				clusterVisible = VK_TRUE;
+			}
+			if ( !clusterVisible )
+				continue;
 
-	uint32_t windowWidth, windowHeight;
-	platform_window_get_size ( &app->window, &windowWidth, &windowHeight );
-	float aspect = windowWidth / (float)windowHeight;
+			if ( drawCount > 0 && drawStart + drawCount == cluster->indexStart )
+			{
+				drawCount += cluster->indexCount;
+				continue;
+			}
 
-	// We would like to spin things on the screen, for this it is helpful to know the current time
-	// in seconds from... Some point in time. Not UNIX timestamp though, that would barely fit
-	// in a float, and thus wouldn't be precise enough for any 3D graphics unless we suddenly find
-	// ourselves in an alternate reality with super high-tech computers from the 1970s.
+			if ( drawCount > 0 )
+			{
+				app_render_draw_views (
+					commandBuffer,
+					drawCount, drawStart,
+					(int32_t)obj->vertexOffset, viewMask
+				);
+			}
+			drawStart = cluster->indexStart;
+			drawCount = cluster->indexCount;
+		}
 
-	// So yeah. That's what this is. The code, not the 1970s thing.
+		if ( drawCount > 0 )
+		{
+			app_render_draw_views (
+				commandBuffer,
+				drawCount, drawStart,
+				(int32_t)obj->vertexOffset, viewMask
+			);
+		}
+	}
+}
 
-	timestamp_t timestamp, freq;
-	platform_get_timestamp ( &timestamp );
-	platform_get_timestamp_freq ( &freq );
-	float T = (float)(timestamp / (double)freq);
+// The counterpart of app_render_model when culling on the GPU: rather than going through the
+// objects, it draws the draws app_render_cull_draws had the GPU write for the views in viewMask,
+// a group of objects at a time. viewMask holds up to 32 views from firstView onward, which are all
+// drawn in the same render pass: for all shadow maps in a single pass, every light wrote the layer
+// of its shadow map as the first instance of its draws. p and v are those of firstView.
+//
+// With VK_AMD_draw_indirect_count, the draws of the objects in view are packed together and
+// counted by the GPU, so only those are drawn. Without it, every draw of a group is drawn, but
+// those of objects and clusters out of view have no instances and cost next to nothing.
+
+static void app_render_model_indirect (
+	app_t* app, uint32_t modelIndex, uint32_t firstView, uint32_t viewMask,
+	rvm_aos_mat4* p, rvm_aos_mat4* v, VkCommandBuffer commandBuffer,
+	VkPipelineLayout pipelineLayout, VkBool32 positionsOnly,
+	VkDescriptorSet* modelDescriptorSet, VkDescriptorSet dummyDescriptorSet,
+	uint32_t dynamicOffsetCount, uint32_t* dynamicOffsets
+)
+{
+	vkutil_model_t* model = &app->model[modelIndex];
+	VkBuffer drawBuffer   = app->modelDraws[modelIndex].drawBuffer;
+	VkBuffer countBuffer  = app->modelDraws[modelIndex].countBuffer;
+	uint32_t groupCount   = app->modelDraws[modelIndex].groupCount;
+	uint32_t drawCount    = app->modelDraws[modelIndex].drawCount;
 
-	// Deduce the transformations geometry will need to go through to get to the proper location
-	// on the screen.
+	// The same transformations as app_render_model
 
-	rvm_aos_mat4 v, p;
-#if 0
-	app_util_create_rotating_vp (
-		T, 1.0f, 0.5f, 0.25f, 0.0f, 0.0f, 5.0f, aspect, 0.1f, 10.0f, &v, &p
+	rvm_aos_mat4 t = rvm_aos_mat4_translate (
+		model->positionOffset[0], model->positionOffset[1], model->positionOffset[2]
 	);
-#else
-	app_util_create_rotating_vp (
-		T, 0.0f, -RVM_PI/2, 0.0f, 0.0f, 0.0f, 0.0f, -250.0f, 100.0f, 0.0f, aspect, 10.0f, 2500.0f,
-		1.0f, &v, &p
+	rvm_aos_mat4 s = rvm_aos_mat4_scale (
+		model->positionScale[0], model->positionScale[1], model->positionScale[2]
 	);
-#endif
-
-	// The lights are to be rotated every frame, and thus we would like to map the memory and
-	// update the data inside.
+	rvm_aos_mat4 m   = rvm_aos_mat4_mul_aos_mat4 ( &t, &s );
+	rvm_aos_mat4 vp  = rvm_aos_mat4_mul_aos_mat4 ( p, v );
+	rvm_aos_mat4 mvp = rvm_aos_mat4_mul_aos_mat4 ( &vp, &m );
 
-	uint32_t lightBufferOffset = app->commandBufferRenderIndex * RVM_ALIGN_UP_POW2 (
-			sizeof ( forward_vs_cb_t ),
-			app->device.properties.limits.minUniformBufferOffsetAlignment
-		);
+	vkCmdPushConstants (
+		commandBuffer,
+		pipelineLayout,
+		VK_SHADER_STAGE_VERTEX_BIT,
+		0,
+		16 * sizeof ( float ),
+		mvp.cells
+	);
 
-	forward_vs_cb_t* lightData = NULL;
-	vkMapMemory (
-		app->device.device, app->staticResources.lightBufferMemory, lightBufferOffset,
-		sizeof ( forward_vs_cb_t ), 0, &lightData
+	vkCmdPushConstants (
+		commandBuffer,
+		pipelineLayout,
+		VK_SHADER_STAGE_VERTEX_BIT,
+		64,
+		16 * sizeof ( float ),
+		m.cells
 	);
 
-	lightData->lightCount     = LIGHT_COUNT;
+	vkCmdBindVertexBuffers (
+		commandBuffer,
+		0, 1,
+		(VkBuffer[1]){ positionsOnly ? model->positionBuffer : model->vertexBuffer },
+		(VkDeviceSize[1]){ 0 }
+	);
+
+	VkIndexType     boundIndexType     = VK_INDEX_TYPE_MAX_ENUM;
+	VkDescriptorSet boundDescriptorSet = VK_NULL_HANDLE;
+
+	for ( uint32_t j = 0; j < groupCount; j++ )
+	{
+		draw_group_t* group = &app->modelDraws[modelIndex].groups[j];
+
+		if ( group->indexType != boundIndexType )
+		{
+			vkCmdBindIndexBuffer ( commandBuffer, model->indexBuffer, 0, group->indexType );
+			boundIndexType = group->indexType;
+		}
+
+		VkDescriptorSet descriptorSet;
+
+		if ( group->textureIndex == 0xFFFFFFFF || modelDescriptorSet == NULL )
+			descriptorSet = dummyDescriptorSet;
+		else
+			descriptorSet = modelDescriptorSet[group->textureIndex];
+
+		if ( descriptorSet != boundDescriptorSet )
+		{
+			vkCmdBindDescriptorSets (
+				commandBuffer,
+				VK_PIPELINE_BIND_POINT_GRAPHICS,
+				pipelineLayout,
+				0, 1, (VkDescriptorSet[1]){ descriptorSet },
+				dynamicOffsetCount, dynamicOffsets
+			);
+			boundDescriptorSet = descriptorSet;
+		}
+
+		for ( uint32_t i = 0; i < 32; i++ )
+		{
+			if ( ( viewMask & ( 1u << i ) ) == 0 )
+				continue;
+
+			uint32_t view = firstView + i;
+			VkDeviceSize drawOffset =
+				( view * drawCount + group->drawStart ) * sizeof ( VkDrawIndexedIndirectCommand );
+
+			if ( app->device.drawIndirectCount )
+			{
+				app->device.cmdDrawIndexedIndirectCount (
+					commandBuffer,
+					drawBuffer, drawOffset,
+					countBuffer, ( view * groupCount + j ) * sizeof ( uint32_t ),
+					group->drawCount, sizeof ( VkDrawIndexedIndirectCommand )
+				);
+			}
+			else
+			{
+				vkCmdDrawIndexedIndirect (
+					commandBuffer,
+					drawBuffer, drawOffset,
+					group->drawCount, sizeof ( VkDrawIndexedIndirectCommand )
+				);
+			}
+		}
+	}
+}
+
+int32_t app_get_profilers ( app_t* app, profiler_t** outCpuProfiler, profiler_t** outGpuProfiler )
+{
+	*outCpuProfiler = &app->profilerCpu;
+	*outGpuProfiler = &app->profilerGpu;
+	return 0;
+}
+
+// Everything the worker threads need to record the views of a frame, see app_render_record_view
+
+typedef struct app_render_views_s
+{
+	app_t*               app;
+	render_cmd_buffer_t* renderCommandBuffer;
+	uint32_t             windowHeight;
+	uint32_t             lightBufferOffset;
+	uint32_t             shadowRefreshMask;	// The lights to render shadow maps for
+
+	rvm_aos_mat4         v[VIEW_COUNT], p[VIEW_COUNT];
+
+	// Filled in by the jobs: the secondary command buffer every view ended up in
+	VkCommandBuffer      commandBuffers[VIEW_COUNT];
+	VkResult             results[VIEW_COUNT];
+} app_render_views_t;
+
+// Records a single view into a secondary command buffer of the thread running it. Secondary
+// command buffers executed inside a render pass "continue" it: they are recorded knowing the
+// render pass, subpass and framebuffer they will be executed in, which they inherit the state of.
+// This job runs on any of the worker threads, so it only ever touches the command pool of its own
+// thread, and only reads everything else. When the shadow maps are rendered in a single pass, the
+// job of the first light records the shadow maps of all lights, and the others aren't run.
+
+static void app_render_record_view ( void* userdata, uint32_t view, uint32_t threadIndex )
+{
+	app_render_views_t*  views = userdata;
+	app_t*               app   = views->app;
+	render_cmd_buffer_t* renderCommandBuffer = views->renderCommandBuffer;
+	VkCommandBuffer      commandBuffer = renderCommandBuffer->threadCommandBuffers[threadIndex * VIEW_COUNT + view];
+
+	// Shadow maps that are kept aren't rendered at all, see app_schedule_shadow_maps. In a single
+	// pass, there's nothing to record if none of them is rendered.
+
+	if ( view != VIEW_CAMERA
+	  && ( views->shadowRefreshMask & ( app->shadowRenderpass.layered ? ~0u : 1u << ( view - VIEW_LIGHT(0) ) ) ) == 0 )
+	{
+		views->commandBuffers[view] = VK_NULL_HANDLE;
+		views->results[view]        = VK_SUCCESS;
+		return;
+	}
+
+	VkCommandBufferInheritanceInfo inheritanceInfo = {
+		.sType       = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+		.renderPass  = app->renderpass.renderPass,
+		.subpass     = SUBPASS_FORWARD,
+		.framebuffer = app->renderpass.framebuffers[app->backbufferIndex],
+	};
+	if ( view != VIEW_CAMERA )
+	{
+		inheritanceInfo.renderPass  = app->shadowRenderpass.layered
+			? app->shadowRenderpass.renderPassKeep
+			: app->shadowRenderpass.renderPass;
+		inheritanceInfo.subpass     = 0;
+		inheritanceInfo.framebuffer = app->shadowRenderpass.layered
+			? app->shadowRenderpass.framebufferLayered
+			: app->shadowRenderpass.framebuffers[view - VIEW_LIGHT(0)];
+	}
+
+	VkResult result = vkBeginCommandBuffer (
+		commandBuffer,
+		&(VkCommandBufferBeginInfo){
+			.sType            = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+			.flags            = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+			.pInheritanceInfo = &inheritanceInfo,
+		}
+	);
+	if ( result != VK_SUCCESS )
+	{
+		views->results[view] = result;
+		return;
+	}
+
+	// When we want to render in the subpass, we do need to specify the graphics pipeline.
+	// Since the pipeline is dependent upon the renderpass and subpass, this can only be
+	// set in the when the subpass is active. Command buffers don't inherit any state from each
+	// other, so secondary command buffers bind their pipeline themselves.
+
+	if ( view == VIEW_CAMERA )
+	{
+		vkbase_profiler_gpu_marker_begin ( &app->profilerGpu, commandBuffer, MARKER_GPU_FORWARD );
+
+		vkCmdBindPipeline (
+			commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+			app->renderpass.pipeline[PIPELINE_FORWARD]
+		);
+
+		for ( uint32_t i = 0; i < MODEL_COUNT; i++ )
+		{
+			// Models still being uploaded are simply skipped
+			if ( !vkutil_uploader_is_complete ( &app->uploader, app->modelUploadTicket[i] ) )
+				continue;
+
+			if ( app->gpuDriven )
+			{
+				app_render_model_indirect (
+					app, i, view, 1, &views->p[view], &views->v[view], commandBuffer,
+					app->pipelineLayout[PIPELINE_FORWARD], VK_FALSE, app->modelDescriptorSets,
+					app->descriptorSet[PIPELINE_FORWARD], 1, (uint32_t[1]) { views->lightBufferOffset }
+				);
+				continue;
+			}
+
+			uint32_t wordCount = app->modelBounds[i].wordCount;
+			app_render_model (
+				&app->model[i], 1,
+				app->modelBounds[i].visibleBits + view * wordCount,
+				app->modelBounds[i].insideBits + view * wordCount, wordCount,
+				&views->p[view], &views->v[view], commandBuffer,
+				app->pipelineLayout[PIPELINE_FORWARD], VK_FALSE, VK_TRUE,
+				(float)views->windowHeight, LOD_PIXEL_ERROR, app->modelDescriptorSets,
+				app->descriptorSet[PIPELINE_FORWARD], 1, (uint32_t[1]) { views->lightBufferOffset }
+			);
+		}
+
+		vkbase_profiler_gpu_marker_end ( &app->profilerGpu, commandBuffer, MARKER_GPU_FORWARD );
+	}
+	else
+	{
+		// In a single pass, the views of all lights are rendered at once. The geometry shader
+		// reads the matrix of every light from the light buffer, so its descriptor set is bound
+		// once up front; nothing else in the pass binds descriptor sets.
+
+		uint32_t         viewCount      = 1;
+		VkPipeline       pipeline       = app->shadowRenderpass.pipeline;
+		VkPipelineLayout pipelineLayout = app->pipelineLayoutShadow;
+		if ( app->shadowRenderpass.layered )
+		{
+			viewCount      = LIGHT_COUNT;
+			pipeline       = app->shadowRenderpass.pipelineLayered;
+			pipelineLayout = app->pipelineLayoutShadowLayered;
+		}
+
+		vkCmdBindPipeline ( commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline );
+
+		if ( app->shadowRenderpass.layered )
+		{
+			vkCmdBindDescriptorSets (
+				commandBuffer,
+				VK_PIPELINE_BIND_POINT_GRAPHICS,
+				pipelineLayout,
+				0, 1, (VkDescriptorSet[1]){ app->descriptorSetShadowLayered },
+				1, (uint32_t[1]) { views->lightBufferOffset }
+			);
+
+			// The single pass keeps the contents of all shadow maps, so the ones rendered again are
+			// cleared here: a clear rectangle covering every one of their layers.
+
+			VkClearRect clearRects[LIGHT_COUNT];
+			uint32_t    clearRectCount = 0;
+			for ( uint32_t i = 0; i < LIGHT_COUNT; i++ )
+			{
+				if ( ( views->shadowRefreshMask & ( 1u << i ) ) == 0 )
+					continue;
+				clearRects[clearRectCount++] = (VkClearRect){
+					.rect           = { .extent = { SHADOW_MAP_WIDTH, SHADOW_MAP_HEIGHT } },
+					.baseArrayLayer = i,
+					.layerCount     = 1,
+				};
+			}
+
+			vkCmdClearAttachments (
+				commandBuffer,
+				1, (VkClearAttachment[1]){
+					{
+						.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+						.clearValue = { .depthStencil = { 1.0f, 0 } },
+					},
+				},
+				clearRectCount, clearRects
+			);
+		}
+
+		for ( uint32_t i = 0; i < MODEL_COUNT; i++ )
+		{
+			if ( !vkutil_uploader_is_complete ( &app->uploader, app->modelUploadTicket[i] ) )
+				continue;
+
+			// Only the shadow maps rendered this frame had their draws written by the GPU
+
+			if ( app->gpuDriven )
+			{
+				app_render_model_indirect (
+					app, i, view, app->shadowRenderpass.layered ? views->shadowRefreshMask : 1,
+					&views->p[view], &views->v[view], commandBuffer,
+					pipelineLayout, VK_TRUE, NULL, VK_NULL_HANDLE, 0, NULL
+				);
+				continue;
+			}
+
+			uint32_t wordCount = app->modelBounds[i].wordCount;
+			app_render_model (
+				&app->model[i], viewCount,
+				app->modelBounds[i].visibleBits + view * wordCount,
+				app->modelBounds[i].insideBits + view * wordCount, wordCount,
+				&views->p[view], &views->v[view], commandBuffer,
+				pipelineLayout, VK_TRUE, VK_FALSE,
+				(float)SHADOW_MAP_HEIGHT, LOD_PIXEL_ERROR_SHADOW, NULL,
+				VK_NULL_HANDLE, 0, NULL
+			);
+		}
+	}
+
+	views->commandBuffers[view] = commandBuffer;
+	views->results[view]        = vkEndCommandBuffer ( commandBuffer );
+}
+
+// Projects a box into the clip space of vp, returning the bounds of its corners after the
+// perspective divide in outMin and outMax. Boxes reaching behind the viewpoint don't have such
+// bounds, for those 0 is returned.
+
+static int32_t app_util_aabb_project (
+	const float aabbMin[3], const float aabbMax[3], const rvm_aos_mat4* vp,
+	float outMin[3], float outMax[3]
+)
+{
+	for ( uint32_t k = 0; k < 3; k++ )
+		outMin[k] = INFINITY, outMax[k] = -INFINITY;
+
+	for ( uint32_t i = 0; i < 8; i++ )
+	{
+		rvm_aos_vec4 corner = {
+			( i & 1 ) ? aabbMax[0] : aabbMin[0],
+			( i & 2 ) ? aabbMax[1] : aabbMin[1],
+			( i & 4 ) ? aabbMax[2] : aabbMin[2],
+			1.0f
+		};
+		corner = rvm_aos_mat4_mul_aos_vec4 ( vp, &corner );
+		if ( corner.w <= 0.0f )
+			return 0;
+
+		for ( uint32_t k = 0; k < 3; k++ )
+		{
+			outMin[k] = fminf ( outMin[k], corner.cells[k] / corner.w );
+			outMax[k] = fmaxf ( outMax[k], corner.cells[k] / corner.w );
+		}
+	}
+	return 1;
+}
+
+// Culls the objects in view of a light down to the ones that can cast a shadow on anything the
+// camera sees, clearing the bits of the others from the culling results of the light.
+//
+// Everything in view of both the camera and the light can receive shadows from the light. In the
+// clip space of the light, these receivers are bounded by a box. Shadows are cast straight away
+// from the light, which is along z in its clip space, so only objects overlapping that box in x
+// and y, and closer to the light than its far side, can shadow the receivers: the box of the
+// receivers extruded toward the light. The rest of the objects in view of the light only cast
+// shadows on things the camera doesn't see. Objects reaching behind the light can't be projected,
+// so they are considered to be anywhere. Models still being uploaded aren't rendered, so they
+// cast no shadows at all.
+//
+// Returns the amount of objects in view of the light in outInFrustum, and the amount of shadow
+// casters among those in outCasters.
+
+static void app_cull_shadow_casters (
+	app_t* app, uint32_t light, const rvm_aos_mat4* shadowVp,
+	uint32_t* outInFrustum, uint32_t* outCasters
+)
+{
+	float receiverMin[2] = {  INFINITY,  INFINITY };
+	float receiverMax[3] = { -INFINITY, -INFINITY, -INFINITY };
+
+	for ( uint32_t j = 0; j < MODEL_COUNT; j++ )
+	{
+		if ( !vkutil_uploader_is_complete ( &app->uploader, app->modelUploadTicket[j] ) )
+			continue;
+
+		vkutil_model_t* model      = &app->model[j];
+		uint32_t        wordCount  = app->modelBounds[j].wordCount;
+		const uint32_t* cameraBits = app->modelBounds[j].visibleBits + VIEW_CAMERA * wordCount;
+		const uint32_t* lightBits  = app->modelBounds[j].visibleBits + VIEW_LIGHT(light) * wordCount;
+
+		for ( uint32_t k = 0; k < model->objectCount; k++ )
+		{
+			if ( ( cameraBits[k/32] & lightBits[k/32] & ( 1u << (k&31) ) ) == 0 )
+				continue;
+
+			vkutil_object_t* obj = &model->objects[k];
+			float objMin[3], objMax[3];
+			if ( !app_util_aabb_project ( obj->aabbMin, obj->aabbMax, shadowVp, objMin, objMax ) )
+			{
+				receiverMin[0] = receiverMin[1] = -1.0f;
+				receiverMax[0] = receiverMax[1] = 1.0f;
+				receiverMax[2] = INFINITY;
+				continue;
+			}
+
+			receiverMin[0] = fminf ( receiverMin[0], objMin[0] );
+			receiverMin[1] = fminf ( receiverMin[1], objMin[1] );
+			for ( uint32_t c = 0; c < 3; c++ )
+				receiverMax[c] = fmaxf ( receiverMax[c], objMax[c] );
+		}
+	}
+
+	uint32_t inFrustum = 0, casters = 0;
+	for ( uint32_t j = 0; j < MODEL_COUNT; j++ )
+	{
+		vkutil_model_t* model     = &app->model[j];
+		uint32_t        wordCount = app->modelBounds[j].wordCount;
+		uint32_t*       lightBits = app->modelBounds[j].visibleBits + VIEW_LIGHT(light) * wordCount;
+
+		if ( !vkutil_uploader_is_complete ( &app->uploader, app->modelUploadTicket[j] ) )
+		{
+			memset ( lightBits, 0, wordCount * sizeof ( uint32_t ) );
+			continue;
+		}
+
+		for ( uint32_t k = 0; k < model->objectCount; k++ )
+		{
+			if ( ( lightBits[k/32] & ( 1u << (k&31) ) ) == 0 )
+				continue;
+			inFrustum++;
+
+			vkutil_object_t* obj = &model->objects[k];
+			float objMin[3], objMax[3];
+			if ( app_util_aabb_project ( obj->aabbMin, obj->aabbMax, shadowVp, objMin, objMax )
+			  && ( objMax[0] < receiverMin[0] || objMin[0] > receiverMax[0]
+			    || objMax[1] < receiverMin[1] || objMin[1] > receiverMax[1]
+			    || objMin[2] > receiverMax[2] ) )
+			{
+				lightBits[k/32] &= ~( 1u << (k&31) );
+				continue;
+			}
+			casters++;
+		}
+	}
+
+	*outInFrustum = inFrustum;
+	*outCasters   = casters;
+}
+
+// Decides which shadow maps are rendered this frame, returning a bit for each of their lights.
+//
+// A shadow map only has to be rendered again when its light moved, or the objects casting shadows
+// in it changed: castersChanged tells, for every light, whether the result of
+// app_cull_shadow_casters differs from what its shadow map was last rendered with. v and p are
+// the views of the lights for this frame.
+//
+// Of the shadow maps that are out of date, at most SHADOW_UPDATE_BUDGET are rendered per frame,
+// keeping the cost of shadows in check however many lights move. The most important ones go
+// first: the ones never rendered before, followed by the ones reaching the largest part of the
+// screen (importance, see app_util_light_screen_coverage). The longer a shadow map is skipped,
+// the more its priority grows, so all of them get their turn eventually. Lights whose shadow map
+// is skipped keep the view it was last rendered with, as the two have to match.
+
+static uint32_t app_schedule_shadow_maps (
+	app_t* app, const rvm_aos_mat4* v, const rvm_aos_mat4* p, const VkBool32* castersChanged,
+	const float* importance
+)
+{
+	float priority[LIGHT_COUNT];
+	for ( uint32_t i = 0; i < LIGHT_COUNT; i++ )
+	{
+		if ( app->shadowMaps[i].valid
+		  && memcmp ( &app->shadowMaps[i].v, &v[i], sizeof ( rvm_aos_mat4 ) ) == 0
+		  && memcmp ( &app->shadowMaps[i].p, &p[i], sizeof ( rvm_aos_mat4 ) ) == 0
+		  && !castersChanged[i] )
+		{
+			priority[i] = -1.0f;	// Up to date
+			continue;
+		}
+
+		// Lights out of view still get a bit of priority, so they're not skipped forever
+		if ( !app->shadowMaps[i].valid )
+			priority[i] = INFINITY;
+		else
+			priority[i] = ( app->shadowMaps[i].framesStale + 1 ) * ( importance[i] + 1.0f / 64.0f );
+	}
+
+	uint32_t refreshMask = 0;
+	for ( uint32_t n = 0; n < SHADOW_UPDATE_BUDGET; n++ )
+	{
+		int32_t best = -1;
+		for ( uint32_t i = 0; i < LIGHT_COUNT; i++ )
+		{
+			if ( ( refreshMask & ( 1u << i ) ) != 0 || priority[i] < 0.0f )
+				continue;
+			if ( best < 0 || priority[i] > priority[best] )
+				best = (int32_t)i;
+		}
+		if ( best < 0 )
+			break;
+		refreshMask |= 1u << best;
+	}
+
+	for ( uint32_t i = 0; i < LIGHT_COUNT; i++ )
+	{
+		if ( ( refreshMask & ( 1u << i ) ) != 0 )
+		{
+			app->shadowMaps[i].valid        = VK_TRUE;
+			app->shadowMaps[i].v            = v[i];
+			app->shadowMaps[i].p            = p[i];
+			app->shadowMaps[i].framesStale  = 0;
+		}
+		else if ( priority[i] >= 0.0f )
+		{
+			app->shadowMaps[i].framesStale++;
+		}
+	}
+
+	return refreshMask;
+}
+
+// Has the GPU cull the objects of all models against all views, when culling on the GPU. Every
+// view's frustum planes, position and level of detail scale are in the cull buffer, at
+// cullBufferOffset for this frame. The compute shader writes the draws of the objects in every
+// view into the draw buffer of their model, a draw per run of clusters in view at full detail,
+// which app_render_model_indirect draws from later on. The CPU only records two dispatches per
+// model here, whatever the amount of objects: the first gathers the shadow receivers of every
+// light over all models, like app_cull_shadow_casters, after which the second can leave out the
+// objects that don't shadow any of them.
+//
+// All of this is recorded into the primary command buffer ahead of the render passes, which can't
+// have dispatches in them. The buffers are shared by all frames: the barrier up front makes the
+// GPU finish drawing the previous frame from them before they are written again.
+
+static void app_render_cull_draws (
+	app_t* app, VkCommandBuffer commandBuffer, uint32_t cullBufferOffset
+)
+{
+	vkbase_profiler_gpu_marker_begin ( &app->profilerGpu, commandBuffer, MARKER_GPU_CULL );
+
+	vkCmdPipelineBarrier (
+		commandBuffer,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0,
+		0, NULL,
+		0, NULL,
+		0, NULL
+	);
+
+	// The bounds of the receivers are gathered with atomics, starting from empty bounds (see
+	// cull_c.glsl), and so are the counts of the draws in view, starting from 0
+
+	VkBuffer receiverBuffer = app->staticResources.receiverBuffer;
+	vkCmdFillBuffer (
+		commandBuffer, receiverBuffer,
+		offsetof ( cull_receivers_t, min ), sizeof ( ( (cull_receivers_t*)0 )->min ), 0xFFFFFFFF
+	);
+	vkCmdFillBuffer (
+		commandBuffer, receiverBuffer,
+		offsetof ( cull_receivers_t, max ), sizeof ( ( (cull_receivers_t*)0 )->max ), 0
+	);
+
+	if ( app->device.drawIndirectCount )
+	{
+		for ( uint32_t i = 0; i < MODEL_COUNT; i++ )
+		{
+			if ( !vkutil_uploader_is_complete ( &app->uploader, app->modelUploadTicket[i] ) )
+				continue;
+			vkCmdFillBuffer ( commandBuffer, app->modelDraws[i].countBuffer, 0, VK_WHOLE_SIZE, 0 );
+		}
+	}
+
+	vkCmdPipelineBarrier (
+		commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0,
+		1, (VkMemoryBarrier[1]){
+			{
+				.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+				.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+				.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+			},
+		},
+		0, NULL,
+		0, NULL
+	);
+
+	// An invocation per object and view, in groups of 64 objects (see cull_c.glsl). All receivers
+	// have to be gathered before any casters can be culled, hence the barrier between the passes.
+
+	vkCmdBindPipeline ( commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, app->pipelineCull );
+
+	for ( uint32_t pass = 0; pass < 2; pass++ )
+	{
+		if ( pass > 0 )
+		{
+			vkCmdPipelineBarrier (
+				commandBuffer,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				0,
+				1, (VkMemoryBarrier[1]){
+					{
+						.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+						.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+						.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+					},
+				},
+				0, NULL,
+				0, NULL
+			);
+		}
+
+		for ( uint32_t i = 0; i < MODEL_COUNT; i++ )
+		{
+			// Models still being uploaded are skipped, their objects may not even be there yet
+			if ( !vkutil_uploader_is_complete ( &app->uploader, app->modelUploadTicket[i] ) )
+				continue;
+
+			vkCmdBindDescriptorSets (
+				commandBuffer,
+				VK_PIPELINE_BIND_POINT_COMPUTE,
+				app->pipelineLayoutCull,
+				0, 1, (VkDescriptorSet[1]){ app->modelDraws[i].descriptorSet },
+				1, (uint32_t[1]) { cullBufferOffset }
+			);
+
+			vkCmdPushConstants (
+				commandBuffer,
+				app->pipelineLayoutCull,
+				VK_SHADER_STAGE_COMPUTE_BIT,
+				0,
+				4 * sizeof ( uint32_t ),
+				(uint32_t[4]){
+					app->model[i].objectCount, app->modelDraws[i].groupCount,
+					app->modelDraws[i].drawCount, pass == 0
+				}
+			);
+
+			vkCmdDispatch ( commandBuffer, RVM_DIV_CEIL ( app->model[i].objectCount, 64 ), VIEW_COUNT, 1 );
+		}
+	}
+
+	// The draws are read by the indirect draws of the render passes that follow
+
+	vkCmdPipelineBarrier (
+		commandBuffer,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+		0,
+		1, (VkMemoryBarrier[1]){
+			{
+				.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+				.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+				.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+			},
+		},
+		0, NULL,
+		0, NULL
+	);
+
+	vkbase_profiler_gpu_marker_end ( &app->profilerGpu, commandBuffer, MARKER_GPU_CULL );
+}
+
+int32_t app_render ( app_t* app, double dt )
+{
+	VkResult result = VK_SUCCESS;
+	int32_t ret;
+
+	app->commandBufferRenderIndex = (app->commandBufferRenderIndex + 1) % RENDER_COMMAND_BUFFER_COUNT;
+	render_cmd_buffer_t* renderCommandBuffer =
+		&app->commandBufferRender[app->commandBufferRenderIndex];
+
+	// Before we do any actual rendering, we will need to wait for a fence in order to ensure we
+	// can do the operations we would like to do. Specifically, we would like to wait for the
+	// command list we submitted the previous frame before we attempt to put more data into
+	// the same command list. Doing so while the command list is still being executed is illegal,
+	// as allowing it to happen would effectively mean you could change GPU instructions while it
+	// is still executing its instructions.
+
+	vkbase_profiler_cpu_frame_begin ( &app->profilerCpu );
+	vkbase_profiler_cpu_marker_begin ( &app->profilerCpu, MARKER_CPU_RENDER_FENCE_WAIT );
+
+	result = vkWaitForFences (
+		app->device.device,
+		1,
+		(VkFence[1]){ renderCommandBuffer->fenceComplete },
+		VK_TRUE,
+		UINT64_MAX
+	);
+	if ( result != VK_SUCCESS )
+		return platform_throw_error ( -1, "vkWaitForFences failed (%u)", result );
+
+	// At a later stage we would need to wait for this fence again. In order to do so, we do need
+	// to reset the fence despite already having waited for that fence.
+
+	result = vkResetFences (
+		app->device.device,
+		1,
+		(VkFence[1]){ renderCommandBuffer->fenceComplete }
+	);
+	if ( result != VK_SUCCESS )
+		return platform_throw_error ( -1, "vkResetFences failed (%u)", result );
+
+	vkbase_profiler_cpu_marker_end ( &app->profilerCpu, MARKER_CPU_RENDER_FENCE_WAIT );
+
+	// Check on the uploads in flight. This never waits: uploads that are done get their staging
+	// memory released and are handed over to the main queue, the others are left alone until the
+	// next frame.
+
+	ret = vkutil_uploader_poll ( &app->uploader );
+	if ( ret != 0 )
+		return platform_throw_error ( ret, "vkutil_uploader_poll failed (%d)", ret );
+
+	// Now we request an unused image from the swapchain, we will need this in order to know
+	// which target we are to be rendering to.
+
+	vkbase_profiler_cpu_marker_begin ( &app->profilerCpu, MARKER_CPU_RENDER_IMAGE_ACQUIRE );
+	ret = vkbase_swapchain_acquire (
+		&app->device, &app->swapchain, &app->queues[QUEUE_MAIN],
+		renderCommandBuffer->semaphoreBackbufferWritable, &app->backbufferIndex
+	);
+	if ( ret != 0 )
+		return ret;
+	vkbase_profiler_cpu_marker_end ( &app->profilerCpu, MARKER_CPU_RENDER_IMAGE_ACQUIRE );
+
+	vkbase_profiler_cpu_marker_begin ( &app->profilerCpu, MARKER_CPU_RENDER_CB_INIT );
+
+	// It is always helpful to know the window width and height in the render function. So just
+	// query it at the top of the function for convenience. The aspect is also frequently used,
+	// so why not.
+
+	uint32_t windowWidth, windowHeight;
+	platform_window_get_size ( &app->window, &windowWidth, &windowHeight );
+	float aspect = windowWidth / (float)windowHeight;
+
+	// We would like to spin things on the screen, for this it is helpful to know the current time
+	// in seconds from... Some point in time. Rather than asking the clock, we add up the dt of
+	// every frame: the platform passes the real time between frames, so things spin just as fast,
+	// but a benchmark passing a fixed dt sees the exact same scene every run.
+
+	app->time += dt;
+	float T = (float)app->time;
+
+	// Deduce the transformations geometry will need to go through to get to the proper location
+	// on the screen.
+
+	rvm_aos_mat4 v, p;
+#if 0
+	app_util_create_rotating_vp (
+		T, 1.0f, 0.5f, 0.25f, 0.0f, 0.0f, 5.0f, aspect, 0.1f, 10.0f, &v, &p
+	);
+#else
+	app_util_create_rotating_vp (
+		T, 0.0f, -RVM_PI/2, 0.0f, 0.0f, 0.0f, 0.0f, -250.0f, 100.0f, 0.0f, aspect, 10.0f, 2500.0f,
+		1.0f, &v, &p
+	);
+#endif
+
+	// The lights are to be rotated every frame, and thus we would like to update the data inside
+	// the light buffer. Its memory stays mapped for as long as the allocator lives, so we only have
+	// to find our part of it.
+
+	uint32_t lightBufferOffset = app->commandBufferRenderIndex * RVM_ALIGN_UP_POW2 (
+			sizeof ( forward_vs_cb_t ),
+			app->device.properties.limits.minUniformBufferOffsetAlignment
+		);
+
+	forward_vs_cb_t* lightData = (forward_vs_cb_t*)(
+		(uint8_t*)app->staticResources.lightBufferAllocation.mapped + lightBufferOffset
+	);
+
+	// The frustum planes of every view, for culling the objects against all of them at once below
+
+	rvm_aos_vec4 frustumPlanes[VIEW_COUNT][6];
+	rvm_aos_mat4 vp = rvm_aos_mat4_mul_aos_mat4 ( &p, &v );
+	rvm_aos_mat4_frustum_planes ( frustumPlanes[VIEW_CAMERA], &vp );
+
+	app_render_views_t views = {
+		.app                 = app,
+		.renderCommandBuffer = renderCommandBuffer,
+		.windowHeight        = windowHeight,
+		.lightBufferOffset   = lightBufferOffset,
+		.v[VIEW_CAMERA]      = v,
+		.p[VIEW_CAMERA]      = p,
+	};
+
+	for ( uint32_t i = 0; i < LIGHT_COUNT; i++ )
+	{
+		rvm_aos_mat4 shadowV, shadowP;
+		app_util_create_rotating_vp (
+			T,
+			LIGHTS[i].initialRotation.x, LIGHTS[i].initialRotation.y, LIGHTS[i].initialRotation.z,
+			LIGHTS[i].rotSpeed.x, LIGHTS[i].rotSpeed.y, LIGHTS[i].rotSpeed.z,
+			LIGHTS[i].pos.x, LIGHTS[i].pos.y, LIGHTS[i].pos.z,
+			1.0f, 1.0f, 2500.0f, LIGHTS[i].fovOuter,
+			&shadowV, &shadowP
+		);
+
+		rvm_aos_mat4 shadowVp = rvm_aos_mat4_mul_aos_mat4 ( &shadowP, &shadowV );
+		rvm_aos_mat4_frustum_planes ( frustumPlanes[VIEW_LIGHT(i)], &shadowVp );
+		views.v[VIEW_LIGHT(i)] = shadowV;
+		views.p[VIEW_LIGHT(i)] = shadowP;
+	}
+
+	// Rather than checking objects one by one for every view as they are rendered, all of them are
+	// checked against all views in one go. The bounding boxes are all laid out next to each other,
+	// so they are tested a couple at a time with SIMD, and the planes of a view stay in registers.
+	// Culling on the GPU, this is left to the GPU altogether, see app_render_cull_draws.
+
+	for ( uint32_t i = 0; i < MODEL_COUNT && !app->gpuDriven; i++ )
+	{
+		rvm_soa_aabb_frustum_cull (
+			app->modelBounds[i].visibleBits, app->modelBounds[i].insideBits,
+			&frustumPlanes[0][0], VIEW_COUNT,
+			&app->modelBounds[i].centers, &app->modelBounds[i].extents
+		);
+	}
+
+	// Of the objects in view of a light, only those casting shadows on something the camera sees
+	// are of any use, see app_cull_shadow_casters. With that known, it can be decided which
+	// shadow maps to render again, see app_schedule_shadow_maps. It needs to know whose shadow
+	// casters changed since their shadow map was rendered, and how much of the screen every light
+	// reaches.
+	//
+	// Culling on the GPU, nothing is known about the objects in view yet: the GPU culls the shadow
+	// casters itself, later on. They depend on the models uploaded and on what the camera sees,
+	// so the models and camera view every shadow map was rendered with are compared instead.
+
+	float pixelsPerUnit = fabsf ( p.rows[1][1] ) * windowHeight * 0.5f;
+	rvm_aos_mat4 invV = rvm_aos_mat4_inverse ( &v );
+	float cameraPosition[3] = { invV.rows[3][0], invV.rows[3][1], invV.rows[3][2] };
+
+	uint32_t modelMask = 0;
+	for ( uint32_t j = 0; j < MODEL_COUNT; j++ )
+	{
+		if ( vkutil_uploader_is_complete ( &app->uploader, app->modelUploadTicket[j] ) )
+			modelMask |= 1u << j;
+	}
+
+	uint32_t inFrustum[LIGHT_COUNT], casters[LIGHT_COUNT];
+	VkBool32 castersChanged[LIGHT_COUNT];
+	float    importance[LIGHT_COUNT];
+	for ( uint32_t i = 0; i < LIGHT_COUNT; i++ )
+	{
+		castersChanged[i] = VK_FALSE;
+		if ( app->gpuDriven )
+		{
+			// The casters are only known to the GPU, but they can only change along with the
+			// models uploaded or the view of the camera their receivers are seen from
+			inFrustum[i] = casters[i] = 0;
+			castersChanged[i] = app->shadowMaps[i].modelMask != modelMask
+				|| memcmp ( &app->shadowMaps[i].cameraVp, &vp, sizeof ( vp ) ) != 0;
+		}
+		else
+		{
+			rvm_aos_mat4 shadowVp = rvm_aos_mat4_mul_aos_mat4 ( &views.p[VIEW_LIGHT(i)], &views.v[VIEW_LIGHT(i)] );
+			app_cull_shadow_casters ( app, i, &shadowVp, &inFrustum[i], &casters[i] );
+		}
+
+		for ( uint32_t j = 0; j < MODEL_COUNT && !castersChanged[i] && !app->gpuDriven; j++ )
+		{
+			uint32_t wordCount = app->modelBounds[j].wordCount;
+			castersChanged[i] = memcmp (
+				app->modelBounds[j].visibleBits + VIEW_LIGHT(i) * wordCount,
+				app->modelBounds[j].casterBits + i * wordCount,
+				wordCount * sizeof ( uint32_t )
+			) != 0;
+		}
+
+		importance[i] = app_util_light_screen_coverage (
+			&LIGHTS[i], frustumPlanes[VIEW_CAMERA], cameraPosition,
+			pixelsPerUnit, (float)windowWidth * (float)windowHeight
+		);
+	}
+
+	views.shadowRefreshMask = app_schedule_shadow_maps (
+		app, &views.v[VIEW_LIGHT(0)], &views.p[VIEW_LIGHT(0)], castersChanged, importance
+	);
+
+	// Remember the shadow casters of the shadow maps rendered this frame, and keep track of how
+	// many objects caster culling saves them from drawing. These statistics are written to the
+	// profile log every once in a while, at the same interval as the profilers. There are none
+	// when culling on the GPU.
+
+	for ( uint32_t i = 0; i < LIGHT_COUNT; i++ )
+	{
+		if ( ( views.shadowRefreshMask & ( 1u << i ) ) == 0 )
+			continue;
+
+		if ( app->gpuDriven )
+		{
+			app->shadowMaps[i].modelMask = modelMask;
+			app->shadowMaps[i].cameraVp  = vp;
+			continue;
+		}
+
+		for ( uint32_t j = 0; j < MODEL_COUNT; j++ )
+		{
+			uint32_t wordCount = app->modelBounds[j].wordCount;
+			memcpy (
+				app->modelBounds[j].casterBits + i * wordCount,
+				app->modelBounds[j].visibleBits + VIEW_LIGHT(i) * wordCount,
+				wordCount * sizeof ( uint32_t )
+			);
+		}
+
+		app->shadowCasterStats.inFrustum[i] += inFrustum[i];
+		app->shadowCasterStats.casters[i]   += casters[i];
+		app->shadowCasterStats.renders[i]++;
+	}
+
+	if ( ++app->shadowCasterStats.frameCount % 60 == 0 && app->profilerLog.platform != NULL
+	  && !app->gpuDriven )
+	{
+		platform_log_file_print (
+			&app->profilerLog, "Shadow casters frame %u:", app->shadowCasterStats.frameCount
+		);
+		for ( uint32_t i = 0; i < LIGHT_COUNT; i++ )
+		{
+			uint32_t renders = app->shadowCasterStats.renders[i] > 0 ? app->shadowCasterStats.renders[i] : 1;
+			platform_log_file_print (
+				&app->profilerLog, " | light %u %.1f of %.1f objects, %.1f draws saved",
+				i, app->shadowCasterStats.casters[i] / (double)renders,
+				app->shadowCasterStats.inFrustum[i] / (double)renders,
+				( app->shadowCasterStats.inFrustum[i] - app->shadowCasterStats.casters[i] ) / (double)renders
+			);
+			app->shadowCasterStats.inFrustum[i] = 0;
+			app->shadowCasterStats.casters[i]   = 0;
+			app->shadowCasterStats.renders[i]   = 0;
+		}
+		platform_log_file_print ( &app->profilerLog, "\n" );
+	}
+
+	// The shadow maps that are kept render nothing at all, which is easily achieved by making
+	// every object invisible to them; culling on the GPU skips their views altogether below. Their
+	// lights keep the view their shadow map was rendered with, as does the light buffer below.
+	// Lights without a shadow map yet don't light anything, rather than lighting through whatever
+	// happens to be in their shadow map.
+
+	for ( uint32_t i = 0; i < LIGHT_COUNT; i++ )
+	{
+		if ( ( views.shadowRefreshMask & ( 1u << i ) ) != 0 )
+			continue;
+
+		views.v[VIEW_LIGHT(i)] = app->shadowMaps[i].v;
+		views.p[VIEW_LIGHT(i)] = app->shadowMaps[i].p;
+		for ( uint32_t j = 0; j < MODEL_COUNT; j++ )
+		{
+			uint32_t wordCount = app->modelBounds[j].wordCount;
+			memset (
+				app->modelBounds[j].visibleBits + VIEW_LIGHT(i) * wordCount, 0,
+				wordCount * sizeof ( uint32_t )
+			);
+		}
+	}
+
+	lightData->lightCount     = LIGHT_COUNT;
 	lightData->cameraPosition = (rvm_aos_vec3){ 1000.0f, 100.0f, 0.0f };
 	for ( uint32_t i = 0; i < LIGHT_COUNT; i++ )
 	{
-		rvm_aos_mat4 shadowV, shadowP;
-		app_util_create_rotating_vp (
-			T,
-			LIGHTS[i].initialRotation.x, LIGHTS[i].initialRotation.y, LIGHTS[i].initialRotation.z,
-			LIGHTS[i].rotSpeed.x, LIGHTS[i].rotSpeed.y, LIGHTS[i].rotSpeed.z,
-			LIGHTS[i].pos.x, LIGHTS[i].pos.y, LIGHTS[i].pos.z,
-			1.0f, 1.0f, 2500.0f, LIGHTS[i].fovOuter,
-			&shadowV, &shadowP
-		);
+		rvm_aos_mat4 shadowVp = rvm_aos_mat4_mul_aos_mat4 ( &app->shadowMaps[i].p, &app->shadowMaps[i].v );
 
-		lightData->lights[i].shadowVp    = rvm_aos_mat4_mul_aos_mat4 ( &shadowP, &shadowV );
+		lightData->lights[i].shadowVp    = shadowVp;
 		lightData->lights[i].position    = LIGHTS[i].pos;
 		lightData->lights[i].direction   = rvm_aos_mat4_mul_aos_vec3w0 ( 
 			&lightData->lights[i].shadowVp, &(rvm_aos_vec3){ 0.0f, 0.0f, 1.0f }
 		);
-		lightData->lights[i].color       = (rvm_aos_vec3){ 1.0f, 1.0f, 1.0f };
+		lightData->lights[i].color       = app->shadowMaps[i].valid
+			? (rvm_aos_vec3){ 1.0f, 1.0f, 1.0f } : (rvm_aos_vec3){ 0.0f, 0.0f, 0.0f };
 		lightData->lights[i].attenuation = LIGHTS[i].attenuation;
 		lightData->lights[i].outerDot    = cosf ( LIGHTS[i].fovOuter / 2.0f );
 		lightData->lights[i].innerDot    = cosf ( LIGHTS[i].fovInner / 2.0f );
 	}
 
-	vkUnmapMemory ( app->device.device, app->staticResources.lightBufferMemory );
+	// Culling on the GPU, the compute shader needs to know about every view as well: its frustum
+	// planes, its position and level of detail scale to pick levels of detail with, like
+	// app_render_model does, and whether it's rendered at all. Like on the CPU, clusters facing
+	// away are only culled for the camera, and objects not shadowing anything the camera sees only
+	// for the lights, which takes the view and projection to project the objects with. The cull
+	// buffer is split up per frame just like the light buffer.
+
+	uint32_t cullBufferOffset = 0;
+	if ( app->gpuDriven )
+	{
+		cullBufferOffset = app->commandBufferRenderIndex * RVM_ALIGN_UP_POW2 (
+				sizeof ( cull_cb_t ),
+				app->device.properties.limits.minUniformBufferOffsetAlignment
+			);
+
+		cull_cb_t* cullData = (cull_cb_t*)(
+			(uint8_t*)app->staticResources.cullBufferAllocation.mapped + cullBufferOffset
+		);
+
+		for ( uint32_t i = 0; i < VIEW_COUNT; i++ )
+		{
+			float viewportHeight = (float)SHADOW_MAP_HEIGHT, lodPixelError = LOD_PIXEL_ERROR_SHADOW;
+			if ( i == VIEW_CAMERA )
+				viewportHeight = (float)windowHeight, lodPixelError = LOD_PIXEL_ERROR;
+
+			rvm_aos_mat4 invViewV = rvm_aos_mat4_inverse ( &views.v[i] );
+			cullData->views[i].vp            = rvm_aos_mat4_mul_aos_mat4 ( &views.p[i], &views.v[i] );
+			memcpy ( cullData->views[i].planes, frustumPlanes[i], sizeof ( frustumPlanes[i] ) );
+			cullData->views[i].position      = (rvm_aos_vec3){
+				invViewV.rows[3][0], invViewV.rows[3][1], invViewV.rows[3][2]
+			};
+			cullData->views[i].lodScale      =
+				fabsf ( views.p[i].rows[1][1] ) * viewportHeight * 0.5f / lodPixelError;
+			cullData->views[i].firstInstance =
+				i != VIEW_CAMERA && app->shadowRenderpass.layered ? i - VIEW_LIGHT(0) : 0;
+			cullData->views[i].enabled       =
+				i == VIEW_CAMERA || ( views.shadowRefreshMask & ( 1u << ( i - VIEW_LIGHT(0) ) ) ) != 0;
+			cullData->views[i].backfaceCulling = i == VIEW_CAMERA;
+			cullData->views[i].casterCulling   = i != VIEW_CAMERA;
+		}
+	}
 
 	// Begin the command buffer. The commands is going to be submitted later.
 
@@ -914,59 +2464,98 @@ int32_t app_render ( app_t* app, double dt )
 	if ( result != VK_SUCCESS )
 		return platform_throw_error ( -1, "vkWaitForFences failed (%u)", result );
 
+	// Now that the fence for this command buffer has been waited on, the timestamps written the
+	// last time it was used are available, and its query pool can be reset for this frame.
+
+	vkbase_profiler_gpu_frame_begin (
+		&app->profilerGpu, &app->device, renderCommandBuffer->commandBuffer,
+		app->commandBufferRenderIndex
+	);
+
+	// The GPU culls the objects before anything is rendered with them, see app_render_cull_draws
+
+	if ( app->gpuDriven )
+		app_render_cull_draws ( app, renderCommandBuffer->commandBuffer, cullBufferOffset );
+
+	vkbase_profiler_cpu_marker_end ( &app->profilerCpu, MARKER_CPU_RENDER_CB_INIT );
+
+	// With the culling done, every view can be recorded on its own. As the fence of this frame has
+	// been waited on, none of the secondary command buffers recorded for it the last time around are
+	// in use anymore, so the command pools of all threads are reset as a whole: much cheaper than
+	// resetting the command buffers one by one. The worker threads then each take views to record
+	// until none are left. This has to wait for vkbase_profiler_gpu_frame_begin, as the forward
+	// view writes GPU timestamps for this frame.
+
+	vkbase_profiler_cpu_marker_begin ( &app->profilerCpu, MARKER_CPU_RENDER_RECORD );
+
+	for ( uint32_t i = 0; i < app->workers.threadCount; i++ )
+	{
+		result = vkResetCommandPool ( app->device.device, renderCommandBuffer->threadCommandPools[i], 0 );
+		if ( result != VK_SUCCESS )
+			return platform_throw_error ( -1, "vkResetCommandPool failed (%u)", result );
+	}
+
+	uint32_t viewJobCount = app->shadowRenderpass.layered ? VIEW_LIGHT(1) : VIEW_COUNT;
+	ret = platform_worker_pool_run ( &app->workers, app_render_record_view, &views, viewJobCount );
+	if ( ret != 0 )
+		return ret;
+
+	for ( uint32_t i = 0; i < viewJobCount; i++ )
+	{
+		if ( views.results[i] != VK_SUCCESS )
+			return platform_throw_error ( -1, "Recording view %u failed (%u)", i, views.results[i] );
+	}
+
+	vkbase_profiler_cpu_marker_end ( &app->profilerCpu, MARKER_CPU_RENDER_RECORD );
+
 	{
 		// I wrote the note below first, but it doesn't make as much sense to move the comment to
 		// here. So go down and read it there. Yeah.
 
-		for ( uint32_t i = 0; i < LIGHT_COUNT; i++ )
+		vkbase_profiler_cpu_marker_begin ( &app->profilerCpu, MARKER_CPU_RENDER_RP_SHADOW );
+		vkbase_profiler_gpu_marker_begin ( &app->profilerGpu, renderCommandBuffer->commandBuffer, MARKER_GPU_SHADOW );
+
+		// Every shadow map rendered this frame gets a pass of its own, unless they are all rendered
+		// at once: a layered framebuffer holds all layers of the shadow map image, and that single
+		// pass keeps the ones not rendered again, see app_render_record_view.
+
+		uint32_t shadowPassCount = app->shadowRenderpass.layered ? 1 : LIGHT_COUNT;
+		for ( uint32_t i = 0; i < shadowPassCount; i++ )
 		{
+			if ( views.commandBuffers[VIEW_LIGHT(i)] == VK_NULL_HANDLE )
+				continue;
+
 			vkCmdBeginRenderPass (
 				renderCommandBuffer->commandBuffer,
 				&(VkRenderPassBeginInfo){
 					.sType           = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
 					.pNext           = NULL,
-					.renderPass      = app->shadowRenderpass.renderPass,
-					.framebuffer     = app->shadowRenderpass.framebuffers[i],
+					.renderPass      = app->shadowRenderpass.layered
+						? app->shadowRenderpass.renderPassKeep
+						: app->shadowRenderpass.renderPass,
+					.framebuffer     = app->shadowRenderpass.layered
+						? app->shadowRenderpass.framebufferLayered
+						: app->shadowRenderpass.framebuffers[i],
 					.renderArea      = { .extent = { SHADOW_MAP_WIDTH, SHADOW_MAP_HEIGHT } },
 					.clearValueCount = 1,
 					.pClearValues    = (VkClearValue[1]){
 						[0] = { .depthStencil  = { 1.0f, 0 } },
 					},
 				},
-				VK_SUBPASS_CONTENTS_INLINE
+				VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
 			);
 
-			{
-				rvm_aos_mat4 shadowV, shadowP;
-				app_util_create_rotating_vp (
-					T,
-					LIGHTS[i].initialRotation.x, LIGHTS[i].initialRotation.y, LIGHTS[i].initialRotation.z,
-					LIGHTS[i].rotSpeed.x, LIGHTS[i].rotSpeed.y, LIGHTS[i].rotSpeed.z,
-					LIGHTS[i].pos.x, LIGHTS[i].pos.y, LIGHTS[i].pos.z,
-					1.0f, 1.0f, 2500.0f, LIGHTS[i].fovOuter,
-					&shadowV, &shadowP
-				);
-	
-				vkCmdBindPipeline (
-					renderCommandBuffer->commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-					app->shadowRenderpass.pipeline
-				);
-			
-				{
-					for ( uint32_t i = 0; i < MODEL_COUNT; i++ )
-					{
-						app_render_model (
-							&app->model[i], &shadowP, &shadowV, renderCommandBuffer->commandBuffer,
-							app->pipelineLayoutShadow, NULL,
-							VK_NULL_HANDLE, 0, NULL
-						);
-					}
-				}
-			}
+			vkCmdExecuteCommands (
+				renderCommandBuffer->commandBuffer,
+				1, &views.commandBuffers[VIEW_LIGHT(i)]
+			);
 	
 			vkCmdEndRenderPass ( renderCommandBuffer->commandBuffer );
 		}
 
+		vkbase_profiler_gpu_marker_end ( &app->profilerGpu, renderCommandBuffer->commandBuffer, MARKER_GPU_SHADOW );
+		vkbase_profiler_cpu_marker_end ( &app->profilerCpu, MARKER_CPU_RENDER_RP_SHADOW );
+
 		// At this point, we can begin with our renderpass. The renderpass will begin from subpass 0
 		// and only advance to the next subpass upon calling vkCmdNextSubpass. In our current scenario
 		// we have a forward render pass in the first subpass, and some post processing in the second
@@ -984,10 +2573,14 @@ int32_t app_render ( app_t* app, double dt )
 		// calling a clear function, allowing the implementation to deduce the cheapest way to ensure
 		// previous data is cleared.
 
-		// For the subpasses we specify "inline" contents, meaning we are going to specify the subpass
-		// in the same command buffer. With the alternative "external command buffer" option, we can
-		// create the commands for the other subpass at a different time or in a different thread, and
-		// tell this command buffer to merely call the command buffer on that subpass.
+		// The contents of every subpass are either "inline", meaning we specify the commands of the
+		// subpass in this command buffer directly, or come from "secondary command buffers". Those
+		// are recorded separately - at a different time, or in a different thread - and this command
+		// buffer merely calls them, which is all it may do in such a subpass. The shadow passes
+		// above and the forward subpass are recorded on the worker threads, only the post
+		// processing subpass, being a single draw, is recorded inline.
+
+		vkbase_profiler_cpu_marker_begin ( &app->profilerCpu, MARKER_CPU_RENDER_RP_START );
 
 		static float x = 0.0f, y = 0.524f, z = 1.57f;
 		x += (float)dt * 3.14f, y += (float)dt * 3.14f, z += (float)dt * 3.14f;
@@ -1006,30 +2599,17 @@ int32_t app_render ( app_t* app, double dt )
 					[1] = { .depthStencil  = { 1.0f, 0 } },
 				},
 			},
-			VK_SUBPASS_CONTENTS_INLINE
+			VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
 		);
 
-		{
-			// When we want to render in the subpass, we do need to specify the graphics pipeline.
-			// Since the pipeline is dependent upon the renderpass and subpass, this can only be
-			// set in the when the subpass is active.
-	
-			vkCmdBindPipeline (
-				renderCommandBuffer->commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-				app->renderpass.pipeline[PIPELINE_FORWARD]
-			);
-			
-			{
-				for ( uint32_t i = 0; i < MODEL_COUNT; i++ )
-				{
-					app_render_model (
-						&app->model[i], &p, &v, renderCommandBuffer->commandBuffer,
-						app->pipelineLayout[PIPELINE_FORWARD], app->modelDescriptorSets,
-						app->descriptorSet[PIPELINE_FORWARD], 1, (uint32_t[1]) { lightBufferOffset }
-					);
-				}
-			}
-		}
+		vkbase_profiler_cpu_marker_end ( &app->profilerCpu, MARKER_CPU_RENDER_RP_START );
+
+		vkbase_profiler_cpu_marker_begin ( &app->profilerCpu, MARKER_CPU_RENDER_RP_FWD );
+		vkCmdExecuteCommands (
+			renderCommandBuffer->commandBuffer,
+			1, &views.commandBuffers[VIEW_CAMERA]
+		);
+		vkbase_profiler_cpu_marker_end ( &app->profilerCpu, MARKER_CPU_RENDER_RP_FWD );
 	
 		// Now that we have completed the forward subpass, we will move onto the post-processing
 		// subpass.
@@ -1037,6 +2617,9 @@ int32_t app_render ( app_t* app, double dt )
 		vkCmdNextSubpass ( renderCommandBuffer->commandBuffer, VK_SUBPASS_CONTENTS_INLINE );
 	
 		{
+			vkbase_profiler_cpu_marker_begin ( &app->profilerCpu, MARKER_CPU_RENDER_RP_POST );
+			vkbase_profiler_gpu_marker_begin ( &app->profilerGpu, renderCommandBuffer->commandBuffer, MARKER_GPU_POST );
+
 			vkCmdBindPipeline (
 				renderCommandBuffer->commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
 				app->renderpass.pipeline[PIPELINE_POST]
@@ -1060,6 +2643,8 @@ int32_t app_render ( app_t* app, double dt )
 			);
 
 			vkCmdDraw ( renderCommandBuffer->commandBuffer, 3, 1, 0, 0 );
+
+			vkbase_profiler_gpu_marker_end ( &app->profilerGpu, renderCommandBuffer->commandBuffer, MARKER_GPU_POST );
 		}
 	
 		vkCmdEndRenderPass ( renderCommandBuffer->commandBuffer );
@@ -1068,6 +2653,8 @@ int32_t app_render ( app_t* app, double dt )
 	result = vkEndCommandBuffer ( renderCommandBuffer->commandBuffer );
 	if ( result != VK_SUCCESS )
 		return platform_throw_error ( -1, "vkWaitForFences failed (%u)", result );
+
+	vkbase_profiler_cpu_marker_end ( &app->profilerCpu, MARKER_CPU_RENDER_RP_POST );
 	
 	// Submit the command buffer to the queue.
 	// We could theoretically submit the command buffer multiple times, and only swap out the data
@@ -1076,6 +2663,7 @@ int32_t app_render ( app_t* app, double dt )
 
 	// In this case, we pretend this scenario does not exist.
 
+	vkbase_profiler_cpu_marker_begin ( &app->profilerCpu, MARKER_CPU_RENDER_CB_SUBMIT );
 	result = vkQueueSubmit (
 		app->queues[QUEUE_MAIN].queue,
 		1, (VkSubmitInfo[1]){
@@ -1096,25 +2684,21 @@ int32_t app_render ( app_t* app, double dt )
 	);
 	if ( result != VK_SUCCESS )
 		return platform_throw_error ( -1, "vkQueueSubmit failed (%u)", result );
+	vkbase_profiler_cpu_marker_end ( &app->profilerCpu, MARKER_CPU_RENDER_CB_SUBMIT );
 
 	// We then queue a present operation, telling the swapchain to push the buffer we render to, to
 	// the screen.
 
-	result = vkQueuePresentKHR (
-		app->queues[QUEUE_MAIN].queue,
-		&(VkPresentInfoKHR){
-			.sType              = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-			.waitSemaphoreCount = 1,
-			.pWaitSemaphores    = (VkSemaphore[1]) { renderCommandBuffer->semaphoreComplete },
-			.swapchainCount     = 1,
-			.pSwapchains        = (VkSwapchainKHR[1]) { app->swapchain.swapchain },
-			.pImageIndices      = (uint32_t[1]) { app->backbufferIndex },
-		}
+	vkbase_profiler_cpu_marker_begin ( &app->profilerCpu, MARKER_CPU_RENDER_FB_PRESENT );
+	ret = vkbase_swapchain_present (
+		&app->swapchain, &app->queues[QUEUE_MAIN], renderCommandBuffer->semaphoreComplete,
+		app->backbufferIndex
 	);
-	if ( result != VK_SUCCESS )
-		return platform_throw_error ( -1, "vkQueuePresentKHR failed (%u)", result );
+	if ( ret != 0 )
+		return ret;
+	vkbase_profiler_cpu_marker_end ( &app->profilerCpu, MARKER_CPU_RENDER_FB_PRESENT );
 
-	return 0;
+	return vkbase_profiler_cpu_frame_end ( &app->profilerCpu );
 }
 
 ////////////////////////////////////////
@@ -1179,6 +2763,43 @@ int32_t app_init_command_infrastructure ( app_t* app )
 			NULL,
 			&cmdBuffer->semaphoreBackbufferWritable
 		);
+
+		// The command pools the worker threads record the views of this frame with. They are only
+		// ever reset as a whole, and their command buffers only live for a frame, which the
+		// transient flag hints at.
+
+		uint32_t threadCount = app->workers.threadCount;
+		cmdBuffer->threadCommandPools   = calloc ( threadCount, sizeof ( VkCommandPool ) );
+		cmdBuffer->threadCommandBuffers = calloc ( threadCount * VIEW_COUNT, sizeof ( VkCommandBuffer ) );
+
+		for ( uint32_t j = 0; j < threadCount; j++ )
+		{
+			VkResult result = vkCreateCommandPool (
+				app->device.device,
+				&(VkCommandPoolCreateInfo){
+					.sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+					.flags            = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+					.queueFamilyIndex = app->queues[QUEUE_MAIN].familyIndex,
+				},
+				NULL,
+				&cmdBuffer->threadCommandPools[j]
+			);
+			if ( result != VK_SUCCESS )
+				return platform_throw_error ( -1, "vkCreateCommandPool failed (%u)", result );
+
+			result = vkAllocateCommandBuffers (
+				app->device.device,
+				&(VkCommandBufferAllocateInfo){
+					.sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+					.commandPool        = cmdBuffer->threadCommandPools[j],
+					.level              = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+					.commandBufferCount = VIEW_COUNT,
+				},
+				&cmdBuffer->threadCommandBuffers[j * VIEW_COUNT]
+			);
+			if ( result != VK_SUCCESS )
+				return platform_throw_error ( -1, "vkAllocateCommandBuffers failed (%u)", result );
+		}
 	}
 
 	app->commandBufferStaging = commandBuffers[STATIC_ARRAY_LENGTH(app->commandBufferRender)];
@@ -1195,6 +2816,12 @@ int32_t app_destroy_command_infrastructure ( app_t* app )
 		vkDestroyFence ( app->device.device, cmdBuffer->fenceComplete, NULL );
 		vkDestroySemaphore ( app->device.device, cmdBuffer->semaphoreComplete, NULL );
 		vkDestroySemaphore ( app->device.device, cmdBuffer->semaphoreBackbufferWritable, NULL );
+
+		// Destroying a command pool frees the command buffers allocated from it as well
+		for ( uint32_t j = 0; j < app->workers.threadCount; j++ )
+			vkDestroyCommandPool ( app->device.device, cmdBuffer->threadCommandPools[j], NULL );
+		free ( cmdBuffer->threadCommandPools );
+		free ( cmdBuffer->threadCommandBuffers );
 	}
 
 	vkDestroyCommandPool ( app->device.device, app->commandPool, NULL );
@@ -1216,7 +2843,7 @@ int32_t app_init_swapchain_image_layouts ( app_t* app )
 			.srcAccessMask    = 0,
 			.dstAccessMask    = VK_ACCESS_MEMORY_READ_BIT,
 			.oldLayout        = VK_IMAGE_LAYOUT_UNDEFINED,
-			.newLayout        = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+			.newLayout        = app->swapchain.presentLayout,
 			.image            = app->swapchain.images[i],
 			.subresourceRange = {
 				.levelCount = 1, .layerCount = 1, .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
@@ -1306,14 +2933,15 @@ int32_t app_init_descriptor_sets ( app_t* app )
 		&(VkDescriptorPoolCreateInfo){
 			.sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
 			.flags         = 0,
-			.maxSets       = textureCount + 2,
-			.poolSizeCount = 5,
-			.pPoolSizes    = (VkDescriptorPoolSize[5]){
+			.maxSets       = textureCount + 3 + MODEL_COUNT,
+			.poolSizeCount = 6,
+			.pPoolSizes    = (VkDescriptorPoolSize[6]){
 				{ .type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,          .descriptorCount = textureCount+1 },
 				{ .type = VK_DESCRIPTOR_TYPE_SAMPLER,                .descriptorCount = textureCount+1 },
 				{ .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, .descriptorCount = textureCount+1 },
-				{ .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, .descriptorCount = textureCount+1 },
+				{ .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, .descriptorCount = textureCount+2+MODEL_COUNT },
 				{ .type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,       .descriptorCount = 1 },
+				{ .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,         .descriptorCount = 5*MODEL_COUNT },
 			},
 		},
 		NULL,
@@ -1322,8 +2950,11 @@ int32_t app_init_descriptor_sets ( app_t* app )
 	if ( vkResult != VK_SUCCESS )
 		return platform_throw_error ( -1, "vkCreateDescriptorPool failed (%u)", vkResult );
 
-	// Note we set "maxSets" to "textureCount + 2". With this, I intend to say "We want a descriptor
-	// set for every single texture, plus two descriptor sets unrelated to textures."
+	// Note we set "maxSets" to "textureCount + 3". With this, I intend to say "We want a descriptor
+	// set for every single texture, plus three descriptor sets unrelated to textures." The third
+	// one, only needed to render all shadow maps in a single pass, just holds the light buffer,
+	// hence the extra dynamic uniform buffer. Culling on the GPU takes another set for every model,
+	// with the cull buffer and three storage buffers each.
 	//
 	// We also want "textureCount + 1" sampled image objects. (images to be sampled in the shader)
 	// The +1 in this case is to account for the dummy texture in the case the object has no
@@ -1401,6 +3032,169 @@ int32_t app_init_descriptor_sets ( app_t* app )
 	if ( vkResult != VK_SUCCESS )
 		return platform_throw_error ( -1, "vkCreateDescriptorSetLayout failed (%u)", vkResult );
 
+	// Rendering all shadow maps in a single pass, the geometry shader needs the matrices of all
+	// lights. These are in the light buffer already, so that is all its descriptor set holds. The
+	// set is only made when it is used, as geometry shader stages are off limits otherwise.
+
+	if ( app->shadowRenderpass.layered )
+	{
+		vkResult = vkCreateDescriptorSetLayout (
+			app->device.device,
+			&(VkDescriptorSetLayoutCreateInfo){
+				.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+				.bindingCount = 1,
+				.pBindings    = (VkDescriptorSetLayoutBinding[1]){
+					{
+						.binding         = 0,
+						.descriptorType  = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+						.descriptorCount = 1,
+						.stageFlags      = VK_SHADER_STAGE_GEOMETRY_BIT,
+					},
+				},
+			},
+			NULL,
+			&app->descriptorSetLayoutShadowLayered
+		);
+		if ( vkResult != VK_SUCCESS )
+			return platform_throw_error ( -1, "vkCreateDescriptorSetLayout failed (%u)", vkResult );
+
+		vkResult = vkAllocateDescriptorSets (
+			app->device.device,
+			&(VkDescriptorSetAllocateInfo){
+				.sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+				.descriptorPool     = app->descriptorPool,
+				.descriptorSetCount = 1,
+				.pSetLayouts        = &app->descriptorSetLayoutShadowLayered,
+			},
+			&app->descriptorSetShadowLayered
+		);
+		if ( vkResult != VK_SUCCESS )
+			return platform_throw_error ( -1, "vkAllocateDescriptorSets failed (%u)", vkResult );
+
+		vkUpdateDescriptorSets (
+			app->device.device,
+			1, (VkWriteDescriptorSet[1]){
+				{
+					.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+					.dstSet          = app->descriptorSetShadowLayered,
+					.dstBinding      = 0,
+					.descriptorCount = 1,
+					.descriptorType  = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+					.pBufferInfo     = &(VkDescriptorBufferInfo){
+						.buffer = app->staticResources.lightBuffer,
+						.offset = 0,
+						.range  = sizeof ( forward_vs_cb_t ),
+					},
+				},
+			},
+			0, NULL
+		);
+	}
+
+	// Culling on the GPU, the compute shader culls a model at a time. It gets the views to cull
+	// for from the cull buffer, and the buffers of the model with its objects and their clusters,
+	// and the draws and counts to write for them, see app_init_model_draws. The bounds of the
+	// shadow receivers are gathered across all models, in the one receiver buffer.
+
+	if ( app->gpuDriven )
+	{
+		vkResult = vkCreateDescriptorSetLayout (
+			app->device.device,
+			&(VkDescriptorSetLayoutCreateInfo){
+				.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+				.bindingCount = 6,
+				.pBindings    = (VkDescriptorSetLayoutBinding[6]){
+					{
+						.binding         = 0,
+						.descriptorType  = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+						.descriptorCount = 1,
+						.stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT,
+					},
+					{
+						.binding         = 1,
+						.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+						.descriptorCount = 1,
+						.stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT,
+					},
+					{
+						.binding         = 2,
+						.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+						.descriptorCount = 1,
+						.stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT,
+					},
+					{
+						.binding         = 3,
+						.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+						.descriptorCount = 1,
+						.stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT,
+					},
+					{
+						.binding         = 4,
+						.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+						.descriptorCount = 1,
+						.stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT,
+					},
+					{
+						.binding         = 5,
+						.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+						.descriptorCount = 1,
+						.stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT,
+					},
+				},
+			},
+			NULL,
+			&app->descriptorSetLayoutCull
+		);
+		if ( vkResult != VK_SUCCESS )
+			return platform_throw_error ( -1, "vkCreateDescriptorSetLayout failed (%u)", vkResult );
+
+		for ( uint32_t i = 0; i < MODEL_COUNT; i++ )
+		{
+			vkResult = vkAllocateDescriptorSets (
+				app->device.device,
+				&(VkDescriptorSetAllocateInfo){
+					.sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+					.descriptorPool     = app->descriptorPool,
+					.descriptorSetCount = 1,
+					.pSetLayouts        = &app->descriptorSetLayoutCull,
+				},
+				&app->modelDraws[i].descriptorSet
+			);
+			if ( vkResult != VK_SUCCESS )
+				return platform_throw_error ( -1, "vkAllocateDescriptorSets failed (%u)", vkResult );
+
+			VkBuffer buffers[6] = {
+				app->staticResources.cullBuffer,
+				app->modelDraws[i].objectBuffer,
+				app->modelDraws[i].drawBuffer,
+				app->modelDraws[i].countBuffer,
+				app->modelDraws[i].clusterBuffer,
+				app->staticResources.receiverBuffer,
+			};
+			VkDescriptorBufferInfo bufferInfos[6];
+			VkWriteDescriptorSet   descriptorWriteOps[6];
+			for ( uint32_t j = 0; j < 6; j++ )
+			{
+				bufferInfos[j] = (VkDescriptorBufferInfo){
+					.buffer = buffers[j],
+					.offset = 0,
+					.range  = j == 0 ? sizeof ( cull_cb_t ) : VK_WHOLE_SIZE,
+				};
+				descriptorWriteOps[j] = (VkWriteDescriptorSet){
+					.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+					.dstSet          = app->modelDraws[i].descriptorSet,
+					.dstBinding      = j,
+					.descriptorCount = 1,
+					.descriptorType  = j == 0
+						? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC
+						: VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+					.pBufferInfo     = &bufferInfos[j],
+				};
+			}
+
+			vkUpdateDescriptorSets ( app->device.device, 6, descriptorWriteOps, 0, NULL );
+		}
+	}
 	
 	// With the pool created, we can start allocating descriptor sets from the pool. We start off
 	// by allocating the default descriptor sets for the dummy texture and the post processing
@@ -1595,6 +3389,8 @@ int32_t app_destroy_descriptor_sets ( app_t* app )
 	vkDestroyDescriptorPool ( app->device.device, app->descriptorPool, NULL );
 	vkDestroyDescriptorSetLayout ( app->device.device, app->descriptorSetLayout[PIPELINE_FORWARD], NULL );
 	vkDestroyDescriptorSetLayout ( app->device.device, app->descriptorSetLayout[PIPELINE_POST], NULL );
+	vkDestroyDescriptorSetLayout ( app->device.device, app->descriptorSetLayoutShadowLayered, NULL );
+	vkDestroyDescriptorSetLayout ( app->device.device, app->descriptorSetLayoutCull, NULL );
 	return 0;
 }
 
@@ -1652,8 +3448,8 @@ int32_t app_init_renderpass ( app_t* app )
 					.samples       = VK_SAMPLE_COUNT_1_BIT,
 					.loadOp        = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
 					.storeOp       = VK_ATTACHMENT_STORE_OP_STORE,
-					.initialLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-					.finalLayout   = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+					.initialLayout = app->swapchain.presentLayout,
+					.finalLayout   = app->swapchain.presentLayout,
 				},
 			},
 			.subpassCount = SUBPASS_COUNT,
@@ -1743,6 +3539,48 @@ int32_t app_init_renderpass ( app_t* app )
 	if ( result != 0 )
 		return platform_throw_error ( -1, "vkCreateRenderPass failed (%u)", result );
 
+	// Rendering all shadow maps in a single pass, not all of them are necessarily rendered again.
+	// The ones that are get cleared in the pass itself, and the others are kept: this render pass
+	// loads the shadow maps rather than clearing them. Render passes only differing in load and
+	// store operations are compatible, so the same framebuffer and pipelines work with either.
+
+	if ( app->shadowRenderpass.layered )
+	{
+		result = vkCreateRenderPass (
+			app->device.device,
+			&(VkRenderPassCreateInfo){
+				.sType           = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+				.attachmentCount = 1,
+				.pAttachments    = (VkAttachmentDescription[1]){
+					[0] = {
+						.format        = VK_FORMAT_D32_SFLOAT,
+						.samples       = VK_SAMPLE_COUNT_1_BIT,
+						.loadOp        = VK_ATTACHMENT_LOAD_OP_LOAD,
+						.storeOp       = VK_ATTACHMENT_STORE_OP_STORE,
+						.initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+						.finalLayout   = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+					},
+				},
+				.subpassCount = 1,
+				.pSubpasses   = (VkSubpassDescription[1]){
+					[0] = {
+						.pipelineBindPoint    = VK_PIPELINE_BIND_POINT_GRAPHICS,
+						.colorAttachmentCount = 0,
+						.pDepthStencilAttachment = &(VkAttachmentReference){
+							.attachment = 0,
+							.layout     = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+						},
+					},
+				},
+				.dependencyCount = 0,
+			},
+			NULL,
+			&app->shadowRenderpass.renderPassKeep
+		);
+		if ( result != 0 )
+			return platform_throw_error ( -1, "vkCreateRenderPass failed (%u)", result );
+	}
+
 	//
 	//
 	//
@@ -1753,6 +3591,8 @@ int32_t app_init_renderpass ( app_t* app )
 int32_t app_destroy_renderpass ( app_t* app )
 {
 	vkDestroyRenderPass ( app->device.device, app->renderpass.renderPass, NULL );
+	vkDestroyRenderPass ( app->device.device, app->shadowRenderpass.renderPass, NULL );
+	vkDestroyRenderPass ( app->device.device, app->shadowRenderpass.renderPassKeep, NULL );
 	return 0;
 }
 
@@ -1839,23 +3679,147 @@ int32_t app_init_graphics_pipeline_prerequisites ( app_t* app )
 	if ( vkResult != VK_SUCCESS )
 		return platform_throw_error ( -1, "vkCreatePipelineLayout failed (%u)", vkResult );
 
+	// Rendering all shadow maps at once takes the same push constants, plus the light buffer for
+	// the geometry shader.
+
+	if ( app->shadowRenderpass.layered )
+	{
+		vkResult = vkCreatePipelineLayout (
+			app->device.device,
+			&(VkPipelineLayoutCreateInfo){
+				.sType                  = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+				.setLayoutCount         = 1,
+				.pSetLayouts            = &app->descriptorSetLayoutShadowLayered,
+				.pushConstantRangeCount = 2,
+				.pPushConstantRanges    = (VkPushConstantRange[2]){
+					{
+						.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+						.offset     = 0,
+						.size       = 16 * sizeof ( float ),
+					},
+					{
+						.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+						.offset     = 64,
+						.size       = 16 * sizeof ( float ),
+					},
+				},
+			},
+			NULL,
+			&app->pipelineLayoutShadowLayered
+		);
+		if ( vkResult != VK_SUCCESS )
+			return platform_throw_error ( -1, "vkCreatePipelineLayout failed (%u)", vkResult );
+	}
+
+	// Culling on the GPU takes the descriptor set of a model, and its amount of objects, groups and
+	// draws as push constants, along with which of the two passes it is.
+
+	if ( app->gpuDriven )
+	{
+		vkResult = vkCreatePipelineLayout (
+			app->device.device,
+			&(VkPipelineLayoutCreateInfo){
+				.sType                  = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+				.setLayoutCount         = 1,
+				.pSetLayouts            = &app->descriptorSetLayoutCull,
+				.pushConstantRangeCount = 1,
+				.pPushConstantRanges    = (VkPushConstantRange[1]){
+					{
+						.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+						.offset     = 0,
+						.size       = 4 * sizeof ( uint32_t ),
+					},
+				},
+			},
+			NULL,
+			&app->pipelineLayoutCull
+		);
+		if ( vkResult != VK_SUCCESS )
+			return platform_throw_error ( -1, "vkCreatePipelineLayout failed (%u)", vkResult );
+	}
+
 	// While pipelines can be created and destroyed without issue, it is advisable to use a
 	// pipeline cache in order to allow the implementation to reuse as many pipeline properties
 	// as possible, and potentially avoid needless pipeline construction time.
 
 	// In addition, this pipeline cache can be written to disk and reloaded next time the app is
-	// started to reduce startup time.
+	// started to reduce startup time. That is exactly what we do: app_destroy_graphics_pipeline_
+	// prerequisites stores the cache, and here we load whatever was stored last time. The data is
+	// only valid for the exact same device and driver, which vkutil_create_pipeline_cache checks
+	// for us; if the data turns out to be stale, it is discarded and we start over empty.
+
+	file_t cacheFile;
+	int32_t ret = platform_data_file_load ( &cacheFile, PIPELINE_CACHE_FILE );
+	if ( ret < 0 )
+		return ret;
 
-	vkResult = vkCreatePipelineCache (
-		app->device.device,
-		&(VkPipelineCacheCreateInfo){
-			.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
-		},
-		NULL,
-		&app->pipelineCache
+	ret = vkutil_create_pipeline_cache (
+		app->device.device, &app->device.properties,
+		cacheFile.data, cacheFile.sizeInBytes, &app->pipelineCache
 	);
-	if ( vkResult != VK_SUCCESS )
-		return platform_throw_error ( -1, "vkCreatePipelineCache failed (%u)", vkResult );
+	if ( cacheFile.data != NULL )
+		platform_file_close ( &cacheFile );
+	if ( ret < 0 )
+		return platform_throw_error ( ret, "vkutil_create_pipeline_cache failed (%i)", ret );
+	if ( ret == 1 )
+		platform_log_warning ( "Discarding pipeline cache from another device or driver\n" );
+
+	// Unlike the graphics pipelines, the compute pipeline culling on the GPU doesn't depend on the
+	// size of the window at all, so it's created once, right here. A compute pipeline is nothing
+	// but its shader, which is told whether the draws are to be counted through a specialization
+	// constant, see cull_c.glsl.
+
+	if ( app->gpuDriven )
+	{
+		file_t file;
+		if ( platform_file_load ( &file, "shaders/cull_c.spv" ) != 0 )
+			return -1;
+
+		VkShaderModule shaderModule;
+		vkResult = vkCreateShaderModule (
+			app->device.device,
+			&(VkShaderModuleCreateInfo){
+				.sType    = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+				.codeSize = file.sizeInBytes,
+				.pCode    = file.data,
+			},
+			NULL,
+			&shaderModule
+		);
+		platform_file_close ( &file );
+		if ( vkResult != VK_SUCCESS )
+			return platform_throw_error ( -1, "vkCreateShaderModule failed (%u)", vkResult );
+
+		vkResult = vkCreateComputePipelines (
+			app->device.device,
+			app->pipelineCache,
+			1, (VkComputePipelineCreateInfo[1]){
+				{
+					.sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+					.stage  = {
+						.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+						.stage  = VK_SHADER_STAGE_COMPUTE_BIT,
+						.module = shaderModule,
+						.pName  = "main",
+						.pSpecializationInfo = &(VkSpecializationInfo){
+							.mapEntryCount = 1,
+							.pMapEntries   = (VkSpecializationMapEntry[1]){
+								{ .constantID = 0, .offset = 0, .size = sizeof ( VkBool32 ) },
+							},
+							.dataSize = sizeof ( VkBool32 ),
+							.pData    = &app->device.drawIndirectCount,
+						},
+					},
+					.layout = app->pipelineLayoutCull,
+				},
+			},
+			NULL,
+			&app->pipelineCull
+		);
+		vkDestroyShaderModule ( app->device.device, shaderModule, NULL );
+		if ( vkResult != VK_SUCCESS )
+			return platform_throw_error ( -1, "vkCreateComputePipelines failed (%u)", vkResult );
+	}
 
 	return 0;
 }
@@ -1869,6 +3833,22 @@ int32_t app_destroy_graphics_pipeline_prerequisites ( app_t* app )
 
 	vkDestroyPipelineLayout ( app->device.device, app->pipelineLayout[PIPELINE_FORWARD], NULL );
 	vkDestroyPipelineLayout ( app->device.device, app->pipelineLayout[PIPELINE_POST], NULL );
+	vkDestroyPipelineLayout ( app->device.device, app->pipelineLayoutShadow, NULL );
+	vkDestroyPipelineLayout ( app->device.device, app->pipelineLayoutShadowLayered, NULL );
+	vkDestroyPipelineLayout ( app->device.device, app->pipelineLayoutCull, NULL );
+	vkDestroyPipeline ( app->device.device, app->pipelineCull, NULL );
+
+	// Store the pipeline cache for the next run. Failing to do so only makes the next startup
+	// slower, so there's no reason to fail here.
+
+	void* cacheData;
+	size_t cacheDataSize;
+	if ( vkutil_get_pipeline_cache_data ( app->device.device, app->pipelineCache, &cacheData, &cacheDataSize ) == 0 )
+	{
+		platform_data_file_store ( PIPELINE_CACHE_FILE, cacheData, cacheDataSize );
+		free ( cacheData );
+	}
+
 	vkDestroyPipelineCache ( app->device.device, app->pipelineCache, NULL );
 	return 0;
 }
@@ -1888,6 +3868,8 @@ int32_t app_init_graphics_pipelines ( app_t* app, uint32_t windowWidth, uint32_t
 	enum
 	{
 		SHADER_SHADOW_VERT,
+		SHADER_SHADOW_LAYERED_VERT,
+		SHADER_SHADOW_LAYERED_GEOM,
 		SHADER_FORWARD_VERT,
 		SHADER_FORWARD_FRAG,
 		SHADER_POST_VERT,
@@ -1901,18 +3883,38 @@ int32_t app_init_graphics_pipelines ( app_t* app, uint32_t windowWidth, uint32_t
 		const char* path;
 		VkShaderModule outModule;
 	} shaders[SHADER_COUNT] = {
-		[SHADER_SHADOW_VERT]  = { .path = "shaders/shadow_v.spv", },
-		[SHADER_FORWARD_VERT] = { .path = "shaders/forward_v.spv", },
-		[SHADER_FORWARD_FRAG] = { .path = "shaders/forward_f.spv", },
-		[SHADER_POST_VERT]    = { .path = "shaders/post_v.spv",    },
-		[SHADER_POST_FRAG]    = { .path = "shaders/post_f.spv",    },
+		[SHADER_SHADOW_VERT]         = { .path = "shaders/shadow_v.spv",         },
+		[SHADER_SHADOW_LAYERED_VERT] = { .path = "shaders/shadow_layered_v.spv", },
+		[SHADER_SHADOW_LAYERED_GEOM] = { .path = "shaders/shadow_layered_g.spv", },
+		[SHADER_FORWARD_VERT]        = { .path = "shaders/forward_v.spv",        },
+		[SHADER_FORWARD_FRAG]        = { .path = "shaders/forward_f.spv",        },
+		[SHADER_POST_VERT]           = { .path = "shaders/post_v.spv",           },
+		[SHADER_POST_FRAG]           = { .path = "shaders/post_f.spv",           },
 	};
 
+	// Geometry shaders may not even be loaded on devices without them, so the shaders for
+	// rendering all shadow maps in a single pass are skipped when it's not done.
+
+	if ( !app->shadowRenderpass.layered )
+	{
+		shaders[SHADER_SHADOW_LAYERED_VERT].path = NULL;
+		shaders[SHADER_SHADOW_LAYERED_GEOM].path = NULL;
+	}
+
+	// The vertex input of the pipelines depends on the vertex format of the models. The model has
+	// been loaded by now, and the pipelines are made for its format; all models are expected to
+	// share it.
+
+	const vertex_layout_t* vertexLayout = &VERTEX_LAYOUTS[app->model[MODEL_TEXCUBE].vertexFormat];
+
 	// Create the aforementioned shader modules. If any of these fail, check the documentation
 	// for compiling the shaders, as you have probably skipped that step.
 
 	for ( uint32_t i = 0; i < STATIC_ARRAY_LENGTH(shaders); i++ )
 	{
+		if ( shaders[i].path == NULL )
+			continue;
+
 		file_t file;
 		if ( platform_file_load ( &file, shaders[i].path ) != 0 )
 			return -1;
@@ -1974,6 +3976,14 @@ int32_t app_init_graphics_pipelines ( app_t* app, uint32_t windowWidth, uint32_t
 						.stage  = VK_SHADER_STAGE_VERTEX_BIT,
 						.module = shaders[SHADER_FORWARD_VERT].outModule,
 						.pName  = "main",
+						.pSpecializationInfo = &(VkSpecializationInfo){
+							.mapEntryCount = 1,
+							.pMapEntries   = (VkSpecializationMapEntry[1]){
+								{ .constantID = 0, .offset = 0, .size = sizeof ( VkBool32 ) },
+							},
+							.dataSize = sizeof ( VkBool32 ),
+							.pData    = &vertexLayout->octahedralNormals,
+						},
 					},
 					{
 						.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
@@ -1988,32 +3998,12 @@ int32_t app_init_graphics_pipelines ( app_t* app, uint32_t windowWidth, uint32_t
 					.pVertexBindingDescriptions    = (VkVertexInputBindingDescription[1]){
 						{
 							.binding   = 0,
-							.stride    = sizeof ( bobj_vert ),
+							.stride    = vertexLayout->stride,
 							.inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
 						},
 					},
 					.vertexAttributeDescriptionCount = VERTEX_ATTRIBUTE_COUNT,
-					.pVertexAttributeDescriptions = 
-						(VkVertexInputAttributeDescription[VERTEX_ATTRIBUTE_COUNT]){
-						[VERTEX_ATTRIBUTE_POSITION] = {
-							.location = VERTEX_ATTRIBUTE_POSITION,
-							.binding  = 0,
-							.format   = VK_FORMAT_R32G32B32_SFLOAT,
-							.offset   = offsetof(bobj_vert, position),
-						},
-						[VERTEX_ATTRIBUTE_TEXCOORD] = {
-							.location = VERTEX_ATTRIBUTE_TEXCOORD,
-							.binding  = 0,
-							.format   = VK_FORMAT_R32G32_SFLOAT,
-							.offset   = offsetof(bobj_vert, texcoord),
-						},
-						[VERTEX_ATTRIBUTE_NORMAL] = {
-							.location = VERTEX_ATTRIBUTE_NORMAL,
-							.binding  = 0,
-							.format   = VK_FORMAT_R32G32B32_SFLOAT,
-							.offset   = offsetof(bobj_vert, normal),
-						},
-					},
+					.pVertexAttributeDescriptions    = vertexLayout->attributes,
 				},
 				.pInputAssemblyState = &(VkPipelineInputAssemblyStateCreateInfo){
 					.sType    = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
@@ -2167,105 +4157,138 @@ int32_t app_init_graphics_pipelines ( app_t* app, uint32_t windowWidth, uint32_t
 	if ( vkResult != VK_SUCCESS )
 		return platform_throw_error ( -1, "vkCreateGraphicsPipelines failed (%u)", vkResult );
 
-	//
+	// The shadow maps only need the depth of the geometry, so their pipeline only has a vertex
+	// shader. It's the base of the pipeline rendering all shadow maps in a single pass below.
 
-	vkResult = vkCreateGraphicsPipelines (
-		app->device.device,
-		app->pipelineCache,
-		1,
-		(VkGraphicsPipelineCreateInfo[1]){
-			[0] = {
-				.sType      = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-				.flags      = VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT,
-				.stageCount = 1,
-				.pStages    = (VkPipelineShaderStageCreateInfo[1]){
-					{
-						.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-						.stage  = VK_SHADER_STAGE_VERTEX_BIT,
-						.module = shaders[SHADER_SHADOW_VERT].outModule,
-						.pName  = "main",
-					},
-				},
-				.pVertexInputState = &(VkPipelineVertexInputStateCreateInfo){
-					.sType             = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-					.vertexBindingDescriptionCount = 1,
-					.pVertexBindingDescriptions    = (VkVertexInputBindingDescription[1]){
-						{
-							.binding   = 0,
-							.stride    = sizeof ( bobj_vert ),
-							.inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
-						},
-					},
-					.vertexAttributeDescriptionCount = 1,
-					.pVertexAttributeDescriptions = 
-						(VkVertexInputAttributeDescription[1]){
-						[0] = {
-							.location = VERTEX_ATTRIBUTE_POSITION,
-							.binding  = 0,
-							.format   = VK_FORMAT_R32G32B32_SFLOAT,
-							.offset   = offsetof(bobj_vert, position),
-						},
-					},
-				},
-				.pInputAssemblyState = &(VkPipelineInputAssemblyStateCreateInfo){
-					.sType    = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-					.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
-				},
-				.pViewportState = &(VkPipelineViewportStateCreateInfo){
-					.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
-					.viewportCount = 1,
-					.pViewports = (VkViewport[1]){
-						{
-							.width = (float)SHADOW_MAP_WIDTH, .height = (float)SHADOW_MAP_HEIGHT,
-							.minDepth = 0.0f, .maxDepth =  1.0f,
-						},
-					},
-					.scissorCount = 1,
-					.pScissors = (VkRect2D[1]){
-						{ .extent.width = SHADOW_MAP_WIDTH, .extent.height = SHADOW_MAP_HEIGHT },
-					},
-				},
-				.pRasterizationState = &(VkPipelineRasterizationStateCreateInfo){
-					.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
-					.depthClampEnable        = VK_FALSE,
-					.rasterizerDiscardEnable = VK_FALSE,
-					.polygonMode             = VK_POLYGON_MODE_FILL,
-					.cullMode                = VK_CULL_MODE_NONE,
-					.frontFace               = VK_FRONT_FACE_COUNTER_CLOCKWISE,
-					.depthBiasEnable         = VK_TRUE,
-					.depthBiasConstantFactor = 5.0f,
-					.depthBiasSlopeFactor    = 1.5f,
-					.lineWidth               = 1.0f,
-				},
-				.pMultisampleState = &(VkPipelineMultisampleStateCreateInfo){
-					.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
-					.rasterizationSamples  = VK_SAMPLE_COUNT_1_BIT,
-					.sampleShadingEnable   = VK_FALSE,
-					.alphaToCoverageEnable = VK_FALSE,
-					.alphaToOneEnable      = VK_FALSE,
-				},
-				.pDepthStencilState = &(VkPipelineDepthStencilStateCreateInfo){
-					.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
-					.depthTestEnable       = VK_TRUE,
-					.depthWriteEnable      = VK_TRUE,
-					.depthCompareOp        = VK_COMPARE_OP_LESS,
-					.depthBoundsTestEnable = VK_FALSE,
-					.stencilTestEnable     = VK_FALSE,
+	VkGraphicsPipelineCreateInfo shadowPipelineCreateInfo = {
+		.sType      = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+		.flags      = VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT,
+		.stageCount = 1,
+		.pStages    = (VkPipelineShaderStageCreateInfo[1]){
+			{
+				.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+				.stage  = VK_SHADER_STAGE_VERTEX_BIT,
+				.module = shaders[SHADER_SHADOW_VERT].outModule,
+				.pName  = "main",
+			},
+		},
+		.pVertexInputState = &(VkPipelineVertexInputStateCreateInfo){
+			.sType             = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+			.vertexBindingDescriptionCount = 1,
+			.pVertexBindingDescriptions    = (VkVertexInputBindingDescription[1]){
+				{
+					.binding   = 0,
+					.stride    = vertexLayout->positionStride,
+					.inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
 				},
-				.pColorBlendState = &(VkPipelineColorBlendStateCreateInfo){
-					.sType           = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
-					.logicOpEnable   = VK_FALSE,
-					.attachmentCount = 0,
+			},
+			.vertexAttributeDescriptionCount = 1,
+			.pVertexAttributeDescriptions    = &vertexLayout->positionAttribute,
+		},
+		.pInputAssemblyState = &(VkPipelineInputAssemblyStateCreateInfo){
+			.sType    = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+			.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+		},
+		.pViewportState = &(VkPipelineViewportStateCreateInfo){
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+			.viewportCount = 1,
+			.pViewports = (VkViewport[1]){
+				{
+					.width = (float)SHADOW_MAP_WIDTH, .height = (float)SHADOW_MAP_HEIGHT,
+					.minDepth = 0.0f, .maxDepth =  1.0f,
 				},
-				.pDynamicState = NULL,
-				.layout        = app->pipelineLayoutShadow,
-				.renderPass    = app->shadowRenderpass.renderPass,
-				.subpass       = 0,
 			},
+			.scissorCount = 1,
+			.pScissors = (VkRect2D[1]){
+				{ .extent.width = SHADOW_MAP_WIDTH, .extent.height = SHADOW_MAP_HEIGHT },
+			},
+		},
+		.pRasterizationState = &(VkPipelineRasterizationStateCreateInfo){
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+			.depthClampEnable        = VK_FALSE,
+			.rasterizerDiscardEnable = VK_FALSE,
+			.polygonMode             = VK_POLYGON_MODE_FILL,
+			.cullMode                = VK_CULL_MODE_NONE,
+			.frontFace               = VK_FRONT_FACE_COUNTER_CLOCKWISE,
+			.depthBiasEnable         = VK_TRUE,
+			.depthBiasConstantFactor = 5.0f,
+			.depthBiasSlopeFactor    = 1.5f,
+			.lineWidth               = 1.0f,
+		},
+		.pMultisampleState = &(VkPipelineMultisampleStateCreateInfo){
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+			.rasterizationSamples  = VK_SAMPLE_COUNT_1_BIT,
+			.sampleShadingEnable   = VK_FALSE,
+			.alphaToCoverageEnable = VK_FALSE,
+			.alphaToOneEnable      = VK_FALSE,
 		},
+		.pDepthStencilState = &(VkPipelineDepthStencilStateCreateInfo){
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+			.depthTestEnable       = VK_TRUE,
+			.depthWriteEnable      = VK_TRUE,
+			.depthCompareOp        = VK_COMPARE_OP_LESS,
+			.depthBoundsTestEnable = VK_FALSE,
+			.stencilTestEnable     = VK_FALSE,
+		},
+		.pColorBlendState = &(VkPipelineColorBlendStateCreateInfo){
+			.sType           = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+			.logicOpEnable   = VK_FALSE,
+			.attachmentCount = 0,
+		},
+		.pDynamicState = NULL,
+		.layout        = app->pipelineLayoutShadow,
+		.renderPass    = app->shadowRenderpass.renderPass,
+		.subpass       = 0,
+	};
+
+	vkResult = vkCreateGraphicsPipelines (
+		app->device.device,
+		app->pipelineCache,
+		1, &shadowPipelineCreateInfo,
 		NULL,
 		&app->shadowRenderpass.pipeline
 	);
+	if ( vkResult != VK_SUCCESS )
+		return platform_throw_error ( -1, "vkCreateGraphicsPipelines failed (%u)", vkResult );
+
+	// Rendering all shadow maps in a single pass differs in its shaders and layout only. The vertex
+	// shader leaves the positions in world space, and the geometry shader transforms every triangle
+	// for the light of its instance, sending it to the layer of that light. As the rest is the same,
+	// the pipeline is derived from the one above, which may speed up creating it.
+
+	if ( app->shadowRenderpass.layered )
+	{
+		VkGraphicsPipelineCreateInfo layeredPipelineCreateInfo = shadowPipelineCreateInfo;
+		layeredPipelineCreateInfo.flags      = VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+		layeredPipelineCreateInfo.stageCount = 2;
+		layeredPipelineCreateInfo.pStages    = (VkPipelineShaderStageCreateInfo[2]){
+			{
+				.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+				.stage  = VK_SHADER_STAGE_VERTEX_BIT,
+				.module = shaders[SHADER_SHADOW_LAYERED_VERT].outModule,
+				.pName  = "main",
+			},
+			{
+				.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+				.stage  = VK_SHADER_STAGE_GEOMETRY_BIT,
+				.module = shaders[SHADER_SHADOW_LAYERED_GEOM].outModule,
+				.pName  = "main",
+			},
+		};
+		layeredPipelineCreateInfo.layout             = app->pipelineLayoutShadowLayered;
+		layeredPipelineCreateInfo.basePipelineHandle = app->shadowRenderpass.pipeline;
+		layeredPipelineCreateInfo.basePipelineIndex  = -1;
+
+		vkResult = vkCreateGraphicsPipelines (
+			app->device.device,
+			app->pipelineCache,
+			1, &layeredPipelineCreateInfo,
+			NULL,
+			&app->shadowRenderpass.pipelineLayered
+		);
+		if ( vkResult != VK_SUCCESS )
+			return platform_throw_error ( -1, "vkCreateGraphicsPipelines failed (%u)", vkResult );
+	}
 
 	// 
 
@@ -2285,6 +4308,8 @@ int32_t app_destroy_graphics_pipelines ( app_t* app )
 	{
 		vkDestroyPipeline ( app->device.device, app->renderpass.pipeline[i], NULL );
 	}
+	vkDestroyPipeline ( app->device.device, app->shadowRenderpass.pipeline, NULL );
+	vkDestroyPipeline ( app->device.device, app->shadowRenderpass.pipelineLayered, NULL );
 	return 0;
 }
 
@@ -2470,14 +4495,19 @@ int32_t app_init_static_resources ( app_t* app )
 		},
 	};
 
+	uint64_t uploadTicket;
 	int32_t ret = vkutil_create_images_helper (
-		app->device.device, app->commandBufferStaging, app->queues[QUEUE_MAIN].queue,
-		&app->device.memoryProperties, STATIC_TEXTURE_COUNT, staticTextureCreateInfo,
-		&app->staticResources.imageMemory
+		&app->uploader, STATIC_TEXTURE_COUNT, staticTextureCreateInfo,
+		app->staticResources.imageAllocations, &uploadTicket
 	);
 	if ( ret != 0 )
 		return platform_throw_error ( -1, "vkutil_create_images_helper failed (%d)", ret );
 
+	// These are used by every frame, so there is no point in not waiting for them
+	ret = vkutil_uploader_wait ( &app->uploader, uploadTicket );
+	if ( ret != 0 )
+		return platform_throw_error ( -1, "vkutil_uploader_wait failed (%d)", ret );
+
 	// We also want to create a buffer to store light data into.
 	// The size calculation might look a little funky, but it is effectively like this:
 	// - We might have RENDER_COMMAND_BUFFER_COUNT buffers in-flight. If we edit the data while
@@ -2496,7 +4526,6 @@ int32_t app_init_static_resources ( app_t* app )
 			app->device.properties.limits.minUniformBufferOffsetAlignment
 		) * RENDER_COMMAND_BUFFER_COUNT;
 
-	VkMemoryRequirements bufferRequirements;
 	vkResult = vkCreateBuffer (
 		app->device.device,
 		&(VkBufferCreateInfo){
@@ -2510,26 +4539,71 @@ int32_t app_init_static_resources ( app_t* app )
 	if ( vkResult != VK_SUCCESS )
 		return platform_throw_error ( -1, "vkCreateBuffer failed (%d)", ret );
 
-	vkGetBufferMemoryRequirements (
-		app->device.device, app->staticResources.lightBuffer, &bufferRequirements
-	);
+	// The allocator keeps host visible memory mapped, so in app_render we can write the light
+	// data through lightBufferAllocation.mapped. Coherent memory saves us from having to flush.
 
-	ret = vkutil_multi_alloc_helper (
-		app->device.device,
-		&app->device.memoryProperties,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-		1, &bufferRequirements,
-		&app->staticResources.lightBufferMemory, NULL, NULL
+	ret = vkutil_allocator_alloc_buffer (
+		&app->allocator, app->staticResources.lightBuffer,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&app->staticResources.lightBufferAllocation
 	);
 	if ( ret != 0 )
-		return platform_throw_error ( -1, "vkutil_multi_alloc_helper failed (%d)", ret );
+		return platform_throw_error ( -1, "vkutil_allocator_alloc_buffer failed (%d)", ret );
 
-	vkResult = vkBindBufferMemory (
-		app->device.device, app->staticResources.lightBuffer,
-		app->staticResources.lightBufferMemory, 0
-	);
-	if ( vkResult != VK_SUCCESS )
-		return platform_throw_error ( -1, "vkBindBufferMemory failed (%d)", ret );
+	// Culling on the GPU, the views to cull for are passed in the same way, see app_render
+
+	if ( app->gpuDriven )
+	{
+		bufferSize =
+			RVM_ALIGN_UP_POW2 (
+				sizeof ( cull_cb_t ),
+				app->device.properties.limits.minUniformBufferOffsetAlignment
+			) * RENDER_COMMAND_BUFFER_COUNT;
+
+		vkResult = vkCreateBuffer (
+			app->device.device,
+			&(VkBufferCreateInfo){
+				.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+				.size  = bufferSize,
+				.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+			},
+			NULL,
+			&app->staticResources.cullBuffer
+		);
+		if ( vkResult != VK_SUCCESS )
+			return platform_throw_error ( -1, "vkCreateBuffer failed (%u)", vkResult );
+
+		ret = vkutil_allocator_alloc_buffer (
+			&app->allocator, app->staticResources.cullBuffer,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&app->staticResources.cullBufferAllocation
+		);
+		if ( ret != 0 )
+			return platform_throw_error ( -1, "vkutil_allocator_alloc_buffer failed (%d)", ret );
+
+		// The bounds of the shadow receivers only ever live on the GPU, see app_render_cull_draws
+
+		vkResult = vkCreateBuffer (
+			app->device.device,
+			&(VkBufferCreateInfo){
+				.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+				.size  = sizeof ( cull_receivers_t ),
+				.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			},
+			NULL,
+			&app->staticResources.receiverBuffer
+		);
+		if ( vkResult != VK_SUCCESS )
+			return platform_throw_error ( -1, "vkCreateBuffer failed (%u)", vkResult );
+
+		ret = vkutil_allocator_alloc_buffer (
+			&app->allocator, app->staticResources.receiverBuffer,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			&app->staticResources.receiverBufferAllocation
+		);
+		if ( ret != 0 )
+			return platform_throw_error ( -1, "vkutil_allocator_alloc_buffer failed (%d)", ret );
+	}
 
 	return 0;
 }
@@ -2537,15 +4611,317 @@ int32_t app_init_static_resources ( app_t* app )
 int32_t app_destroy_static_resources ( app_t* app )
 {
 	vkDestroyImageView ( app->device.device, app->staticResources.imageViewDummyDiffuse, NULL );
+	vkDestroyImageView ( app->device.device, app->staticResources.imageViewShadowArray, NULL );
+	for ( uint32_t i = 0; i < LIGHT_COUNT; i++ )
+		vkDestroyImageView ( app->device.device, app->staticResources.imageViewShadowDepthAttachment[i], NULL );
 	vkDestroyImage ( app->device.device, app->staticResources.imageDummyDiffuse, NULL );
-	vkFreeMemory ( app->device.device, app->staticResources.imageMemory, NULL );
+	vkDestroyImage ( app->device.device, app->staticResources.imageShadowArray, NULL );
+	for ( uint32_t i = 0; i < STATIC_TEXTURE_COUNT; i++ )
+		vkutil_allocator_free ( &app->allocator, &app->staticResources.imageAllocations[i] );
 
 	vkDestroySampler ( app->device.device, app->staticResources.samplerNearest, NULL );
 	vkDestroySampler ( app->device.device, app->staticResources.samplerAnisotropic, NULL );
 
+	vkDestroySampler ( app->device.device, app->staticResources.samplerShadow, NULL );
+
 	vkDestroyBuffer ( app->device.device, app->staticResources.lightBuffer, NULL );
-	
-	vkFreeMemory ( app->device.device, app->staticResources.lightBufferMemory, NULL );
+	vkutil_allocator_free ( &app->allocator, &app->staticResources.lightBufferAllocation );
+	vkDestroyBuffer ( app->device.device, app->staticResources.cullBuffer, NULL );
+	vkutil_allocator_free ( &app->allocator, &app->staticResources.cullBufferAllocation );
+	vkDestroyBuffer ( app->device.device, app->staticResources.receiverBuffer, NULL );
+	vkutil_allocator_free ( &app->allocator, &app->staticResources.receiverBufferAllocation );
+
+	return 0;
+}
+
+////////////////////////////////////////
+//
+
+int32_t app_init_model_bounds ( app_t* app )
+{
+	// The culling works on the bounding boxes of all objects of a model at once, as SIMD vectors of
+	// the same coordinate of a couple of boxes. That needs the centers and extents of the boxes in
+	// their own arrays, each aligned to the size of the SIMD vectors. We just use 32 bytes, enough
+	// for AVX.
+
+	for ( uint32_t i = 0; i < MODEL_COUNT; i++ )
+	{
+		vkutil_model_t* model = &app->model[i];
+
+		uint32_t paddedCount = RVM_ALIGN_UP_POW2 ( model->objectCount, 8 );
+		uint32_t wordCount   = RVM_DIV_CEIL ( model->objectCount, 32 );
+
+		void* memory = malloc (
+			32 + 6 * paddedCount * sizeof ( float )
+			+ ( 2 * VIEW_COUNT + LIGHT_COUNT ) * wordCount * sizeof ( uint32_t )
+		);
+		if ( memory == NULL )
+			return platform_throw_error ( -1, "Failed to allocate the bounds of %u objects", model->objectCount );
+
+		float* data = (float*)RVM_ALIGN_UP_POW2 ( (uintptr_t)memory, 32 );
+		float* cells[6];
+		for ( uint32_t j = 0; j < 6; j++ )
+			cells[j] = data + j * paddedCount;
+
+		for ( uint32_t j = 0; j < model->objectCount; j++ )
+		{
+			vkutil_object_t* obj = &model->objects[j];
+			for ( uint32_t k = 0; k < 3; k++ )
+			{
+				cells[k  ][j] = 0.5f * ( obj->aabbMin[k] + obj->aabbMax[k] );
+				cells[k+3][j] = 0.5f * ( obj->aabbMax[k] - obj->aabbMin[k] );
+			}
+		}
+
+		app->modelBounds[i].memory      = memory;
+		app->modelBounds[i].wordCount   = wordCount;
+		app->modelBounds[i].visibleBits = (uint32_t*)( data + 6 * paddedCount );
+		app->modelBounds[i].insideBits  = app->modelBounds[i].visibleBits + VIEW_COUNT * wordCount;
+		app->modelBounds[i].casterBits  = app->modelBounds[i].insideBits + VIEW_COUNT * wordCount;
+		memset ( app->modelBounds[i].casterBits, 0, LIGHT_COUNT * wordCount * sizeof ( uint32_t ) );
+		rvm_soa_vec3_init ( &app->modelBounds[i].centers, cells[0], cells[1], cells[2], model->objectCount );
+		rvm_soa_vec3_init ( &app->modelBounds[i].extents, cells[3], cells[4], cells[5], model->objectCount );
+	}
+
+	return 0;
+}
+
+int32_t app_destroy_model_bounds ( app_t* app )
+{
+	for ( uint32_t i = 0; i < MODEL_COUNT; i++ )
+		free ( app->modelBounds[i].memory );
+
+	return 0;
+}
+
+int32_t app_init_model_draws ( app_t* app )
+{
+	// Culling on the GPU, the compute shader needs the bounds and levels of detail of the objects
+	// of every model in a buffer, and their clusters in another, and buffers to write the draws of
+	// every view to, and how many of those there are in view when they're counted. See
+	// app_render_cull_draws.
+	//
+	// The draws are drawn a group of objects at a time: the objects sharing their index type and
+	// texture, which are drawn with the same index buffer and descriptor set bound. The draws of
+	// the objects are sorted by their group, so the draws the compute shader writes for the objects
+	// of a group are a single range of draws in every view. Every object gets as many draws as
+	// app_util_object_draw_count says it can take. The groups with 16 bit indices go first, so the
+	// index buffer is only bound twice.
+
+	for ( uint32_t i = 0; i < MODEL_COUNT; i++ )
+	{
+		vkutil_model_t* model = &app->model[i];
+
+		// Every combination of index type and texture, including no texture at all, has a key. The
+		// draws of the objects are counted per key, and every key with objects makes a group.
+
+		uint32_t  textureSlots = model->textureCount + 1;
+		uint32_t  keyCount     = 2 * textureSlots;
+		uint32_t* keyDraws     = alloca ( 3 * keyCount * sizeof ( uint32_t ) );
+		uint32_t* keyNext      = keyDraws + keyCount;
+		uint32_t* keyGroup     = keyNext + keyCount;
+		memset ( keyDraws, 0, keyCount * sizeof ( uint32_t ) );
+
+		uint32_t* objectKeys = malloc ( model->objectCount * sizeof ( uint32_t ) );
+		cull_object_t* objects = malloc ( model->objectCount * sizeof ( cull_object_t ) );
+		app->modelDraws[i].groups = malloc ( keyCount * sizeof ( draw_group_t ) );
+		if ( objectKeys == NULL || objects == NULL || app->modelDraws[i].groups == NULL )
+			return platform_throw_error ( -1, "Failed to allocate the draws of %u objects", model->objectCount );
+
+		for ( uint32_t j = 0; j < model->objectCount; j++ )
+		{
+			vkutil_object_t* obj = &model->objects[j];
+			objectKeys[j] = ( obj->indexType == VK_INDEX_TYPE_UINT32 ? textureSlots : 0 )
+				+ ( obj->textureIndex == 0xFFFFFFFF ? model->textureCount : obj->textureIndex );
+			keyDraws[objectKeys[j]] += app_util_object_draw_count ( obj );
+		}
+
+		uint32_t groupCount = 0, drawStart = 0;
+		for ( uint32_t k = 0; k < keyCount; k++ )
+		{
+			if ( keyDraws[k] == 0 )
+				continue;
+
+			app->modelDraws[i].groups[groupCount] = (draw_group_t){
+				.indexType    = k >= textureSlots ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16,
+				.textureIndex = k % textureSlots == model->textureCount ? 0xFFFFFFFF : k % textureSlots,
+				.drawStart    = drawStart,
+				.drawCount    = keyDraws[k],
+			};
+			keyGroup[k] = groupCount++;
+			keyNext[k]  = drawStart;
+			drawStart  += keyDraws[k];
+		}
+		app->modelDraws[i].groupCount = groupCount;
+		app->modelDraws[i].drawCount  = drawStart;
+
+		// The clusters keep their place in the model, which the objects refer to them by
+
+		uint32_t clusterCount = 0;
+		for ( uint32_t j = 0; j < model->objectCount; j++ )
+		{
+			vkutil_object_t* obj = &model->objects[j];
+			if ( obj->clusterStart + obj->clusterCount > clusterCount )
+				clusterCount = obj->clusterStart + obj->clusterCount;
+
+			uint32_t       group = keyGroup[objectKeys[j]];
+			cull_object_t* dst   = &objects[j];
+
+			*dst = (cull_object_t){
+				.lodCount     = obj->lodCount,
+				.vertexOffset = (int32_t)obj->vertexOffset,
+				.group        = group,
+				.groupStart   = app->modelDraws[i].groups[group].drawStart,
+				.drawStart    = keyNext[objectKeys[j]],
+				.drawCount    = app_util_object_draw_count ( obj ),
+				.clusterStart = obj->clusterStart,
+				.clusterCount = obj->clusterCount,
+			};
+			keyNext[objectKeys[j]] += dst->drawCount;
+			for ( uint32_t k = 0; k < 3; k++ )
+			{
+				dst->aabbMin[k] = obj->aabbMin[k];
+				dst->aabbMax[k] = obj->aabbMax[k];
+			}
+			for ( uint32_t k = 0; k < obj->lodCount; k++ )
+			{
+				dst->lods[k].indexStart = obj->lods[k].indexStart;
+				dst->lods[k].indexCount = obj->lods[k].indexCount;
+				dst->lods[k].error      = obj->lods[k].error;
+			}
+		}
+		free ( objectKeys );
+
+		cull_cluster_t* clusters = malloc ( ( clusterCount > 0 ? clusterCount : 1 ) * sizeof ( cull_cluster_t ) );
+		if ( clusters == NULL )
+		{
+			free ( objects );
+			return platform_throw_error ( -1, "Failed to allocate the %u clusters of model %u", clusterCount, i );
+		}
+
+		for ( uint32_t j = 0; j < clusterCount; j++ )
+		{
+			vkutil_cluster_t* cluster = &model->clusters[j];
+			cull_cluster_t*   dst     = &clusters[j];
+
+			*dst = (cull_cluster_t){
+				.indexStart = cluster->indexStart,
+				.indexCount = cluster->indexCount,
+				.radius     = cluster->radius,
+				.coneCutoff = cluster->coneCutoff,
+			};
+			for ( uint32_t k = 0; k < 3; k++ )
+			{
+				dst->aabbMin[k]  = cluster->aabbMin[k];
+				dst->aabbMax[k]  = cluster->aabbMax[k];
+				dst->center[k]   = cluster->center[k];
+				dst->coneAxis[k] = cluster->coneAxis[k];
+			}
+		}
+
+		// The objects and clusters are only ever read by the GPU, and the draws and counts only
+		// ever written by it, so they can all go in device local memory. Buffers can't be empty,
+		// so models without clusters get room for one they don't use.
+
+		struct
+		{
+			VkBuffer*            outBuffer;
+			vkutil_allocation_t* outAllocation;
+			VkDeviceSize         size;
+			VkBufferUsageFlags   usage;
+		} buffers[4] = {
+			{
+				&app->modelDraws[i].objectBuffer, &app->modelDraws[i].objectAllocation,
+				model->objectCount * sizeof ( cull_object_t ),
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			},
+			{
+				&app->modelDraws[i].clusterBuffer, &app->modelDraws[i].clusterAllocation,
+				( clusterCount > 0 ? clusterCount : 1 ) * sizeof ( cull_cluster_t ),
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			},
+			{
+				&app->modelDraws[i].drawBuffer, &app->modelDraws[i].drawAllocation,
+				VIEW_COUNT * (VkDeviceSize)drawStart * sizeof ( VkDrawIndexedIndirectCommand ),
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			},
+			{
+				&app->modelDraws[i].countBuffer, &app->modelDraws[i].countAllocation,
+				VIEW_COUNT * groupCount * sizeof ( uint32_t ),
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+					| VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			},
+		};
+
+		for ( uint32_t j = 0; j < STATIC_ARRAY_LENGTH(buffers); j++ )
+		{
+			VkResult vkResult = vkCreateBuffer (
+				app->device.device,
+				&(VkBufferCreateInfo){
+					.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+					.size  = buffers[j].size,
+					.usage = buffers[j].usage,
+				},
+				NULL,
+				buffers[j].outBuffer
+			);
+			if ( vkResult != VK_SUCCESS )
+				return platform_throw_error ( -1, "vkCreateBuffer failed (%u)", vkResult );
+
+			int32_t ret = vkutil_allocator_alloc_buffer (
+				&app->allocator, *buffers[j].outBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				buffers[j].outAllocation
+			);
+			if ( ret != 0 )
+				return platform_throw_error ( -1, "vkutil_allocator_alloc_buffer failed (%d)", ret );
+		}
+
+		// The objects and clusters are uploaded like the model itself. As uploads complete in the
+		// order they were submitted, the ticket of this upload replaces that of the model: once it
+		// completes, the model, its objects and their clusters are all there.
+
+		int32_t ret = vkutil_uploader_begin ( &app->uploader );
+		if ( ret == 0 )
+		{
+			ret = vkutil_uploader_upload_buffer (
+				&app->uploader, objects, model->objectCount * sizeof ( cull_object_t ),
+				app->modelDraws[i].objectBuffer, VK_ACCESS_SHADER_READ_BIT
+			);
+		}
+		if ( ret == 0 && clusterCount > 0 )
+		{
+			ret = vkutil_uploader_upload_buffer (
+				&app->uploader, clusters, clusterCount * sizeof ( cull_cluster_t ),
+				app->modelDraws[i].clusterBuffer, VK_ACCESS_SHADER_READ_BIT
+			);
+		}
+		if ( ret == 0 )
+			ret = vkutil_uploader_submit ( &app->uploader, &app->modelUploadTicket[i] );
+		else
+			vkutil_uploader_abort ( &app->uploader );
+		free ( objects );
+		free ( clusters );
+		if ( ret != 0 )
+			return platform_throw_error ( -1, "Uploading the objects of model %u failed (%d)", i, ret );
+	}
+
+	return 0;
+}
+
+int32_t app_destroy_model_draws ( app_t* app )
+{
+	for ( uint32_t i = 0; i < MODEL_COUNT; i++ )
+	{
+		vkDestroyBuffer ( app->device.device, app->modelDraws[i].objectBuffer, NULL );
+		vkDestroyBuffer ( app->device.device, app->modelDraws[i].clusterBuffer, NULL );
+		vkDestroyBuffer ( app->device.device, app->modelDraws[i].drawBuffer, NULL );
+		vkDestroyBuffer ( app->device.device, app->modelDraws[i].countBuffer, NULL );
+		vkutil_allocator_free ( &app->allocator, &app->modelDraws[i].objectAllocation );
+		vkutil_allocator_free ( &app->allocator, &app->modelDraws[i].clusterAllocation );
+		vkutil_allocator_free ( &app->allocator, &app->modelDraws[i].drawAllocation );
+		vkutil_allocator_free ( &app->allocator, &app->modelDraws[i].countAllocation );
+		free ( app->modelDraws[i].groups );
+	}
 
 	return 0;
 }
@@ -2617,6 +4993,31 @@ int32_t app_init_renderpass_framebuffers ( app_t* app, uint32_t windowWidth, uin
 		if ( result != 0 )
 			return platform_throw_error ( -1, "vkCreateFramebuffer failed (%u)", result );
 	}
+
+	// Rendering all shadow maps in a single pass renders into a framebuffer with a layer for every
+	// light. Its attachment is the array view of all shadow maps, the one they're sampled through.
+
+	if ( app->shadowRenderpass.layered )
+	{
+		VkResult result = vkCreateFramebuffer (
+			app->device.device,
+			&(VkFramebufferCreateInfo){
+				.sType           = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+				.renderPass      = app->shadowRenderpass.renderPass,
+				.attachmentCount = 1,
+				.pAttachments    = (VkImageView[1]){
+					[0] = app->staticResources.imageViewShadowArray,
+				},
+				.width  = SHADOW_MAP_WIDTH,
+				.height = SHADOW_MAP_HEIGHT,
+				.layers = LIGHT_COUNT,
+			},
+			NULL,
+			&app->shadowRenderpass.framebufferLayered
+		);
+		if ( result != 0 )
+			return platform_throw_error ( -1, "vkCreateFramebuffer failed (%u)", result );
+	}
 	
 	return 0;
 }
@@ -2628,6 +5029,7 @@ int32_t app_destroy_renderpass_framebuffers ( app_t* app )
 
 	for ( uint32_t i = 0; i < LIGHT_COUNT; i++ )
 		vkDestroyFramebuffer ( app->device.device, app->shadowRenderpass.framebuffers[i], NULL );
+	vkDestroyFramebuffer ( app->device.device, app->shadowRenderpass.framebufferLayered, NULL );
 
 	free ( app->renderpass.framebuffers );
 	
@@ -2709,11 +5111,18 @@ int32_t app_init_render_attachments ( app_t* app, uint32_t windowWidth, uint32_t
 		},
 	};
 
+	uint64_t uploadTicket;
 	int32_t ret = vkutil_create_images_helper (
-		app->device.device, app->commandBufferStaging, app->queues[QUEUE_MAIN].queue,
-		&app->device.memoryProperties, TRANSIENT_ATTACHMENT_COUNT, transientAttachmentCreateInfo,
-		&app->attachments.memory
+		&app->uploader, TRANSIENT_ATTACHMENT_COUNT, transientAttachmentCreateInfo,
+		app->attachments.allocations, &uploadTicket
 	);
+	if ( ret != 0 )
+		return platform_throw_error ( -1, "vkutil_create_images_helper failed (%d)", ret );
+
+	// These are used by every frame, so there is no point in not waiting for them
+	ret = vkutil_uploader_wait ( &app->uploader, uploadTicket );
+	if ( ret != 0 )
+		return platform_throw_error ( -1, "vkutil_uploader_wait failed (%d)", ret );
 
 	vkUpdateDescriptorSets (
 		app->device.device,
@@ -2743,7 +5152,8 @@ int32_t app_destroy_render_attachments ( app_t* app )
 	vkDestroyImage ( app->device.device, app->attachments.imageIntermediateColor, NULL );
 	vkDestroyImage ( app->device.device, app->attachments.imageIntermediateDepth, NULL );
 
-	vkFreeMemory ( app->device.device, app->attachments.memory, NULL );
+	for ( uint32_t i = 0; i < TRANSIENT_ATTACHMENT_COUNT; i++ )
+		vkutil_allocator_free ( &app->allocator, &app->attachments.allocations[i] );
 
 	return 0;
 }
@@ -194,6 +194,16 @@ rvm_aos_mat4 rvm_aos_mat4_inverse ( const rvm_aos_mat4* m );
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+void rvm_aos_mat4_frustum_planes ( rvm_aos_vec4 outPlanes[6], const rvm_aos_mat4* vp );	//NOTE(Rick): Clip space z in [0, w], like Vulkan
+void rvm_soa_aabb_frustum_cull (
+	uint32_t* outVisibleBits, uint32_t* outInsideBits,
+	const rvm_aos_vec4* planes, uint32_t frustumCount,
+	const rvm_soa_vec3* centers, const rvm_soa_vec3* extents
+);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 #ifdef RVM_MATH_IMPLEMENTATION
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -213,9 +223,12 @@ rvm_aos_mat4 rvm_aos_mat4_inverse ( const rvm_aos_mat4* m );
 #include <assert.h>
 #include <float.h>
 #include <math.h>
+#include <stddef.h>
 
-#if RVM_MATH_VECTOR_INSTR_SET == RVM_MATH_VECTOR_INSTR_SET_SSE || RVM_MATH_INSTR_SET == RVM_MATH_VECTOR_INSTR_SET_AVX
+#if RVM_MATH_VECTOR_INSTR_SET == RVM_MATH_VECTOR_INSTR_SET_SSE || RVM_MATH_VECTOR_INSTR_SET == RVM_MATH_VECTOR_INSTR_SET_AVX
 #include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
 #endif
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1877,6 +1890,152 @@ rvm_aos_mat4 rvm_aos_mat4_inverse ( const rvm_aos_mat4* m )
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// Gribb & Hartmann, "Fast Extraction of Viewing Frustum Planes from the World-View-Projection Matrix".
+// A point p is inside when dot(plane.xyz, p) + plane.w >= 0 for all planes. The planes are not
+// normalized, as only the sign of that distance matters to the culling below.
+// Order: left, right, bottom, top, near, far
+
+void rvm_aos_mat4_frustum_planes ( rvm_aos_vec4 outPlanes[6], const rvm_aos_mat4* vp )
+{
+#define CLIP_COLUMN(c) (rvm_aos_vec4){ .x = vp->rows[0][c], .y = vp->rows[1][c], .z = vp->rows[2][c], .w = vp->rows[3][c] }
+	rvm_aos_vec4 cx = CLIP_COLUMN ( 0 ), cy = CLIP_COLUMN ( 1 ), cz = CLIP_COLUMN ( 2 ), cw = CLIP_COLUMN ( 3 );
+#undef CLIP_COLUMN
+
+	for ( uint32_t i = 0; i < 4; i++ )
+	{
+		outPlanes[0].cells[i] = cw.cells[i] + cx.cells[i];	// -w <= x
+		outPlanes[1].cells[i] = cw.cells[i] - cx.cells[i];	//  x <= w
+		outPlanes[2].cells[i] = cw.cells[i] + cy.cells[i];	// -w <= y
+		outPlanes[3].cells[i] = cw.cells[i] - cy.cells[i];	//  y <= w
+		outPlanes[4].cells[i] =               cz.cells[i];	//  0 <= z
+		outPlanes[5].cells[i] = cw.cells[i] - cz.cells[i];	//  z <= w
+	}
+}
+
+// Tests the boxes given by centers +/- extents against frustumCount frustums of 6 planes each, all
+// in a single pass over the boxes. For every frustum, RVM_DIV_CEIL(vectorCount,32) words of bits
+// are written, one bit per box: set in outVisibleBits when the box is potentially visible, and in
+// outInsideBits (optional) when it is entirely inside the frustum. Boxes are only rejected when
+// they are entirely outside one of the planes, so some boxes close to the corners of the frustum
+// are visible while they are really out of view.
+// With SIMD, centers and extents are processed a vector at a time, with the usual alignment. NEON
+// is used on AArch64 regardless of RVM_MATH_VECTOR_INSTR_SET, as it is always there.
+
+void rvm_soa_aabb_frustum_cull (
+	uint32_t* outVisibleBits, uint32_t* outInsideBits,
+	const rvm_aos_vec4* planes, uint32_t frustumCount,
+	const rvm_soa_vec3* centers, const rvm_soa_vec3* extents
+)
+{
+	assert ( centers->vectorCount == extents->vectorCount );
+	const uint32_t count     = centers->vectorCount;
+	const uint32_t wordCount = RVM_DIV_CEIL ( count, 32 );
+
+	for ( uint32_t i = 0; i < frustumCount * wordCount; i++ )
+	{
+		outVisibleBits[i] = 0;
+		if ( outInsideBits != NULL )
+			outInsideBits[i] = 0;
+	}
+
+	// The box is outside a plane when its center is further behind it than the box extends towards
+	// the plane: dot(n, c) + d < -dot(|n|, e). It is entirely in front of it when dot(n, c) + d
+	// >= dot(|n|, e).
+
+	uint32_t vec = 0;
+#if RVM_MATH_VECTOR_INSTR_SET == RVM_MATH_VECTOR_INSTR_SET_SSE
+	const __m128 signMask = _mm_set1_ps ( -0.0f );
+	for ( ; vec + 4 <= count; vec += 4 )
+	{
+		__m128 cx = _mm_load_ps ( centers->x + vec ), cy = _mm_load_ps ( centers->y + vec ), cz = _mm_load_ps ( centers->z + vec );
+		__m128 ex = _mm_load_ps ( extents->x + vec ), ey = _mm_load_ps ( extents->y + vec ), ez = _mm_load_ps ( extents->z + vec );
+		for ( uint32_t f = 0; f < frustumCount; f++ )
+		{
+			__m128 outside = _mm_setzero_ps ( ), intersecting = _mm_setzero_ps ( );
+			for ( const rvm_aos_vec4* p = &planes[6*f]; p != &planes[6*f+6]; p++ )
+			{
+				__m128 nx = _mm_set1_ps ( p->x ), ny = _mm_set1_ps ( p->y ), nz = _mm_set1_ps ( p->z );
+				__m128 d = _mm_add_ps ( _mm_add_ps ( _mm_mul_ps ( nx, cx ), _mm_mul_ps ( ny, cy ) ), _mm_add_ps ( _mm_mul_ps ( nz, cz ), _mm_set1_ps ( p->w ) ) );
+				__m128 r = _mm_add_ps ( _mm_add_ps ( _mm_mul_ps ( _mm_andnot_ps ( signMask, nx ), ex ), _mm_mul_ps ( _mm_andnot_ps ( signMask, ny ), ey ) ), _mm_mul_ps ( _mm_andnot_ps ( signMask, nz ), ez ) );
+				outside      = _mm_or_ps ( outside, _mm_cmplt_ps ( d, _mm_xor_ps ( r, signMask ) ) );
+				intersecting = _mm_or_ps ( intersecting, _mm_cmplt_ps ( d, r ) );
+			}
+			outVisibleBits[f*wordCount + vec/32] |= (uint32_t)(~_mm_movemask_ps ( outside ) & 0xF) << (vec&31);
+			if ( outInsideBits != NULL )
+				outInsideBits[f*wordCount + vec/32] |= (uint32_t)(~_mm_movemask_ps ( intersecting ) & 0xF) << (vec&31);
+		}
+	}
+#elif RVM_MATH_VECTOR_INSTR_SET == RVM_MATH_VECTOR_INSTR_SET_AVX
+	const __m256 signMask = _mm256_set1_ps ( -0.0f );
+	for ( ; vec + 8 <= count; vec += 8 )
+	{
+		__m256 cx = _mm256_load_ps ( centers->x + vec ), cy = _mm256_load_ps ( centers->y + vec ), cz = _mm256_load_ps ( centers->z + vec );
+		__m256 ex = _mm256_load_ps ( extents->x + vec ), ey = _mm256_load_ps ( extents->y + vec ), ez = _mm256_load_ps ( extents->z + vec );
+		for ( uint32_t f = 0; f < frustumCount; f++ )
+		{
+			__m256 outside = _mm256_setzero_ps ( ), intersecting = _mm256_setzero_ps ( );
+			for ( const rvm_aos_vec4* p = &planes[6*f]; p != &planes[6*f+6]; p++ )
+			{
+				__m256 nx = _mm256_set1_ps ( p->x ), ny = _mm256_set1_ps ( p->y ), nz = _mm256_set1_ps ( p->z );
+				__m256 d = _mm256_add_ps ( _mm256_add_ps ( _mm256_mul_ps ( nx, cx ), _mm256_mul_ps ( ny, cy ) ), _mm256_add_ps ( _mm256_mul_ps ( nz, cz ), _mm256_set1_ps ( p->w ) ) );
+				__m256 r = _mm256_add_ps ( _mm256_add_ps ( _mm256_mul_ps ( _mm256_andnot_ps ( signMask, nx ), ex ), _mm256_mul_ps ( _mm256_andnot_ps ( signMask, ny ), ey ) ), _mm256_mul_ps ( _mm256_andnot_ps ( signMask, nz ), ez ) );
+				outside      = _mm256_or_ps ( outside, _mm256_cmp_ps ( d, _mm256_xor_ps ( r, signMask ), _CMP_LT_OQ ) );
+				intersecting = _mm256_or_ps ( intersecting, _mm256_cmp_ps ( d, r, _CMP_LT_OQ ) );
+			}
+			outVisibleBits[f*wordCount + vec/32] |= (uint32_t)(~_mm256_movemask_ps ( outside ) & 0xFF) << (vec&31);
+			if ( outInsideBits != NULL )
+				outInsideBits[f*wordCount + vec/32] |= (uint32_t)(~_mm256_movemask_ps ( intersecting ) & 0xFF) << (vec&31);
+		}
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	const uint32x4_t laneBits = { 1, 2, 4, 8 };
+	for ( ; vec + 4 <= count; vec += 4 )
+	{
+		float32x4_t cx = vld1q_f32 ( centers->x + vec ), cy = vld1q_f32 ( centers->y + vec ), cz = vld1q_f32 ( centers->z + vec );
+		float32x4_t ex = vld1q_f32 ( extents->x + vec ), ey = vld1q_f32 ( extents->y + vec ), ez = vld1q_f32 ( extents->z + vec );
+		for ( uint32_t f = 0; f < frustumCount; f++ )
+		{
+			uint32x4_t outside = vdupq_n_u32 ( 0 ), intersecting = vdupq_n_u32 ( 0 );
+			for ( const rvm_aos_vec4* p = &planes[6*f]; p != &planes[6*f+6]; p++ )
+			{
+				float32x4_t d = vmlaq_n_f32 ( vmlaq_n_f32 ( vmlaq_n_f32 ( vdupq_n_f32 ( p->w ), cx, p->x ), cy, p->y ), cz, p->z );
+				float32x4_t r = vmlaq_n_f32 ( vmlaq_n_f32 ( vmulq_n_f32 ( ex, fabsf ( p->x ) ), ey, fabsf ( p->y ) ), ez, fabsf ( p->z ) );
+				outside      = vorrq_u32 ( outside, vcltq_f32 ( d, vnegq_f32 ( r ) ) );
+				intersecting = vorrq_u32 ( intersecting, vcltq_f32 ( d, r ) );
+			}
+			outVisibleBits[f*wordCount + vec/32] |= (vaddvq_u32 ( vbicq_u32 ( laneBits, outside ) )) << (vec&31);
+			if ( outInsideBits != NULL )
+				outInsideBits[f*wordCount + vec/32] |= (vaddvq_u32 ( vbicq_u32 ( laneBits, intersecting ) )) << (vec&31);
+		}
+	}
+#endif
+
+	// Whatever is left after the last full vector, or everything without SIMD
+
+	for ( ; vec < count; vec++ )
+	{
+		float cx = centers->x[vec], cy = centers->y[vec], cz = centers->z[vec];
+		float ex = extents->x[vec], ey = extents->y[vec], ez = extents->z[vec];
+		for ( uint32_t f = 0; f < frustumCount; f++ )
+		{
+			uint32_t outside = 0, intersecting = 0;
+			for ( const rvm_aos_vec4* p = &planes[6*f]; p != &planes[6*f+6]; p++ )
+			{
+				float d = ( ( p->x * cx ) + ( p->y * cy ) ) + ( ( p->z * cz ) + p->w );
+				float r = ( fabsf ( p->x ) * ex + fabsf ( p->y ) * ey ) + fabsf ( p->z ) * ez;
+				outside      |= d < -r;
+				intersecting |= d < r;
+			}
+			outVisibleBits[f*wordCount + vec/32] |= (outside^1) << (vec&31);
+			if ( outInsideBits != NULL )
+				outInsideBits[f*wordCount + vec/32] |= (intersecting^1) << (vec&31);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 #endif // RVM_MATH_IMPLEMENTATION
 
 #ifdef __cplusplus
@@ -31,7 +31,7 @@
 #define STATIC_ARRAY_LENGTH(x) (sizeof(x)/sizeof((x)[0]))
 #if defined ( _WIN32 )
 #define alloca _alloca
-#elif defined ( __ANDROID__ )
+#else
 #include <alloca.h>
 #endif
 
@@ -427,6 +427,19 @@ int32_t vkbase_init_device (
 		if ( suitable )
 		{
 			outDevice->physical = physicalDevices[i];
+
+			// Some extensions aren't required, but are used when they are there. Like the
+			// required ones, they have to be enabled when creating the device.
+
+			outDevice->drawIndirectCount = VK_FALSE;
+			for ( uint32_t k = 0; k < availableDeviceExtensionCount; k++ )
+			{
+				if ( strcmp (
+						availableDeviceExtensions[k].extensionName,
+						VK_AMD_DRAW_INDIRECT_COUNT_EXTENSION_NAME
+					) == 0 )
+					outDevice->drawIndirectCount = VK_TRUE;
+			}
 			break;
 		}
 	}
@@ -468,50 +481,81 @@ int32_t vkbase_init_device (
 		outDevice->physical, &physicalDeviceQueueFamilyCount, queueFamilyProperties
 	);
 
-	VkDeviceQueueCreateInfo* deviceQueueCreateInfos =
-		alloca ( queueCount * sizeof ( VkDeviceQueueCreateInfo ) );
+	// Queues are assigned a family and an index within that family. Should a family run out of
+	// queues, further requests for it share the last queue of the family instead: a queue_t is then
+	// simply the same VkQueue as another one, which is fine as long as both are used from the
+	// same thread.
+
+	// Note the spec says graphics and compute families always support transfer operations, even
+	// if they do not report VK_QUEUE_TRANSFER_BIT, so we add that bit ourselves.
+
 	uint32_t* queueFamilyQueueCount = alloca(physicalDeviceQueueFamilyCount * sizeof ( uint32_t ));
+	uint32_t* queueIndices          = alloca(queueCount * sizeof ( uint32_t ));
 	memset ( queueFamilyQueueCount, 0, physicalDeviceQueueFamilyCount * sizeof ( uint32_t ) );
 
 	for ( uint32_t i = 0; i < queueCount; i++ )
 	{
 		uint32_t requiredFlags = queueCreateInfos[i].queueFlags;
 		uint32_t found = 0;
-		for ( uint32_t j = 0; j < physicalDeviceQueueFamilyCount; j++ )
-		{
-			if ( (queueFamilyProperties[j].queueFlags & requiredFlags) != requiredFlags)
-				continue;
 
-			for ( uint32_t k = 0; k < queueCreateInfos[i].presentWindowCount; k++ )
+		// Pass 0 looks for a family with a queue to spare that has none of the avoided flags.
+		// Pass 1 allows the avoided flags, pass 2 allows sharing a queue.
+		for ( uint32_t pass = 0; pass < 3 && !found; pass++ )
+		{
+			for ( uint32_t j = 0; j < physicalDeviceQueueFamilyCount; j++ )
 			{
-				uint32_t windowIdx = queueCreateInfos[i].presentWindowIndices[k];
-
-				VkBool32 presentSupported = VK_FALSE;
-				vkResult = vkGetPhysicalDeviceSurfaceSupportKHR (
-					outDevice->physical, i, windows[windowIdx]->surface, &presentSupported
-				);
-				if ( vkResult != VK_SUCCESS )
-					return platform_throw_error (
-						-1, "vkGetPhysicalDeviceSurfaceSupportKHR failed with error %u", vkResult
+				uint32_t familyFlags = queueFamilyProperties[j].queueFlags;
+				if ( familyFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT) )
+					familyFlags |= VK_QUEUE_TRANSFER_BIT;
+
+				if ( (familyFlags & requiredFlags) != requiredFlags)
+					continue;
+				if ( pass == 0 && (familyFlags & queueCreateInfos[i].avoidFlags) != 0 )
+					continue;
+				if ( pass < 2 && queueFamilyQueueCount[j] >= queueFamilyProperties[j].queueCount )
+					continue;
+				if ( pass == 2 && queueFamilyQueueCount[j] == 0 )
+					continue;
+
+				// Windows without a surface (headless mode) are never presented to, so any queue
+				// family can "present" to them.
+
+				uint32_t presentSupported = 1;
+				for ( uint32_t k = 0; k < queueCreateInfos[i].presentWindowCount; k++ )
+				{
+					uint32_t windowIdx = queueCreateInfos[i].presentWindowIndices[k];
+					if ( windows[windowIdx]->surface == VK_NULL_HANDLE )
+						continue;
+
+					VkBool32 surfaceSupported = VK_FALSE;
+					vkResult = vkGetPhysicalDeviceSurfaceSupportKHR (
+						outDevice->physical, j, windows[windowIdx]->surface, &surfaceSupported
 					);
+					if ( vkResult != VK_SUCCESS )
+						return platform_throw_error (
+							-1, "vkGetPhysicalDeviceSurfaceSupportKHR failed with error %u", vkResult
+						);
+
+					if ( !surfaceSupported )
+					{
+						presentSupported = 0;
+						break;
+					}
+				}
 
 				if ( !presentSupported )
 					continue;
-			}
 
-			if ( queueFamilyQueueCount[j] >= queueFamilyProperties[j].queueCount )
-				continue;
-
-			queueFamilyQueueCount[j]++;
-			outQueues[i].familyIndex = j;
-			found = 1;
-			deviceQueueCreateInfos[i] = (VkDeviceQueueCreateInfo){
-				.sType            = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-				.queueFamilyIndex = j,
-				.queueCount       = 1,
-				.pQueuePriorities = (float[1]){ 1.0f },
-			};
-			break;
+				if ( pass < 2 )
+					queueIndices[i] = queueFamilyQueueCount[j]++;
+				else
+					queueIndices[i] = queueFamilyQueueCount[j] - 1;
+				outQueues[i].familyIndex = j;
+				outQueues[i].minImageTransferGranularity =
+					queueFamilyProperties[j].minImageTransferGranularity;
+				found = 1;
+				break;
+			}
 		}
 
 		if ( found == 0 )
@@ -519,7 +563,55 @@ int32_t vkbase_init_device (
 				-2, "Could not find an appropriate queue for queue entry %u", i
 			);
 	}
+
+	// Vulkan wants a single VkDeviceQueueCreateInfo per family, covering all queues we use from it
+
+	VkDeviceQueueCreateInfo* deviceQueueCreateInfos =
+		alloca ( physicalDeviceQueueFamilyCount * sizeof ( VkDeviceQueueCreateInfo ) );
+	float* queuePriorities = alloca ( queueCount * sizeof ( float ) );
+	uint32_t deviceQueueCreateInfoCount = 0;
+
+	for ( uint32_t i = 0; i < queueCount; i++ )
+		queuePriorities[i] = 1.0f;
+
+	for ( uint32_t j = 0; j < physicalDeviceQueueFamilyCount; j++ )
+	{
+		if ( queueFamilyQueueCount[j] == 0 )
+			continue;
+
+		deviceQueueCreateInfos[deviceQueueCreateInfoCount++] = (VkDeviceQueueCreateInfo){
+			.sType            = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+			.queueFamilyIndex = j,
+			.queueCount       = queueFamilyQueueCount[j],
+			.pQueuePriorities = queuePriorities,
+		};
+	}
 	
+	// Features are opt-in: anything not enabled here may not be used, even if the device supports
+	// it. The ones we're after are the block compressed texture formats, which vkutil_load_bobj
+	// uses for whichever of them the device supports, geometry shaders, which allow rendering
+	// into all layers of a layered framebuffer in a single pass, and indirect draws of more than a
+	// single draw at once, starting at any instance, which allow the GPU to decide what it draws
+	// itself. Everything using these checks the enabled features first.
+
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures ( outDevice->physical, &supportedFeatures );
+	outDevice->features = (VkPhysicalDeviceFeatures){
+		.textureCompressionETC2     = supportedFeatures.textureCompressionETC2,
+		.textureCompressionASTC_LDR = supportedFeatures.textureCompressionASTC_LDR,
+		.textureCompressionBC       = supportedFeatures.textureCompressionBC,
+		.geometryShader             = supportedFeatures.geometryShader,
+		.multiDrawIndirect          = supportedFeatures.multiDrawIndirect,
+		.drawIndirectFirstInstance  = supportedFeatures.drawIndirectFirstInstance,
+	};
+
+	const char** enabledDeviceExtensions =
+		alloca ( ( requiredDeviceExtensionCount + 1 ) * sizeof ( const char* ) );
+	uint32_t enabledDeviceExtensionCount = requiredDeviceExtensionCount;
+	memcpy ( enabledDeviceExtensions, requiredDeviceExtensions, requiredDeviceExtensionCount * sizeof ( const char* ) );
+	if ( outDevice->drawIndirectCount )
+		enabledDeviceExtensions[enabledDeviceExtensionCount++] = VK_AMD_DRAW_INDIRECT_COUNT_EXTENSION_NAME;
+
 	// Now we create the device object with its extensions and queues we would like to use. This
 	// object is nearly exclusively used instead of the VkPhysicalDevice from this point onward.
 
@@ -527,10 +619,11 @@ int32_t vkbase_init_device (
 		outDevice->physical,
 		&(VkDeviceCreateInfo){
 			.sType                   = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-			.queueCreateInfoCount    = queueCount,
+			.queueCreateInfoCount    = deviceQueueCreateInfoCount,
 			.pQueueCreateInfos       = deviceQueueCreateInfos,
-			.enabledExtensionCount   = requiredDeviceExtensionCount,
-			.ppEnabledExtensionNames = requiredDeviceExtensions,
+			.enabledExtensionCount   = enabledDeviceExtensionCount,
+			.ppEnabledExtensionNames = enabledDeviceExtensions,
+			.pEnabledFeatures        = &outDevice->features,
 		},
 		NULL,
 		&outDevice->device
@@ -538,21 +631,27 @@ int32_t vkbase_init_device (
 	if ( vkResult != VK_SUCCESS )
 		return platform_throw_error ( -1, "vkCreateDevice failed with error %u", vkResult );
 
+	// Like the debug report functions of the instance, the commands of optional device extensions
+	// aren't statically linked, and are obtained through vkGetDeviceProcAddr instead.
+
+	outDevice->cmdDrawIndexedIndirectCount = NULL;
+	if ( outDevice->drawIndirectCount )
+	{
+		outDevice->cmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountAMD)
+			vkGetDeviceProcAddr ( outDevice->device, "vkCmdDrawIndexedIndirectCountAMD" );
+		if ( outDevice->cmdDrawIndexedIndirectCount == NULL )
+			outDevice->drawIndirectCount = VK_FALSE;
+	}
+
 	// We should obtain the queue for the queue family we selected. Now that the device is created,
 	// the queue can be queried from the device. We don't need it in this function just yet,
 	// but we just initialize it to easily obtain it at a later time.
 
-	for ( uint32_t i = 0; i < physicalDeviceQueueFamilyCount; i++ )
+	for ( uint32_t i = 0; i < queueCount; i++ )
 	{
-		uint32_t cnt = 0;
-		for ( uint32_t j = 0; j < queueCount && cnt < queueFamilyQueueCount[i]; j++ )
-		{
-			if ( outQueues[i].familyIndex == i )
-			{
-				vkGetDeviceQueue ( outDevice->device, i, cnt, &outQueues[j].queue );
-				cnt++;
-			}
-		}
+		vkGetDeviceQueue (
+			outDevice->device, outQueues[i].familyIndex, queueIndices[i], &outQueues[i].queue
+		);
 	}
 
 	// For the next function, we will need to know about the available memory regions on the device
@@ -566,11 +665,107 @@ int32_t vkbase_init_device (
 	return 0;
 }
 
+// Creates a set of images to render into instead of a VkSwapchainKHR for windows without a
+// surface. These behave like swapchain images to the application, other than being handed back
+// in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL so the result can be read back to the CPU.
+
+static int32_t vkbase_init_offscreen_swapchain (
+	swapchain_t* outSwapchain, device_t* device, window_t* window
+)
+{
+	VkResult vkResult;
+
+	uint32_t width, height;
+	int32_t result = platform_window_get_size ( window, &width, &height );
+	if ( result != 0 )
+		return result;
+
+	// Three images, so the demo's frames in flight behave the same as they would with a
+	// MAILBOX swapchain
+
+	*outSwapchain = (swapchain_t){
+		.imageCount    = 3,
+		.surfaceFormat = {
+			.format     = VK_FORMAT_R8G8B8A8_SRGB,
+			.colorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR,
+		},
+		.extent        = { width, height },
+		.presentLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+	};
+	outSwapchain->images     = malloc ( outSwapchain->imageCount * sizeof ( VkImage     ) );
+	outSwapchain->imageViews = malloc ( outSwapchain->imageCount * sizeof ( VkImageView ) );
+
+	VkMemoryRequirements* requirements =
+		alloca ( outSwapchain->imageCount * sizeof ( VkMemoryRequirements ) );
+	VkDeviceSize* offsets = alloca ( outSwapchain->imageCount * sizeof ( VkDeviceSize ) );
+
+	for ( uint32_t i = 0; i < outSwapchain->imageCount; i++ )
+	{
+		vkResult = vkCreateImage (
+			device->device,
+			&(VkImageCreateInfo){
+				.sType         = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+				.imageType     = VK_IMAGE_TYPE_2D,
+				.format        = outSwapchain->surfaceFormat.format,
+				.extent        = { width, height, 1 },
+				.mipLevels     = 1,
+				.arrayLayers   = 1,
+				.samples       = VK_SAMPLE_COUNT_1_BIT,
+				.tiling        = VK_IMAGE_TILING_OPTIMAL,
+				.usage         = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+				.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+			},
+			NULL,
+			&outSwapchain->images[i]
+		);
+		if ( vkResult != VK_SUCCESS )
+			return platform_throw_error ( -1, "vkCreateImage failed with error %u", vkResult );
+
+		vkGetImageMemoryRequirements ( device->device, outSwapchain->images[i], &requirements[i] );
+	}
+
+	if ( vkutil_multi_alloc_helper (
+			device->device, &device->memoryProperties, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			outSwapchain->imageCount, requirements, &outSwapchain->memory, NULL, offsets
+		) != 0 )
+		return platform_throw_error ( -1, "Could not allocate offscreen swapchain memory" );
+
+	for ( uint32_t i = 0; i < outSwapchain->imageCount; i++ )
+	{
+		vkBindImageMemory ( device->device, outSwapchain->images[i], outSwapchain->memory, offsets[i] );
+
+		vkResult = vkCreateImageView (
+			device->device,
+			&(VkImageViewCreateInfo){
+				.sType      = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+				.image      = outSwapchain->images[i],
+				.viewType   = VK_IMAGE_VIEW_TYPE_2D,
+				.format     = outSwapchain->surfaceFormat.format,
+				.subresourceRange = {
+					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+					.levelCount = 1, .layerCount = 1,
+				},
+			},
+			NULL,
+			&outSwapchain->imageViews[i]
+		);
+		if ( vkResult != VK_SUCCESS )
+			return platform_throw_error (
+				-1, "vkCreateImageView failed with error %u", vkResult
+			);
+	}
+
+	return 0;
+}
+
 int32_t vkbase_init_swapchain (
 	swapchain_t* outSwapchain, instance_t* instance, device_t* device, window_t* window,
 	swapchain_t* oldSwapchain
 )
 {
+	if ( window->surface == VK_NULL_HANDLE )
+		return vkbase_init_offscreen_swapchain ( outSwapchain, device, window );
+
 
 	// With the device and surface created, we will need to create the VkSwapchainKHR object
 	// responsible for passing images from the device onto the surface. To do so, we will need to
@@ -694,6 +889,9 @@ int32_t vkbase_init_swapchain (
 	VkExtent2D          surfaceSize           =	 surfaceCapabilities.currentExtent;
 
 	outSwapchain->surfaceFormat = *selectedSurfaceFormat;
+	outSwapchain->extent        = surfaceSize;
+	outSwapchain->presentLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	outSwapchain->memory        = VK_NULL_HANDLE;
 	
 	// Create the swapchain using the properties we just acquired. If we passed an old swapchain,
 	// we pass it onto the function for replacement.
@@ -790,6 +988,475 @@ int32_t vkbase_init_swapchain (
 	return 0;
 }
 
+int32_t vkbase_swapchain_acquire (
+	device_t* device, swapchain_t* swapchain, queue_t* queue, VkSemaphore signalSemaphore,
+	uint32_t* outImageIndex
+)
+{
+	VkResult vkResult;
+
+	if ( swapchain->swapchain != VK_NULL_HANDLE )
+	{
+		vkResult = vkAcquireNextImageKHR (
+			device->device, swapchain->swapchain, UINT64_MAX, signalSemaphore, VK_NULL_HANDLE,
+			outImageIndex
+		);
+		if ( vkResult != VK_SUCCESS )
+			return platform_throw_error ( -1, "vkAcquireNextImageKHR failed (%u)", vkResult );
+		return 0;
+	}
+
+	// Offscreen images are simply cycled through. The caller still expects the semaphore to be
+	// signaled once the image is writable, so we signal it with an empty submission. The image
+	// is guaranteed to be writable by then, as the caller waits for the fence of the frame that
+	// last used this image before acquiring it again.
+
+	*outImageIndex = swapchain->nextImage;
+	swapchain->nextImage = (swapchain->nextImage + 1) % swapchain->imageCount;
+
+	vkResult = vkQueueSubmit (
+		queue->queue,
+		1, (VkSubmitInfo[1]){
+			{
+				.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+				.signalSemaphoreCount = 1,
+				.pSignalSemaphores    = (VkSemaphore[1]){ signalSemaphore },
+			},
+		},
+		VK_NULL_HANDLE
+	);
+	if ( vkResult != VK_SUCCESS )
+		return platform_throw_error ( -1, "vkQueueSubmit failed (%u)", vkResult );
+	return 0;
+}
+
+int32_t vkbase_swapchain_present (
+	swapchain_t* swapchain, queue_t* queue, VkSemaphore waitSemaphore, uint32_t imageIndex
+)
+{
+	VkResult vkResult;
+
+	if ( swapchain->swapchain != VK_NULL_HANDLE )
+	{
+		vkResult = vkQueuePresentKHR (
+			queue->queue,
+			&(VkPresentInfoKHR){
+				.sType              = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+				.waitSemaphoreCount = 1,
+				.pWaitSemaphores    = (VkSemaphore[1]) { waitSemaphore },
+				.swapchainCount     = 1,
+				.pSwapchains        = (VkSwapchainKHR[1]) { swapchain->swapchain },
+				.pImageIndices      = (uint32_t[1]) { imageIndex },
+			}
+		);
+		if ( vkResult != VK_SUCCESS )
+			return platform_throw_error ( -1, "vkQueuePresentKHR failed (%u)", vkResult );
+		return 0;
+	}
+
+	// There is nothing to present to, but the semaphore still has to be waited upon: Signaling
+	// it again in the next acquire while it is still signaled is not allowed.
+
+	vkResult = vkQueueSubmit (
+		queue->queue,
+		1, (VkSubmitInfo[1]){
+			{
+				.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+				.waitSemaphoreCount = 1,
+				.pWaitSemaphores    = (VkSemaphore[1]){ waitSemaphore },
+				.pWaitDstStageMask  = (VkPipelineStageFlags[1]){ VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT },
+			},
+		},
+		VK_NULL_HANDLE
+	);
+	if ( vkResult != VK_SUCCESS )
+		return platform_throw_error ( -1, "vkQueueSubmit failed (%u)", vkResult );
+	return 0;
+}
+
+// Copies the contents of a swapchain image to outPixels, which should be large enough to hold
+// extent.width * extent.height pixels of 4 bytes each. This is only supported for offscreen
+// swapchains, as those are the only ones guaranteed to be usable as a transfer source.
+// The function waits for the queue to go idle, so it is intended for captures and tests rather
+// than for use every frame.
+
+int32_t vkbase_swapchain_readback (
+	device_t* device, swapchain_t* swapchain, queue_t* queue, VkCommandBuffer commandBuffer,
+	uint32_t imageIndex, void* outPixels
+)
+{
+	if ( swapchain->presentLayout != VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL )
+		return platform_throw_error ( -1, "Only offscreen swapchains can be read back" );
+
+	VkResult vkResult;
+	VkDeviceSize size = (VkDeviceSize)swapchain->extent.width * swapchain->extent.height * 4;
+
+	VkBuffer buffer;
+	vkResult = vkCreateBuffer (
+		device->device,
+		&(VkBufferCreateInfo){
+			.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+			.size  = size,
+			.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		},
+		NULL,
+		&buffer
+	);
+	if ( vkResult != VK_SUCCESS )
+		return platform_throw_error ( -1, "vkCreateBuffer failed (%u)", vkResult );
+
+	// Reading back from memory is one of the few cases where HOST_CACHED memory is beneficial
+
+	VkMemoryRequirements requirements;
+	VkDeviceMemory memory;
+	vkGetBufferMemoryRequirements ( device->device, buffer, &requirements );
+	if ( vkutil_multi_alloc_helper (
+			device->device, &device->memoryProperties,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+				| VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+			1, &requirements, &memory, NULL, NULL ) != 0
+		&& vkutil_multi_alloc_helper (
+			device->device, &device->memoryProperties,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			1, &requirements, &memory, NULL, NULL ) != 0 )
+	{
+		vkDestroyBuffer ( device->device, buffer, NULL );
+		return platform_throw_error ( -1, "Could not allocate readback memory" );
+	}
+	vkBindBufferMemory ( device->device, buffer, memory, 0 );
+
+	vkBeginCommandBuffer (
+		commandBuffer,
+		&(VkCommandBufferBeginInfo){
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+			.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+		}
+	);
+	vkCmdCopyImageToBuffer (
+		commandBuffer,
+		swapchain->images[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		buffer,
+		1, (VkBufferImageCopy[1]){
+			{
+				.imageSubresource = {
+					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+					.layerCount = 1,
+				},
+				.imageExtent = { swapchain->extent.width, swapchain->extent.height, 1 },
+			}
+		}
+	);
+	vkCmdPipelineBarrier (
+		commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_HOST_BIT,
+		0,
+		0, NULL,
+		1, (VkBufferMemoryBarrier[1]){
+			{
+				.sType         = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+				.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+				.dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+				.buffer        = buffer,
+				.size          = VK_WHOLE_SIZE,
+			},
+		},
+		0, NULL
+	);
+	vkEndCommandBuffer ( commandBuffer );
+
+	vkResult = vkQueueSubmit (
+		queue->queue,
+		1, (VkSubmitInfo[1]){
+			{
+				.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+				.commandBufferCount = 1,
+				.pCommandBuffers    = (VkCommandBuffer[1]){ commandBuffer },
+			},
+		},
+		VK_NULL_HANDLE
+	);
+	if ( vkResult == VK_SUCCESS )
+		vkResult = vkQueueWaitIdle ( queue->queue );
+
+	if ( vkResult == VK_SUCCESS )
+	{
+		void* data;
+		vkResult = vkMapMemory ( device->device, memory, 0, size, 0, &data );
+		if ( vkResult == VK_SUCCESS )
+		{
+			memcpy ( outPixels, data, size );
+			vkUnmapMemory ( device->device, memory );
+		}
+	}
+
+	vkDestroyBuffer ( device->device, buffer, NULL );
+	vkFreeMemory ( device->device, memory, NULL );
+
+	if ( vkResult != VK_SUCCESS )
+		return platform_throw_error ( -1, "Swapchain readback failed (%u)", vkResult );
+	return 0;
+}
+
+////////////////////////////////////////
+// Profiling
+//
+// CPU markers simply accumulate platform_get_timestamp deltas over a frame. GPU markers write a
+// timestamp at the top of the pipe when they begin and at the bottom of the pipe when they end,
+// into a query pool that belongs to the frame in flight they were recorded in. By the time that
+// frame in flight comes around again, the demo has waited for its fence, so the results are
+// available and can be read without stalling anything.
+//
+// Single frames are noisy, so every completed frame also goes into a small history from which
+// rolling averages are computed. Those are what gets written to the log file.
+
+static int32_t vkbase_profiler_init_common (
+	profiler_t* outProfiler, uint32_t markerCount, const char** markerNames
+)
+{
+	memset ( outProfiler, 0, sizeof ( *outProfiler ) );
+	outProfiler->markerCount    = markerCount;
+	outProfiler->markerNames    = markerNames;
+	outProfiler->markerTimes    = (double*)calloc ( markerCount, sizeof ( double ) );
+	outProfiler->markerAverages = (double*)calloc ( markerCount, sizeof ( double ) );
+	outProfiler->history        = (double*)calloc ( VKBASE_PROFILER_AVERAGE_FRAMES*(markerCount+1), sizeof ( double ) );
+	if ( outProfiler->markerTimes == NULL || outProfiler->markerAverages == NULL || outProfiler->history == NULL )
+		return platform_throw_error ( -1, "Failed to allocate profiler markers" );
+	return 0;
+}
+
+// Called whenever markerTimes and frameTime hold the results of a newly completed frame
+static void vkbase_profiler_complete_frame ( profiler_t* profiler )
+{
+	uint32_t stride = profiler->markerCount + 1;
+	double* entry = profiler->history + (profiler->completedFrameCount % VKBASE_PROFILER_AVERAGE_FRAMES)*stride;
+	memcpy ( entry, profiler->markerTimes, profiler->markerCount*sizeof ( double ) );
+	entry[profiler->markerCount] = profiler->frameTime;
+	profiler->completedFrameCount++;
+
+	uint32_t frameCount = profiler->completedFrameCount < VKBASE_PROFILER_AVERAGE_FRAMES ?
+		(uint32_t)profiler->completedFrameCount : VKBASE_PROFILER_AVERAGE_FRAMES;
+	for ( uint32_t i = 0; i < stride; i++ )
+	{
+		double sum = 0.0;
+		for ( uint32_t j = 0; j < frameCount; j++ )
+			sum += profiler->history[j*stride + i];
+
+		if ( i < profiler->markerCount )
+			profiler->markerAverages[i] = sum / frameCount;
+		else
+			profiler->frameTimeAverage = sum / frameCount;
+	}
+
+	if ( profiler->logFile == NULL || profiler->completedFrameCount % profiler->logInterval != 0 )
+		return;
+
+	platform_log_file_print (
+		profiler->logFile, "%s frame %llu: %.3f ms",
+		profiler->logLabel, (unsigned long long)profiler->completedFrameCount, profiler->frameTimeAverage
+	);
+	for ( uint32_t i = 0; i < profiler->markerCount; i++ )
+		platform_log_file_print ( profiler->logFile, " | %s %.3f ms", profiler->markerNames[i], profiler->markerAverages[i] );
+	platform_log_file_print ( profiler->logFile, "\n" );
+}
+
+int32_t vkbase_profiler_init_cpu (
+	profiler_t* outProfiler, uint32_t markerCount, const char** markerNames
+)
+{
+	int32_t ret = vkbase_profiler_init_common ( outProfiler, markerCount, markerNames );
+	if ( ret < 0 )
+		return ret;
+
+	timestamp_t freq;
+	if ( ( ret = platform_get_timestamp_freq ( &freq ) ) < 0 )
+		return ret;
+	outProfiler->ticksToMs = 1000.0 / (double)freq;
+
+	outProfiler->markerStarts = (timestamp_t*)calloc ( markerCount, sizeof ( timestamp_t ) );
+	outProfiler->markerTotals = (timestamp_t*)calloc ( markerCount, sizeof ( timestamp_t ) );
+	if ( outProfiler->markerStarts == NULL || outProfiler->markerTotals == NULL )
+		return platform_throw_error ( -2, "Failed to allocate profiler markers" );
+	return 0;
+}
+
+int32_t vkbase_profiler_init_gpu (
+	profiler_t* outProfiler, device_t* device, queue_t* queue, uint32_t framesInFlight,
+	uint32_t markerCount, const char** markerNames
+)
+{
+	int32_t ret = vkbase_profiler_init_common ( outProfiler, markerCount, markerNames );
+	if ( ret < 0 )
+		return ret;
+
+	if ( framesInFlight > VKBASE_PROFILER_MAX_FRAMES_IN_FLIGHT )
+		return platform_throw_error ( -2, "Profiler supports at most %u frames in flight", VKBASE_PROFILER_MAX_FRAMES_IN_FLIGHT );
+	outProfiler->framesInFlight = framesInFlight;
+
+	// Not every queue family supports timestamps, and the ones that do may only write some of the
+	// bits. We mask the bits off so the subtraction below also works when the counter wraps.
+	uint32_t queueFamilyCount;
+	vkGetPhysicalDeviceQueueFamilyProperties ( device->physical, &queueFamilyCount, NULL );
+	VkQueueFamilyProperties* queueFamilies = (VkQueueFamilyProperties*)alloca ( queueFamilyCount*sizeof ( VkQueueFamilyProperties ) );
+	vkGetPhysicalDeviceQueueFamilyProperties ( device->physical, &queueFamilyCount, queueFamilies );
+
+	uint32_t validBits = queueFamilies[queue->familyIndex].timestampValidBits;
+	if ( validBits == 0 )
+		return platform_throw_error ( -3, "Queue family %u does not support timestamps", queue->familyIndex );
+	outProfiler->timestampMask = validBits >= 64 ? ~0ull : ( ( 1ull << validBits ) - 1 );
+
+	outProfiler->markersWritten = (uint8_t*)calloc ( framesInFlight*markerCount, sizeof ( uint8_t ) );
+	if ( outProfiler->markersWritten == NULL )
+		return platform_throw_error ( -4, "Failed to allocate profiler markers" );
+
+	for ( uint32_t i = 0; i < framesInFlight; i++ )
+	{
+		VkResult result = vkCreateQueryPool (
+			device->device,
+			&(VkQueryPoolCreateInfo) {
+				.sType              = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+				.pNext              = NULL,
+				.flags              = 0,
+				.queryType          = VK_QUERY_TYPE_TIMESTAMP,
+				.queryCount         = 2*markerCount,
+				.pipelineStatistics = 0,
+			},
+			NULL,
+			&outProfiler->queryPools[i]
+		);
+		if ( result != VK_SUCCESS )
+			return platform_throw_error ( -5, "vkCreateQueryPool failed (%u)", result );
+	}
+
+	return 0;
+}
+
+int32_t vkbase_profiler_destroy (
+	profiler_t* profiler, device_t* device
+)
+{
+	for ( uint32_t i = 0; i < profiler->framesInFlight; i++ )
+		vkDestroyQueryPool ( device->device, profiler->queryPools[i], NULL );
+
+	free ( profiler->markerTimes );
+	free ( profiler->markerAverages );
+	free ( profiler->history );
+	free ( profiler->markerStarts );
+	free ( profiler->markerTotals );
+	free ( profiler->markersWritten );
+	memset ( profiler, 0, sizeof ( *profiler ) );
+	return 0;
+}
+
+int32_t vkbase_profiler_set_log_file (
+	profiler_t* profiler, log_file_t* logFile, const char* label, uint32_t interval
+)
+{
+	profiler->logFile     = logFile;
+	profiler->logLabel    = label;
+	profiler->logInterval = interval > 0 ? interval : 1;
+	return 0;
+}
+
+int32_t vkbase_profiler_cpu_frame_begin ( profiler_t* profiler )
+{
+	memset ( profiler->markerTotals, 0, profiler->markerCount*sizeof ( timestamp_t ) );
+	return platform_get_timestamp ( &profiler->frameStart );
+}
+
+int32_t vkbase_profiler_cpu_frame_end ( profiler_t* profiler )
+{
+	timestamp_t now;
+	int32_t ret = platform_get_timestamp ( &now );
+
+	for ( uint32_t i = 0; i < profiler->markerCount; i++ )
+		profiler->markerTimes[i] = (double)profiler->markerTotals[i] * profiler->ticksToMs;
+	profiler->frameTime = (double)(now - profiler->frameStart) * profiler->ticksToMs;
+
+	vkbase_profiler_complete_frame ( profiler );
+	return ret;
+}
+
+int32_t vkbase_profiler_cpu_marker_begin ( profiler_t* profiler, uint32_t marker )
+{
+	return platform_get_timestamp ( &profiler->markerStarts[marker] );
+}
+
+int32_t vkbase_profiler_cpu_marker_end ( profiler_t* profiler, uint32_t marker )
+{
+	timestamp_t now;
+	int32_t ret = platform_get_timestamp ( &now );
+	profiler->markerTotals[marker] += now - profiler->markerStarts[marker];
+	return ret;
+}
+
+int32_t vkbase_profiler_gpu_frame_begin (
+	profiler_t* profiler, device_t* device, VkCommandBuffer commandBuffer, uint32_t frameIndex
+)
+{
+	// Collect whatever this frame in flight recorded last time around. The caller has waited for
+	// the fence of this frame, so no VK_QUERY_RESULT_WAIT_BIT is necessary; should a result not be
+	// available for whatever reason, we'd rather keep the previous value than stall.
+	uint8_t* written = profiler->markersWritten + frameIndex*profiler->markerCount;
+	uint32_t writtenCount = 0;
+	uint64_t frameBegin = UINT64_MAX, frameEnd = 0;
+	for ( uint32_t i = 0; i < profiler->markerCount; i++ )
+	{
+		if ( !written[i] )
+		{
+			profiler->markerTimes[i] = 0.0;
+			continue;
+		}
+
+		uint64_t timestamps[2];
+		VkResult result = vkGetQueryPoolResults (
+			device->device, profiler->queryPools[frameIndex], 2*i, 2,
+			sizeof ( timestamps ), timestamps, sizeof ( uint64_t ), VK_QUERY_RESULT_64_BIT
+		);
+		if ( result == VK_SUCCESS )
+		{
+			uint64_t ticks = ( timestamps[1] - timestamps[0] ) & profiler->timestampMask;
+			profiler->markerTimes[i] = (double)ticks * device->properties.limits.timestampPeriod * 1e-6;
+
+			// Markers are ordered within a frame, so ignoring wraparound here only costs us the
+			// frame time of the one frame in which the counter wraps
+			frameBegin = timestamps[0] < frameBegin ? timestamps[0] : frameBegin;
+			frameEnd   = timestamps[1] > frameEnd   ? timestamps[1] : frameEnd;
+		}
+		written[i] = 0;
+		writtenCount++;
+	}
+	if ( writtenCount > 0 )
+	{
+		uint64_t ticks = frameEnd > frameBegin ? ( frameEnd - frameBegin ) & profiler->timestampMask : 0;
+		profiler->frameTime = (double)ticks * device->properties.limits.timestampPeriod * 1e-6;
+		vkbase_profiler_complete_frame ( profiler );
+	}
+
+	// Queries have to be reset before they can be written again, which has to happen outside of a
+	// render pass, so do it all up front
+	vkCmdResetQueryPool ( commandBuffer, profiler->queryPools[frameIndex], 0, 2*profiler->markerCount );
+	profiler->currentFrame = frameIndex;
+	return 0;
+}
+
+int32_t vkbase_profiler_gpu_marker_begin (
+	profiler_t* profiler, VkCommandBuffer commandBuffer, uint32_t marker
+)
+{
+	vkCmdWriteTimestamp ( commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, profiler->queryPools[profiler->currentFrame], 2*marker+0 );
+	return 0;
+}
+
+int32_t vkbase_profiler_gpu_marker_end (
+	profiler_t* profiler, VkCommandBuffer commandBuffer, uint32_t marker
+)
+{
+	vkCmdWriteTimestamp ( commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, profiler->queryPools[profiler->currentFrame], 2*marker+1 );
+	profiler->markersWritten[profiler->currentFrame*profiler->markerCount + marker] = 1;
+	return 0;
+}
+
 int32_t vkbase_destroy_swapchain ( device_t* device, swapchain_t* swapchain )
 {
 	// Not sure why, but not deleting image views for the swapchain does not generate errors,
@@ -802,7 +1469,23 @@ int32_t vkbase_destroy_swapchain ( device_t* device, swapchain_t* swapchain )
 		swapchain->imageViews[i] = VK_NULL_HANDLE;
 	}
 
-	vkDestroySwapchainKHR ( device->device, swapchain->swapchain, NULL );
+	if ( swapchain->swapchain != VK_NULL_HANDLE )
+	{
+		vkDestroySwapchainKHR ( device->device, swapchain->swapchain, NULL );
+	}
+	else
+	{
+		// Offscreen images are ours to destroy, as opposed to those owned by a VkSwapchainKHR
+		for ( uint32_t i = 0; i < swapchain->imageCount; i++ )
+			vkDestroyImage ( device->device, swapchain->images[i], NULL );
+		vkFreeMemory ( device->device, swapchain->memory, NULL );
+		swapchain->memory = VK_NULL_HANDLE;
+	}
+
+	free ( swapchain->images );
+	free ( swapchain->imageViews );
+	swapchain->images     = NULL;
+	swapchain->imageViews = NULL;
 
 	return 0;
 }
@@ -27,7 +27,7 @@ extern "C" {	// Expose functions with C linkage for cross-compat with C and C++
 // Vulkan include
 
 #if !defined ( __ANDROID__ ) || __ANDROID_API__ >= 24
-#include <vulkan\vulkan.h>
+#include <vulkan/vulkan.h>
 #else
 // Android version 24 and on officially supports Vulkan, while version 23 does not
 // Some vendors do ship with versions of libVulkan however, so we can use Vulkan on these
@@ -42,12 +42,11 @@ extern "C" {	// Expose functions with C linkage for cross-compat with C and C++
 // This will incur serious performance penalties, but allow for a dialog box to pop up when
 // an issue has occurred.
 #define VK_ENABLE_DEBUG 0
-#define TEMP_TIMESTAMP_STUFF_RENDERDOC_CRASHES_IDK_MAN 0
 
 #define STATIC_ARRAY_LENGTH(x) (sizeof(x)/sizeof((x)[0]))
 #if defined ( _WIN32 )
 #define alloca _alloca
-#elif defined ( __ANDROID__ )
+#else
 #include <alloca.h>
 #endif
 
@@ -61,9 +60,14 @@ typedef enum
 // Platform-specific structures
 
 typedef struct file_s { void* data; size_t sizeInBytes; } file_t;
+typedef struct file_mapping_s { const void* data; size_t sizeInBytes; void* platform; } file_mapping_t;
 typedef struct log_file_s { void* platform; } log_file_t;
 typedef struct window_s { void* platform; VkSurfaceKHR surface; } window_t;
-typedef struct profiler_s { void* platform; } profiler_t;
+typedef struct worker_pool_s { void* platform; uint32_t threadCount; } worker_pool_t;
+
+// A job run by a worker pool. threadIndex is that of the thread running it, see
+// platform_worker_pool_run.
+typedef void ( *worker_job_t ) ( void* userdata, uint32_t jobIndex, uint32_t threadIndex );
 
 typedef struct instance_s
 {
@@ -77,12 +81,21 @@ typedef struct device_s
 	VkDevice         device;
 	VkPhysicalDeviceProperties properties;
 	VkPhysicalDeviceMemoryProperties memoryProperties;
+	VkPhysicalDeviceFeatures features;	// Those that were enabled
+
+	// VK_AMD_draw_indirect_count, enabled when the device has it: indirect draws taking their
+	// draw count from a buffer. Its command is an extension, so it's obtained at runtime.
+	VkBool32 drawIndirectCount;
+	PFN_vkCmdDrawIndexedIndirectCountAMD cmdDrawIndexedIndirectCount;
 } device_t;
 
 typedef struct queue_s
 {
 	VkQueue queue;
 	uint32_t familyIndex;
+
+	// Granularity of image transfers on this queue, see VkQueueFamilyProperties
+	VkExtent3D minImageTransferGranularity;
 } queue_t;
 
 typedef struct swapchain_s
@@ -92,8 +105,65 @@ typedef struct swapchain_s
 	VkImageView*       imageViews;
 	uint32_t           imageCount;
 	VkSurfaceFormatKHR surfaceFormat;
+	VkExtent2D         extent;
+
+	// Layout the images are to be in when handed back to the swapchain. This is
+	// VK_IMAGE_LAYOUT_PRESENT_SRC_KHR for a regular swapchain, but offscreen swapchains (windows
+	// without a surface, such as in headless mode) are never presented, only read back.
+	VkImageLayout      presentLayout;
+
+	// Offscreen swapchains only: The memory backing the images and the image to acquire next
+	VkDeviceMemory     memory;
+	uint32_t           nextImage;
 } swapchain_t;
 
+////////////////////////////////////////
+// Profiling
+
+#define VKBASE_PROFILER_MAX_FRAMES_IN_FLIGHT 4
+#define VKBASE_PROFILER_AVERAGE_FRAMES       64	// Window of the rolling averages, in frames
+
+typedef uint64_t timestamp_t;
+
+typedef struct profiler_s
+{
+	uint32_t     markerCount;
+	const char** markerNames;
+
+	// Duration of every marker in milliseconds for the most recently completed frame, and the
+	// amount of frames completed so far. GPU results lag behind by the amount of frames in flight,
+	// as they are only read back once the GPU is known to be done with them. The frame time spans
+	// from frame begin to frame end on the CPU, and from the first to the last timestamp on the GPU.
+	double*      markerTimes;
+	double       frameTime;
+	uint64_t     completedFrameCount;
+
+	// Rolling averages over the last VKBASE_PROFILER_AVERAGE_FRAMES completed frames. The history
+	// holds markerCount+1 entries per frame, the last being the frame time.
+	double*      history;
+	double*      markerAverages;
+	double       frameTimeAverage;
+
+	// Averages are written to logFile every logInterval completed frames, if a log file is set
+	log_file_t*  logFile;
+	const char*  logLabel;
+	uint32_t     logInterval;
+
+	// CPU profilers: timestamps from platform_get_timestamp, in ticks
+	timestamp_t* markerStarts;
+	timestamp_t* markerTotals;
+	timestamp_t  frameStart;
+	double       ticksToMs;
+
+	// GPU profilers: a query pool per frame in flight, each containing a begin and end timestamp
+	// for every marker, and which markers were written to in each of those frames
+	VkQueryPool  queryPools[VKBASE_PROFILER_MAX_FRAMES_IN_FLIGHT];
+	uint8_t*     markersWritten;
+	uint32_t     framesInFlight;
+	uint32_t     currentFrame;
+	uint64_t     timestampMask;
+} profiler_t;
+
 ////////////////////////////////////////
 // 
 
@@ -102,13 +172,17 @@ typedef struct queue_create_info_s
 	VkQueueFlagBits queueFlags;
 	uint32_t presentWindowCount;
 	uint32_t* presentWindowIndices;
+
+	// Families supporting any of these flags are only picked if no other family qualifies. Setting
+	// this to graphics and compute for a transfer queue asks for a dedicated transfer family (the
+	// DMA engines on discrete GPUs), falling back to whatever family can do transfers.
+	VkQueueFlags avoidFlags;
 } queue_create_info_t;
 
 ////////////////////////////////////////
 // 
 
 typedef struct app_s app_t;
-typedef uint64_t timestamp_t;
 
 ////////////////////////////////////////
 // Functions to be implemented by the demo
@@ -118,6 +192,10 @@ int32_t app_free   ( app_t* app );
 int32_t app_resize ( app_t* app, uint32_t windowWidth, uint32_t windowHeight );
 int32_t app_render ( app_t* app, double dt );
 
+// Hands out the profilers the demo records its frames with, for tools such as the benchmark
+// harness. Either may be NULL if the demo does not profile that side.
+int32_t app_get_profilers ( app_t* app, profiler_t** outCpuProfiler, profiler_t** outGpuProfiler );
+
 ////////////////////////////////////////
 // 
 
@@ -135,6 +213,18 @@ int32_t vkbase_init_swapchain (
 	swapchain_t* oldSwapchain
 );
 
+int32_t vkbase_swapchain_acquire (
+	device_t* device, swapchain_t* swapchain, queue_t* queue, VkSemaphore signalSemaphore,
+	uint32_t* outImageIndex
+);
+int32_t vkbase_swapchain_present (
+	swapchain_t* swapchain, queue_t* queue, VkSemaphore waitSemaphore, uint32_t imageIndex
+);
+int32_t vkbase_swapchain_readback (
+	device_t* device, swapchain_t* swapchain, queue_t* queue, VkCommandBuffer commandBuffer,
+	uint32_t imageIndex, void* outPixels
+);
+
 int32_t vkbase_destroy_swapchain (
 	device_t* device, swapchain_t* swapchain
 );
@@ -145,13 +235,34 @@ int32_t vkbase_destroy_instance (
 	instance_t* instance
 );
 
-//int32_t vkbase_profiler_init_cpu (
-//	profiler_t* outProfiler, uint32_t markerCount, const char** markerNames
-//);
-//int32_t vkbase_profiler_init_gpu (
-//	profiler_t* outProfiler, uint32_t markerCount, const char** markerNames
-//);
-//int32_t vkbase_profiler_
+int32_t vkbase_profiler_init_cpu (
+	profiler_t* outProfiler, uint32_t markerCount, const char** markerNames
+);
+int32_t vkbase_profiler_init_gpu (
+	profiler_t* outProfiler, device_t* device, queue_t* queue, uint32_t framesInFlight,
+	uint32_t markerCount, const char** markerNames
+);
+int32_t vkbase_profiler_destroy (
+	profiler_t* profiler, device_t* device
+);
+int32_t vkbase_profiler_set_log_file (
+	profiler_t* profiler, log_file_t* logFile, const char* label, uint32_t interval
+);
+
+int32_t vkbase_profiler_cpu_frame_begin  ( profiler_t* profiler );
+int32_t vkbase_profiler_cpu_frame_end    ( profiler_t* profiler );
+int32_t vkbase_profiler_cpu_marker_begin ( profiler_t* profiler, uint32_t marker );
+int32_t vkbase_profiler_cpu_marker_end   ( profiler_t* profiler, uint32_t marker );
+
+int32_t vkbase_profiler_gpu_frame_begin (
+	profiler_t* profiler, device_t* device, VkCommandBuffer commandBuffer, uint32_t frameIndex
+);
+int32_t vkbase_profiler_gpu_marker_begin (
+	profiler_t* profiler, VkCommandBuffer commandBuffer, uint32_t marker
+);
+int32_t vkbase_profiler_gpu_marker_end (
+	profiler_t* profiler, VkCommandBuffer commandBuffer, uint32_t marker
+);
 
 ////////////////////////////////////////
 // Platform-specific utility functions
@@ -166,6 +277,10 @@ int32_t platform_get_timestamp_freq    ( timestamp_t* outTimestampFreq );
 
 int32_t platform_file_load       ( file_t* outFile, const char* file );
 int32_t platform_file_close      ( file_t* file );
+int32_t platform_file_map        ( file_mapping_t* outMapping, const char* file );
+int32_t platform_file_unmap      ( file_mapping_t* mapping );
+int32_t platform_data_file_load  ( file_t* outFile, const char* name );
+int32_t platform_data_file_store ( const char* name, const void* data, uint64_t size );
 int32_t platform_log_file_create ( log_file_t* outFile, const char* name );
 int32_t platform_log_file_print  ( log_file_t* file, const char* format, ... );
 int32_t platform_log_file_write  ( log_file_t* file, const void* data, uint64_t size );
@@ -177,6 +292,18 @@ int32_t platform_log_file_close  ( log_file_t* file );
 int32_t platform_window_create       ( window_t* outWindow, void* userdata );
 int32_t platform_window_get_size     ( window_t* window, uint32_t* outWidth, uint32_t* outHeight );
 
+////////////////////////////////////////
+// Platform-specific threading functions
+
+// A worker pool runs jobs on threadCount threads: the thread calling platform_worker_pool_run,
+// which only returns once all jobs are done, and threadCount-1 threads of its own. A threadCount
+// of 0 asks for a thread per CPU core. Every thread has an index below threadCount, 0 being the
+// calling thread, so jobs can pick per-thread resources without any locking.
+
+int32_t platform_worker_pool_create  ( worker_pool_t* outPool, uint32_t threadCount );
+int32_t platform_worker_pool_run     ( worker_pool_t* pool, worker_job_t job, void* userdata, uint32_t jobCount );
+int32_t platform_worker_pool_destroy ( worker_pool_t* pool );
+
 ////////////////////////////////////////
 // Platform-specific Vulkan functions
 
@@ -0,0 +1,265 @@
+/*
+  Copyright (c) 2016 Rick van Miltenburg, NHTV Breda University of Applied Sciences
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+  associated documentation files (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all copies or
+  substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "vkbench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+////////////////////////////////////////
+// Statistics
+
+typedef struct vkbench_stats_s
+{
+	double min, median, p99, max, mean;
+} vkbench_stats_t;
+
+static int vkbench_compare_double ( const void* a, const void* b )
+{
+	double da = *(const double*)a, db = *(const double*)b;
+	return (da > db) - (da < db);
+}
+
+// Sorts the samples in place. Percentiles use the nearest-rank method, so they are always one of
+// the measured values rather than an interpolation between two of them.
+static vkbench_stats_t vkbench_compute_stats ( double* samples, uint32_t count )
+{
+	vkbench_stats_t stats = { 0 };
+	if ( count == 0 )
+		return stats;
+
+	qsort ( samples, count, sizeof ( double ), vkbench_compare_double );
+
+	double sum = 0.0;
+	for ( uint32_t i = 0; i < count; i++ )
+		sum += samples[i];
+
+	uint32_t p99Rank = (uint32_t)ceil ( 0.99 * count );
+	stats.min    = samples[0];
+	stats.median = (count & 1) ? samples[count/2] : 0.5 * (samples[count/2-1] + samples[count/2]);
+	stats.p99    = samples[(p99Rank > 0 ? p99Rank : 1) - 1];
+	stats.max    = samples[count-1];
+	stats.mean   = sum / count;
+	return stats;
+}
+
+////////////////////////////////////////
+// JSON output
+
+static void vkbench_write_string ( FILE* out, const char* str )
+{
+	fputc ( '"', out );
+	for ( ; *str != '\0'; str++ )
+	{
+		if ( *str == '"' || *str == '\\' )
+			fputc ( '\\', out );
+		fputc ( *str, out );
+	}
+	fputc ( '"', out );
+}
+
+static void vkbench_write_stats ( FILE* out, const vkbench_stats_t* stats, uint32_t count )
+{
+	fprintf (
+		out, "{ \"samples\": %u, \"min\": %.4f, \"median\": %.4f, \"p99\": %.4f, \"max\": %.4f, \"mean\": %.4f }",
+		count, stats->min, stats->median, stats->p99, stats->max, stats->mean
+	);
+}
+
+// Marker samples are stored frame-major (sample i of marker m lives at i*markerCount + m), which
+// is the order they come in. Gather a marker's samples into scratch to compute its statistics.
+static void vkbench_write_markers (
+	FILE* out, const char* name, uint32_t markerCount, const char** markerNames,
+	const double* samples, uint32_t sampleCount, double* scratch
+)
+{
+	fprintf ( out, "  \"%s\": [", name );
+	for ( uint32_t m = 0; m < markerCount; m++ )
+	{
+		for ( uint32_t i = 0; i < sampleCount; i++ )
+			scratch[i] = samples[i*markerCount + m];
+		vkbench_stats_t stats = vkbench_compute_stats ( scratch, sampleCount );
+
+		fprintf ( out, "%s\n    { \"name\": ", m == 0 ? "" : "," );
+		vkbench_write_string ( out, markerNames[m] );
+		fprintf ( out, ", \"ms\": " );
+		vkbench_write_stats ( out, &stats, sampleCount );
+		fprintf ( out, " }" );
+	}
+	fprintf ( out, "\n  ]" );
+}
+
+////////////////////////////////////////
+// Harness
+
+// Copies the latest results of a profiler into the sample array, but only if it completed a frame
+// since we last looked. GPU profilers lag behind and may not have anything new yet.
+static void vkbench_sample_profiler (
+	const profiler_t* profiler, uint64_t* lastCompleted, double* samples, uint32_t* sampleCount,
+	uint32_t maxSampleCount
+)
+{
+	if ( profiler == NULL || profiler->completedFrameCount == *lastCompleted || *sampleCount >= maxSampleCount )
+		return;
+
+	*lastCompleted = profiler->completedFrameCount;
+	memcpy ( samples + *sampleCount*profiler->markerCount, profiler->markerTimes, profiler->markerCount*sizeof ( double ) );
+	(*sampleCount)++;
+}
+
+int32_t vkbench_run ( const vkbench_config_t* config, void* userdata )
+{
+	timestamp_t freq, start, end;
+	platform_get_timestamp_freq ( &freq );
+	double ticksToMs = 1000.0 / (double)freq;
+
+	// Initialization
+
+	app_t* app = NULL;
+	platform_get_timestamp ( &start );
+	int32_t ret = app_init ( &app, userdata );
+	platform_get_timestamp ( &end );
+	if ( ret != 0 )
+		return ret;
+	double initMs = (end - start) * ticksToMs;
+
+	profiler_t* profilerCpu = NULL;
+	profiler_t* profilerGpu = NULL;
+	app_get_profilers ( app, &profilerCpu, &profilerGpu );
+
+	uint32_t frameCount  = config->frameCount;
+	double*  frameTimes  = NULL;
+	double*  scratch     = NULL;
+	double*  cpuSamples  = NULL;
+	double*  gpuSamples  = NULL;
+	FILE*    out         = NULL;
+
+	// malloc ( 0 ) may return NULL, which we'd take for a failure
+	uint32_t bufferCount = frameCount > 0 ? frameCount : 1;
+
+	// The sample buffers are only allocated for profilers with markers to sample, the others are
+	// left NULL and skipped by vkbench_sample_profiler.
+
+	if ( profilerCpu != NULL && profilerCpu->markerCount == 0 )
+		profilerCpu = NULL;
+	if ( profilerGpu != NULL && profilerGpu->markerCount == 0 )
+		profilerGpu = NULL;
+
+	frameTimes = (double*)malloc ( bufferCount*sizeof ( double ) );
+	scratch    = (double*)malloc ( bufferCount*sizeof ( double ) );
+	if ( profilerCpu != NULL )
+		cpuSamples = (double*)malloc ( bufferCount*profilerCpu->markerCount*sizeof ( double ) );
+	if ( profilerGpu != NULL )
+		gpuSamples = (double*)malloc ( bufferCount*profilerGpu->markerCount*sizeof ( double ) );
+	if ( frameTimes == NULL || scratch == NULL || (profilerCpu != NULL && cpuSamples == NULL) || (profilerGpu != NULL && gpuSamples == NULL) )
+	{
+		ret = platform_throw_error ( -1, "Failed to allocate benchmark samples" );
+		goto cleanup;
+	}
+
+	// Warmup: lets the driver finish any lazy work (pipeline compilation, memory residency) and
+	// fills up the frames in flight before we start measuring
+
+	for ( uint32_t i = 0; i < config->warmupFrameCount; i++ )
+	{
+		if ( (ret = app_render ( app, config->dt )) != 0 )
+			goto cleanup;
+	}
+
+	uint64_t cpuLastCompleted = profilerCpu != NULL ? profilerCpu->completedFrameCount : 0;
+	uint64_t gpuLastCompleted = profilerGpu != NULL ? profilerGpu->completedFrameCount : 0;
+	uint32_t cpuSampleCount = 0, gpuSampleCount = 0;
+
+	// Measured frames
+
+	for ( uint32_t i = 0; i < frameCount; i++ )
+	{
+		platform_get_timestamp ( &start );
+		ret = app_render ( app, config->dt );
+		platform_get_timestamp ( &end );
+		if ( ret != 0 )
+			goto cleanup;
+
+		frameTimes[i] = (end - start) * ticksToMs;
+		vkbench_sample_profiler ( profilerCpu, &cpuLastCompleted, cpuSamples, &cpuSampleCount, frameCount );
+		vkbench_sample_profiler ( profilerGpu, &gpuLastCompleted, gpuSamples, &gpuSampleCount, frameCount );
+	}
+
+	// The profilers are destroyed along with the app, but the marker names are static strings owned
+	// by the demo, so hold on to what we need to describe the samples.
+
+	uint32_t     cpuMarkerCount = profilerCpu != NULL ? profilerCpu->markerCount : 0;
+	uint32_t     gpuMarkerCount = profilerGpu != NULL ? profilerGpu->markerCount : 0;
+	const char** cpuMarkerNames = profilerCpu != NULL ? profilerCpu->markerNames : NULL;
+	const char** gpuMarkerNames = profilerGpu != NULL ? profilerGpu->markerNames : NULL;
+
+	// Shutdown. app_free waits for the queues to go idle, so this includes draining the frames
+	// still in flight.
+
+	platform_get_timestamp ( &start );
+	ret = app_free ( app );
+	platform_get_timestamp ( &end );
+	app = NULL;
+	if ( ret != 0 )
+		goto cleanup;
+	double freeMs = (end - start) * ticksToMs;
+
+	// Report
+
+	out = stdout;
+	if ( config->outputPath != NULL )
+	{
+		out = fopen ( config->outputPath, "w" );
+		if ( out == NULL )
+		{
+			ret = platform_throw_error ( -2, "Could not open \"%s\" for writing", config->outputPath );
+			goto cleanup;
+		}
+	}
+
+	vkbench_stats_t frameStats = vkbench_compute_stats ( frameTimes, frameCount );
+
+	fprintf ( out, "{\n" );
+	fprintf ( out, "  \"frames\": %u,\n  \"warmupFrames\": %u,\n  \"dt\": %.6f,\n", frameCount, config->warmupFrameCount, config->dt );
+	fprintf ( out, "  \"width\": %u,\n  \"height\": %u,\n", config->width, config->height );
+	fprintf ( out, "  \"initMs\": %.4f,\n  \"freeMs\": %.4f,\n", initMs, freeMs );
+	fprintf ( out, "  \"cpuFrameMs\": " );
+	vkbench_write_stats ( out, &frameStats, frameCount );
+	fprintf ( out, ",\n" );
+	vkbench_write_markers ( out, "cpuPhases", cpuMarkerCount, cpuMarkerNames, cpuSamples, cpuSampleCount, scratch );
+	fprintf ( out, ",\n" );
+	vkbench_write_markers ( out, "gpuPhases", gpuMarkerCount, gpuMarkerNames, gpuSamples, gpuSampleCount, scratch );
+	fprintf ( out, "\n}\n" );
+
+cleanup:
+	if ( out != NULL && out != stdout )
+		fclose ( out );
+
+	free ( frameTimes );
+	free ( scratch );
+	free ( cpuSamples );
+	free ( gpuSamples );
+
+	// Only still set if we bailed out before shutting down, in which case the error we are
+	// returning is the more interesting one.
+	if ( app != NULL )
+		app_free ( app );
+	return ret;
+}
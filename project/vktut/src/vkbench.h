@@ -0,0 +1,52 @@
+#pragma once
+
+/*
+  Copyright (c) 2016 Rick van Miltenburg, NHTV Breda University of Applied Sciences
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+  associated documentation files (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all copies or
+  substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifdef __cplusplus
+extern "C" {	// Expose functions with C linkage for cross-compat with C and C++
+#endif
+
+#include "vkbase.h"
+
+////////////////////////////////////////
+// Benchmark harness
+//
+// Drives app_init/app_render/app_free for a fixed amount of frames with a fixed simulated dt,
+// instead of the wall-clock dt the regular entry point passes, so runs are comparable between
+// changes. Timings are gathered from the demo's profilers (see app_get_profilers) and written out
+// as JSON once the run completes.
+
+typedef struct vkbench_config_s
+{
+	uint32_t    frameCount;         // Frames to measure
+	uint32_t    warmupFrameCount;   // Frames rendered before measuring, excluded from the results
+	double      dt;                 // Simulated time step passed to app_render, in seconds
+	uint32_t    width, height;      // Only reported; the platform creates the window/images
+	const char* outputPath;         // JSON destination, NULL for stdout
+} vkbench_config_t;
+
+int32_t vkbench_run ( const vkbench_config_t* config, void* userdata );
+
+////////////////////////////////////////
+// 
+
+#ifdef __cplusplus
+};	// Round off the cross-compat block
+#endif
@@ -31,6 +31,9 @@
 #include <stdio.h>
 #include <assert.h>
 #include <dlfcn.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 #include <android/log.h>
 #include <android_native_app_glue.h>
@@ -202,6 +205,92 @@ int32_t platform_file_close ( file_t* file )
 	return 0;
 }
 
+// Rather than copying the asset into a heap allocation like platform_file_load does, we keep the
+// asset open and hand out the pointer AAsset_getBuffer returns. For assets stored uncompressed
+// in the APK (see noCompress in build.gradle) this is a direct mmap of the APK contents, paged in
+// on demand. Compressed assets are inflated into a buffer owned by the asset, which still saves
+// the additional copy into our own allocation.
+
+int32_t platform_file_map ( file_mapping_t* outMapping, const char* path )
+{
+	AAsset* file = AAssetManager_open ( APP->activity->assetManager, path, AASSET_MODE_STREAMING );
+	if ( file == NULL )
+		return platform_throw_error ( -1, "Unable to open file %s", path );
+
+	const void* data = AAsset_getBuffer ( file );
+	if ( data == NULL )
+	{
+		AAsset_close ( file );
+		return platform_throw_error ( -2, "Unable to map file %s", path );
+	}
+
+	outMapping->data        = data;
+	outMapping->sizeInBytes = AAsset_getLength64 ( file );
+	outMapping->platform    = file;
+	return 0;
+}
+
+int32_t platform_file_unmap ( file_mapping_t* mapping )
+{
+	if ( mapping->data == NULL )
+		return platform_throw_error ( -1, "Attempting to unmap a NULL file mapping" );
+	AAsset_close ( (AAsset*)mapping->platform );
+	mapping->data        = NULL;
+	mapping->sizeInBytes = 0;
+	mapping->platform    = NULL;
+	return 0;
+}
+
+// The APK assets are read-only, so data files (caches and the like) go into the external data
+// path, same as the log files. Returns 1 if the file does not exist (yet), which is not an error.
+
+int32_t platform_data_file_load ( file_t* outFile, const char* name )
+{
+	char buffer[256];
+	snprintf ( buffer, sizeof ( buffer ), "%s/%s", APP->activity->externalDataPath, name );
+
+	outFile->data        = NULL;
+	outFile->sizeInBytes = 0;
+
+	FILE* file = fopen ( buffer, "rb" );
+	if ( file == NULL )
+		return 1;
+	fseek ( file, 0, SEEK_END );
+	long size = ftell ( file );
+	fseek ( file, 0, SEEK_SET );
+
+	uint8_t* data = malloc ( size > 0 ? size : 1 );
+	size_t read = fread ( data, 1, size, file );
+	fclose ( file );
+	if ( read != (size_t)size )
+	{
+		free ( data );
+		return platform_throw_error ( -1, "Could not read data file %s", buffer );
+	}
+
+	outFile->data = data;
+	outFile->sizeInBytes = size;
+
+	return 0;
+}
+
+int32_t platform_data_file_store ( const char* name, const void* data, uint64_t size )
+{
+	char buffer[256];
+	snprintf ( buffer, sizeof ( buffer ), "%s/%s", APP->activity->externalDataPath, name );
+
+	FILE* file = fopen ( buffer, "wb" );
+	if ( file == NULL )
+		return platform_throw_error ( -1, "Could not open data file %s for writing", buffer );
+
+	size_t written = fwrite ( data, 1, (size_t)size, file );
+	fclose ( file );
+	if ( written != (size_t)size )
+		return platform_throw_error ( -2, "Could not write data file %s", buffer );
+
+	return 0;
+}
+
 int32_t platform_log_file_create ( log_file_t* outFile, const char* name )
 {
 	char buffer[256];
@@ -291,6 +380,156 @@ int32_t platform_window_get_size ( window_t* window, uint32_t* outWidth, uint32_
 	return 0;
 }
 
+////////////////////////////////////////
+// Platform-specific threading functions
+
+typedef struct platform_worker_pool_s
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t  workAvailable;
+	pthread_cond_t  workDone;
+
+	// The jobs of the current run. Threads take the next job under the mutex, and run it without.
+	worker_job_t job;
+	void*        userdata;
+	uint32_t     jobCount, nextJob, jobsDone;
+
+	// Bumped for every run, so the threads can tell a new run from the one they already helped out
+	uint64_t     generation;
+	uint32_t     exitRequested;
+
+	uint32_t     threadCount;
+	pthread_t*   threads;
+	struct platform_worker_s* workers;
+} platform_worker_pool_t;
+
+typedef struct platform_worker_s
+{
+	platform_worker_pool_t* pool;
+	uint32_t threadIndex;
+} platform_worker_t;
+
+// Runs jobs until there are none left. Called and returns with the mutex of the pool held.
+static void platform_worker_pool_work ( platform_worker_pool_t* pool, uint32_t threadIndex )
+{
+	while ( pool->nextJob < pool->jobCount )
+	{
+		uint32_t jobIndex = pool->nextJob++;
+
+		pthread_mutex_unlock ( &pool->mutex );
+		pool->job ( pool->userdata, jobIndex, threadIndex );
+		pthread_mutex_lock ( &pool->mutex );
+
+		if ( ++pool->jobsDone == pool->jobCount )
+			pthread_cond_signal ( &pool->workDone );
+	}
+}
+
+static void* platform_worker_thread ( void* userdata )
+{
+	platform_worker_t* worker = userdata;
+	platform_worker_pool_t* pool = worker->pool;
+	uint64_t generation = 0;
+
+	pthread_mutex_lock ( &pool->mutex );
+	for ( ;; )
+	{
+		while ( !pool->exitRequested && pool->generation == generation )
+			pthread_cond_wait ( &pool->workAvailable, &pool->mutex );
+		if ( pool->exitRequested )
+			break;
+
+		generation = pool->generation;
+		platform_worker_pool_work ( pool, worker->threadIndex );
+	}
+	pthread_mutex_unlock ( &pool->mutex );
+	return NULL;
+}
+
+int32_t platform_worker_pool_create ( worker_pool_t* outPool, uint32_t threadCount )
+{
+	if ( threadCount == 0 )
+	{
+		long cpuCount = sysconf ( _SC_NPROCESSORS_ONLN );
+		threadCount = cpuCount > 0 ? (uint32_t)cpuCount : 1;
+	}
+
+	platform_worker_pool_t* pool = calloc ( 1, sizeof ( platform_worker_pool_t ) );
+	pool->threadCount = threadCount;
+	pool->threads     = calloc ( threadCount, sizeof ( pthread_t ) );
+	pool->workers     = calloc ( threadCount, sizeof ( platform_worker_t ) );
+	pthread_mutex_init ( &pool->mutex, NULL );
+	pthread_cond_init ( &pool->workAvailable, NULL );
+	pthread_cond_init ( &pool->workDone, NULL );
+
+	outPool->platform    = pool;
+	outPool->threadCount = 1;
+
+	// Thread 0 is whichever thread runs the jobs, so only the others are started here. If starting
+	// one fails, the pool just makes do with the threads it has.
+
+	for ( uint32_t i = 1; i < threadCount; i++ )
+	{
+		pool->workers[i] = (platform_worker_t){ .pool = pool, .threadIndex = i };
+		if ( pthread_create ( &pool->threads[i], NULL, platform_worker_thread, &pool->workers[i] ) != 0 )
+		{
+			platform_log_warning ( "Could not start worker thread %u of %u\n", i, threadCount );
+			break;
+		}
+		outPool->threadCount = i + 1;
+	}
+	pool->threadCount = outPool->threadCount;
+
+	return 0;
+}
+
+int32_t platform_worker_pool_run ( worker_pool_t* pool, worker_job_t job, void* userdata, uint32_t jobCount )
+{
+	platform_worker_pool_t* platformPool = pool->platform;
+
+	pthread_mutex_lock ( &platformPool->mutex );
+	platformPool->job      = job;
+	platformPool->userdata = userdata;
+	platformPool->jobCount = jobCount;
+	platformPool->nextJob  = 0;
+	platformPool->jobsDone = 0;
+	platformPool->generation++;
+	pthread_cond_broadcast ( &platformPool->workAvailable );
+
+	platform_worker_pool_work ( platformPool, 0 );
+	while ( platformPool->jobsDone < platformPool->jobCount )
+		pthread_cond_wait ( &platformPool->workDone, &platformPool->mutex );
+	pthread_mutex_unlock ( &platformPool->mutex );
+
+	return 0;
+}
+
+int32_t platform_worker_pool_destroy ( worker_pool_t* pool )
+{
+	platform_worker_pool_t* platformPool = pool->platform;
+	if ( platformPool == NULL )
+		return 0;
+
+	pthread_mutex_lock ( &platformPool->mutex );
+	platformPool->exitRequested = 1;
+	pthread_cond_broadcast ( &platformPool->workAvailable );
+	pthread_mutex_unlock ( &platformPool->mutex );
+
+	for ( uint32_t i = 1; i < platformPool->threadCount; i++ )
+		pthread_join ( platformPool->threads[i], NULL );
+
+	pthread_cond_destroy ( &platformPool->workDone );
+	pthread_cond_destroy ( &platformPool->workAvailable );
+	pthread_mutex_destroy ( &platformPool->mutex );
+	free ( platformPool->workers );
+	free ( platformPool->threads );
+	free ( platformPool );
+
+	pool->platform    = NULL;
+	pool->threadCount = 0;
+	return 0;
+}
+
 ////////////////////////////////////////
 // Platform-specific Vulkan functions
 
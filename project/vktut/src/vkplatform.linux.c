@@ -0,0 +1,774 @@
+/*
+  Copyright (c) 2016 Rick van Miltenburg, NHTV Breda University of Applied Sciences
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+  associated documentation files (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all copies or
+  substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#if !defined ( __linux__ ) || defined ( __ANDROID__ )
+#error Wait... This is not (desktop) Linux!
+#endif
+
+// We need to define VK_USE_PLATFORM_XCB_KHR in order to use XCB specific functions
+// This is not required outside of the platform-specific implementation
+#define VK_USE_PLATFORM_XCB_KHR 1
+#include <xcb/xcb.h>
+#include "vkbase.h"
+#if VKTUT_BENCH
+#include "vkbench.h"
+#endif
+#include <alloca.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+////////////////////////////////////////
+// Linux defines
+
+#define WINDOW_WIDTH       1920
+#define WINDOW_HEIGHT      1080
+
+////////////////////////////////////////
+// Platform-specific data structure
+
+// There is no native Wayland surface support here: Wayland compositors run XWayland, which the
+// XCB path works with just fine. Machines without any display server (CI, render farm) use the
+// headless mode instead, which renders into offscreen images rather than a surface. Headless mode
+// is used when --headless is passed, VKTUT_HEADLESS is set, or no X server can be reached.
+
+typedef struct platform_data_s
+{
+	app_t* app;
+	uint32_t exitRequested;
+	uint32_t initialized;
+
+	uint32_t headless;
+	uint32_t width, height;
+	uint64_t frameCount;	// Amount of frames to render before exiting, 0 to run until closed
+
+	struct platform_window_s* window;
+} platform_data_t;
+
+typedef struct platform_window_s
+{
+	xcb_connection_t* connection;
+	xcb_window_t window;
+	xcb_atom_t deleteWindowAtom;
+	uint32_t width, height;
+	platform_data_t* platformData;
+} platform_window_t;
+
+static platform_data_t* PLATFORM;	// The Vulkan functions below need to know whether we are
+// running headless, but do not get passed anything to find out with. Same story as on Android.
+
+////////////////////////////////////////
+// Platform-specific application functions
+
+int32_t platform_log_warning ( const char* warningFormat, ... )
+{
+	// Warnings go to stderr, keeping stdout free for anything the application wants to output
+	va_list va;
+	va_start ( va, warningFormat );
+	vfprintf ( stderr, warningFormat, va );
+	va_end ( va );
+	return 0;
+}
+
+int32_t platform_throw_error ( int32_t code, const char* humanReadableFormat, ... )
+{
+	// There is no dialog box to show on a machine which might not even have a display, so errors
+	// are printed to stderr instead
+	va_list va;
+	va_start ( va, humanReadableFormat );
+	fprintf ( stderr, "Error (%d): ", code );
+	vfprintf ( stderr, humanReadableFormat, va );
+	fprintf ( stderr, "\n" );
+	va_end ( va );
+	return code;
+}
+
+int32_t platform_get_timestamp ( timestamp_t* outTimestamp )
+{
+	struct timespec ts;
+	clock_gettime ( CLOCK_MONOTONIC, &ts );
+
+	*outTimestamp = (timestamp_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	return 0;
+}
+
+int32_t platform_get_timestamp_freq ( timestamp_t* outTimestampFreq )
+{
+	*outTimestampFreq = 1000000000;
+	return 0;
+}
+
+////////////////////////////////////////
+// Platform-specific I/O functions
+
+int32_t platform_file_load ( file_t* outFile, const char* path )
+{
+	// Same layout as on Windows: the executable lives in bin/, the assets in bin/assets/
+	size_t len = 7 + strlen ( path ) + 1;
+	char* fullPath = alloca ( len );
+	snprintf ( fullPath, len, "assets/%s", path );
+
+	FILE* file = fopen ( fullPath, "rb" );
+	if ( file == NULL )
+		return platform_throw_error ( -1, "Could not open file %s", fullPath );
+	fseek ( file, 0, SEEK_END );
+	long size = ftell ( file );
+	fseek ( file, 0, SEEK_SET );
+
+	uint8_t* data = malloc ( size );
+	fread ( data, 1, size, file );
+	fclose ( file );
+
+	outFile->data = data;
+	outFile->sizeInBytes = size;
+
+	return 0;
+}
+
+int32_t platform_file_close ( file_t* file )
+{
+	if ( file->data == NULL )
+		return platform_throw_error ( -1, "Attempting to close a NULL file" );
+	free ( file->data );
+	file->data        = NULL;
+	file->sizeInBytes = 0;
+	return 0;
+}
+
+int32_t platform_file_map ( file_mapping_t* outMapping, const char* path )
+{
+	size_t len = 7 + strlen ( path ) + 1;
+	char* fullPath = alloca ( len );
+	snprintf ( fullPath, len, "assets/%s", path );
+
+	int fd = open ( fullPath, O_RDONLY );
+	if ( fd < 0 )
+		return platform_throw_error ( -1, "Could not open file %s", fullPath );
+
+	struct stat st;
+	if ( fstat ( fd, &st ) != 0 || st.st_size == 0 )
+	{
+		close ( fd );
+		return platform_throw_error ( -2, "Could not get the size of file %s", fullPath );
+	}
+
+	// The mapping keeps its own reference to the file, so the descriptor can be closed right away
+	void* data = mmap ( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close ( fd );
+	if ( data == MAP_FAILED )
+		return platform_throw_error ( -3, "Could not map file %s", fullPath );
+
+	// The loaders walk through the data front to back, so have the kernel read ahead aggressively
+	madvise ( data, st.st_size, MADV_SEQUENTIAL );
+
+	outMapping->data        = data;
+	outMapping->sizeInBytes = st.st_size;
+	outMapping->platform    = NULL;
+	return 0;
+}
+
+int32_t platform_file_unmap ( file_mapping_t* mapping )
+{
+	if ( mapping->data == NULL )
+		return platform_throw_error ( -1, "Attempting to unmap a NULL file mapping" );
+	munmap ( (void*)mapping->data, mapping->sizeInBytes );
+	mapping->data        = NULL;
+	mapping->sizeInBytes = 0;
+	return 0;
+}
+
+// Data files (caches and the like) are written to and read from the working directory, next to
+// the log files. Returns 1 if the file does not exist (yet), which is not an error.
+
+int32_t platform_data_file_load ( file_t* outFile, const char* name )
+{
+	outFile->data        = NULL;
+	outFile->sizeInBytes = 0;
+
+	FILE* file = fopen ( name, "rb" );
+	if ( file == NULL )
+		return 1;
+	fseek ( file, 0, SEEK_END );
+	long size = ftell ( file );
+	fseek ( file, 0, SEEK_SET );
+
+	uint8_t* data = malloc ( size > 0 ? size : 1 );
+	size_t read = fread ( data, 1, size, file );
+	fclose ( file );
+	if ( read != (size_t)size )
+	{
+		free ( data );
+		return platform_throw_error ( -1, "Could not read data file %s", name );
+	}
+
+	outFile->data = data;
+	outFile->sizeInBytes = size;
+
+	return 0;
+}
+
+int32_t platform_data_file_store ( const char* name, const void* data, uint64_t size )
+{
+	FILE* file = fopen ( name, "wb" );
+	if ( file == NULL )
+		return platform_throw_error ( -1, "Could not open data file %s for writing", name );
+
+	size_t written = fwrite ( data, 1, (size_t)size, file );
+	fclose ( file );
+	if ( written != (size_t)size )
+		return platform_throw_error ( -2, "Could not write data file %s", name );
+
+	return 0;
+}
+
+int32_t platform_log_file_create ( log_file_t* outFile, const char* name )
+{
+	outFile->platform = fopen ( name, "wb" );
+	if ( outFile->platform == NULL )
+		return -1;
+
+	return 0;
+}
+
+int32_t platform_log_file_print ( log_file_t* file, const char* format, ... )
+{
+	va_list va;
+	va_start(va,format);
+	vfprintf ( (FILE*)file->platform, format, va );
+	va_end(va);
+	return 0;
+}
+
+int32_t platform_log_file_write ( log_file_t* file, const void* data, uint64_t size )
+{
+	fwrite ( data, size, 1, (FILE*)file->platform );
+	return 0;
+}
+
+int32_t platform_log_file_close ( log_file_t* file )
+{
+	fclose ( (FILE*)file->platform );
+	return 0;
+}
+
+////////////////////////////////////////
+// Platform-specific window management functions
+
+static xcb_atom_t platform_xcb_intern_atom ( xcb_connection_t* connection, const char* name )
+{
+	xcb_intern_atom_reply_t* reply = xcb_intern_atom_reply (
+		connection, xcb_intern_atom ( connection, 0, strlen ( name ), name ), NULL
+	);
+	if ( reply == NULL )
+		return XCB_ATOM_NONE;
+	xcb_atom_t atom = reply->atom;
+	free ( reply );
+	return atom;
+}
+
+int32_t platform_window_create ( window_t* outWindow, void* userdata )
+{
+	platform_window_t* window = calloc ( 1, sizeof ( platform_window_t ) );
+	window->platformData = userdata;
+	window->width        = window->platformData->width;
+	window->height       = window->platformData->height;
+	window->platformData->window = window;
+	outWindow->platform  = window;
+	outWindow->surface   = VK_NULL_HANDLE;
+
+	if ( window->platformData->headless )
+		return 0;
+
+	int screenIndex;
+	window->connection = xcb_connect ( NULL, &screenIndex );
+	if ( xcb_connection_has_error ( window->connection ) )
+	{
+		// No X server to talk to. Rather than failing, render without a window.
+		platform_log_warning ( "Could not connect to an X server, running headless\n" );
+		xcb_disconnect ( window->connection );
+		window->connection = NULL;
+		window->platformData->headless = 1;
+		return 0;
+	}
+
+	xcb_screen_iterator_t it = xcb_setup_roots_iterator ( xcb_get_setup ( window->connection ) );
+	for ( int i = 0; i < screenIndex; i++ )
+		xcb_screen_next ( &it );
+	xcb_screen_t* screen = it.data;
+
+	// Create the window, listening for resizes through structure notifications
+
+	window->window = xcb_generate_id ( window->connection );
+	xcb_create_window (
+		window->connection, XCB_COPY_FROM_PARENT, window->window, screen->root,
+		0, 0, window->width, window->height, 0,
+		XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
+		XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK,
+		(uint32_t[2]){ screen->black_pixel, XCB_EVENT_MASK_STRUCTURE_NOTIFY }
+	);
+
+	const char* title = "Vulkan example";
+	xcb_change_property (
+		window->connection, XCB_PROP_MODE_REPLACE, window->window,
+		XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8, strlen ( title ), title
+	);
+
+	// Without opting in to WM_DELETE_WINDOW, the window manager would kill our connection when
+	// the window is closed rather than letting us shut down properly
+
+	xcb_atom_t protocolsAtom = platform_xcb_intern_atom ( window->connection, "WM_PROTOCOLS" );
+	window->deleteWindowAtom = platform_xcb_intern_atom ( window->connection, "WM_DELETE_WINDOW" );
+	xcb_change_property (
+		window->connection, XCB_PROP_MODE_REPLACE, window->window,
+		protocolsAtom, XCB_ATOM_ATOM, 32, 1, &window->deleteWindowAtom
+	);
+
+	xcb_map_window ( window->connection, window->window );
+	xcb_flush ( window->connection );
+
+	return 0;
+}
+
+int32_t platform_window_get_size ( window_t* window, uint32_t* outWidth, uint32_t* outHeight )
+{
+	platform_window_t* platformWindow = window->platform;
+	*outWidth  = platformWindow->width;
+	*outHeight = platformWindow->height;
+	return 0;
+}
+
+// The benchmark build is headless and has no events to process
+#if !VKTUT_BENCH
+static void platform_window_process_events ( platform_window_t* window )
+{
+	if ( window->connection == NULL )
+		return;
+
+	xcb_generic_event_t* event;
+	while ( (event = xcb_poll_for_event ( window->connection )) != NULL )
+	{
+		switch ( event->response_type & ~0x80 )
+		{
+		case XCB_CONFIGURE_NOTIFY:
+			{
+				xcb_configure_notify_event_t* configure = (xcb_configure_notify_event_t*)event;
+				if ( configure->width == window->width && configure->height == window->height )
+					break;
+
+				window->width  = configure->width;
+				window->height = configure->height;
+
+				if ( window->platformData->initialized != 1 )
+					break;
+
+				int32_t ret = app_resize ( window->platformData->app, window->width, window->height );
+				if ( ret != 0 )
+					platform_throw_error ( ret, "app_resize failed" );
+			}
+			break;
+
+		case XCB_CLIENT_MESSAGE:
+			if ( ((xcb_client_message_event_t*)event)->data.data32[0] == window->deleteWindowAtom )
+				window->platformData->exitRequested = 1;
+			break;
+		}
+		free ( event );
+	}
+
+	if ( xcb_connection_has_error ( window->connection ) )
+		window->platformData->exitRequested = 1;
+}
+#endif
+
+////////////////////////////////////////
+// Platform-specific threading functions
+
+typedef struct platform_worker_pool_s
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t  workAvailable;
+	pthread_cond_t  workDone;
+
+	// The jobs of the current run. Threads take the next job under the mutex, and run it without.
+	worker_job_t job;
+	void*        userdata;
+	uint32_t     jobCount, nextJob, jobsDone;
+
+	// Bumped for every run, so the threads can tell a new run from the one they already helped out
+	uint64_t     generation;
+	uint32_t     exitRequested;
+
+	uint32_t     threadCount;
+	pthread_t*   threads;
+	struct platform_worker_s* workers;
+} platform_worker_pool_t;
+
+typedef struct platform_worker_s
+{
+	platform_worker_pool_t* pool;
+	uint32_t threadIndex;
+} platform_worker_t;
+
+// Runs jobs until there are none left. Called and returns with the mutex of the pool held.
+static void platform_worker_pool_work ( platform_worker_pool_t* pool, uint32_t threadIndex )
+{
+	while ( pool->nextJob < pool->jobCount )
+	{
+		uint32_t jobIndex = pool->nextJob++;
+
+		pthread_mutex_unlock ( &pool->mutex );
+		pool->job ( pool->userdata, jobIndex, threadIndex );
+		pthread_mutex_lock ( &pool->mutex );
+
+		if ( ++pool->jobsDone == pool->jobCount )
+			pthread_cond_signal ( &pool->workDone );
+	}
+}
+
+static void* platform_worker_thread ( void* userdata )
+{
+	platform_worker_t* worker = userdata;
+	platform_worker_pool_t* pool = worker->pool;
+	uint64_t generation = 0;
+
+	pthread_mutex_lock ( &pool->mutex );
+	for ( ;; )
+	{
+		while ( !pool->exitRequested && pool->generation == generation )
+			pthread_cond_wait ( &pool->workAvailable, &pool->mutex );
+		if ( pool->exitRequested )
+			break;
+
+		generation = pool->generation;
+		platform_worker_pool_work ( pool, worker->threadIndex );
+	}
+	pthread_mutex_unlock ( &pool->mutex );
+	return NULL;
+}
+
+int32_t platform_worker_pool_create ( worker_pool_t* outPool, uint32_t threadCount )
+{
+	if ( threadCount == 0 )
+	{
+		long cpuCount = sysconf ( _SC_NPROCESSORS_ONLN );
+		threadCount = cpuCount > 0 ? (uint32_t)cpuCount : 1;
+	}
+
+	platform_worker_pool_t* pool = calloc ( 1, sizeof ( platform_worker_pool_t ) );
+	pool->threadCount = threadCount;
+	pool->threads     = calloc ( threadCount, sizeof ( pthread_t ) );
+	pool->workers     = calloc ( threadCount, sizeof ( platform_worker_t ) );
+	pthread_mutex_init ( &pool->mutex, NULL );
+	pthread_cond_init ( &pool->workAvailable, NULL );
+	pthread_cond_init ( &pool->workDone, NULL );
+
+	outPool->platform    = pool;
+	outPool->threadCount = 1;
+
+	// Thread 0 is whichever thread runs the jobs, so only the others are started here. If starting
+	// one fails, the pool just makes do with the threads it has.
+
+	for ( uint32_t i = 1; i < threadCount; i++ )
+	{
+		pool->workers[i] = (platform_worker_t){ .pool = pool, .threadIndex = i };
+		if ( pthread_create ( &pool->threads[i], NULL, platform_worker_thread, &pool->workers[i] ) != 0 )
+		{
+			platform_log_warning ( "Could not start worker thread %u of %u\n", i, threadCount );
+			break;
+		}
+		outPool->threadCount = i + 1;
+	}
+	pool->threadCount = outPool->threadCount;
+
+	return 0;
+}
+
+int32_t platform_worker_pool_run ( worker_pool_t* pool, worker_job_t job, void* userdata, uint32_t jobCount )
+{
+	platform_worker_pool_t* platformPool = pool->platform;
+
+	pthread_mutex_lock ( &platformPool->mutex );
+	platformPool->job      = job;
+	platformPool->userdata = userdata;
+	platformPool->jobCount = jobCount;
+	platformPool->nextJob  = 0;
+	platformPool->jobsDone = 0;
+	platformPool->generation++;
+	pthread_cond_broadcast ( &platformPool->workAvailable );
+
+	platform_worker_pool_work ( platformPool, 0 );
+	while ( platformPool->jobsDone < platformPool->jobCount )
+		pthread_cond_wait ( &platformPool->workDone, &platformPool->mutex );
+	pthread_mutex_unlock ( &platformPool->mutex );
+
+	return 0;
+}
+
+int32_t platform_worker_pool_destroy ( worker_pool_t* pool )
+{
+	platform_worker_pool_t* platformPool = pool->platform;
+	if ( platformPool == NULL )
+		return 0;
+
+	pthread_mutex_lock ( &platformPool->mutex );
+	platformPool->exitRequested = 1;
+	pthread_cond_broadcast ( &platformPool->workAvailable );
+	pthread_mutex_unlock ( &platformPool->mutex );
+
+	for ( uint32_t i = 1; i < platformPool->threadCount; i++ )
+		pthread_join ( platformPool->threads[i], NULL );
+
+	pthread_cond_destroy ( &platformPool->workDone );
+	pthread_cond_destroy ( &platformPool->workAvailable );
+	pthread_mutex_destroy ( &platformPool->mutex );
+	free ( platformPool->workers );
+	free ( platformPool->threads );
+	free ( platformPool );
+
+	pool->platform    = NULL;
+	pool->threadCount = 0;
+	return 0;
+}
+
+////////////////////////////////////////
+// Platform-specific Vulkan functions
+
+int32_t platform_vulkan_get_required_instance_layers (
+	VkLayerProperties* layers, uint32_t layerCount, const char*** outLayers, uint32_t* outCount
+)
+{
+#if VK_ENABLE_DEBUG
+	static const char* Layers[] = {
+		"VK_LAYER_LUNARG_standard_validation",
+	};
+	*outLayers = Layers;
+	*outCount  = sizeof ( Layers ) / sizeof ( Layers[0] );
+	return 0;
+#else
+	// Since layers are for the most part intended for debug purposes, we have no specific
+	// layers we would like to enable in this case.
+	*outLayers = NULL;
+	*outCount  = 0;
+	return 0;
+#endif
+}
+
+int32_t platform_vulkan_get_required_instance_extensions (
+	const char*** outExtensions, uint32_t* outCount, uint32_t* outDebugSupported
+)
+{
+	static const char* Extensions[] = {
+#if VK_ENABLE_DEBUG
+		"VK_EXT_debug_report",		// Allows for debug output functionality
+#endif
+		"VK_KHR_surface",			// Allows for output targets (window render targets)
+		"VK_KHR_xcb_surface",		// Allows for platform-specific output targets
+	};
+	static const uint32_t DebugExtensionCount = VK_ENABLE_DEBUG ? 1 : 0;
+
+#if VK_ENABLE_DEBUG
+	*outDebugSupported = 1;
+#else
+	*outDebugSupported = 0;
+#endif
+
+	// Without a window there is no surface, so the surface extensions are left out. This also
+	// allows running on implementations without any presentation support at all.
+
+	*outExtensions = Extensions;
+	*outCount      = PLATFORM->headless
+		? DebugExtensionCount
+		: sizeof ( Extensions ) / sizeof ( Extensions[0] );
+	return 0;
+}
+
+int32_t platform_vulkan_get_required_device_extensions (
+	const char*** outExtensions, uint32_t* outCount
+)
+{
+	static const char* Extensions[] = {
+		VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+	};
+
+	*outExtensions = Extensions;
+	*outCount      = PLATFORM->headless ? 0 : sizeof ( Extensions ) / sizeof ( Extensions[0] );
+	return 0;
+}
+
+int32_t platform_vulkan_create_surface (
+	VkSurfaceKHR* outSurface, VkInstance instance, window_t* window
+)
+{
+	platform_window_t* platformWindow = window->platform;
+
+	// No surface in headless mode, vkbase creates offscreen images to render into instead
+	if ( platformWindow->connection == NULL )
+	{
+		*outSurface = VK_NULL_HANDLE;
+		return 0;
+	}
+
+	VkResult vkResult = vkCreateXcbSurfaceKHR (
+		instance,
+		&(VkXcbSurfaceCreateInfoKHR){
+			.sType      = VK_STRUCTURE_TYPE_XCB_SURFACE_CREATE_INFO_KHR,
+			.connection = platformWindow->connection,
+			.window     = platformWindow->window,
+		},
+		NULL,
+		outSurface
+	);
+	if ( vkResult != VK_SUCCESS )
+		return platform_throw_error ( -1, "vkCreateXcbSurfaceKHR failed with code %u", vkResult );
+	return 0;
+}
+
+////////////////////////////////////////
+// Entry point
+
+#if VKTUT_BENCH
+
+// The benchmark build always runs headless: a window would tie the results to the compositor and
+// the display's refresh rate. The frame loop itself lives in vkbench.c.
+
+int main ( int argc, char* argv[] )
+{
+	platform_data_t data = {
+		.width    = WINDOW_WIDTH,
+		.height   = WINDOW_HEIGHT,
+		.headless = 1,
+	};
+	PLATFORM = &data;
+
+	vkbench_config_t config = {
+		.frameCount       = 1000,
+		.warmupFrameCount = 100,
+		.dt               = 1.0 / 60.0,
+		.outputPath       = NULL,
+	};
+
+	for ( int i = 1; i < argc; i++ )
+	{
+		if ( strcmp ( argv[i], "--frames" ) == 0 && i + 1 < argc )
+			config.frameCount = (uint32_t)strtoul ( argv[++i], NULL, 10 );
+		else if ( strcmp ( argv[i], "--warmup" ) == 0 && i + 1 < argc )
+			config.warmupFrameCount = (uint32_t)strtoul ( argv[++i], NULL, 10 );
+		else if ( strcmp ( argv[i], "--dt" ) == 0 && i + 1 < argc )
+			config.dt = strtod ( argv[++i], NULL );
+		else if ( strcmp ( argv[i], "--size" ) == 0 && i + 1 < argc )
+			sscanf ( argv[++i], "%ux%u", &data.width, &data.height );
+		else if ( strcmp ( argv[i], "--out" ) == 0 && i + 1 < argc )
+			config.outputPath = argv[++i];
+		else
+		{
+			fprintf ( stderr, "Usage: %s [--frames N] [--warmup N] [--dt SECONDS] [--size WxH] [--out FILE]\n", argv[0] );
+			return -1;
+		}
+	}
+
+	if ( config.frameCount == 0 || data.width == 0 || data.height == 0 )
+	{
+		fprintf ( stderr, "Frame count and size must be non-zero\n" );
+		return -1;
+	}
+
+	config.width  = data.width;
+	config.height = data.height;
+
+	return vkbench_run ( &config, &data );
+}
+
+#else
+
+static volatile sig_atomic_t SignalExitRequested = 0;
+
+static void platform_signal_handler ( int signal )
+{
+	SignalExitRequested = 1;
+}
+
+int main ( int argc, char* argv[] )
+{
+	platform_data_t data = {
+		.width  = WINDOW_WIDTH,
+		.height = WINDOW_HEIGHT,
+	};
+	PLATFORM = &data;
+
+	const char* headlessEnv = getenv ( "VKTUT_HEADLESS" );
+	if ( headlessEnv != NULL && strcmp ( headlessEnv, "0" ) != 0 )
+		data.headless = 1;
+
+	for ( int i = 1; i < argc; i++ )
+	{
+		if ( strcmp ( argv[i], "--headless" ) == 0 )
+			data.headless = 1;
+		else if ( strcmp ( argv[i], "--frames" ) == 0 && i + 1 < argc )
+			data.frameCount = strtoull ( argv[++i], NULL, 10 );
+		else if ( strcmp ( argv[i], "--size" ) == 0 && i + 1 < argc )
+			sscanf ( argv[++i], "%ux%u", &data.width, &data.height );
+		else
+		{
+			fprintf ( stderr, "Usage: %s [--headless] [--frames N] [--size WxH]\n", argv[0] );
+			return -1;
+		}
+	}
+
+	// Without a window to close, SIGINT/SIGTERM are the way to stop; shut down cleanly on those
+	signal ( SIGINT,  platform_signal_handler );
+	signal ( SIGTERM, platform_signal_handler );
+
+	int32_t ret = app_init ( &data.app, &data );
+	if ( ret != 0 )
+		return ret;
+
+	data.initialized = 1;
+
+	timestamp_t cur, prev, freq;
+	platform_get_timestamp_freq ( &freq );
+	platform_get_timestamp ( &cur );
+
+	double tickToSec = 1.0 / freq;
+
+	for ( uint64_t frame = 0; data.frameCount == 0 || frame < data.frameCount; frame++ )
+	{
+		prev = cur;
+
+		platform_window_process_events ( data.window );
+
+		if ( data.exitRequested || SignalExitRequested )
+			break;
+
+		platform_get_timestamp ( &cur );
+		app_render ( data.app, tickToSec * (cur - prev) );
+	}
+
+	return app_free ( data.app );
+}
+
+#endif
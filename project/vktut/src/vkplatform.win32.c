@@ -168,6 +168,136 @@ int32_t platform_file_close ( file_t* file )
 	return 0;
 }
 
+// Memory maps a file instead of reading it into a heap allocation. The pages are only read from
+// disk once they are actually touched, and as they are backed by the file itself, the OS can drop
+// them again under memory pressure without them ever hitting the page file. This keeps the peak
+// memory usage of loading large model files down to the staging memory they are copied into.
+
+typedef struct platform_file_mapping_s
+{
+	HANDLE file;
+	HANDLE mapping;
+} platform_file_mapping_t;
+
+int32_t platform_file_map ( file_mapping_t* outMapping, const char* path )
+{
+	// See platform_file_load for why the assets/ prefix is added here
+	size_t len = 7 + strlen ( path ) + 1;
+	char* fullPath = _alloca ( len );
+	strcpy_s ( fullPath, len, "assets/" );
+	strcat_s ( fullPath, len, path );
+
+	// FILE_FLAG_SEQUENTIAL_SCAN hints the cache manager to read ahead aggressively, which matches
+	// the way the loaders walk through the mapped data front to back
+
+	HANDLE file = CreateFileA (
+		fullPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL
+	);
+	if ( file == INVALID_HANDLE_VALUE )
+		return platform_throw_error ( -1, "Could not open file %s", fullPath );
+
+	LARGE_INTEGER size;
+	if ( GetFileSizeEx ( file, &size ) == FALSE || size.QuadPart == 0 )
+	{
+		CloseHandle ( file );
+		return platform_throw_error ( -2, "Could not get the size of file %s", fullPath );
+	}
+
+	HANDLE mapping = CreateFileMappingA ( file, NULL, PAGE_READONLY, 0, 0, NULL );
+	if ( mapping == NULL )
+	{
+		CloseHandle ( file );
+		return platform_throw_error (
+			-3, "CreateFileMapping failed for file %s with code %u", fullPath, GetLastError ( )
+		);
+	}
+
+	const void* data = MapViewOfFile ( mapping, FILE_MAP_READ, 0, 0, 0 );
+	if ( data == NULL )
+	{
+		CloseHandle ( mapping );
+		CloseHandle ( file );
+		return platform_throw_error (
+			-4, "MapViewOfFile failed for file %s with code %u", fullPath, GetLastError ( )
+		);
+	}
+
+	platform_file_mapping_t* platformMapping = malloc ( sizeof ( platform_file_mapping_t ) );
+	platformMapping->file    = file;
+	platformMapping->mapping = mapping;
+
+	outMapping->data        = data;
+	outMapping->sizeInBytes = (size_t)size.QuadPart;
+	outMapping->platform    = platformMapping;
+	return 0;
+}
+
+int32_t platform_file_unmap ( file_mapping_t* mapping )
+{
+	if ( mapping->data == NULL )
+		return platform_throw_error ( -1, "Attempting to unmap a NULL file mapping" );
+
+	platform_file_mapping_t* platformMapping = mapping->platform;
+	UnmapViewOfFile ( mapping->data );
+	CloseHandle ( platformMapping->mapping );
+	CloseHandle ( platformMapping->file );
+	free ( platformMapping );
+
+	mapping->data        = NULL;
+	mapping->sizeInBytes = 0;
+	mapping->platform    = NULL;
+	return 0;
+}
+
+// Data files are files the application writes itself and reads back on a later run, such as
+// caches. They live next to the log files in the working directory rather than in assets/, as
+// the assets are considered read-only. A missing data file is not an error: it simply has not
+// been written yet, which is reported by returning 1.
+
+int32_t platform_data_file_load ( file_t* outFile, const char* name )
+{
+	FILE* file;
+	outFile->data        = NULL;
+	outFile->sizeInBytes = 0;
+
+	errno_t err = fopen_s ( &file, name, "rb" );
+	if ( err != 0 )
+		return 1;
+	fseek ( file, 0, SEEK_END );
+	long size = ftell ( file );
+	fseek ( file, 0, SEEK_SET );
+
+	uint8_t* data = malloc ( size > 0 ? size : 1 );
+	size_t read = fread ( data, 1, size, file );
+	fclose ( file );
+	if ( read != (size_t)size )
+	{
+		free ( data );
+		return platform_throw_error ( -1, "Could not read data file %s", name );
+	}
+
+	outFile->data = data;
+	outFile->sizeInBytes = size;
+
+	return 0;
+}
+
+int32_t platform_data_file_store ( const char* name, const void* data, uint64_t size )
+{
+	FILE* file;
+	errno_t err = fopen_s ( &file, name, "wb" );
+	if ( err != 0 )
+		return platform_throw_error ( -1, "Could not open data file %s for writing", name );
+
+	size_t written = fwrite ( data, 1, (size_t)size, file );
+	fclose ( file );
+	if ( written != (size_t)size )
+		return platform_throw_error ( -2, "Could not write data file %s", name );
+
+	return 0;
+}
+
 int32_t platform_log_file_create ( log_file_t* outFile, const char* name )
 {
 	char buffer[32];
@@ -300,6 +430,159 @@ int32_t platform_window_get_size ( window_t* window, uint32_t* outWidth, uint32_
 	return 0;
 }
 
+////////////////////////////////////////
+// Platform-specific threading functions
+
+typedef struct platform_worker_pool_s
+{
+	CRITICAL_SECTION   lock;
+	CONDITION_VARIABLE workAvailable;
+	CONDITION_VARIABLE workDone;
+
+	// The jobs of the current run. Threads take the next job under the lock, and run it without.
+	worker_job_t job;
+	void*        userdata;
+	uint32_t     jobCount, nextJob, jobsDone;
+
+	// Bumped for every run, so the threads can tell a new run from the one they already helped out
+	uint64_t     generation;
+	uint32_t     exitRequested;
+
+	uint32_t     threadCount;
+	HANDLE*      threads;
+	struct platform_worker_s* workers;
+} platform_worker_pool_t;
+
+typedef struct platform_worker_s
+{
+	platform_worker_pool_t* pool;
+	uint32_t threadIndex;
+} platform_worker_t;
+
+// Runs jobs until there are none left. Called and returns with the lock of the pool held.
+static void platform_worker_pool_work ( platform_worker_pool_t* pool, uint32_t threadIndex )
+{
+	while ( pool->nextJob < pool->jobCount )
+	{
+		uint32_t jobIndex = pool->nextJob++;
+
+		LeaveCriticalSection ( &pool->lock );
+		pool->job ( pool->userdata, jobIndex, threadIndex );
+		EnterCriticalSection ( &pool->lock );
+
+		if ( ++pool->jobsDone == pool->jobCount )
+			WakeConditionVariable ( &pool->workDone );
+	}
+}
+
+static DWORD WINAPI platform_worker_thread ( LPVOID userdata )
+{
+	platform_worker_t* worker = userdata;
+	platform_worker_pool_t* pool = worker->pool;
+	uint64_t generation = 0;
+
+	EnterCriticalSection ( &pool->lock );
+	for ( ;; )
+	{
+		while ( !pool->exitRequested && pool->generation == generation )
+			SleepConditionVariableCS ( &pool->workAvailable, &pool->lock, INFINITE );
+		if ( pool->exitRequested )
+			break;
+
+		generation = pool->generation;
+		platform_worker_pool_work ( pool, worker->threadIndex );
+	}
+	LeaveCriticalSection ( &pool->lock );
+	return 0;
+}
+
+int32_t platform_worker_pool_create ( worker_pool_t* outPool, uint32_t threadCount )
+{
+	if ( threadCount == 0 )
+	{
+		SYSTEM_INFO systemInfo;
+		GetSystemInfo ( &systemInfo );
+		threadCount = systemInfo.dwNumberOfProcessors > 0 ? systemInfo.dwNumberOfProcessors : 1;
+	}
+
+	platform_worker_pool_t* pool = calloc ( 1, sizeof ( platform_worker_pool_t ) );
+	pool->threadCount = threadCount;
+	pool->threads     = calloc ( threadCount, sizeof ( HANDLE ) );
+	pool->workers     = calloc ( threadCount, sizeof ( platform_worker_t ) );
+	InitializeCriticalSection ( &pool->lock );
+	InitializeConditionVariable ( &pool->workAvailable );
+	InitializeConditionVariable ( &pool->workDone );
+
+	outPool->platform    = pool;
+	outPool->threadCount = 1;
+
+	// Thread 0 is whichever thread runs the jobs, so only the others are started here. If starting
+	// one fails, the pool just makes do with the threads it has.
+
+	for ( uint32_t i = 1; i < threadCount; i++ )
+	{
+		pool->workers[i] = (platform_worker_t){ .pool = pool, .threadIndex = i };
+		pool->threads[i] = CreateThread ( NULL, 0, platform_worker_thread, &pool->workers[i], 0, NULL );
+		if ( pool->threads[i] == NULL )
+		{
+			platform_log_warning ( "Could not start worker thread %u of %u\n", i, threadCount );
+			break;
+		}
+		outPool->threadCount = i + 1;
+	}
+	pool->threadCount = outPool->threadCount;
+
+	return 0;
+}
+
+int32_t platform_worker_pool_run ( worker_pool_t* pool, worker_job_t job, void* userdata, uint32_t jobCount )
+{
+	platform_worker_pool_t* platformPool = pool->platform;
+
+	EnterCriticalSection ( &platformPool->lock );
+	platformPool->job      = job;
+	platformPool->userdata = userdata;
+	platformPool->jobCount = jobCount;
+	platformPool->nextJob  = 0;
+	platformPool->jobsDone = 0;
+	platformPool->generation++;
+	WakeAllConditionVariable ( &platformPool->workAvailable );
+
+	platform_worker_pool_work ( platformPool, 0 );
+	while ( platformPool->jobsDone < platformPool->jobCount )
+		SleepConditionVariableCS ( &platformPool->workDone, &platformPool->lock, INFINITE );
+	LeaveCriticalSection ( &platformPool->lock );
+
+	return 0;
+}
+
+int32_t platform_worker_pool_destroy ( worker_pool_t* pool )
+{
+	platform_worker_pool_t* platformPool = pool->platform;
+	if ( platformPool == NULL )
+		return 0;
+
+	EnterCriticalSection ( &platformPool->lock );
+	platformPool->exitRequested = 1;
+	WakeAllConditionVariable ( &platformPool->workAvailable );
+	LeaveCriticalSection ( &platformPool->lock );
+
+	for ( uint32_t i = 1; i < platformPool->threadCount; i++ )
+	{
+		WaitForSingleObject ( platformPool->threads[i], INFINITE );
+		CloseHandle ( platformPool->threads[i] );
+	}
+
+	DeleteCriticalSection ( &platformPool->lock );
+	free ( platformPool->workers );
+	free ( platformPool->threads );
+	free ( platformPool );
+
+	pool->platform    = NULL;
+	pool->threadCount = 0;
+	return 0;
+}
+
 ////////////////////////////////////////
 // Platform-specific Vulkan functions
 
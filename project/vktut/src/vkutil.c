@@ -29,13 +29,14 @@
 #define C2STR(x) case x: return #x
 
 // Excerpts from rvm_math.h for utility functions. We don't need the entire header here.
+#define RVM_MIN(x,y) (((x)<(y))?(x):(y))
 #define RVM_MAX(x,y) (((x)>(y))?(x):(y))
 #define RVM_ALIGN_UP_POW2(x,n) (((x)+((n)-1))&(~((n)-1)))
 
 // And, of course, my favorite: alloca!
 #if defined ( _WIN32 )
 #define alloca _alloca
-#elif defined ( __ANDROID__ )
+#else
 #include <alloca.h>
 #endif
 
@@ -243,414 +244,2023 @@ int32_t vkutil_multi_alloc_helper (
 }
 
 
-// TODO(Rick): Error handling
-int32_t vkutil_create_images_helper (
-	VkDevice device, VkCommandBuffer stagingCommandBuffer, VkQueue stagingQueue,
-	VkPhysicalDeviceMemoryProperties* memoryProperties,
-	uint32_t imageCount, vkutil_image_desc* imageDescs, VkDeviceMemory* outMemory
+// The allocator below sits on top of vkAllocateMemory. Rather than allocating memory for every
+// (group of) resource(s), it requests large blocks per memory type and hands out ranges within
+// those. Not only is vkAllocateMemory slow (it usually ends up in the kernel driver), the amount
+// of allocations alive at any time is limited by maxMemoryAllocationCount, which can be as low
+// as 4096. With one allocation per resource, that is a limit you can hit a lot sooner than you
+// would think.
+//
+// Every block keeps a list of free ranges, sorted by offset. Allocating takes the first range
+// that fits the request once aligned (first-fit), freeing puts the range back and merges it with
+// its neighbours. The padding needed for alignment stays in the free list, so it can still be
+// used by allocations with a smaller alignment.
+//
+// Vulkan requires linear resources (buffers, linear images) and optimal images to be
+// bufferImageGranularity bytes apart when they share a page of memory. Instead of tracking which
+// kind of resource lives next to which, the allocator simply never puts both kinds in the same
+// block.
+//
+// Host visible blocks are mapped once on creation and stay mapped: vkMapMemory may only be called
+// once per VkDeviceMemory, so with several allocations in one block we could not map them
+// separately anyway.
+
+static int32_t vkutil_memory_block_insert_range (
+	vkutil_memory_block_t* block, uint32_t index, VkDeviceSize offset, VkDeviceSize size
 )
 {
-	// First allocate enough memory requirement structures on the stack for all images
-
-	VkMemoryRequirements* imageRequirements = alloca ( imageCount * sizeof ( VkMemoryRequirements ) );
+	if ( block->freeRangeCount == block->freeRangeCapacity )
+	{
+		uint32_t capacity = block->freeRangeCapacity ? 2*block->freeRangeCapacity : 16;
+		vkutil_memory_range_t* ranges = realloc ( block->freeRanges, capacity * sizeof ( vkutil_memory_range_t ) );
+		if ( ranges == NULL )
+			return -1;
+		block->freeRanges        = ranges;
+		block->freeRangeCapacity = capacity;
+	}
 
-	// Create all images and get their individual memory requirements. The initial layout has to
-	// be _UNDEFINED on creation, though we will take the layout the user specified for use later.
-	// Usage flags are set to upload data from the CPU, and - if mipmapping is to be applied -
-	// to copy to itself.
+	memmove (
+		&block->freeRanges[index+1], &block->freeRanges[index],
+		(block->freeRangeCount - index) * sizeof ( vkutil_memory_range_t )
+	);
+	block->freeRanges[index] = (vkutil_memory_range_t){ offset, size };
+	block->freeRangeCount++;
+	return 0;
+}
 
-	// The total size for the staging buffer is also calculated. This staging buffer will be
-	// required for uploading the data to the device memory.
+static void vkutil_memory_block_remove_range ( vkutil_memory_block_t* block, uint32_t index )
+{
+	memmove (
+		&block->freeRanges[index], &block->freeRanges[index+1],
+		(block->freeRangeCount - index - 1) * sizeof ( vkutil_memory_range_t )
+	);
+	block->freeRangeCount--;
+}
 
-	VkResult result;
-	uint32_t totalStagingBufferPixelSize = 0;
-	for ( uint32_t i = 0; i < imageCount; i++ )
+// Takes size bytes at the given alignment from the first free range that can hold them.
+// Returns 0 and the offset on success, -1 if nothing fits.
+static int32_t vkutil_memory_block_take (
+	vkutil_memory_block_t* block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* outOffset
+)
+{
+	for ( uint32_t i = 0; i < block->freeRangeCount; i++ )
 	{
-		VkImageCreateInfo info = *imageDescs[i].createInfo;
-		info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		info.usage        |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-		if ( imageDescs[i].mipMode == VKUTIL_IMAGE_MIPMAP_GENERATE )
-			info.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
-		result = vkCreateImage ( device, &info, NULL, imageDescs[i].outImage );
+		vkutil_memory_range_t range = block->freeRanges[i];
+		VkDeviceSize offset = RVM_ALIGN_UP_POW2 ( range.offset, alignment );
+		if ( offset + size > range.offset + range.size )
+			continue;
 
-		
-		if ( imageDescs[i].initialData != NULL )
-			totalStagingBufferPixelSize +=
-				imageDescs[i].createInfo->extent.width * imageDescs[i].createInfo->extent.height * 4;
-		vkGetImageMemoryRequirements ( device, *imageDescs[i].outImage, &imageRequirements[i] );
-	}
+		// The range is split in up to two: the padding before the allocation, and whatever is left
+		// after it. The padding replaces the range itself, the remainder comes right after it.
 
-	// Now we allocate the memory for use by the images and the staging buffer separately.
-	// These will likely have to be in separate memory types, as dedicated GPUs have
-	// separate heaps for GPU operations and for upload operations, as opposed to integrated GPUs
-	// which commonly use one large heap for the same purpose.
+		VkDeviceSize padding   = offset - range.offset;
+		VkDeviceSize remainder = range.offset + range.size - (offset + size);
+
+		if ( padding > 0 )
+		{
+			block->freeRanges[i].size = padding;
+			if ( remainder > 0 && vkutil_memory_block_insert_range ( block, i+1, offset + size, remainder ) != 0 )
+				return -1;
+		}
+		else if ( remainder > 0 )
+		{
+			block->freeRanges[i] = (vkutil_memory_range_t){ offset + size, remainder };
+		}
+		else
+		{
+			vkutil_memory_block_remove_range ( block, i );
+		}
 
-	VkDeviceMemory imageMemory;
-	VkDeviceSize* imageMemoryOffsets = alloca ( imageCount * sizeof ( VkDeviceSize ) );
-	VkDeviceSize imageMemorySize, stagingMemorySize;
+		*outOffset = offset;
+		return 0;
+	}
 
-	if ( vkutil_multi_alloc_helper (
-			device, memoryProperties, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			imageCount, imageRequirements, &imageMemory, &imageMemorySize, imageMemoryOffsets
-		) != 0 )
-		return -1;
+	return -1;
+}
 
-	*outMemory = imageMemory;
+static int32_t vkutil_memory_block_give_back (
+	vkutil_memory_block_t* block, VkDeviceSize offset, VkDeviceSize size
+)
+{
+	// Find the first free range after the one we are returning
+	uint32_t i = 0;
+	while ( i < block->freeRangeCount && block->freeRanges[i].offset < offset )
+		i++;
 
-	// We now bind the memory we allocated to the staging buffer and the individual images.
-	// Since all images are similarly allocated from the same block of memory, but will need to
-	// be placed at specific offets, we use the offsets returned by the allocation helper.
+	uint32_t mergePrev = i > 0 && block->freeRanges[i-1].offset + block->freeRanges[i-1].size == offset;
+	uint32_t mergeNext = i < block->freeRangeCount && offset + size == block->freeRanges[i].offset;
 
-	for ( uint32_t i = 0; i < imageCount; i++ )
+	if ( mergePrev && mergeNext )
+	{
+		block->freeRanges[i-1].size += size + block->freeRanges[i].size;
+		vkutil_memory_block_remove_range ( block, i );
+	}
+	else if ( mergePrev )
+	{
+		block->freeRanges[i-1].size += size;
+	}
+	else if ( mergeNext )
 	{
-		vkBindImageMemory ( device, *imageDescs[i].outImage, imageMemory, imageMemoryOffsets[i] );
+		block->freeRanges[i].offset  = offset;
+		block->freeRanges[i].size   += size;
 	}
+	else
+	{
+		return vkutil_memory_block_insert_range ( block, i, offset, size );
+	}
+	return 0;
+}
 
-	for ( uint32_t i = 0; i < imageCount; i++ )
+static vkutil_memory_block_t* vkutil_allocator_create_block (
+	vkutil_allocator_t* allocator, uint32_t memoryTypeIndex, vkutil_allocation_kind_t kind,
+	VkDeviceSize size, uint32_t dedicated
+)
+{
+	VkDeviceMemory memory;
+	VkResult result = vkAllocateMemory (
+		allocator->device,
+		&(VkMemoryAllocateInfo){
+			.sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+			.allocationSize  = size,
+			.memoryTypeIndex = memoryTypeIndex,
+		},
+		NULL,
+		&memory
+	);
+	if ( result != VK_SUCCESS )
+		return NULL;
+
+	void* mapped = NULL;
+	uint32_t propertyFlags = allocator->memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags;
+	if ( propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT )
 	{
-		for ( uint32_t j = 0; j < imageDescs[i].imageViewCount; j++ )
+		if ( vkMapMemory ( allocator->device, memory, 0, VK_WHOLE_SIZE, 0, &mapped ) != VK_SUCCESS )
 		{
-			VkImageViewCreateInfo createInfo = *imageDescs[i].imageViews[j].createInfo;
-			createInfo.image = *imageDescs[i].outImage;
-
-			vkCreateImageView (
-				device,
-				&createInfo,
-				NULL,
-				imageDescs[i].imageViews[j].outImageView
-			);
+			vkFreeMemory ( allocator->device, memory, NULL );
+			return NULL;
 		}
 	}
 
-	
-	if ( stagingCommandBuffer == VK_NULL_HANDLE || stagingQueue == VK_NULL_HANDLE )
-		return -1;
-
-	VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
-	VkBuffer stagingBuffer = VK_NULL_HANDLE;
+	vkutil_memory_block_t* block = calloc ( 1, sizeof ( vkutil_memory_block_t ) );
+	if ( block == NULL || vkutil_memory_block_insert_range ( block, 0, 0, size ) != 0 )
+	{
+		free ( block );
+		vkFreeMemory ( allocator->device, memory, NULL );
+		return NULL;
+	}
 
-	// At this time, we did all we could do on the CPU side: It is time to take it over to the
-	// GPU/Driver to get the data to the place we would like it to be
+	block->memory          = memory;
+	block->size            = size;
+	block->memoryTypeIndex = memoryTypeIndex;
+	block->kind            = kind;
+	block->dedicated       = dedicated;
+	block->mapped          = mapped;
+	block->next            = allocator->blocks;
+	allocator->blocks      = block;
+	return block;
+}
 
-	vkBeginCommandBuffer (
-		stagingCommandBuffer,
-		&(VkCommandBufferBeginInfo) {
-			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-			.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
-		}
-	);
-	{	
-		if ( totalStagingBufferPixelSize )
-		{
-			// Now we create the aforementioned staging buffer and calculate its memory requirements
+static void vkutil_allocator_destroy_block ( vkutil_allocator_t* allocator, vkutil_memory_block_t* block )
+{
+	vkutil_memory_block_t** link = &allocator->blocks;
+	while ( *link != block )
+		link = &(*link)->next;
+	*link = block->next;
+
+	// Freeing memory implicitly unmaps it
+	vkFreeMemory ( allocator->device, block->memory, NULL );
+	free ( block->freeRanges );
+	free ( block );
+}
 
-			result = vkCreateBuffer (
-				device,
-				&(VkBufferCreateInfo){
-					.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-					.size  = totalStagingBufferPixelSize,
-					.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-				},
-				NULL,
-				&stagingBuffer
-			);
+int32_t vkutil_allocator_init (
+	vkutil_allocator_t* outAllocator, VkDevice device,
+	const VkPhysicalDeviceMemoryProperties* memoryProperties, VkDeviceSize blockSize
+)
+{
+	*outAllocator = (vkutil_allocator_t){
+		.device           = device,
+		.memoryProperties = *memoryProperties,
+		.blockSize        = blockSize ? blockSize : VKUTIL_ALLOCATOR_BLOCK_SIZE,
+		.blocks           = NULL,
+	};
+	return 0;
+}
 
-			VkMemoryRequirements stagingBufferRequirements;
-			vkGetBufferMemoryRequirements ( device, stagingBuffer, &stagingBufferRequirements );
+int32_t vkutil_allocator_destroy ( vkutil_allocator_t* allocator )
+{
+	while ( allocator->blocks != NULL )
+		vkutil_allocator_destroy_block ( allocator, allocator->blocks );
+	return 0;
+}
 
-			if ( vkutil_multi_alloc_helper (
-					device, memoryProperties, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-					1, &stagingBufferRequirements, &stagingMemory, &stagingMemorySize, NULL
-				) != 0 )
-				return -1;
+int32_t vkutil_allocator_alloc (
+	vkutil_allocator_t* allocator, const VkMemoryRequirements* requirements,
+	uint32_t requiredProperties, vkutil_allocation_kind_t kind, vkutil_allocation_t* outAllocation
+)
+{
+	*outAllocation = (vkutil_allocation_t){ 0 };
+	uint32_t dedicated = requirements->size > allocator->blockSize / 2;
 
-			// Now we fill the staging buffer. We map the staging buffer memory to a virtual pointer to
-			// allow us to copy the data into the memory and unbind to not linger this memory.
+	// Same as vkutil_multi_alloc_helper, we go through the memory types in order. The spec
+	// guarantees the types are sorted such that the first compatible one is the best fit.
 
-			// All images are located into the same block of memory of the staging buffer, right after
-			// one another to minimize space requirements.
+	for ( uint32_t i = 0; i < allocator->memoryProperties.memoryTypeCount; i++ )
+	{
+		if ( !(requirements->memoryTypeBits & (1<<i)) )
+			continue;
+		if ( (allocator->memoryProperties.memoryTypes[i].propertyFlags & requiredProperties) != requiredProperties )
+			continue;
 
-			uint32_t* pixels;
-			vkMapMemory ( device, stagingMemory, 0, totalStagingBufferPixelSize, 0, &pixels );
+		// Try the existing blocks of this memory type first
 
-			for ( uint32_t i = 0; i < imageCount; i++ )
+		vkutil_memory_block_t* block = NULL;
+		VkDeviceSize offset = 0;
+		if ( !dedicated )
+		{
+			for ( block = allocator->blocks; block != NULL; block = block->next )
 			{
-				if ( imageDescs[i].initialData == NULL )
+				if ( block->memoryTypeIndex != i || block->kind != (uint32_t)kind || block->dedicated )
 					continue;
-
-				uint32_t size = imageDescs[i].createInfo->extent.width * imageDescs[i].createInfo->extent.height;
-				memcpy ( pixels, imageDescs[i].initialData, size * 4 );
-				pixels += size;
+				if ( vkutil_memory_block_take ( block, requirements->size, requirements->alignment, &offset ) == 0 )
+					break;
 			}
+		}
 
-			vkUnmapMemory ( device, stagingMemory );
+		// Then a new one. Memory coming straight from vkAllocateMemory is aligned to anything
+		// a resource could require, so offset 0 is always fine.
 
-			vkBindBufferMemory ( device, stagingBuffer, stagingMemory, 0 );
+		if ( block == NULL )
+		{
+			VkDeviceSize blockSize = dedicated ? requirements->size : allocator->blockSize;
+			block = vkutil_allocator_create_block ( allocator, i, kind, blockSize, dedicated );
+			if ( block == NULL )
+				continue;	// Heap might be full, try the next memory type
+			if ( vkutil_memory_block_take ( block, requirements->size, requirements->alignment, &offset ) != 0 )
+				return -2;
 		}
 
-		// First, we need to transition images from their _UNDEFINED layout to a layout we can
-		// actually make use of. Since we are to transfer the texture data to the images,
-		// we pick VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, as this is the layout intended for
-		// being the target of copy operations.
+		block->allocationCount++;
+		*outAllocation = (vkutil_allocation_t){
+			.memory = block->memory,
+			.offset = offset,
+			.size   = requirements->size,
+			.mapped = block->mapped != NULL ? block->mapped + offset : NULL,
+			.block  = block,
+		};
+		return 0;
+	}
 
-		// The only access requirement is writing from the transfer engine.
+	return -1;
+}
 
-		VkImageMemoryBarrier* imgBarriers = alloca ( imageCount * sizeof ( VkImageMemoryBarrier ) );
+int32_t vkutil_allocator_alloc_buffer (
+	vkutil_allocator_t* allocator, VkBuffer buffer, uint32_t requiredProperties,
+	vkutil_allocation_t* outAllocation
+)
+{
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements ( allocator->device, buffer, &requirements );
 
-		for ( uint32_t i = 0; i < imageCount; i++ )
-		{
-			imgBarriers[i] = (VkImageMemoryBarrier){
-				.sType            = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-				.srcAccessMask    = 0,
-				.dstAccessMask    = VK_ACCESS_TRANSFER_WRITE_BIT,
-				.oldLayout        = VK_IMAGE_LAYOUT_UNDEFINED,
-				.newLayout        = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				.image            = *imageDescs[i].outImage,
-				.subresourceRange = {
-					.aspectMask = imageDescs[i].aspectMask,
-					.levelCount = imageDescs[i].createInfo->mipLevels,
-					.layerCount = imageDescs[i].createInfo->arrayLayers,
-				},
-			};
-		}
+	int32_t ret = vkutil_allocator_alloc (
+		allocator, &requirements, requiredProperties, VKUTIL_ALLOCATION_LINEAR, outAllocation
+	);
+	if ( ret != 0 )
+		return ret;
 
-		vkCmdPipelineBarrier (
-			stagingCommandBuffer,
-			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-			0,
-			0, NULL,
-			0, NULL,
-			imageCount, imgBarriers
-		);
+	if ( vkBindBufferMemory ( allocator->device, buffer, outAllocation->memory, outAllocation->offset ) != VK_SUCCESS )
+	{
+		vkutil_allocator_free ( allocator, outAllocation );
+		return -3;
+	}
+	return 0;
+}
+
+int32_t vkutil_allocator_alloc_image (
+	vkutil_allocator_t* allocator, VkImage image, VkImageTiling tiling, uint32_t requiredProperties,
+	vkutil_allocation_t* outAllocation
+)
+{
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements ( allocator->device, image, &requirements );
 
-		// At this point, we copy over the individual portions of the staging buffer to the images.
+	int32_t ret = vkutil_allocator_alloc (
+		allocator, &requirements, requiredProperties,
+		tiling == VK_IMAGE_TILING_OPTIMAL ? VKUTIL_ALLOCATION_OPTIMAL : VKUTIL_ALLOCATION_LINEAR,
+		outAllocation
+	);
+	if ( ret != 0 )
+		return ret;
 
-		VkDeviceSize offset = 0;
-		for ( uint32_t i = 0; i < imageCount; i++ )
-		{
-			if ( imageDescs[i].initialData == NULL )
-				continue;
+	if ( vkBindImageMemory ( allocator->device, image, outAllocation->memory, outAllocation->offset ) != VK_SUCCESS )
+	{
+		vkutil_allocator_free ( allocator, outAllocation );
+		return -3;
+	}
+	return 0;
+}
 
-			uint32_t width  = imageDescs[i].createInfo->extent.width;
-			uint32_t height = imageDescs[i].createInfo->extent.height;
+int32_t vkutil_allocator_free ( vkutil_allocator_t* allocator, vkutil_allocation_t* allocation )
+{
+	vkutil_memory_block_t* block = allocation->block;
+	if ( block == NULL )
+		return 0;
 
-			vkCmdCopyBufferToImage  (
-				stagingCommandBuffer, stagingBuffer, *imageDescs[i].outImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				1, (VkBufferImageCopy[1]){
-					{
-						.bufferOffset      = offset,
-						.bufferRowLength   = width,
-						.bufferImageHeight = height,
-						.imageSubresource  = {
-							.aspectMask = imageDescs[i].aspectMask,
-							.mipLevel   = 0,
-							.layerCount = 1,
-						},
-						.imageExtent = { width, height, 1 }
-					}
-				} );
-			offset += width * height * 4;
-		}
+	block->allocationCount--;
+	if ( block->dedicated )
+	{
+		vkutil_allocator_destroy_block ( allocator, block );
+	}
+	else if ( vkutil_memory_block_give_back ( block, allocation->offset, allocation->size ) != 0 )
+	{
+		return -1;
+	}
+
+	// Empty shared blocks are kept around: the next load will most likely need them again, and
+	// allocating them anew is exactly what we are trying to avoid
 
-		// If we are to generate mipmaps, we use vkCmdBlitImage to copy over scaled versions of
-		// the image. We do this until we've either reached mipLevels specified in the CreateImage
-		// call, or until we've reached the mip of 1x1 pixels
+	*allocation = (vkutil_allocation_t){ 0 };
+	return 0;
+}
 
-		for ( uint32_t i = 0; i < imageCount; i++ )
+int32_t vkutil_allocator_get_stats (
+	const vkutil_allocator_t* allocator, vkutil_allocator_stats_t* outStats
+)
+{
+	*outStats = (vkutil_allocator_stats_t){ 0 };
+	for ( const vkutil_memory_block_t* block = allocator->blocks; block != NULL; block = block->next )
+	{
+		VkDeviceSize freeBytes = 0;
+		for ( uint32_t i = 0; i < block->freeRangeCount; i++ )
 		{
-			if ( imageDescs[i].initialData != NULL
-				&& imageDescs[i].mipMode == VKUTIL_IMAGE_MIPMAP_GENERATE )
-			{
-				uint32_t width  = imageDescs[i].createInfo->extent.width;
-				uint32_t height = imageDescs[i].createInfo->extent.height;
+			freeBytes += block->freeRanges[i].size;
+			outStats->largestFreeRange = RVM_MAX ( outStats->largestFreeRange, block->freeRanges[i].size );
+		}
 
-				for ( uint32_t j = 1;
-					j < imageDescs[i].createInfo->mipLevels && (width > 1 || height > 1);
-					j++ )
-				{
-					uint32_t newWidth = RVM_MAX ( 1, width / 2), newHeight = RVM_MAX ( 1, height / 2 );
-
-					vkCmdBlitImage (
-						stagingCommandBuffer,
-						*imageDescs[i].outImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-						*imageDescs[i].outImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-						1, (VkImageBlit[1]) {
-							{
-								.srcSubresource = {
-									.aspectMask = imageDescs[i].aspectMask,
-									.mipLevel   = j-1,
-									.layerCount = 1,
-								},
-								.srcOffsets[1] = { width, height, 1 },
-								.dstSubresource = {
-									.aspectMask = imageDescs[i].aspectMask,
-									.mipLevel   = j,
-									.layerCount = 1,
-								},
-								.dstOffsets[1] = { newWidth, newHeight, 1 },
-							}
-						}, VK_FILTER_LINEAR
-					);
+		outStats->blockCount++;
+		outStats->dedicatedBlockCount += block->dedicated;
+		outStats->allocationCount     += block->allocationCount;
+		outStats->allocatedBytes      += block->size;
+		outStats->usedBytes           += block->size - freeBytes;
+		outStats->freeRangeCount      += block->freeRangeCount;
+	}
+	return 0;
+}
 
-					vkCmdPipelineBarrier (
-						stagingCommandBuffer,
-						VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-						VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-						0,
-						0, NULL,
-						0, NULL,
-						1, (VkImageMemoryBarrier[1]){
-							{
-								.sType            = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-								.srcAccessMask    = VK_ACCESS_TRANSFER_WRITE_BIT,
-								.dstAccessMask    = VK_ACCESS_TRANSFER_WRITE_BIT,
-								.oldLayout        = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-								.newLayout        = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-								.image            = *imageDescs[i].outImage,
-								.subresourceRange = {
-									.aspectMask = imageDescs[i].aspectMask,
-									.levelCount = imageDescs[i].createInfo->mipLevels,
-									.layerCount = 1,
-								},
-							}
-						}
-					);
+// The uploader moves data from the CPU to device local resources without stalling the rendering
+// that's going on in the meantime. vkutil_create_images_helper and vkutil_load_bobj used to record
+// their copies on the render queue and wait for it to go idle, which is fine for the first load,
+// but means a hitch of several frames whenever something is loaded while we're rendering.
+//
+// Most desktop GPUs expose a queue family with only the TRANSFER bit set. These queues map to
+// the DMA engines of the GPU, which can copy data around while the graphics engine is busy doing
+// other things. Copies are recorded into a batch, which gets submitted to that transfer queue and
+// is identified by a ticket: an ever increasing number, much like the value of a timeline
+// semaphore. vkutil_uploader_poll is called once a frame, and checks (never waits!) whether the
+// transfers have completed. Once they have, the staging memory is given back and the remaining
+// work is submitted to the graphics queue, after which the ticket is complete and the resources
+// can be used by any command buffer submitted to the graphics queue from then on.
+//
+// That remaining work exists for two reasons:
+//
+// * Resources created with VK_SHARING_MODE_EXCLUSIVE are owned by one queue family at a time.
+//   When the transfer queue is from a different family than the graphics queue, ownership has to
+//   be handed over explicitly: a "release" barrier on the transfer queue, followed by a matching
+//   "acquire" barrier on the graphics queue. Without it, the contents of the resource are
+//   undefined as far as the graphics queue is concerned.
+// * Transfer queues can copy, but not blit. Generating mipmaps using vkCmdBlitImage (and the
+//   final layout transitions) happen on the graphics queue instead.
+//
+// Why not submit the graphics part right away, waiting on the semaphore signalled by the
+// transfer? A queue executes its submissions in order, and while in theory later submissions
+// may start before a waiting one, in practice most drivers do not. The frames rendered in the
+// meantime would end up waiting on the upload, which is exactly what we are trying to avoid.
+// We do still wait on the semaphore: by the time the graphics part is submitted it is signalled
+// already, but it's what makes the writes of the transfer queue visible to the graphics queue.
+//
+// All data goes through a single staging buffer, created once and mapped for as long as the
+// uploader lives. It is used as a ring: reservations are taken from the head, and the space used
+// by a batch is given back as soon as its transfer fence is signalled. As batches complete in the
+// order they were submitted, the space always comes back in the order it was handed out. When the
+// ring is full, the batch being recorded is submitted with what it has so far, and we wait for
+// the oldest batch to make room. Uploads larger than the ring are simply split up into chunks,
+// so loading a model or texture never allocates any memory for staging, and the amount of host
+// visible memory used stays the same no matter how large the assets are.
+
+int32_t vkutil_uploader_init (
+	vkutil_uploader_t* outUploader, vkutil_allocator_t* allocator,
+	VkQueue transferQueue, uint32_t transferFamily, VkExtent3D transferGranularity,
+	VkQueue graphicsQueue, uint32_t graphicsFamily, VkDeviceSize stagingSize
+)
+{
+	*outUploader = (vkutil_uploader_t){
+		.allocator           = allocator,
+		.device              = allocator->device,
+		.transferQueue       = transferQueue,
+		.graphicsQueue       = graphicsQueue,
+		.transferFamily      = transferFamily,
+		.graphicsFamily      = graphicsFamily,
+		.transferGranularity = transferGranularity,
+		.stagingSize         = stagingSize ? stagingSize : VKUTIL_UPLOADER_STAGING_SIZE,
+		.nextTicket          = 1,
+		.completedTicket     = 0,
+	};
+	VkDevice device = allocator->device;
+
+	// The staging ring. Host visible allocations are persistently mapped by the allocator. We ask
+	// for coherent memory so we don't need to flush the writes to it ourselves: submitting the
+	// command buffer makes them visible to the device.
+
+	if ( vkCreateBuffer (
+			device,
+			&(VkBufferCreateInfo){
+				.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+				.size  = outUploader->stagingSize,
+				.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			},
+			NULL,
+			&outUploader->stagingBuffer
+		) != VK_SUCCESS )
+		return -1;
 
-					width = newWidth, height = newHeight;
-				}
-			}
-		}
+	if ( vkutil_allocator_alloc_buffer (
+			allocator, outUploader->stagingBuffer,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&outUploader->stagingAllocation
+		) != 0 )
+		return -1;
 
-		// Now that we're done transferring the data to the images, we can transition the layout
-		// to be optimal for what the user is going to use the data for rather than for being
-		// targets of copy operations.
+	// Command buffers are reused once their batch has completed, which requires the pool to allow
+	// resetting individual command buffers
 
-		for ( uint32_t i = 0; i < imageCount; i++ )
-		{
-			imgBarriers[i] = (VkImageMemoryBarrier){
-				.sType            = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-				.srcAccessMask    = VK_ACCESS_TRANSFER_WRITE_BIT,
-				.dstAccessMask    = imageDescs[i].accessMask,
-				.oldLayout        = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				.newLayout        = imageDescs[i].createInfo->initialLayout,
-				.image            = *imageDescs[i].outImage,
-				.subresourceRange = {
-					.aspectMask = imageDescs[i].aspectMask,
-					.levelCount = imageDescs[i].createInfo->mipLevels,
-					.layerCount = imageDescs[i].createInfo->arrayLayers,
+	uint32_t families[2] = { transferFamily, graphicsFamily };
+	VkCommandPool* pools[2] = { &outUploader->transferCommandPool, &outUploader->graphicsCommandPool };
+	for ( uint32_t i = 0; i < 2; i++ )
+	{
+		if ( vkCreateCommandPool (
+				device,
+				&(VkCommandPoolCreateInfo){
+					.sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+					.flags            = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+					.queueFamilyIndex = families[i],
 				},
-			};
-		}
+				NULL,
+				pools[i]
+			) != VK_SUCCESS )
+			return -1;
+	}
 
-		vkCmdPipelineBarrier (
-			stagingCommandBuffer,
-			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-			0,
-			0, NULL,
-			0, NULL,
-			imageCount, imgBarriers
+	for ( uint32_t i = 0; i < VKUTIL_UPLOADER_BATCH_COUNT; i++ )
+	{
+		vkutil_upload_batch_t* batch = &outUploader->batches[i];
+		VkResult result = vkAllocateCommandBuffers (
+			device,
+			&(VkCommandBufferAllocateInfo){
+				.sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+				.commandPool        = outUploader->transferCommandPool,
+				.level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+				.commandBufferCount = 1,
+			},
+			&batch->transferCommandBuffer
 		);
+		if ( result == VK_SUCCESS )
+		{
+			result = vkAllocateCommandBuffers (
+				device,
+				&(VkCommandBufferAllocateInfo){
+					.sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+					.commandPool        = outUploader->graphicsCommandPool,
+					.level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+					.commandBufferCount = 1,
+				},
+				&batch->graphicsCommandBuffer
+			);
+		}
+		if ( result == VK_SUCCESS )
+		{
+			result = vkCreateFence (
+				device, &(VkFenceCreateInfo){ .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO },
+				NULL, &batch->transferFence
+			);
+		}
+		if ( result == VK_SUCCESS )
+		{
+			result = vkCreateFence (
+				device, &(VkFenceCreateInfo){ .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO },
+				NULL, &batch->graphicsFence
+			);
+		}
+		if ( result == VK_SUCCESS )
+		{
+			result = vkCreateSemaphore (
+				device, &(VkSemaphoreCreateInfo){ .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO },
+				NULL, &batch->transferSemaphore
+			);
+		}
+		if ( result != VK_SUCCESS )
+			return -2;
 	}
 
-	// We now end the command buffer and immediately submit the command buffer for execution on
-	// the staging queue.
+	return 0;
+}
 
-	vkEndCommandBuffer ( stagingCommandBuffer );
+// Returns the oldest batch that has been submitted to the transfer queue, or NULL if there is
+// none. Batches are always finished in the order they were submitted, so completedTicket can
+// simply be bumped to the ticket of the batch that was finished last.
+static vkutil_upload_batch_t* vkutil_uploader_oldest_transfer ( vkutil_uploader_t* uploader )
+{
+	vkutil_upload_batch_t* oldest = NULL;
+	for ( uint32_t i = 0; i < VKUTIL_UPLOADER_BATCH_COUNT; i++ )
+	{
+		vkutil_upload_batch_t* batch = &uploader->batches[i];
+		if ( batch->state == VKUTIL_UPLOAD_BATCH_TRANSFERRING && (oldest == NULL || batch->ticket < oldest->ticket) )
+			oldest = batch;
+	}
+	return oldest;
+}
 
-	vkQueueSubmit (
-		stagingQueue,
-		1,
-		&(VkSubmitInfo){
-			.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-			.pWaitDstStageMask  = (VkPipelineStageFlags[1]){ VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT },
-			.commandBufferCount = 1,
-			.pCommandBuffers    = (VkCommandBuffer[1]){ stagingCommandBuffer },
-		},
-		VK_NULL_HANDLE
-	);
+int32_t vkutil_uploader_poll ( vkutil_uploader_t* uploader )
+{
+	VkDevice device = uploader->device;
 
-	// We wait for the entire staging queue up to this point to complete. This is far, far from
-	// optimal performance-wise, but it allows us to deallocate the temporary staging buffer
-	// we allocated earlier.
+	// Batches whose graphics part has completed can be reused
 
-	// Ideally the staging queue would be separate from the render queue, and the staging
-	// resources would be managed by the application to just be deallocated a couple of frames
-	// later. This would allow the command buffer to wait on the GPU for the upload to complete
-	// and the memory to be deallocated. But for the purposes of demonstration, we take pretty
-	// large shortcuts here.
+	for ( uint32_t i = 0; i < VKUTIL_UPLOADER_BATCH_COUNT; i++ )
+	{
+		vkutil_upload_batch_t* batch = &uploader->batches[i];
+		if ( batch->state == VKUTIL_UPLOAD_BATCH_FINISHING
+			&& vkGetFenceStatus ( device, batch->graphicsFence ) == VK_SUCCESS )
+		{
+			vkResetFences ( device, 2, (VkFence[2]){ batch->transferFence, batch->graphicsFence } );
+			batch->state = VKUTIL_UPLOAD_BATCH_FREE;
+		}
+	}
 
-	vkQueueWaitIdle ( stagingQueue );
+	// Batches whose transfer has completed no longer need their part of the staging ring, and get
+	// the remainder of their work submitted to the graphics queue
 
-	if ( stagingBuffer != VK_NULL_HANDLE )
+	vkutil_upload_batch_t* batch;
+	while ( (batch = vkutil_uploader_oldest_transfer ( uploader )) != NULL
+		&& vkGetFenceStatus ( device, batch->transferFence ) == VK_SUCCESS )
 	{
-		// Just a little cleanup, then we're done here
+		uploader->stagingUsed -= batch->stagingBytes;
+		batch->stagingBytes    = 0;
 
-		vkDestroyBuffer ( device, stagingBuffer, NULL );
-		vkFreeMemory ( device, stagingMemory, NULL );
-	}
+		VkResult result = vkQueueSubmit (
+			uploader->graphicsQueue,
+			1, (VkSubmitInfo[1]){
+				{
+					.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+					.waitSemaphoreCount   = 1,
+					.pWaitSemaphores      = &batch->transferSemaphore,
+					.pWaitDstStageMask    = (VkPipelineStageFlags[1]){ VK_PIPELINE_STAGE_ALL_COMMANDS_BIT },
+					.commandBufferCount   = 1,
+					.pCommandBuffers      = &batch->graphicsCommandBuffer,
+				},
+			},
+			batch->graphicsFence
+		);
+		if ( result != VK_SUCCESS )
+			return -1;
 
-	
+		batch->state = VKUTIL_UPLOAD_BATCH_FINISHING;
+		uploader->completedTicket = batch->ticket;
+	}
 
 	return 0;
 }
 
-int32_t vkutil_load_bobj (
-	vkutil_model_t* model,
-	VkDevice device, const void* bobjData, uint64_t bobjLen,
-	VkPhysicalDeviceMemoryProperties* memoryProperties,
-	VkQueue stagingQueue, VkCommandBuffer stagingCommandBuffer
-)
+int32_t vkutil_uploader_is_complete ( vkutil_uploader_t* uploader, uint64_t ticket )
 {
-	// Load the file first of all
+	return ticket <= uploader->completedTicket;
+}
 
-	// The BOBJ file starts with a header telling us what is in the file and where it is
+int32_t vkutil_uploader_wait ( vkutil_uploader_t* uploader, uint64_t ticket )
+{
+	if ( ticket >= uploader->nextTicket )
+		return -1;	// Never submitted
 
-	bobj_file_header* fhead = (bobj_file_header*)bobjData;
+	while ( !vkutil_uploader_is_complete ( uploader, ticket ) )
+	{
+		vkutil_upload_batch_t* batch = vkutil_uploader_oldest_transfer ( uploader );
+		if ( batch == NULL )
+			return -1;
+		vkWaitForFences ( uploader->device, 1, &batch->transferFence, VK_TRUE, UINT64_MAX );
+		if ( vkutil_uploader_poll ( uploader ) != 0 )
+			return -2;
+	}
+	return 0;
+}
 
-	// From this, we can now get the location of other structures
+// Waits for everything submitted so far, graphics part included, after which none of the
+// resources uploaded to are in use by the uploader anymore.
+int32_t vkutil_uploader_wait_idle ( vkutil_uploader_t* uploader )
+{
+	if ( uploader->nextTicket > 1 && vkutil_uploader_wait ( uploader, uploader->nextTicket - 1 ) != 0 )
+		return -1;
 
-	bobj_object_header* objects   = (bobj_object_header* )((uint8_t*)bobjData + fhead->objectsStart );
-	bobj_texture_header* textures = (bobj_texture_header*)((uint8_t*)bobjData + fhead->texturesStart);
-	bobj_vert* vertices           = (bobj_vert*          )((uint8_t*)bobjData + fhead->vertexStart  );
-	bobj_index* indices           = (bobj_index*         )((uint8_t*)bobjData + fhead->indexStart   );
-	uint8_t* texdata              = (uint8_t*            )((uint8_t*)bobjData + fhead->texdataStart );
+	for ( uint32_t i = 0; i < VKUTIL_UPLOADER_BATCH_COUNT; i++ )
+	{
+		vkutil_upload_batch_t* batch = &uploader->batches[i];
+		if ( batch->state == VKUTIL_UPLOAD_BATCH_FINISHING )
+			vkWaitForFences ( uploader->device, 1, &batch->graphicsFence, VK_TRUE, UINT64_MAX );
+	}
 
-	*model = (vkutil_model_t){
-		.objectCount  = fhead->objCount,
-		.textureCount = fhead->texCount,
-		.objects      = malloc ( fhead->objCount * sizeof ( vkutil_object_t )
-			+ fhead->texCount * (sizeof ( VkImage )+sizeof ( VkImageView )) ),
-	};
+	// Puts the batches we just waited for back up for grabs
+	if ( vkutil_uploader_poll ( uploader ) != 0 )
+		return -2;
+	return 0;
+}
 
-	model->images       = (VkImage*    )(model->objects + fhead->objCount);
-	model->imageViews   = (VkImageView*)(model->images  + fhead->texCount);
+int32_t vkutil_uploader_destroy ( vkutil_uploader_t* uploader )
+{
+	VkDevice device = uploader->device;
 
-	VkImageCreateInfo* imageCreateInfo =
-		alloca ( fhead->texCount * sizeof ( VkImageCreateInfo ) );
-	VkImageViewCreateInfo* imageViewCreateInfo =
-		alloca ( fhead->texCount * sizeof ( VkImageViewCreateInfo ) );
-	vkutil_image_view_desc* imageViewDescs =
-		alloca ( fhead->texCount * sizeof ( vkutil_image_view_desc ) );
-	vkutil_image_desc* imageDescs      = alloca ( fhead->texCount * sizeof ( vkutil_image_desc ) );
-	VkImage* images                    = alloca ( fhead->texCount * sizeof ( VkImage ) );
+	// Finish everything that is still in flight before tearing things down. A batch that is still
+	// being recorded is submitted as well, as the resources it uploads to may be in use already.
 
-	// Create all textures of the object
+	if ( uploader->current != NULL )
+		vkutil_uploader_submit ( uploader, NULL );
+	vkutil_uploader_wait_idle ( uploader );
 
-	for ( uint32_t i = 0; i < fhead->texCount; i++ )
+	for ( uint32_t i = 0; i < VKUTIL_UPLOADER_BATCH_COUNT; i++ )
 	{
-		uint32_t mipLevels = 1;
-		uint32_t w = textures[i].width, h = textures[i].height;
-		while ( w > 1 || h > 1 )
+		vkutil_upload_batch_t* batch = &uploader->batches[i];
+		vkDestroySemaphore ( device, batch->transferSemaphore, NULL );
+		vkDestroyFence ( device, batch->transferFence, NULL );
+		vkDestroyFence ( device, batch->graphicsFence, NULL );
+	}
+
+	// Destroying the pools frees the command buffers allocated from them as well
+	vkDestroyCommandPool ( device, uploader->transferCommandPool, NULL );
+	vkDestroyCommandPool ( device, uploader->graphicsCommandPool, NULL );
+
+	vkDestroyBuffer ( device, uploader->stagingBuffer, NULL );
+	vkutil_allocator_free ( uploader->allocator, &uploader->stagingAllocation );
+	return 0;
+}
+
+int32_t vkutil_uploader_begin ( vkutil_uploader_t* uploader )
+{
+	if ( uploader->current != NULL )
+		return -1;	// Submit the previous batch first
+
+	vkutil_uploader_poll ( uploader );
+
+	// With all batches in flight, we have no choice but to wait for the oldest one
+
+	vkutil_upload_batch_t* batch = NULL;
+	for ( ;; )
+	{
+		for ( uint32_t i = 0; i < VKUTIL_UPLOADER_BATCH_COUNT && batch == NULL; i++ )
+		{
+			if ( uploader->batches[i].state == VKUTIL_UPLOAD_BATCH_FREE )
+				batch = &uploader->batches[i];
+		}
+		if ( batch != NULL )
+			break;
+
+		vkutil_upload_batch_t* oldest = NULL;
+		for ( uint32_t i = 0; i < VKUTIL_UPLOADER_BATCH_COUNT; i++ )
+		{
+			if ( uploader->batches[i].state == VKUTIL_UPLOAD_BATCH_FINISHING
+				&& (oldest == NULL || uploader->batches[i].ticket < oldest->ticket) )
+				oldest = &uploader->batches[i];
+		}
+		if ( oldest != NULL )
+		{
+			vkWaitForFences ( uploader->device, 1, &oldest->graphicsFence, VK_TRUE, UINT64_MAX );
+		}
+		else
+		{
+			oldest = vkutil_uploader_oldest_transfer ( uploader );
+			if ( oldest == NULL )
+				return -2;
+			vkWaitForFences ( uploader->device, 1, &oldest->transferFence, VK_TRUE, UINT64_MAX );
+		}
+		vkutil_uploader_poll ( uploader );
+	}
+
+	VkCommandBufferBeginInfo beginInfo = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+	};
+	if ( vkBeginCommandBuffer ( batch->transferCommandBuffer, &beginInfo ) != VK_SUCCESS
+		|| vkBeginCommandBuffer ( batch->graphicsCommandBuffer, &beginInfo ) != VK_SUCCESS )
+		return -3;
+
+	batch->state        = VKUTIL_UPLOAD_BATCH_RECORDING;
+	batch->stagingBytes = 0;
+	uploader->current   = batch;
+	return 0;
+}
+
+// Throws away a batch that never made it to the GPU. It took the most recent part of the staging
+// ring, so giving that back is just a matter of moving the head back to where the batch started.
+static void vkutil_uploader_discard ( vkutil_uploader_t* uploader, vkutil_upload_batch_t* batch )
+{
+	vkResetCommandBuffer ( batch->transferCommandBuffer, 0 );
+	vkResetCommandBuffer ( batch->graphicsCommandBuffer, 0 );
+
+	uploader->stagingHead = (uploader->stagingHead + uploader->stagingSize - batch->stagingBytes) % uploader->stagingSize;
+	uploader->stagingUsed -= batch->stagingBytes;
+	batch->stagingBytes    = 0;
+	batch->state           = VKUTIL_UPLOAD_BATCH_FREE;
+}
+
+int32_t vkutil_uploader_abort ( vkutil_uploader_t* uploader )
+{
+	vkutil_upload_batch_t* batch = uploader->current;
+	if ( batch == NULL )
+		return -1;
+	uploader->current = NULL;
+
+	vkutil_uploader_discard ( uploader, batch );
+	return 0;
+}
+
+int32_t vkutil_uploader_submit ( vkutil_uploader_t* uploader, uint64_t* outTicket )
+{
+	vkutil_upload_batch_t* batch = uploader->current;
+	if ( batch == NULL )
+		return -1;
+	uploader->current = NULL;
+
+	if ( vkEndCommandBuffer ( batch->transferCommandBuffer ) != VK_SUCCESS
+		|| vkEndCommandBuffer ( batch->graphicsCommandBuffer ) != VK_SUCCESS )
+	{
+		vkutil_uploader_discard ( uploader, batch );
+		return -2;
+	}
+
+	// Only the transfer part is submitted now, see the comment above vkutil_uploader_init for
+	// why the graphics part has to wait for vkutil_uploader_poll
+
+	VkResult result = vkQueueSubmit (
+		uploader->transferQueue,
+		1, (VkSubmitInfo[1]){
+			{
+				.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+				.commandBufferCount   = 1,
+				.pCommandBuffers      = &batch->transferCommandBuffer,
+				.signalSemaphoreCount = 1,
+				.pSignalSemaphores    = &batch->transferSemaphore,
+			},
+		},
+		batch->transferFence
+	);
+	if ( result != VK_SUCCESS )
+	{
+		vkutil_uploader_discard ( uploader, batch );
+		return -3;
+	}
+
+	batch->ticket = uploader->nextTicket++;
+	batch->state  = VKUTIL_UPLOAD_BATCH_TRANSFERRING;
+	if ( outTicket )
+		*outTicket = batch->ticket;
+	return 0;
+}
+
+// Takes up to size bytes from the head of the staging ring, in a multiple of granularity bytes
+// unless all of it fits. Returns non-zero if not even granularity bytes are available.
+static int32_t vkutil_uploader_take_staging (
+	vkutil_uploader_t* uploader, VkDeviceSize size, VkDeviceSize granularity,
+	VkDeviceSize* outOffset, VkDeviceSize* outSize
+)
+{
+	if ( uploader->stagingUsed == uploader->stagingSize )
+		return -1;
+	if ( uploader->stagingUsed == 0 )
+		uploader->stagingHead = 0;	// Nothing in flight, might as well start at the beginning
+
+	// Everything from the tail up to the head is in use by batches, so the free space runs from
+	// the head up to either the end of the ring or the tail, whichever comes first. If that isn't
+	// enough, we skip what is left at the end of the ring and continue at its start.
+
+	VkDeviceSize head  = uploader->stagingHead;
+	VkDeviceSize tail  = (head + uploader->stagingSize - uploader->stagingUsed) % uploader->stagingSize;
+	VkDeviceSize start = RVM_ALIGN_UP_POW2 ( head, VKUTIL_UPLOADER_STAGING_ALIGNMENT );
+	VkDeviceSize end   = head >= tail ? uploader->stagingSize : tail;
+	if ( start > end || end - start < granularity )
+	{
+		if ( head < tail )
+			return -1;
+		start = 0;
+		end   = tail;
+		if ( end < granularity )
+			return -1;
+	}
+
+	VkDeviceSize available = end - start;
+	VkDeviceSize taken     = size <= available ? size : available - available % granularity;
+	VkDeviceSize consumed  = (start >= head ? start - head : uploader->stagingSize - head + start) + taken;
+
+	uploader->stagingHead            = (start + taken) % uploader->stagingSize;
+	uploader->stagingUsed           += consumed;
+	uploader->current->stagingBytes += consumed;
+
+	*outOffset = start;
+	*outSize   = taken;
+	return 0;
+}
+
+int32_t vkutil_uploader_reserve (
+	vkutil_uploader_t* uploader, VkDeviceSize size, VkDeviceSize granularity,
+	VkDeviceSize* outOffset, VkDeviceSize* outSize, void** outData
+)
+{
+	if ( uploader->current == NULL )
+		return -1;
+	if ( granularity == 0 || granularity > size )
+		granularity = size;
+	if ( granularity > uploader->stagingSize )
+		return -2;	// Would never fit
+
+	VkDeviceSize offset, taken;
+	while ( vkutil_uploader_take_staging ( uploader, size, granularity, &offset, &taken ) != 0 )
+	{
+		// The ring is full. Whatever the current batch has recorded so far goes on its way, and we
+		// continue recording in a new batch once the oldest one has made room.
+
+		if ( uploader->current->stagingBytes > 0 )
+		{
+			if ( vkutil_uploader_submit ( uploader, NULL ) != 0 || vkutil_uploader_begin ( uploader ) != 0 )
+				return -3;
+		}
+
+		vkutil_upload_batch_t* oldest = vkutil_uploader_oldest_transfer ( uploader );
+		if ( oldest == NULL )
+			return -4;
+		vkWaitForFences ( uploader->device, 1, &oldest->transferFence, VK_TRUE, UINT64_MAX );
+		if ( vkutil_uploader_poll ( uploader ) != 0 )
+			return -5;
+	}
+
+	*outOffset = offset;
+	*outSize   = taken;
+	*outData   = (uint8_t*)uploader->stagingAllocation.mapped + offset;
+	return 0;
+}
+
+int32_t vkutil_uploader_copy_buffer (
+	vkutil_uploader_t* uploader, VkDeviceSize srcOffset,
+	VkBuffer dstBuffer, VkDeviceSize dstOffset, VkDeviceSize size
+)
+{
+	if ( uploader->current == NULL )
+		return -1;
+
+	// The buffer has no contents we care about yet, so there is nothing to wait for or to acquire
+	// before writing to it on the transfer queue
+
+	vkCmdCopyBuffer (
+		uploader->current->transferCommandBuffer, uploader->stagingBuffer, dstBuffer,
+		1, (VkBufferCopy[1]){
+			{
+				.srcOffset = srcOffset,
+				.dstOffset = dstOffset,
+				.size      = size,
+			},
+		}
+	);
+	return 0;
+}
+
+int32_t vkutil_uploader_finish_buffer (
+	vkutil_uploader_t* uploader, VkBuffer dstBuffer, VkDeviceSize size, VkAccessFlags dstAccessMask
+)
+{
+	vkutil_upload_batch_t* batch = uploader->current;
+	if ( batch == NULL )
+		return -1;
+
+	// Hand over ownership to the graphics queue family. The release half only needs to make the
+	// writes available: the access mask of the destination is ignored on this side. Copies
+	// recorded in batches submitted before this one are covered as well, as they were submitted
+	// to the same queue earlier.
+
+	uint32_t transferOwnership = uploader->transferFamily != uploader->graphicsFamily;
+	VkBufferMemoryBarrier barrier = {
+		.sType               = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.srcAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask       = 0,
+		.srcQueueFamilyIndex = transferOwnership ? uploader->transferFamily : VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = transferOwnership ? uploader->graphicsFamily : VK_QUEUE_FAMILY_IGNORED,
+		.buffer              = dstBuffer,
+		.offset              = 0,
+		.size                = size,
+	};
+	if ( transferOwnership )
+	{
+		vkCmdPipelineBarrier (
+			batch->transferCommandBuffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			0,
+			0, NULL,
+			1, &barrier,
+			0, NULL
+		);
+	}
+
+	// The acquire half on the graphics queue makes the data visible to whatever will read it
+
+	barrier.srcAccessMask = transferOwnership ? 0 : VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = dstAccessMask;
+	vkCmdPipelineBarrier (
+		batch->graphicsCommandBuffer,
+		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+		0,
+		0, NULL,
+		1, &barrier,
+		0, NULL
+	);
+
+	return 0;
+}
+
+int32_t vkutil_uploader_upload_buffer (
+	vkutil_uploader_t* uploader, const void* data, VkDeviceSize size,
+	VkBuffer dstBuffer, VkAccessFlags dstAccessMask
+)
+{
+	// Copy the data over in as large chunks as the staging ring allows
+
+	for ( VkDeviceSize done = 0; done < size; )
+	{
+		VkDeviceSize offset, chunk;
+		void* staging;
+		if ( vkutil_uploader_reserve (
+				uploader, size - done, VKUTIL_UPLOADER_STAGING_ALIGNMENT, &offset, &chunk, &staging
+			) != 0 )
+			return -1;
+
+		memcpy ( staging, (const uint8_t*)data + done, chunk );
+		vkutil_uploader_copy_buffer ( uploader, offset, dstBuffer, done, chunk );
+		done += chunk;
+	}
+
+	return vkutil_uploader_finish_buffer ( uploader, dstBuffer, size, dstAccessMask );
+}
+
+// Size of the texel blocks of a format as they are laid out in a buffer. Uncompressed formats
+// have blocks of a single texel. Only the formats images are uploaded in are listed, anything
+// else is taken to be 4 bytes per texel.
+static void vkutil_format_block (
+	VkFormat format, uint32_t* outWidth, uint32_t* outHeight, uint32_t* outBytes
+)
+{
+	switch ( format )
+	{
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+		*outWidth = 4, *outHeight = 4, *outBytes = 8;
+		break;
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+		*outWidth = 4, *outHeight = 4, *outBytes = 16;
+		break;
+	default:
+		*outWidth = 1, *outHeight = 1, *outBytes = 4;
+		break;
+	}
+}
+
+int32_t vkutil_uploader_upload_image (
+	vkutil_uploader_t* uploader, const void* data,
+	VkImage dstImage, const VkImageCreateInfo* createInfo,
+	VkImageAspectFlags aspectMask, vkutil_image_mipmap_mode_t mipMode,
+	VkImageLayout finalLayout, VkAccessFlags dstAccessMask
+)
+{
+	if ( uploader->current == NULL )
+		return -1;
+
+	uint32_t width  = createInfo->extent.width;
+	uint32_t height = createInfo->extent.height;
+	VkImageSubresourceRange range = {
+		.aspectMask = aspectMask,
+		.levelCount = createInfo->mipLevels,
+		.layerCount = createInfo->arrayLayers,
+	};
+
+	// First, we need to transition the image from its _UNDEFINED layout to a layout we can
+	// actually make use of. Since we are to transfer the texture data to the image, we pick
+	// VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, as this is the layout intended for being the target
+	// of copy operations. The only access requirement is writing from the transfer engine.
+
+	vkCmdPipelineBarrier (
+		uploader->current->transferCommandBuffer,
+		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0,
+		0, NULL,
+		0, NULL,
+		1, (VkImageMemoryBarrier[1]){
+			{
+				.sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+				.srcAccessMask       = 0,
+				.dstAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT,
+				.oldLayout           = VK_IMAGE_LAYOUT_UNDEFINED,
+				.newLayout           = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.image               = dstImage,
+				.subresourceRange    = range,
+			}
+		}
+	);
+
+	// Copy the data into the image. For block compressed formats, a row is a row of blocks. As
+	// much of the image as fits goes into the staging ring at once, and is copied with a single
+	// vkCmdCopyBufferToImage holding a region per mip level, rather than a copy per level.
+	//
+	// Copies have to start at a multiple of the minImageTransferGranularity of the queue (counted
+	// in blocks for block compressed formats), which is (1,1,1) for most queues, but transfer
+	// queues may report (0,0,0): only whole mip levels can be copied. A level then has to fit in
+	// the staging ring in one go.
+
+	uint32_t blockWidth, blockHeight, blockBytes;
+	vkutil_format_block ( createInfo->format, &blockWidth, &blockHeight, &blockBytes );
+	if ( mipMode == VKUTIL_IMAGE_MIPMAP_GENERATE && (blockWidth > 1 || blockHeight > 1) )
+		return -3;	// Blits can't write block compressed images
+
+	uint32_t levelCount = mipMode == VKUTIL_IMAGE_MIPMAP_INCLUDED ? createInfo->mipLevels : 1;
+	VkDeviceSize remaining = 0;
+	for ( uint32_t level = 0; level < levelCount; level++ )
+	{
+		remaining += (VkDeviceSize)((RVM_MAX ( 1, width  >> level ) + blockWidth  - 1) / blockWidth)
+			* ((RVM_MAX ( 1, height >> level ) + blockHeight - 1) / blockHeight) * blockBytes;
+	}
+
+	// Every reservation holds at most one (part of a) region per level, as a level only gets
+	// split up when the reservation runs out
+
+	VkBufferImageCopy* regions = alloca ( levelCount * sizeof ( VkBufferImageCopy ) );
+	uint32_t regionCount = 0;
+	VkDeviceSize stagingOffset = 0, stagingLeft = 0;
+	uint8_t* staging = NULL;
+
+	const uint8_t* levelData = data;
+	for ( uint32_t level = 0; level < levelCount; level++ )
+	{
+		uint32_t levelWidth  = RVM_MAX ( 1, width  >> level );
+		uint32_t levelHeight = RVM_MAX ( 1, height >> level );
+		uint32_t blocksWide  = (levelWidth  + blockWidth  - 1) / blockWidth;
+		uint32_t blocksHigh  = (levelHeight + blockHeight - 1) / blockHeight;
+
+		VkDeviceSize rowPitch = blocksWide * blockBytes;
+		uint32_t rowGranularity = uploader->transferGranularity.height;
+		if ( rowGranularity == 0 || uploader->transferGranularity.width == 0 )
+			rowGranularity = blocksHigh;
+
+		for ( uint32_t row = 0; row < blocksHigh; )
+		{
+			uint32_t rows = (uint32_t)RVM_MIN ( blocksHigh - row, stagingLeft / rowPitch );
+			if ( rows < blocksHigh - row )
+				rows -= rows % rowGranularity;
+
+			if ( rows == 0 )
+			{
+				// Out of staging memory. Copy what we have so far, as reserving more may start a
+				// new batch, and continue with a fresh reservation for the rest of the image.
+
+				if ( regionCount > 0 )
+				{
+					vkCmdCopyBufferToImage (
+						uploader->current->transferCommandBuffer, uploader->stagingBuffer, dstImage,
+						VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regionCount, regions
+					);
+					regionCount = 0;
+				}
+
+				void* mapped;
+				if ( vkutil_uploader_reserve (
+						uploader, remaining, RVM_MIN ( rowGranularity, blocksHigh - row ) * rowPitch,
+						&stagingOffset, &stagingLeft, &mapped
+					) != 0 )
+					return -2;
+				staging = mapped;
+				continue;
+			}
+
+			// The extent is in texels, and may end halfway through the last blocks at the edges
+			// of the image, but the buffer always holds whole blocks
+
+			VkDeviceSize size = rows * rowPitch;
+			memcpy ( staging, levelData + row * rowPitch, size );
+			regions[regionCount++] = (VkBufferImageCopy){
+				.bufferOffset      = stagingOffset,
+				.bufferRowLength   = blocksWide * blockWidth,
+				.bufferImageHeight = rows * blockHeight,
+				.imageSubresource  = {
+					.aspectMask = aspectMask,
+					.mipLevel   = level,
+					.layerCount = 1,
+				},
+				.imageOffset = { 0, row * blockHeight, 0 },
+				.imageExtent = {
+					levelWidth, RVM_MIN ( rows * blockHeight, levelHeight - row * blockHeight ), 1
+				},
+			};
+
+			staging       += size;
+			stagingOffset += size;
+			stagingLeft   -= size;
+			remaining     -= size;
+			row           += rows;
+		}
+
+		levelData += blocksHigh * rowPitch;
+	}
+
+	if ( regionCount > 0 )
+	{
+		vkCmdCopyBufferToImage (
+			uploader->current->transferCommandBuffer, uploader->stagingBuffer, dstImage,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regionCount, regions
+		);
+	}
+
+	// Hand the image over to the graphics queue family. The layout stays the same: the blits
+	// below still need the image to be a transfer destination.
+
+	vkutil_upload_batch_t* batch = uploader->current;
+	uint32_t transferOwnership = uploader->transferFamily != uploader->graphicsFamily;
+	VkImageMemoryBarrier barrier = {
+		.sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+		.srcAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask       = 0,
+		.oldLayout           = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		.newLayout           = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		.srcQueueFamilyIndex = transferOwnership ? uploader->transferFamily : VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = transferOwnership ? uploader->graphicsFamily : VK_QUEUE_FAMILY_IGNORED,
+		.image               = dstImage,
+		.subresourceRange    = range,
+	};
+	if ( transferOwnership )
+	{
+		vkCmdPipelineBarrier (
+			batch->transferCommandBuffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			0,
+			0, NULL,
+			0, NULL,
+			1, &barrier
+		);
+	}
+
+	barrier.srcAccessMask = transferOwnership ? 0 : VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier (
+		batch->graphicsCommandBuffer,
+		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0,
+		0, NULL,
+		0, NULL,
+		1, &barrier
+	);
+
+	// If we are to generate mipmaps, we use vkCmdBlitImage to copy over scaled versions of
+	// the image. We do this until we've either reached mipLevels specified in the CreateImage
+	// call, or until we've reached the mip of 1x1 pixels
+
+	if ( mipMode == VKUTIL_IMAGE_MIPMAP_GENERATE )
+	{
+		for ( uint32_t j = 1; j < createInfo->mipLevels && (width > 1 || height > 1); j++ )
+		{
+			uint32_t newWidth = RVM_MAX ( 1, width / 2), newHeight = RVM_MAX ( 1, height / 2 );
+
+			vkCmdBlitImage (
+				batch->graphicsCommandBuffer,
+				dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				1, (VkImageBlit[1]) {
+					{
+						.srcSubresource = {
+							.aspectMask = aspectMask,
+							.mipLevel   = j-1,
+							.layerCount = 1,
+						},
+						.srcOffsets[1] = { width, height, 1 },
+						.dstSubresource = {
+							.aspectMask = aspectMask,
+							.mipLevel   = j,
+							.layerCount = 1,
+						},
+						.dstOffsets[1] = { newWidth, newHeight, 1 },
+					}
+				}, VK_FILTER_LINEAR
+			);
+
+			vkCmdPipelineBarrier (
+				batch->graphicsCommandBuffer,
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				0,
+				0, NULL,
+				0, NULL,
+				1, (VkImageMemoryBarrier[1]){
+					{
+						.sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+						.srcAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT,
+						.dstAccessMask       = VK_ACCESS_TRANSFER_READ_BIT,
+						.oldLayout           = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+						.newLayout           = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+						.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+						.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+						.image               = dstImage,
+						.subresourceRange    = {
+							.aspectMask   = aspectMask,
+							.baseMipLevel = j,
+							.levelCount   = 1,
+							.layerCount   = 1,
+						},
+					}
+				}
+			);
+
+			width = newWidth, height = newHeight;
+		}
+	}
+
+	// Now that we're done transferring the data to the image, we can transition the layout
+	// to be optimal for what the user is going to use the data for rather than for being
+	// the target of copy operations.
+
+	vkCmdPipelineBarrier (
+		batch->graphicsCommandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+		0,
+		0, NULL,
+		0, NULL,
+		1, (VkImageMemoryBarrier[1]){
+			{
+				.sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+				.srcAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT,
+				.dstAccessMask       = dstAccessMask,
+				.oldLayout           = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				.newLayout           = finalLayout,
+				.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.image               = dstImage,
+				.subresourceRange    = range,
+			}
+		}
+	);
+
+	return 0;
+}
+
+int32_t vkutil_uploader_transition_image (
+	vkutil_uploader_t* uploader, VkImage image, const VkImageCreateInfo* createInfo,
+	VkImageAspectFlags aspectMask, VkImageLayout finalLayout, VkAccessFlags dstAccessMask
+)
+{
+	if ( uploader->current == NULL )
+		return -1;
+
+	// Images without initial data never touch the transfer queue: their contents are undefined
+	// anyway, so all that's left is getting them in the layout they will be used in
+
+	if ( finalLayout == VK_IMAGE_LAYOUT_UNDEFINED )
+		return 0;
+
+	vkCmdPipelineBarrier (
+		uploader->current->graphicsCommandBuffer,
+		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+		0,
+		0, NULL,
+		0, NULL,
+		1, (VkImageMemoryBarrier[1]){
+			{
+				.sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+				.srcAccessMask       = 0,
+				.dstAccessMask       = dstAccessMask,
+				.oldLayout           = VK_IMAGE_LAYOUT_UNDEFINED,
+				.newLayout           = finalLayout,
+				.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.image               = image,
+				.subresourceRange    = {
+					.aspectMask = aspectMask,
+					.levelCount = createInfo->mipLevels,
+					.layerCount = createInfo->arrayLayers,
+				},
+			}
+		}
+	);
+	return 0;
+}
+
+// Destroys whatever vkutil_create_images_helper created before it failed. Everything starts out
+// as VK_NULL_HANDLE and zeroed allocations, which are fine to destroy and free, so there is no
+// need to keep track of how far we got.
+static void vkutil_destroy_images_helper (
+	vkutil_uploader_t* uploader, uint32_t imageCount, vkutil_image_desc* imageDescs,
+	vkutil_allocation_t* allocations
+)
+{
+	VkDevice device = uploader->device;
+	for ( uint32_t i = 0; i < imageCount; i++ )
+	{
+		for ( uint32_t j = 0; j < imageDescs[i].imageViewCount; j++ )
+		{
+			vkDestroyImageView ( device, *imageDescs[i].imageViews[j].outImageView, NULL );
+			*imageDescs[i].imageViews[j].outImageView = VK_NULL_HANDLE;
+		}
+		vkDestroyImage ( device, *imageDescs[i].outImage, NULL );
+		*imageDescs[i].outImage = VK_NULL_HANDLE;
+		vkutil_allocator_free ( uploader->allocator, &allocations[i] );
+	}
+}
+
+int32_t vkutil_create_images_helper (
+	vkutil_uploader_t* uploader, uint32_t imageCount, vkutil_image_desc* imageDescs,
+	vkutil_allocation_t* outAllocations, uint64_t* outTicket
+)
+{
+	VkDevice device = uploader->device;
+
+	for ( uint32_t i = 0; i < imageCount; i++ )
+	{
+		*imageDescs[i].outImage = VK_NULL_HANDLE;
+		for ( uint32_t j = 0; j < imageDescs[i].imageViewCount; j++ )
+			*imageDescs[i].imageViews[j].outImageView = VK_NULL_HANDLE;
+		outAllocations[i] = (vkutil_allocation_t){ 0 };
+	}
+
+	// Create all images and get their individual memory requirements. The initial layout has to
+	// be _UNDEFINED on creation, though we will take the layout the user specified for use later.
+	// Usage flags are set to upload data from the CPU, and - if mipmapping is to be applied -
+	// to copy to itself.
+
+	for ( uint32_t i = 0; i < imageCount; i++ )
+	{
+		VkImageCreateInfo info = *imageDescs[i].createInfo;
+		info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		info.usage        |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+		if ( imageDescs[i].mipMode == VKUTIL_IMAGE_MIPMAP_GENERATE )
+			info.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		if ( vkCreateImage ( device, &info, NULL, imageDescs[i].outImage ) != VK_SUCCESS )
+		{
+			*imageDescs[i].outImage = VK_NULL_HANDLE;
+			vkutil_destroy_images_helper ( uploader, imageCount, imageDescs, outAllocations );
+			return -1;
+		}
+	}
+
+	// Now we allocate the memory for use by the images. This will likely be a different memory
+	// type than the staging memory the data comes from, as dedicated GPUs have separate heaps for
+	// GPU operations and for upload operations, as opposed to integrated GPUs which commonly use
+	// one large heap for the same purpose.
+
+	// Every image gets an allocation of its own from the allocator, which binds it for us as
+	// well. They will usually all end up in the same block of device memory anyway.
+
+	for ( uint32_t i = 0; i < imageCount; i++ )
+	{
+		if ( vkutil_allocator_alloc_image (
+				uploader->allocator, *imageDescs[i].outImage, imageDescs[i].createInfo->tiling,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &outAllocations[i]
+			) != 0 )
+		{
+			vkutil_destroy_images_helper ( uploader, imageCount, imageDescs, outAllocations );
+			return -1;
+		}
+	}
+
+	for ( uint32_t i = 0; i < imageCount; i++ )
+	{
+		for ( uint32_t j = 0; j < imageDescs[i].imageViewCount; j++ )
+		{
+			VkImageViewCreateInfo createInfo = *imageDescs[i].imageViews[j].createInfo;
+			createInfo.image = *imageDescs[i].outImage;
+
+			if ( vkCreateImageView (
+					device,
+					&createInfo,
+					NULL,
+					imageDescs[i].imageViews[j].outImageView
+				) != VK_SUCCESS )
+			{
+				*imageDescs[i].imageViews[j].outImageView = VK_NULL_HANDLE;
+				vkutil_destroy_images_helper ( uploader, imageCount, imageDescs, outAllocations );
+				return -1;
+			}
+		}
+	}
+
+	// At this time, we did all we could do on the CPU side: It is time to take it over to the
+	// GPU/Driver to get the data to the place we would like it to be. The uploader copies the data
+	// into its staging ring and records the copies for us, splitting large images up as needed.
+
+	if ( vkutil_uploader_begin ( uploader ) != 0 )
+	{
+		vkutil_destroy_images_helper ( uploader, imageCount, imageDescs, outAllocations );
+		return -2;
+	}
+
+	for ( uint32_t i = 0; i < imageCount; i++ )
+	{
+		int32_t ret;
+		if ( imageDescs[i].initialData == NULL )
+		{
+			ret = vkutil_uploader_transition_image (
+				uploader, *imageDescs[i].outImage, imageDescs[i].createInfo,
+				imageDescs[i].aspectMask, imageDescs[i].createInfo->initialLayout,
+				imageDescs[i].accessMask
+			);
+		}
+		else
+		{
+			ret = vkutil_uploader_upload_image (
+				uploader, imageDescs[i].initialData, *imageDescs[i].outImage, imageDescs[i].createInfo,
+				imageDescs[i].aspectMask, imageDescs[i].mipMode,
+				imageDescs[i].createInfo->initialLayout, imageDescs[i].accessMask
+			);
+		}
+		if ( ret != 0 )
+		{
+			vkutil_uploader_submit ( uploader, NULL );
+			return -3;
+		}
+	}
+
+	// We don't wait for the copies to complete here. The images can be used by the graphics queue
+	// once vkutil_uploader_is_complete says the returned ticket is.
+
+	if ( vkutil_uploader_submit ( uploader, outTicket ) != 0 )
+		return -4;
+
+	return 0;
+}
+
+// Half floats, for the texcoords of quantized vertices. Denormals, infinities and NaNs are kept as
+// they are, rounding is to nearest even.
+
+static float vkutil_half_to_float ( uint16_t h )
+{
+	uint32_t sign = (uint32_t)(h & 0x8000) << 16, exponent = (h >> 10) & 31, mantissa = h & 1023, x;
+	if ( exponent == 31 )
+		x = sign | 0x7F800000 | (mantissa << 13);
+	else if ( exponent != 0 )
+		x = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+	else if ( mantissa == 0 )
+		x = sign;
+	else
+	{
+		// Denormal half floats are normal floats
+		exponent = 127 - 15 + 1;
+		while ( (mantissa & 1024) == 0 )
+			mantissa <<= 1, exponent--;
+		x = sign | (exponent << 23) | ((mantissa & 1023) << 13);
+	}
+
+	float f;
+	memcpy ( &f, &x, sizeof ( f ) );
+	return f;
+}
+
+static uint16_t vkutil_float_to_half ( float f )
+{
+	uint32_t x;
+	memcpy ( &x, &f, sizeof ( x ) );
+
+	uint32_t sign     = (x >> 16) & 0x8000;
+	int32_t  exponent = (int32_t)((x >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = x & 0x7FFFFF;
+
+	if ( ((x >> 23) & 0xFF) == 0xFF )
+		return (uint16_t)(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+	if ( exponent >= 31 )
+		return (uint16_t)(sign | 0x7C00);
+	if ( exponent <= 0 )
+	{
+		if ( exponent < -10 )
+			return (uint16_t)sign;
+		mantissa |= 0x800000;
+		uint32_t shift = 14 - exponent;
+		uint32_t half = mantissa >> shift, rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+		if ( rest > halfway || (rest == halfway && (half & 1)) )
+			half++;
+		return (uint16_t)(sign | half);
+	}
+
+	uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13), rest = mantissa & 0x1FFF;
+	if ( rest > 0x1000 || (rest == 0x1000 && (half & 1)) )
+		half++;
+	return (uint16_t)(sign | half);
+}
+
+// Devices support only some of the block compressed formats, if any: BC is a desktop thing, ETC2
+// and ASTC are found on mobile devices. When the format of a texture in a BOBJ file can't be
+// sampled, it is decoded to plain RGBA8 on the CPU instead. This costs the memory and bandwidth
+// the compression was supposed to save, but beats not showing the texture at all.
+
+static VkFormat vkutil_bobj_texture_format ( uint32_t format )
+{
+	switch ( format )
+	{
+	case BOBJ_TEXTURE_FORMAT_RGBA8:      return VK_FORMAT_R8G8B8A8_SRGB;
+	case BOBJ_TEXTURE_FORMAT_BC1:        return VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+	case BOBJ_TEXTURE_FORMAT_BC3:        return VK_FORMAT_BC3_SRGB_BLOCK;
+	case BOBJ_TEXTURE_FORMAT_ETC2_RGB8:  return VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK;
+	case BOBJ_TEXTURE_FORMAT_ETC2_RGBA8: return VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK;
+	default:                             return VK_FORMAT_UNDEFINED;
+	}
+}
+
+// Size of all mip levels of a texture together, in the layout of the BOBJ file
+static uint64_t vkutil_bobj_texture_size (
+	VkFormat format, uint32_t width, uint32_t height, uint32_t mipCount
+)
+{
+	uint32_t blockWidth, blockHeight, blockBytes;
+	vkutil_format_block ( format, &blockWidth, &blockHeight, &blockBytes );
+
+	uint64_t size = 0;
+	for ( uint32_t level = 0; level < mipCount; level++ )
+	{
+		uint64_t blocksWide = (RVM_MAX ( 1, width  >> level ) + blockWidth  - 1) / blockWidth;
+		uint64_t blocksHigh = (RVM_MAX ( 1, height >> level ) + blockHeight - 1) / blockHeight;
+		size += blocksWide * blocksHigh * blockBytes;
+	}
+	return size;
+}
+
+static uint8_t vkutil_clamp_u8 ( int32_t v )
+{
+	return (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
+}
+
+// Decodes the color half of a BC1 or BC3 block. BC3 color blocks always use four colors.
+static void vkutil_decode_bc1 ( const uint8_t* block, uint8_t out[16][4], int32_t alwaysFourColors )
+{
+	uint32_t c0 = block[0] | (block[1] << 8), c1 = block[2] | (block[3] << 8);
+	uint32_t indices = block[4] | (block[5] << 8) | (block[6] << 16) | ((uint32_t)block[7] << 24);
+
+	uint8_t palette[4][4];
+	for ( uint32_t i = 0; i < 2; i++ )
+	{
+		uint32_t c = i == 0 ? c0 : c1;
+		uint32_t r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+		palette[i][0] = (uint8_t)((r << 3) | (r >> 2));
+		palette[i][1] = (uint8_t)((g << 2) | (g >> 4));
+		palette[i][2] = (uint8_t)((b << 3) | (b >> 2));
+		palette[i][3] = 255;
+	}
+	for ( uint32_t j = 0; j < 3; j++ )
+	{
+		if ( c0 > c1 || alwaysFourColors )
+		{
+			palette[2][j] = (uint8_t)((2 * palette[0][j] + palette[1][j]) / 3);
+			palette[3][j] = (uint8_t)((palette[0][j] + 2 * palette[1][j]) / 3);
+		}
+		else
+		{
+			palette[2][j] = (uint8_t)((palette[0][j] + palette[1][j]) / 2);
+			palette[3][j] = 0;
+		}
+	}
+	palette[2][3] = 255;
+	palette[3][3] = c0 > c1 || alwaysFourColors ? 255 : 0;
+
+	for ( uint32_t i = 0; i < 16; i++ )
+		memcpy ( out[i], palette[(indices >> (2 * i)) & 3], 4 );
+}
+
+// Decodes the alpha half of a BC3 block
+static void vkutil_decode_bc3_alpha ( const uint8_t* block, uint8_t out[16][4] )
+{
+	uint32_t a0 = block[0], a1 = block[1];
+	uint64_t indices = 0;
+	for ( uint32_t i = 0; i < 6; i++ )
+		indices |= (uint64_t)block[2+i] << (8 * i);
+
+	uint8_t palette[8] = { (uint8_t)a0, (uint8_t)a1 };
+	for ( uint32_t i = 1; i < 7; i++ )
+	{
+		if ( a0 > a1 )
+			palette[1+i] = (uint8_t)(((7 - i) * a0 + i * a1) / 7);
+		else if ( i < 5 )
+			palette[1+i] = (uint8_t)(((5 - i) * a0 + i * a1) / 5);
+	}
+	if ( a0 <= a1 )
+		palette[6] = 0, palette[7] = 255;
+
+	for ( uint32_t i = 0; i < 16; i++ )
+		out[i][3] = palette[(indices >> (3 * i)) & 7];
+}
+
+// Decodes the color half of an ETC2 block. Besides the individual and differential modes of ETC1,
+// ETC2 has T, H and planar modes, hidden in differential blocks that would overflow.
+static void vkutil_decode_etc2 ( const uint8_t* block, uint8_t out[16][4] )
+{
+	static const int32_t modifiers[8][4] = {
+		{  2,   8,  -2,   -8 }, {  5,  17,  -5,  -17 }, {  9,  29,  -9,  -29 }, { 13,  42, -13,  -42 },
+		{ 18,  60, -18,  -60 }, { 24,  80, -24,  -80 }, { 33, 106, -33, -106 }, { 47, 183, -47, -183 },
+	};
+	static const int32_t distances[8] = { 3, 6, 11, 16, 23, 32, 41, 64 };
+
+	uint64_t w = 0;
+	for ( uint32_t i = 0; i < 8; i++ )
+		w = (w << 8) | block[i];
+
+	// Pixels are numbered going down the columns, x * 4 + y
+
+#define ETC_PIXEL_INDEX(w,i) ((((w) >> (16 + (i))) & 1) << 1 | (((w) >> (i)) & 1))
+#define ETC_EXTEND4(c) (((c) << 4) | (c))
+#define ETC_EXTEND5(c) (((c) << 3) | ((c) >> 2))
+
+	int32_t r  = (int32_t)((w >> 59) & 31), g  = (int32_t)((w >> 51) & 31), b  = (int32_t)((w >> 43) & 31);
+	int32_t dr = (int32_t)((w >> 56) &  7), dg = (int32_t)((w >> 48) &  7), db = (int32_t)((w >> 40) &  7);
+	dr = dr >= 4 ? dr - 8 : dr, dg = dg >= 4 ? dg - 8 : dg, db = db >= 4 ? db - 8 : db;
+	uint32_t differential = (w >> 33) & 1;
+
+	if ( !differential || (r + dr >= 0 && r + dr <= 31 && g + dg >= 0 && g + dg <= 31 && b + db >= 0 && b + db <= 31) )
+	{
+		// Individual and differential modes: two halves of 2x4 or 4x2 pixels, each with a base
+		// color and a table of modifiers to add to it
+
+		int32_t base[2][3];
+		if ( differential )
+		{
+			base[0][0] = ETC_EXTEND5 ( r ), base[1][0] = ETC_EXTEND5 ( r + dr );
+			base[0][1] = ETC_EXTEND5 ( g ), base[1][1] = ETC_EXTEND5 ( g + dg );
+			base[0][2] = ETC_EXTEND5 ( b ), base[1][2] = ETC_EXTEND5 ( b + db );
+		}
+		else
+		{
+			for ( uint32_t j = 0; j < 3; j++ )
+			{
+				base[0][j] = (int32_t)ETC_EXTEND4 ( (w >> (60 - 8 * j)) & 15 );
+				base[1][j] = (int32_t)ETC_EXTEND4 ( (w >> (56 - 8 * j)) & 15 );
+			}
+		}
+
+		uint32_t table[2] = { (uint32_t)(w >> 37) & 7, (uint32_t)(w >> 34) & 7 };
+		uint32_t flip = (w >> 32) & 1;
+		for ( uint32_t x = 0; x < 4; x++ )
+		{
+			for ( uint32_t y = 0; y < 4; y++ )
+			{
+				uint32_t half = flip ? y >= 2 : x >= 2;
+				int32_t modifier = modifiers[table[half]][ETC_PIXEL_INDEX ( w, x * 4 + y )];
+				for ( uint32_t j = 0; j < 3; j++ )
+					out[y * 4 + x][j] = vkutil_clamp_u8 ( base[half][j] + modifier );
+				out[y * 4 + x][3] = 255;
+			}
+		}
+	}
+	else if ( r + dr < 0 || r + dr > 31 || g + dg < 0 || g + dg > 31 )
+	{
+		// T and H modes: two base colors, from which four colors are made that every pixel
+		// picks from
+
+		int32_t c[2][3], paint[4][3];
+		if ( r + dr < 0 || r + dr > 31 )
+		{
+			c[0][0] = (int32_t)(((w >> 57) & 12) | ((w >> 56) & 3));
+			c[0][1] = (int32_t)((w >> 52) & 15), c[0][2] = (int32_t)((w >> 48) & 15);
+			c[1][0] = (int32_t)((w >> 44) & 15), c[1][1] = (int32_t)((w >> 40) & 15);
+			c[1][2] = (int32_t)((w >> 36) & 15);
+			int32_t d = distances[((w >> 33) & 6) | ((w >> 32) & 1)];
+			for ( uint32_t j = 0; j < 3; j++ )
+			{
+				int32_t c0 = ETC_EXTEND4 ( c[0][j] ), c1 = ETC_EXTEND4 ( c[1][j] );
+				paint[0][j] = c0, paint[1][j] = c1 + d, paint[2][j] = c1, paint[3][j] = c1 - d;
+			}
+		}
+		else
+		{
+			c[0][0] = (int32_t)((w >> 59) & 15);
+			c[0][1] = (int32_t)(((w >> 55) & 14) | ((w >> 52) & 1));
+			c[0][2] = (int32_t)(((w >> 48) & 8) | ((w >> 47) & 7));
+			c[1][0] = (int32_t)((w >> 43) & 15), c[1][1] = (int32_t)((w >> 39) & 15);
+			c[1][2] = (int32_t)((w >> 35) & 15);
+			uint32_t v0 = (c[0][0] << 8) | (c[0][1] << 4) | c[0][2];
+			uint32_t v1 = (c[1][0] << 8) | (c[1][1] << 4) | c[1][2];
+			int32_t d = distances[((w >> 32) & 4) | ((w >> 31) & 2) | (v0 >= v1)];
+			for ( uint32_t j = 0; j < 3; j++ )
+			{
+				int32_t c0 = ETC_EXTEND4 ( c[0][j] ), c1 = ETC_EXTEND4 ( c[1][j] );
+				paint[0][j] = c0 + d, paint[1][j] = c0 - d, paint[2][j] = c1 + d, paint[3][j] = c1 - d;
+			}
+		}
+
+		for ( uint32_t x = 0; x < 4; x++ )
+		{
+			for ( uint32_t y = 0; y < 4; y++ )
+			{
+				uint32_t index = ETC_PIXEL_INDEX ( w, x * 4 + y );
+				for ( uint32_t j = 0; j < 3; j++ )
+					out[y * 4 + x][j] = vkutil_clamp_u8 ( paint[index][j] );
+				out[y * 4 + x][3] = 255;
+			}
+		}
+	}
+	else
+	{
+		// Planar mode: three colors, at the origin, right and bottom of the block, between
+		// which is interpolated
+
+		int32_t o[3], h[3], v[3];
+		o[0] = (int32_t)((w >> 57) & 63);
+		o[1] = (int32_t)(((w >> 50) & 64) | ((w >> 49) & 63));
+		o[2] = (int32_t)(((w >> 43) & 32) | ((w >> 40) & 24) | ((w >> 39) & 7));
+		h[0] = (int32_t)(((w >> 33) & 62) | ((w >> 32) & 1));
+		h[1] = (int32_t)((w >> 25) & 127), h[2] = (int32_t)((w >> 19) & 63);
+		v[0] = (int32_t)((w >> 13) & 63), v[1] = (int32_t)((w >> 6) & 127), v[2] = (int32_t)(w & 63);
+		for ( uint32_t j = 0; j < 3; j++ )
+		{
+			if ( j == 1 )
+			{
+				o[j] = (o[j] << 1) | (o[j] >> 6), h[j] = (h[j] << 1) | (h[j] >> 6), v[j] = (v[j] << 1) | (v[j] >> 6);
+			}
+			else
+			{
+				o[j] = (o[j] << 2) | (o[j] >> 4), h[j] = (h[j] << 2) | (h[j] >> 4), v[j] = (v[j] << 2) | (v[j] >> 4);
+			}
+		}
+
+		for ( int32_t x = 0; x < 4; x++ )
+		{
+			for ( int32_t y = 0; y < 4; y++ )
+			{
+				for ( uint32_t j = 0; j < 3; j++ )
+				{
+					out[y * 4 + x][j] = vkutil_clamp_u8 (
+						(x * (h[j] - o[j]) + y * (v[j] - o[j]) + 4 * o[j] + 2) >> 2
+					);
+				}
+				out[y * 4 + x][3] = 255;
+			}
+		}
+	}
+
+#undef ETC_PIXEL_INDEX
+#undef ETC_EXTEND4
+#undef ETC_EXTEND5
+}
+
+// Decodes the EAC alpha half of an ETC2 RGBA8 block
+static void vkutil_decode_eac_alpha ( const uint8_t* block, uint8_t out[16][4] )
+{
+	static const int32_t modifiers[16][8] = {
+		{ -3, -6,  -9, -15, 2, 5, 8, 14 }, { -3, -7, -10, -13, 2, 6, 9, 12 },
+		{ -2, -5,  -8, -13, 1, 4, 7, 12 }, { -2, -4,  -6, -13, 1, 3, 5, 12 },
+		{ -3, -6,  -8, -12, 2, 5, 7, 11 }, { -3, -7,  -9, -11, 2, 6, 8, 10 },
+		{ -4, -7,  -8, -11, 3, 6, 7, 10 }, { -3, -5,  -8, -11, 2, 4, 7, 10 },
+		{ -2, -6,  -8, -10, 1, 5, 7,  9 }, { -2, -5,  -8, -10, 1, 4, 7,  9 },
+		{ -2, -4,  -8, -10, 1, 3, 7,  9 }, { -2, -5,  -7, -10, 1, 4, 6,  9 },
+		{ -3, -4,  -7, -10, 2, 3, 6,  9 }, { -1, -2,  -3, -10, 0, 1, 2,  9 },
+		{ -4, -6,  -8,  -9, 3, 5, 7,  8 }, { -3, -5,  -7,  -9, 2, 4, 6,  8 },
+	};
+
+	int32_t base = block[0], multiplier = block[1] >> 4;
+	const int32_t* table = modifiers[block[1] & 15];
+	uint64_t indices = 0;
+	for ( uint32_t i = 2; i < 8; i++ )
+		indices = (indices << 8) | block[i];
+
+	// Pixels go down the columns again, with the first one in the highest bits
+
+	for ( uint32_t i = 0; i < 16; i++ )
+	{
+		uint32_t x = i / 4, y = i % 4;
+		out[y * 4 + x][3] = vkutil_clamp_u8 ( base + table[(indices >> (45 - 3 * i)) & 7] * multiplier );
+	}
+}
+
+// Decodes all mip levels of a BOBJ texture into RGBA8, in the layout of VKUTIL_IMAGE_MIPMAP_INCLUDED
+static void vkutil_decode_bobj_texture (
+	uint32_t format, uint32_t width, uint32_t height, uint32_t mipCount,
+	const uint8_t* in, uint8_t* out
+)
+{
+	for ( uint32_t level = 0; level < mipCount; level++ )
+	{
+		uint32_t levelWidth = RVM_MAX ( 1, width >> level ), levelHeight = RVM_MAX ( 1, height >> level );
+		for ( uint32_t by = 0; by < levelHeight; by += 4 )
+		{
+			for ( uint32_t bx = 0; bx < levelWidth; bx += 4 )
+			{
+				uint8_t texels[16][4];
+				switch ( format )
+				{
+				case BOBJ_TEXTURE_FORMAT_BC1:
+					vkutil_decode_bc1 ( in, texels, 0 );
+					in += 8;
+					break;
+				case BOBJ_TEXTURE_FORMAT_BC3:
+					vkutil_decode_bc1 ( in + 8, texels, 1 );
+					vkutil_decode_bc3_alpha ( in, texels );
+					in += 16;
+					break;
+				case BOBJ_TEXTURE_FORMAT_ETC2_RGB8:
+					vkutil_decode_etc2 ( in, texels );
+					in += 8;
+					break;
+				case BOBJ_TEXTURE_FORMAT_ETC2_RGBA8:
+					vkutil_decode_etc2 ( in + 8, texels );
+					vkutil_decode_eac_alpha ( in, texels );
+					in += 16;
+					break;
+				}
+
+				// Blocks at the right and bottom edges may stick out of the image
+
+				for ( uint32_t y = 0; y < 4 && by + y < levelHeight; y++ )
+				{
+					for ( uint32_t x = 0; x < 4 && bx + x < levelWidth; x++ )
+						memcpy ( out + ((by + y) * levelWidth + bx + x) * 4, texels[y * 4 + x], 4 );
+				}
+			}
+		}
+		out += levelWidth * levelHeight * 4;
+	}
+}
+
+// Cleans up after a model that failed to load. Uploads to it may still be in flight, including
+// the ones submitted before things went wrong, so those are waited for first.
+static int32_t vkutil_load_bobj_failed ( vkutil_model_t* model, vkutil_uploader_t* uploader, int32_t ret )
+{
+	vkutil_uploader_wait_idle ( uploader );
+	vkutil_destroy_bobj ( model, uploader->allocator );
+	*model = (vkutil_model_t){ 0 };
+	return ret;
+}
+
+int32_t vkutil_load_bobj (
+	vkutil_model_t* model, VkPhysicalDevice physicalDevice,
+	vkutil_uploader_t* uploader, const void* bobjData, uint64_t bobjLen,
+	uint64_t* outTicket
+)
+{
+	VkDevice device = uploader->device;
+	vkutil_allocator_t* allocator = uploader->allocator;
+
+	// Load the file first of all
+
+	// The BOBJ file starts with a header telling us what is in the file and where it is
+
+	bobj_file_header* fhead = (bobj_file_header*)bobjData;
+
+	// The data is typically a memory mapping of the file rather than a copy of it, and everything
+	// below reads straight from it into staging memory. That makes it important to check every
+	// section actually lies within the data before touching it: Reading past the end of a mapping
+	// is not just garbage, it is an access violation.
+
+	if ( bobjLen < sizeof ( bobj_file_header ) || fhead->magic != BOBJ_FILE_MAGIC )
+		return -1;
+	if ( fhead->version != BOBJ_VERSION )
+		return -2;
+	if ( fhead->vertexFormat != BOBJ_VERTEX_FORMAT_FLOAT && fhead->vertexFormat != BOBJ_VERTEX_FORMAT_QUANTIZED )
+		return -3;
+
+	uint32_t vertexSize = fhead->vertexFormat == BOBJ_VERTEX_FORMAT_QUANTIZED
+		? sizeof ( bobj_vert_quantized ) : sizeof ( bobj_vert );
+	uint32_t positionSize = fhead->vertexFormat == BOBJ_VERTEX_FORMAT_QUANTIZED
+		? sizeof ( bobj_position_quantized ) : sizeof ( bobj_position );
+	if ( (uint64_t)fhead->objectsStart  + (uint64_t)fhead->objCount    * sizeof ( bobj_object_header  ) > bobjLen
+	  || (uint64_t)fhead->texturesStart + (uint64_t)fhead->texCount    * sizeof ( bobj_texture_header ) > bobjLen
+	  || (uint64_t)fhead->vertexStart   + (uint64_t)fhead->vertexCount * vertexSize                     > bobjLen
+	  || (uint64_t)fhead->positionStart + (uint64_t)fhead->vertexCount * positionSize                   > bobjLen
+	  || (uint64_t)fhead->clusterStart  + (uint64_t)fhead->clusterCount * sizeof ( bobj_cluster       ) > bobjLen
+	  || (uint64_t)fhead->indexStart    + (uint64_t)fhead->indexDataSize                                > bobjLen
+	  || fhead->texdataStart > bobjLen )
+		return -3;
+
+	// From this, we can now get the location of other structures
+
+	bobj_object_header* objects   = (bobj_object_header* )((uint8_t*)bobjData + fhead->objectsStart );
+	bobj_texture_header* textures = (bobj_texture_header*)((uint8_t*)bobjData + fhead->texturesStart);
+	bobj_vert* vertices           = (bobj_vert*          )((uint8_t*)bobjData + fhead->vertexStart  );
+	bobj_vert_quantized* quantizedVertices = (bobj_vert_quantized*)vertices;
+	void* positions               = (void*               )((uint8_t*)bobjData + fhead->positionStart);
+	bobj_cluster* clusters        = (bobj_cluster*       )((uint8_t*)bobjData + fhead->clusterStart );
+	uint8_t* indices              = (uint8_t*            )((uint8_t*)bobjData + fhead->indexStart   );
+	uint8_t* texdata              = (uint8_t*            )((uint8_t*)bobjData + fhead->texdataStart );
+
+	*model = (vkutil_model_t){
+		.objectCount  = fhead->objCount,
+		.textureCount = fhead->texCount,
+		.vertexFormat = fhead->vertexFormat,
+		.positionScale  = { fhead->positionScale[0],  fhead->positionScale[1],  fhead->positionScale[2]  },
+		.positionOffset = { fhead->positionOffset[0], fhead->positionOffset[1], fhead->positionOffset[2] },
+		.objects      = calloc ( 1, fhead->objCount * sizeof ( vkutil_object_t )
+			+ fhead->texCount * (sizeof ( vkutil_allocation_t )+sizeof ( VkImage )+sizeof ( VkImageView )) ),
+	};
+
+	// The handles and allocations start out zeroed, along with the rest of the model, so that
+	// vkutil_destroy_bobj can clean up a model that only got halfway should anything fail below
+
+	// The allocations go first, so they are properly aligned following the objects
+	model->imageAllocations = (vkutil_allocation_t*)(model->objects          + fhead->objCount);
+	model->images           = (VkImage*            )(model->imageAllocations + fhead->texCount);
+	model->imageViews       = (VkImageView*        )(model->images           + fhead->texCount);
+
+	VkImageCreateInfo* imageCreateInfo =
+		alloca ( fhead->texCount * sizeof ( VkImageCreateInfo ) );
+	VkImageViewCreateInfo* imageViewCreateInfo =
+		alloca ( fhead->texCount * sizeof ( VkImageViewCreateInfo ) );
+	vkutil_image_view_desc* imageViewDescs =
+		alloca ( fhead->texCount * sizeof ( vkutil_image_view_desc ) );
+	vkutil_image_desc* imageDescs      = alloca ( fhead->texCount * sizeof ( vkutil_image_desc ) );
+	VkImage* images                    = alloca ( fhead->texCount * sizeof ( VkImage ) );
+
+	void** decodedTexels = alloca ( fhead->texCount * sizeof ( void* ) );
+
+	for ( uint32_t i = 0; i < fhead->texCount; i++ )
+	{
+		uint32_t mipLevels = 1;
+		uint32_t w = textures[i].width, h = textures[i].height;
+		while ( w > 1 || h > 1 )
 			mipLevels++, w /= 2, h /= 2;
 
+		VkFormat format = vkutil_bobj_texture_format ( textures[i].format );
+		uint64_t texelEnd = (uint64_t)fhead->texdataStart + textures[i].offset + textures[i].size;
+		if ( format == VK_FORMAT_UNDEFINED || textures[i].width == 0 || textures[i].height == 0
+		  || textures[i].mipCount == 0 || textures[i].mipCount > mipLevels || texelEnd > bobjLen
+		  || textures[i].size < vkutil_bobj_texture_size (
+				format, textures[i].width, textures[i].height, textures[i].mipCount
+			) )
+			return vkutil_load_bobj_failed ( model, uploader, -3 );
+	}
+
+	for ( uint32_t i = 0; i < fhead->objCount; i++ )
+	{
+		if ( (objects[i].indexSize != sizeof ( bobj_index ) && objects[i].indexSize != sizeof ( bobj_index16 ))
+		  || ((uint64_t)objects[i].indexOffset + objects[i].indexCount) * objects[i].indexSize > fhead->indexDataSize
+		  || (uint64_t)objects[i].clusterOffset + objects[i].clusterCount > fhead->clusterCount
+		  || objects[i].lodCount == 0 || objects[i].lodCount > VKUTIL_MAX_LODS || objects[i].lodCount > BOBJ_MAX_LODS
+		  || objects[i].vertexOffset >= fhead->vertexCount
+		  || (objects[i].textureIndex >= fhead->texCount && objects[i].textureIndex != 0xFFFFFFFF) )
+			return vkutil_load_bobj_failed ( model, uploader, -3 );
+
+		for ( uint32_t j = 0; j < objects[i].lodCount; j++ )
+		{
+			bobj_lod* lod = &objects[i].lods[j];
+			if ( (uint64_t)lod->indexOffset + lod->indexCount > objects[i].indexCount )
+				return vkutil_load_bobj_failed ( model, uploader, -3 );
+		}
+
+		for ( uint32_t j = 0; j < objects[i].clusterCount; j++ )
+		{
+			bobj_cluster* cluster = &clusters[objects[i].clusterOffset + j];
+			if ( (uint64_t)cluster->indexOffset + cluster->indexCount > objects[i].lods[0].indexCount )
+				return vkutil_load_bobj_failed ( model, uploader, -3 );
+		}
+	}
+
+	// Create all textures of the object. The mip levels were made by mconv, so there is no
+	// need to blit them here, which wouldn't be possible for block compressed formats anyway.
+
+	for ( uint32_t i = 0; i < fhead->texCount; i++ )
+	{
+		VkFormat format = vkutil_bobj_texture_format ( textures[i].format );
+
+		VkFormatProperties formatProperties;
+		vkGetPhysicalDeviceFormatProperties ( physicalDevice, format, &formatProperties );
+
+		decodedTexels[i] = NULL;
+		if ( (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) == 0 )
+		{
+			format = VK_FORMAT_R8G8B8A8_SRGB;
+			decodedTexels[i] = malloc ( vkutil_bobj_texture_size (
+				format, textures[i].width, textures[i].height, textures[i].mipCount
+			) );
+			if ( decodedTexels[i] == NULL )
+			{
+				for ( uint32_t j = 0; j < i; j++ )
+					free ( decodedTexels[j] );
+				return vkutil_load_bobj_failed ( model, uploader, -5 );
+			}
+			vkutil_decode_bobj_texture (
+				textures[i].format, textures[i].width, textures[i].height, textures[i].mipCount,
+				texdata + textures[i].offset, decodedTexels[i]
+			);
+		}
+
 		imageCreateInfo[i] = (VkImageCreateInfo){
 			.sType         = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
 			.imageType     = VK_IMAGE_TYPE_2D,
-			.format        = VK_FORMAT_R8G8B8A8_SRGB,
+			.format        = format,
 			.extent        = { textures[i].width, textures[i].height, 1 },
-			.mipLevels     = mipLevels,
+			.mipLevels     = textures[i].mipCount,
 			.arrayLayers   = 1,
 			.samples       = VK_SAMPLE_COUNT_1_BIT,
 			.tiling        = VK_IMAGE_TILING_OPTIMAL,
@@ -660,7 +2270,7 @@ int32_t vkutil_load_bobj (
 		imageViewCreateInfo[i] = (VkImageViewCreateInfo){
 			.sType            = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
 			.viewType         = VK_IMAGE_VIEW_TYPE_2D,
-			.format           = VK_FORMAT_R8G8B8A8_SRGB,
+			.format           = format,
 			.subresourceRange = {
 				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
 				.levelCount = imageCreateInfo[i].mipLevels,
@@ -674,32 +2284,50 @@ int32_t vkutil_load_bobj (
 		};
 		imageDescs[i] = (vkutil_image_desc){
 			.outImage   = &model->images[i],
-			.initialData= texdata + textures[i].offset,
+			.initialData= decodedTexels[i] ? decodedTexels[i] : texdata + textures[i].offset,
 			.createInfo = &imageCreateInfo[i],
-			.mipMode    = VKUTIL_IMAGE_MIPMAP_GENERATE,
+			.mipMode    = VKUTIL_IMAGE_MIPMAP_INCLUDED,
 			.accessMask = VK_ACCESS_SHADER_READ_BIT,
 			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
 			.imageViewCount = 1, .imageViews = &imageViewDescs[i],
 		};
 	}
+	// The textures go in a batch of their own. Batches complete in the order they were submitted,
+	// so only the ticket of the vertex data below has to be handed back.
+
+	// The texels are copied into staging memory before the helper returns, so the decoded ones
+	// can go right after.
+
 	if ( fhead->texCount > 0 )
 	{
-		vkutil_create_images_helper (
-			device, stagingCommandBuffer, stagingQueue, memoryProperties, fhead->texCount,
-			imageDescs, &model->imageMemory
+		int32_t ret = vkutil_create_images_helper (
+			uploader, fhead->texCount, imageDescs, model->imageAllocations, NULL
 		);
+		for ( uint32_t i = 0; i < fhead->texCount; i++ )
+			free ( decodedTexels[i] );
+		if ( ret != 0 )
+			return vkutil_load_bobj_failed ( model, uploader, -5 );
 	}
 
 	// Create all internal object descriptors
 
-	VkResult result;
-	
+	model->clusters = malloc ( fhead->clusterCount * sizeof ( vkutil_cluster_t ) );
+
+	// Objects that use less than 65536 distinct vertices come with 16 bit indices, which take half
+	// the memory and half the bandwidth of 32 bit ones. Their indices are relative to their first
+	// vertex, which the draw adds back through its vertexOffset.
+
 	for ( uint32_t i = 0; i < fhead->objCount; i++ )
 	{
 		model->objects[i] = (vkutil_object_t){
-			.indexStart   = objects[i].indexOffset,
-			.indexCount   = objects[i].indexCount,
+			.indexStart   = objects[i].indexOffset + objects[i].lods[0].indexOffset,
+			.indexCount   = objects[i].lods[0].indexCount,
+			.indexType    = objects[i].indexSize == sizeof ( bobj_index16 ) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32,
+			.vertexOffset = objects[i].vertexOffset,
+			.clusterStart = objects[i].clusterOffset,
+			.clusterCount = objects[i].clusterCount,
 			.textureIndex = objects[i].textureIndex,
+			.lodCount     = objects[i].lodCount,
 		};
 
 		for ( uint32_t j = 0; j < 3; j++ )
@@ -707,17 +2335,46 @@ int32_t vkutil_load_bobj (
 			model->objects[i].aabbMin[j] = objects[i].aabbMin[j];
 			model->objects[i].aabbMax[j] = objects[i].aabbMax[j];
 		}
+
+		for ( uint32_t j = 0; j < objects[i].lodCount; j++ )
+		{
+			model->objects[i].lods[j] = (vkutil_lod_t){
+				.indexStart = objects[i].indexOffset + objects[i].lods[j].indexOffset,
+				.indexCount = objects[i].lods[j].indexCount,
+				.error      = objects[i].lods[j].error,
+			};
+		}
+
+		// The index ranges of the clusters are made absolute, so they can be drawn directly
+		for ( uint32_t j = objects[i].clusterOffset; j < objects[i].clusterOffset + objects[i].clusterCount; j++ )
+		{
+			vkutil_cluster_t* cluster = &model->clusters[j];
+			*cluster = (vkutil_cluster_t){
+				.indexStart = model->objects[i].indexStart + clusters[j].indexOffset,
+				.indexCount = clusters[j].indexCount,
+				.radius     = clusters[j].radius,
+				.coneCutoff = clusters[j].coneCutoff,
+			};
+			memcpy ( cluster->center,   clusters[j].center,   sizeof ( cluster->center   ) );
+			memcpy ( cluster->aabbMin,  clusters[j].aabbMin,  sizeof ( cluster->aabbMin  ) );
+			memcpy ( cluster->aabbMax,  clusters[j].aabbMax,  sizeof ( cluster->aabbMax  ) );
+			memcpy ( cluster->coneAxis, clusters[j].coneAxis, sizeof ( cluster->coneAxis ) );
+		}
 	}
 	
-	// Now we create two buffers. No matter the amount of objects contained within this object
+	// Now we create three buffers. No matter the amount of objects contained within this object
 	// model, all vertex data is shared. The other objects will simply have offset indices when
 	// other vertex data is required. This allows less overhead in switching the buffers and
 	// less overhead in terms of memory alignment etc
+	// The third buffer holds nothing but the positions of the vertices. The shadow pass renders
+	// the scene several times over and only needs the positions, which are a fraction of each
+	// vertex: Fetching them from a buffer of their own saves the bandwidth of reading the rest.
 	
-	uint32_t vbSize = fhead->vertexCount * sizeof ( bobj_vert ),
-		ibSize = fhead->indexCount * sizeof ( bobj_index );
+	uint32_t vbSize = fhead->vertexCount * vertexSize,
+		pbSize = fhead->vertexCount * positionSize,
+		ibSize = fhead->indexDataSize;
 
-	result = vkCreateBuffer (
+	VkResult result = vkCreateBuffer (
 		device,
 		&(VkBufferCreateInfo){
 			.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
@@ -727,64 +2384,73 @@ int32_t vkutil_load_bobj (
 		NULL,
 		&model->vertexBuffer
 	);
+	if ( result != VK_SUCCESS )
+	{
+		model->vertexBuffer = VK_NULL_HANDLE;
+		return vkutil_load_bobj_failed ( model, uploader, -4 );
+	}
 	
 	result = vkCreateBuffer (
 		device,
 		&(VkBufferCreateInfo){
 			.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-			.size  = ibSize,
-			.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			.size  = pbSize,
+			.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 		},
 		NULL,
-		&model->indexBuffer
+		&model->positionBuffer
 	);
-
-	// On top of the two former buffers, we will create one more buffer: While we could leave this
-	// one out, we need to have a buffer we can upload our data to. This buffer needs to be in
-	// HOST_VISIBLE memory, but this memory may not be optimal for GPU access. For this reason,
-	// we create a "staging" buffer to send the vertex data to, and subsequently copy the data over
-	// to the actual buffers
-
-	VkBuffer stagingBuffer;
+	if ( result != VK_SUCCESS )
+	{
+		model->positionBuffer = VK_NULL_HANDLE;
+		return vkutil_load_bobj_failed ( model, uploader, -4 );
+	}
+	
 	result = vkCreateBuffer (
 		device,
 		&(VkBufferCreateInfo){
 			.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-			.size  = vbSize + ibSize,
-			.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			.size  = ibSize,
+			.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 		},
 		NULL,
-		&stagingBuffer
+		&model->indexBuffer
 	);
+	if ( result != VK_SUCCESS )
+	{
+		model->indexBuffer = VK_NULL_HANDLE;
+		return vkutil_load_bobj_failed ( model, uploader, -4 );
+	}
 
-	// Allocate memory large enough for the buffer object
-	
-	VkMemoryRequirements stagingRequirements;
-	VkDeviceSize stagingMemorySize;
-	VkDeviceMemory stagingMemory;
-
-	vkGetBufferMemoryRequirements ( device, stagingBuffer, &stagingRequirements );
-	vkutil_multi_alloc_helper (
-		device, memoryProperties, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-		1, &stagingRequirements, &stagingMemory, &stagingMemorySize, NULL
-	);
-	
-	// Memory acquired by vkAllocateMemory can be written to using vkMapMemory, assuming the heap
-	// the memory is allocated on is HOST_VISIBLE.
-	
-	// Usually, the returned memory pointer is best to be kept around for as short as possible.
-	// While the memory could remain mapped for the duration of the application, and simply changed
-	// on-the-fly, it can be easy to forget this memory is generally not very well optimized for
-	// CPU usage, and may result in unnecessary slowdowns. If the programmer properly manages
-	// the memory, however, keeping the memory mapped can allow frequently or consistently
-	// updated memory to be updated with as little cost as possible.
+	// The buffers get device local memory from the allocator. They will end up in the same block
+	// of memory, right after one another, alignment permitting. The allocator binds the memory to
+	// the buffers for us.
 	
-	// Really though, we aren't even using the appropriate memory for our purposes, so let's not
-	// faff about with keeping this memory mapped. We literally have no use for doing so at this
-	// point.
+	if ( vkutil_allocator_alloc_buffer (
+			allocator, model->vertexBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &model->vertexAllocation
+		) != 0
+		|| vkutil_allocator_alloc_buffer (
+			allocator, model->positionBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &model->positionAllocation
+		) != 0
+		|| vkutil_allocator_alloc_buffer (
+			allocator, model->indexBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &model->indexAllocation
+		) != 0 )
+		return vkutil_load_bobj_failed ( model, uploader, -4 );
+
+	// On top of the two former buffers, we need somewhere to upload our data to. This needs to be
+	// HOST_VISIBLE memory, but this memory may not be optimal for GPU access. For this reason, we
+	// send the vertex data to "staging" memory first, and subsequently copy the data over to the
+	// actual buffers. The uploader has a ring buffer of such memory we write into, a chunk at a
+	// time, which is reused as soon as the copies from it have completed.
+
+	if ( vkutil_uploader_begin ( uploader ) != 0 )
+		return vkutil_load_bobj_failed ( model, uploader, -4 );
 	
-	uint8_t* data;
-	result = vkMapMemory ( device, stagingMemory, 0, stagingMemorySize, 0, &data );
+	// The allocator keeps all of its host visible memory mapped for as long as it lives. Mapping is
+	// not free, and as many allocations share the same VkDeviceMemory, mapping and unmapping them
+	// individually isn't even possible: a VkDeviceMemory can only be mapped once at a time. Just
+	// keep in mind this memory is generally not very well optimized for CPU usage, which brings us
+	// to the next point.
 	
 	// We will now copy our data in the returned data pointer.
 	// It is worth pointing out that this memory should - for as much as possible -
@@ -799,206 +2465,221 @@ int32_t vkutil_load_bobj (
 	// GPU.
 	
 #if !VKUTIL_BOBJ_FLIP_TEXCOORD_V
-	memcpy ( data,              vertices, fhead->vertexCount * sizeof ( bobj_vert ) );
+	int32_t ret = vkutil_uploader_upload_buffer (
+		uploader, vertices, vbSize, model->vertexBuffer, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT
+	);
 #else
 	// We could flip the V axis after copy, not requiring copies
 	// But depending on the implementation this can be a catastrophic performance hit as suggested
 	// above. Feel free to check, but I would really suggest leaving this as it is.
 	// Timings for my machine loading sponza.bobj are included in comments
 
-#if 1
-	// 9 ms (debug), 4 ms (release)
-	for ( uint32_t i = 0; i < fhead->vertexCount; i++ )
-	{
-		bobj_vert v = vertices[i];
-		v.texcoord[1] = 1.0f - v.texcoord[1];
-		((bobj_vert*)data)[i] = v;
-	}
-#else
-	// 40 ms (debug), 26 ms (release) (>4x & >6x resp)
-	memcpy ( data,              vertices, fhead->vertexCount * sizeof ( bobj_vert ) );
-	for ( uint32_t i = 0; i < fhead->vertexCount; i++ )
-	{
-		((bobj_vert*)data)[i].texcoord[1] = 1.0f - ((bobj_vert*)data)[i].texcoord[1];
-	}
-#endif
-#endif
-	memcpy ( data + vbSize, indices,  fhead->indexCount * sizeof ( bobj_index ) );
-	
-	// We can now return the memory obtained to Vulkan, as we will never actually access it again.
-	// Mapping operations can fail if too much memory is mapped, so do not linger mapped memory.
-	// In addition, note that not all of our write operations may be immediately seen by the GPU:
-	// If the memory has the _HOST_COHERENT bit set, the memory is located in the host memory and
-	// only _CACHED_ on the GPU. This can result in the GPU in using outdated information.
-	
-	// While command buffer submissions automatically flush these caches, calls to
-	// vkFlushMappedMemoryRanges may sometimes be required.
-	
-	vkUnmapMemory ( device, stagingMemory );
-
-	// We would like to allocate one batch of memory in which both the vertex and index buffers
-	// can be contained. To do so, we will first need to query the requirements of both buffers,
-	// listing the required size, alignment and compatible memory heaps.
-	
-	VkMemoryRequirements requirements[2];
-	VkDeviceSize offsets[2];
-	vkGetBufferMemoryRequirements ( device, model->vertexBuffer, &requirements[0] );
-	vkGetBufferMemoryRequirements ( device, model->indexBuffer, &requirements[1] );
-
-	VkDeviceSize bufferMemorySize;
-	vkutil_multi_alloc_helper (
-		device, memoryProperties, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		2, requirements, &model->vbIbMemory, &bufferMemorySize, offsets
-	);
-	
-	// We will now finally bind the memory to the appropriate buffers in order to ensure they
-	// can actually use the data we just passed.
-	
-	result = vkBindBufferMemory ( device, stagingBuffer, stagingMemory, 0 );
-	result = vkBindBufferMemory ( device, model->vertexBuffer, model->vbIbMemory, offsets[0] );
-	result = vkBindBufferMemory ( device, model->indexBuffer,  model->vbIbMemory, offsets[1] );
-
-	// We will now record the instructions to pass the data from the staging buffer to the vertex-
-	// and index buffer safely
-
-	vkBeginCommandBuffer (
-		stagingCommandBuffer,
-		&(VkCommandBufferBeginInfo){
-			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-			.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
-		}
-	);
+	// The flipped vertices are written straight into the staging ring, as many as fit at a time.
+	// The granularity makes sure we never get a partial vertex.
 
+	int32_t ret = 0;
+	for ( uint32_t i = 0; i < fhead->vertexCount && ret == 0; )
 	{
-		// We want to read from the staging buffer, and write to the other two buffers
-		// So we explicitly enable these features - and only these features - for the time being
-
-		vkCmdPipelineBarrier (
-			stagingCommandBuffer,
-			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-			0,
-			0, NULL,
-			3, (VkBufferMemoryBarrier[3]){
-				{
-					.sType         = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-					.srcAccessMask = 0,
-					.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
-					.buffer        = stagingBuffer,
-					.offset        = 0,
-					.size          = vbSize + ibSize,
-				},
-				{
-					.sType         = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-					.srcAccessMask = 0,
-					.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-					.buffer        = model->vertexBuffer,
-					.offset        = 0,
-					.size          = vbSize,
-				},
-				{
-					.sType         = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-					.srcAccessMask = 0,
-					.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-					.buffer        = model->indexBuffer,
-					.offset        = 0,
-					.size          = ibSize,
-				},
-			},
-			0, NULL
+		VkDeviceSize offset, size;
+		void* staging;
+		ret = vkutil_uploader_reserve (
+			uploader, (fhead->vertexCount - i) * vertexSize, vertexSize, &offset, &size, &staging
 		);
+		if ( ret != 0 )
+			break;
 
-		// Now we copy over the data
-
-		vkCmdCopyBuffer (
-			stagingCommandBuffer, stagingBuffer, model->vertexBuffer,
-			1, (VkBufferCopy[1]){
-				{
-					.srcOffset = offsets[0],
-					.dstOffset = 0,
-					.size      = vbSize,
-				},
+		uint32_t count = (uint32_t)(size / vertexSize);
+		if ( fhead->vertexFormat == BOBJ_VERTEX_FORMAT_QUANTIZED )
+		{
+			// Half float texcoords take a detour through float to be flipped
+			bobj_vert_quantized* data = staging;
+			for ( uint32_t j = 0; j < count; j++ )
+			{
+				bobj_vert_quantized v = quantizedVertices[i+j];
+				v.texcoord[1] = vkutil_float_to_half ( 1.0f - vkutil_half_to_float ( v.texcoord[1] ) );
+				data[j] = v;
 			}
-		);
-		vkCmdCopyBuffer (
-			stagingCommandBuffer, stagingBuffer, model->indexBuffer,
-			1, (VkBufferCopy[1]){
-				{
-					.srcOffset = offsets[1],
-					.dstOffset = 0,
-					.size      = ibSize,
-				},
+		}
+		else
+		{
+			bobj_vert* data = staging;
+#if 1
+			// 9 ms (debug), 4 ms (release)
+			for ( uint32_t j = 0; j < count; j++ )
+			{
+				bobj_vert v = vertices[i+j];
+				v.texcoord[1] = 1.0f - v.texcoord[1];
+				data[j] = v;
 			}
+#else
+			// 40 ms (debug), 26 ms (release) (>4x & >6x resp)
+			memcpy ( data, vertices + i, size );
+			for ( uint32_t j = 0; j < count; j++ )
+			{
+				data[j].texcoord[1] = 1.0f - data[j].texcoord[1];
+			}
+#endif
+		}
+		ret = vkutil_uploader_copy_buffer (
+			uploader, offset, model->vertexBuffer, (VkDeviceSize)i * vertexSize, size
 		);
-
-		// And we transition to a state where the buffers can be used for their respective
-		// purposes
-
-		vkCmdPipelineBarrier (
-			stagingCommandBuffer,
-			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-			0,
-			0, NULL,
-			2, (VkBufferMemoryBarrier[2]){
-				{
-					.sType         = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-					.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-					.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
-					.buffer        = model->vertexBuffer,
-					.offset        = 0,
-					.size          = vbSize,
-				},
-				{
-					.sType         = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-					.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-					.dstAccessMask = VK_ACCESS_INDEX_READ_BIT,
-					.buffer        = model->indexBuffer,
-					.offset        = 0,
-					.size          = ibSize,
-				},
-			},
-			0, NULL
+		i += count;
+	}
+	if ( ret == 0 )
+	{
+		ret = vkutil_uploader_finish_buffer (
+			uploader, model->vertexBuffer, vbSize, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT
 		);
 	}
+#endif
+	// The positions don't have texture coordinates to flip, so they can go as they are
+	if ( ret == 0 )
+	{
+		ret = vkutil_uploader_upload_buffer (
+			uploader, positions, pbSize, model->positionBuffer, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT
+		);
+	}
+	if ( ret == 0 )
+	{
+		ret = vkutil_uploader_upload_buffer (
+			uploader, indices, ibSize, model->indexBuffer, VK_ACCESS_INDEX_READ_BIT
+		);
+	}
+	
+	// Note that not all of our write operations may be immediately seen by the GPU. We asked for
+	// _HOST_COHERENT memory, which takes care of that for us: command buffer submissions make
+	// writes to coherent memory visible. For memory without that bit, calls to
+	// vkFlushMappedMemoryRanges would be required.
 
-	vkEndCommandBuffer ( stagingCommandBuffer );
-
-	// Submit the command buffer and wait until it is done
-
-	vkQueueSubmit (
-		stagingQueue,
-		1, (VkSubmitInfo[1]) {
-			{
-				.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-				.commandBufferCount   = 1,
-				.pCommandBuffers      = (VkCommandBuffer[1]){ stagingCommandBuffer },
-			},
-		},
-		VK_NULL_HANDLE
-	);
-	vkQueueWaitIdle ( stagingQueue );
-
-	// The staging buffer is no longer required, and therefore deleted
-
-	vkDestroyBuffer ( device, stagingBuffer, NULL );
-	vkFreeMemory ( device, stagingMemory, NULL );
+	// Submit the batch, without waiting for it to complete. The model can't be drawn until the
+	// returned ticket has completed. If any of the uploads failed, the batch is thrown away
+	// instead: the buffers it copies to are about to be destroyed.
 
-	// TODO
+	if ( ret != 0 )
+	{
+		vkutil_uploader_abort ( uploader );
+		return vkutil_load_bobj_failed ( model, uploader, -6 );
+	}
+	if ( vkutil_uploader_submit ( uploader, outTicket ) != 0 )
+		return vkutil_load_bobj_failed ( model, uploader, -6 );
 
 	return 0;
 }
 
-int32_t vkutil_destroy_bobj ( vkutil_model_t* model, VkDevice device )
+int32_t vkutil_destroy_bobj ( vkutil_model_t* model, vkutil_allocator_t* allocator )
 {
+	VkDevice device = allocator->device;
 	for ( uint32_t i = 0; i < model->textureCount; i++ )
 		vkDestroyImageView ( device, model->imageViews[i], NULL );
 	for ( uint32_t i = 0; i < model->textureCount; i++ )
+	{
 		vkDestroyImage ( device, model->images[i], NULL );
+		vkutil_allocator_free ( allocator, &model->imageAllocations[i] );
+	}
 	vkDestroyBuffer ( device, model->vertexBuffer, NULL );
+	vkDestroyBuffer ( device, model->positionBuffer, NULL );
 	vkDestroyBuffer ( device, model->indexBuffer, NULL );
-	vkFreeMemory ( device, model->vbIbMemory, NULL );
-	vkFreeMemory ( device, model->imageMemory, NULL );
+	vkutil_allocator_free ( allocator, &model->vertexAllocation );
+	vkutil_allocator_free ( allocator, &model->positionAllocation );
+	vkutil_allocator_free ( allocator, &model->indexAllocation );
+	free ( model->clusters );
 	free ( model->objects );
 	return 0;
-}
\ No newline at end of file
+}
+
+// Pipeline cache data starts with a header identifying the device it was created on. The driver
+// is supposed to reject data it cannot use, but not every driver is as careful about this as it
+// should be, so we check the header ourselves before handing anything over. Data that does not
+// match (different GPU, updated driver, truncated file) is discarded, and we start with an empty
+// cache instead. Returns 1 in that case, 0 if the initial data was used.
+
+int32_t vkutil_create_pipeline_cache (
+	VkDevice device, const VkPhysicalDeviceProperties* properties,
+	const void* initialData, size_t initialDataSize, VkPipelineCache* outCache
+)
+{
+	int32_t ret = 0;
+
+	if ( initialData != NULL )
+	{
+		// Header layout for VK_PIPELINE_CACHE_HEADER_VERSION_ONE, as described in the spec under
+		// vkGetPipelineCacheData. All fields are tightly packed 32-bit values.
+		typedef struct
+		{
+			uint32_t headerLength;
+			uint32_t headerVersion;
+			uint32_t vendorID;
+			uint32_t deviceID;
+			uint8_t  pipelineCacheUUID[VK_UUID_SIZE];
+		} pipeline_cache_header_t;
+
+		pipeline_cache_header_t header;
+		if ( initialDataSize >= sizeof ( header ) )
+			memcpy ( &header, initialData, sizeof ( header ) );
+
+		if (
+			initialDataSize < sizeof ( header ) ||
+			header.headerLength < sizeof ( header ) ||
+			header.headerLength > initialDataSize ||
+			header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+			header.vendorID != properties->vendorID ||
+			header.deviceID != properties->deviceID ||
+			memcmp ( header.pipelineCacheUUID, properties->pipelineCacheUUID, VK_UUID_SIZE ) != 0
+		)
+		{
+			initialData     = NULL;
+			initialDataSize = 0;
+			ret             = 1;
+		}
+	}
+
+	VkResult result = vkCreatePipelineCache (
+		device,
+		&(VkPipelineCacheCreateInfo){
+			.sType           = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+			.pNext           = NULL,
+			.flags           = 0,
+			.initialDataSize = initialDataSize,
+			.pInitialData    = initialData,
+		},
+		NULL,
+		outCache
+	);
+	if ( result != VK_SUCCESS )
+		return -1;
+
+	return ret;
+}
+
+// Retrieves the contents of a pipeline cache for storage. The data is allocated with malloc and
+// is to be freed by the caller.
+
+int32_t vkutil_get_pipeline_cache_data (
+	VkDevice device, VkPipelineCache cache, void** outData, size_t* outDataSize
+)
+{
+	*outData     = NULL;
+	*outDataSize = 0;
+
+	size_t size;
+	VkResult result = vkGetPipelineCacheData ( device, cache, &size, NULL );
+	if ( result != VK_SUCCESS )
+		return -1;
+
+	void* data = malloc ( size );
+	if ( data == NULL )
+		return -2;
+
+	// The cache cannot grow between the two calls unless pipelines are being created from another
+	// thread at the same time, which we don't do. Should it happen anyway, VK_INCOMPLETE tells us.
+	result = vkGetPipelineCacheData ( device, cache, &size, data );
+	if ( result != VK_SUCCESS )
+	{
+		free ( data );
+		return -3;
+	}
+
+	*outData     = data;
+	*outDataSize = size;
+	return 0;
+}
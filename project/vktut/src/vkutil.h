@@ -27,7 +27,7 @@ extern "C" {	// Expose functions with C linkage for cross-compat with C and C++
 // Vulkan include
 
 #if !defined ( __ANDROID__ ) || __ANDROID_API__ >= 24
-#include <vulkan\vulkan.h>
+#include <vulkan/vulkan.h>
 #else
 // Android version 24 and on officially supports Vulkan, while version 23 does not
 // Some vendors do ship with versions of libVulkan however, so we can use Vulkan on these
@@ -44,13 +44,150 @@ extern "C" {	// Expose functions with C linkage for cross-compat with C and C++
 #define VKUTIL_BOBJ_FLIP_TEXCOORD_V 1
 #endif
 
+////////////////////////////////////////
+// Memory allocator
+
+#ifndef VKUTIL_ALLOCATOR_BLOCK_SIZE
+// Size of the blocks the allocator requests from Vulkan. Requests larger than half a block get a
+// block of their own.
+#define VKUTIL_ALLOCATOR_BLOCK_SIZE (64ull*1024*1024)
+#endif
+
+typedef enum
+{
+	// Buffers and linearly tiled images, versus optimally tiled images. Both kinds are never placed
+	// in the same block, so bufferImageGranularity does not have to be accounted for between them.
+	VKUTIL_ALLOCATION_LINEAR,
+	VKUTIL_ALLOCATION_OPTIMAL,
+
+	VKUTIL_ALLOCATION_KIND_COUNT,
+} vkutil_allocation_kind_t;
+
+typedef struct vkutil_memory_range_s
+{
+	VkDeviceSize offset, size;
+} vkutil_memory_range_t;
+
+typedef struct vkutil_memory_block_s
+{
+	VkDeviceMemory memory;
+	VkDeviceSize   size;
+	uint32_t       memoryTypeIndex;
+	uint32_t       kind;
+	uint32_t       dedicated;
+	uint8_t*       mapped;	// Persistently mapped if the memory type is host visible, NULL otherwise
+
+	// Free ranges, sorted by offset, neighbouring ranges always merged
+	uint32_t               freeRangeCount, freeRangeCapacity;
+	vkutil_memory_range_t* freeRanges;
+	uint32_t               allocationCount;
+
+	struct vkutil_memory_block_s* next;
+} vkutil_memory_block_t;
+
+typedef struct vkutil_allocation_s
+{
+	VkDeviceMemory memory;
+	VkDeviceSize   offset;
+	VkDeviceSize   size;
+	void*          mapped;	// Pointer to offset within the mapped block, NULL if not host visible
+
+	vkutil_memory_block_t* block;
+} vkutil_allocation_t;
+
+typedef struct vkutil_allocator_s
+{
+	VkDevice                         device;
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	VkDeviceSize                     blockSize;
+	vkutil_memory_block_t*           blocks;
+} vkutil_allocator_t;
+
+typedef struct vkutil_allocator_stats_s
+{
+	uint32_t     blockCount;           // VkDeviceMemory objects, including dedicated ones
+	uint32_t     dedicatedBlockCount;
+	uint32_t     allocationCount;
+	VkDeviceSize allocatedBytes;       // Total size of all blocks
+	VkDeviceSize usedBytes;            // Part of that handed out to allocations, alignment included
+	uint32_t     freeRangeCount;
+	VkDeviceSize largestFreeRange;
+} vkutil_allocator_stats_t;
+
+////////////////////////////////////////
+// Uploader
+
+#ifndef VKUTIL_UPLOADER_BATCH_COUNT
+// Maximum amount of upload batches in flight at the same time
+#define VKUTIL_UPLOADER_BATCH_COUNT 8
+#endif
+
+#ifndef VKUTIL_UPLOADER_STAGING_SIZE
+// Size of the staging ring buffer all uploads go through. This is all the host visible memory the
+// uploader will ever use, no matter how large the uploads are.
+#define VKUTIL_UPLOADER_STAGING_SIZE (16*1024*1024)
+#endif
+
+// Alignment of every reservation in the staging ring. Copies to images require offsets to be a
+// multiple of the texel size (and of 4 on transfer queues), this covers all formats we use.
+#define VKUTIL_UPLOADER_STAGING_ALIGNMENT 16
+
+typedef enum
+{
+	VKUTIL_UPLOAD_BATCH_FREE,
+	VKUTIL_UPLOAD_BATCH_RECORDING,
+	VKUTIL_UPLOAD_BATCH_TRANSFERRING,	// Submitted to the transfer queue
+	VKUTIL_UPLOAD_BATCH_FINISHING,		// Transfer done, finishing commands submitted to graphics
+} vkutil_upload_batch_state_t;
+
+typedef struct vkutil_upload_batch_s
+{
+	vkutil_upload_batch_state_t state;
+	uint64_t        ticket;
+
+	// Copies are recorded into the transfer command buffer. Everything the transfer queue can't
+	// do (acquiring ownership, mipmap generation, final layout transitions) goes into the graphics
+	// command buffer, which is submitted once the transfer has completed.
+	VkCommandBuffer transferCommandBuffer;
+	VkCommandBuffer graphicsCommandBuffer;
+	VkFence         transferFence, graphicsFence;
+	VkSemaphore     transferSemaphore;
+
+	// Bytes of the staging ring used by this batch, padding included. Given back as soon as the
+	// transfer has completed.
+	VkDeviceSize    stagingBytes;
+} vkutil_upload_batch_t;
+
+typedef struct vkutil_uploader_s
+{
+	vkutil_allocator_t*    allocator;
+	VkDevice               device;
+	VkQueue                transferQueue, graphicsQueue;
+	uint32_t               transferFamily, graphicsFamily;
+	VkExtent3D             transferGranularity;
+	VkCommandPool          transferCommandPool, graphicsCommandPool;
+	vkutil_upload_batch_t  batches[VKUTIL_UPLOADER_BATCH_COUNT];
+	vkutil_upload_batch_t* current;	// Batch being recorded, if any
+
+	// Staging ring buffer, persistently mapped
+	VkBuffer               stagingBuffer;
+	vkutil_allocation_t    stagingAllocation;
+	VkDeviceSize           stagingSize;
+	VkDeviceSize           stagingHead;	// Where the next reservation starts (padding aside)
+	VkDeviceSize           stagingUsed;	// Bytes in use by batches, up to stagingHead
+
+	uint64_t               nextTicket;
+	uint64_t               completedTicket;	// Uploads up to here may be used by graphics submissions
+} vkutil_uploader_t;
+
 ////////////////////////////////////////
 // 
 
 typedef enum
 {
 	VKUTIL_IMAGE_MIPMAP_NONE,
-	VKUTIL_IMAGE_MIPMAP_GENERATE,
+	VKUTIL_IMAGE_MIPMAP_GENERATE,	// Blit the first level down, not for block compressed formats
+	VKUTIL_IMAGE_MIPMAP_INCLUDED,	// The data holds every level, largest first, tightly packed
 } vkutil_image_mipmap_mode_t;
 
 typedef struct
@@ -72,12 +209,36 @@ typedef struct
 	VkImageAspectFlagBits aspectMask;
 } vkutil_image_desc;
 
+// A level of detail of an object, see bobj_lod
+#define VKUTIL_MAX_LODS 4
+
+typedef struct lod_s
+{
+	uint32_t indexStart, indexCount;	// Like those of the object it is part of
+	float error;
+} vkutil_lod_t;
+
+// A run of consecutive triangles of an object, see bobj_cluster
+typedef struct cluster_s
+{
+	uint32_t indexStart, indexCount;	// Like those of the object it is part of
+	float center[3], radius;
+	float aabbMin[3];
+	float aabbMax[3];
+	float coneAxis[3], coneCutoff;
+} vkutil_cluster_t;
+
 typedef struct object_s
 {
-	uint32_t indexStart, indexCount;
+	uint32_t indexStart, indexCount;	// In indices of indexType, of the full detail level
+	VkIndexType indexType;
+	uint32_t vertexOffset;	// Added to every index
+	uint32_t clusterStart, clusterCount;	// Of the full detail level
 	uint32_t textureIndex;
 	float aabbMin[3];
 	float aabbMax[3];
+	uint32_t lodCount;
+	vkutil_lod_t lods[VKUTIL_MAX_LODS];
 } vkutil_object_t;
 
 typedef struct
@@ -86,11 +247,23 @@ typedef struct
 	uint32_t textureCount;
 
 	vkutil_object_t* objects;
+	vkutil_cluster_t* clusters;
 	VkImage* images;
 	VkImageView* imageViews;
 
 	VkBuffer vertexBuffer, indexBuffer;
-	VkDeviceMemory vbIbMemory, imageMemory;
+	vkutil_allocation_t vertexAllocation, indexAllocation;
+
+	// Just the positions of the vertices, tightly packed, for passes that don't need anything else
+	VkBuffer positionBuffer;
+	vkutil_allocation_t positionAllocation;
+
+	// bobj_vertex_format of the vertex buffer. Positions in it are transformed by
+	// positionOffset + positionScale * position to get the actual position.
+	uint32_t vertexFormat;
+	float positionScale[3];
+	float positionOffset[3];
+	vkutil_allocation_t* imageAllocations;
 
 	void* userdata;
 } vkutil_model_t;
@@ -111,21 +284,93 @@ int32_t vkutil_multi_alloc_helper (
 	VkDeviceMemory* outMemory, VkDeviceSize* outMemorySize, VkDeviceSize* outMemoryOffsets
 );
 
+int32_t vkutil_allocator_init (
+	vkutil_allocator_t* outAllocator, VkDevice device,
+	const VkPhysicalDeviceMemoryProperties* memoryProperties, VkDeviceSize blockSize
+);
+int32_t vkutil_allocator_destroy ( vkutil_allocator_t* allocator );
+
+int32_t vkutil_allocator_alloc (
+	vkutil_allocator_t* allocator, const VkMemoryRequirements* requirements,
+	uint32_t requiredProperties, vkutil_allocation_kind_t kind, vkutil_allocation_t* outAllocation
+);
+int32_t vkutil_allocator_alloc_buffer (
+	vkutil_allocator_t* allocator, VkBuffer buffer, uint32_t requiredProperties,
+	vkutil_allocation_t* outAllocation
+);
+int32_t vkutil_allocator_alloc_image (
+	vkutil_allocator_t* allocator, VkImage image, VkImageTiling tiling, uint32_t requiredProperties,
+	vkutil_allocation_t* outAllocation
+);
+int32_t vkutil_allocator_free ( vkutil_allocator_t* allocator, vkutil_allocation_t* allocation );
+
+int32_t vkutil_allocator_get_stats (
+	const vkutil_allocator_t* allocator, vkutil_allocator_stats_t* outStats
+);
+
+int32_t vkutil_uploader_init (
+	vkutil_uploader_t* outUploader, vkutil_allocator_t* allocator,
+	VkQueue transferQueue, uint32_t transferFamily, VkExtent3D transferGranularity,
+	VkQueue graphicsQueue, uint32_t graphicsFamily, VkDeviceSize stagingSize
+);
+int32_t vkutil_uploader_destroy ( vkutil_uploader_t* uploader );
+
+int32_t vkutil_uploader_begin ( vkutil_uploader_t* uploader );
+int32_t vkutil_uploader_reserve (
+	vkutil_uploader_t* uploader, VkDeviceSize size, VkDeviceSize granularity,
+	VkDeviceSize* outOffset, VkDeviceSize* outSize, void** outData
+);
+int32_t vkutil_uploader_copy_buffer (
+	vkutil_uploader_t* uploader, VkDeviceSize srcOffset,
+	VkBuffer dstBuffer, VkDeviceSize dstOffset, VkDeviceSize size
+);
+int32_t vkutil_uploader_finish_buffer (
+	vkutil_uploader_t* uploader, VkBuffer dstBuffer, VkDeviceSize size, VkAccessFlags dstAccessMask
+);
+int32_t vkutil_uploader_upload_buffer (
+	vkutil_uploader_t* uploader, const void* data, VkDeviceSize size,
+	VkBuffer dstBuffer, VkAccessFlags dstAccessMask
+);
+int32_t vkutil_uploader_upload_image (
+	vkutil_uploader_t* uploader, const void* data,
+	VkImage dstImage, const VkImageCreateInfo* createInfo,
+	VkImageAspectFlags aspectMask, vkutil_image_mipmap_mode_t mipMode,
+	VkImageLayout finalLayout, VkAccessFlags dstAccessMask
+);
+int32_t vkutil_uploader_transition_image (
+	vkutil_uploader_t* uploader, VkImage image, const VkImageCreateInfo* createInfo,
+	VkImageAspectFlags aspectMask, VkImageLayout finalLayout, VkAccessFlags dstAccessMask
+);
+int32_t vkutil_uploader_submit ( vkutil_uploader_t* uploader, uint64_t* outTicket );
+int32_t vkutil_uploader_abort  ( vkutil_uploader_t* uploader );
+
+int32_t vkutil_uploader_poll        ( vkutil_uploader_t* uploader );
+int32_t vkutil_uploader_is_complete ( vkutil_uploader_t* uploader, uint64_t ticket );
+int32_t vkutil_uploader_wait        ( vkutil_uploader_t* uploader, uint64_t ticket );
+int32_t vkutil_uploader_wait_idle   ( vkutil_uploader_t* uploader );
+
 int32_t vkutil_create_images_helper (
-	VkDevice device, VkCommandBuffer stagingCommandBuffer, VkQueue stagingQueue,
-	VkPhysicalDeviceMemoryProperties* memoryProperties,
-	uint32_t imageCount, vkutil_image_desc* imageDescs, VkDeviceMemory* outMemory
+	vkutil_uploader_t* uploader, uint32_t imageCount, vkutil_image_desc* imageDescs,
+	vkutil_allocation_t* outAllocations, uint64_t* outTicket
 );
 
 int32_t vkutil_load_bobj (
-	vkutil_model_t* model,
-	VkDevice device, const void* bobjData, uint64_t bobjLen,
-	VkPhysicalDeviceMemoryProperties* memoryProperties,
-	VkQueue stagingQueue, VkCommandBuffer stagingCommandBuffer
+	vkutil_model_t* model, VkPhysicalDevice physicalDevice,
+	vkutil_uploader_t* uploader, const void* bobjData, uint64_t bobjLen,
+	uint64_t* outTicket
 );
 
 int32_t vkutil_destroy_bobj (
-	vkutil_model_t* model, VkDevice device
+	vkutil_model_t* model, vkutil_allocator_t* allocator
+);
+
+int32_t vkutil_create_pipeline_cache (
+	VkDevice device, const VkPhysicalDeviceProperties* properties,
+	const void* initialData, size_t initialDataSize, VkPipelineCache* outCache
+);
+
+int32_t vkutil_get_pipeline_cache_data (
+	VkDevice device, VkPipelineCache cache, void** outData, size_t* outDataSize
 );
 
 ////////////////////////////////////////